@@ -1034,20 +1034,30 @@ static void e1000_handle_rdma_packet(E1000State *s, const uint8_t *buf,
     payload = buf + 14 + sizeof(struct rdma_packet_header);
     payload_len = size - 14 - sizeof(struct rdma_packet_header);
 
+    trace_e1000_rdma_rx(hdr->dest_qp, hdr->wr_id, hdr->opcode, hdr->length,
+                        size);
+
     /* Process based on opcode */
     switch (hdr->opcode) {
-    case RDMA_OP_WRITE:
+    case RDMA_OP_WRITE: {
         /* Validate destination address and key */
-        if (!e1000_rdma_validate_mr(s, hdr->remote_key, hdr->remote_addr,
-                                   hdr->length, 0x08)) {  /* WRITE permission */
+        bool ok = e1000_rdma_validate_mr(s, hdr->remote_key, hdr->remote_addr,
+                                         hdr->length, 0x08);  /* WRITE permission */
+        int r;
+
+        trace_e1000_rdma_mr_validate(hdr->dest_qp, hdr->wr_id, hdr->remote_key,
+                                     hdr->remote_addr, hdr->length, ok);
+        if (!ok) {
             qemu_log_mask(LOG_GUEST_ERROR,
                          "e1000_rdma: WRITE validation failed\n");
             return;
         }
 
         /* DMA write to destination */
-        if (e1000_rdma_dma_write(s, hdr->remote_addr, payload,
-                                 hdr->length) == 0) {
+        r = e1000_rdma_dma_write(s, hdr->remote_addr, payload, hdr->length);
+        trace_e1000_rdma_dma_write(hdr->dest_qp, hdr->wr_id, hdr->remote_addr,
+                                   hdr->length, r);
+        if (r == 0) {
             /* Post completion to destination QP */
             uint32_t dest_qp = hdr->dest_qp;
             if (dest_qp < E1000_QP_COUNT && s->rdma.qp[dest_qp].valid) {
@@ -1057,6 +1067,7 @@ static void e1000_handle_rdma_packet(E1000State *s, const uint8_t *buf,
             }
         }
         break;
+    }
 
     case RDMA_OP_READ:
         /* TODO: Handle RDMA_READ request - send back data */
@@ -1594,6 +1605,8 @@ static void e1000_rdma_post_completion(E1000State *s, uint32_t qp_num,
     if (e1000_rdma_dma_write(s, cq_addr, &comp, sizeof(comp)) == 0) {
         /* Advance tail pointer */
         s->rdma.qp[qp_num].cq_tail = (tail + 1) % size;
+        trace_e1000_rdma_cqe(qp_num, wr_id, opcode, byte_len, status,
+                             s->rdma.qp[qp_num].cq_tail);
     }
 }
 
@@ -1617,6 +1630,7 @@ static void e1000_rdma_do_write(E1000State *s, uint32_t qp_num,
     uint8_t *buffer;
     struct rdma_packet_header hdr;
     uint8_t status = RDMA_WC_SUCCESS;
+    int r;
 
     /* Allocate buffer for payload */
     buffer = g_malloc(wr->length);
@@ -1626,7 +1640,10 @@ static void e1000_rdma_do_write(E1000State *s, uint32_t qp_num,
     }
 
     /* Step 1: DMA read source data from guest */
-    if (e1000_rdma_dma_read(s, wr->local_offset, buffer, wr->length) != 0) {
+    r = e1000_rdma_dma_read(s, wr->local_offset, buffer, wr->length);
+    trace_e1000_rdma_dma_read(qp_num, wr->wr_id, wr->local_offset,
+                              wr->length, r);
+    if (r != 0) {
         status = RDMA_WC_LOC_PROT_ERR;
         goto cleanup;
     }
@@ -1668,6 +1685,7 @@ cleanup:
     g_free(buffer);
 
 post_completion:
+    trace_e1000_rdma_tx(qp_num, wr->wr_id, wr->length, status);
     /* Post completion */
     if (wr->flags & 0x01) {  /* Signaled */
         e1000_rdma_post_completion(s, qp_num, wr->wr_id, status,
@@ -1693,7 +1711,10 @@ static void e1000_rdma_process_sq(E1000State *s, uint32_t qp_num)
         hwaddr wr_addr = s->rdma.qp[qp_num].sq_base +
                          (head % size) * sizeof(struct rdma_work_request);
 
-        if (e1000_rdma_dma_read(s, wr_addr, &wr, sizeof(wr)) != 0) {
+        int r = e1000_rdma_dma_read(s, wr_addr, &wr, sizeof(wr));
+        trace_e1000_rdma_wr_fetch(qp_num, head, r ? 0 : wr.wr_id,
+                                  r ? 0 : wr.opcode, r ? 0 : wr.length, r);
+        if (r != 0) {
             qemu_log_mask(LOG_GUEST_ERROR,
                          "e1000_rdma: Failed to read WR at qp=%d head=%d\n",
                          qp_num, head);
@@ -1786,6 +1807,7 @@ e1000_mmio_write(void *opaque, hwaddr addr, uint64_t val,
         case E1000_QP_SQ_TAIL:
             /* Doorbell! Process work queue */
             s->rdma.qp[qp_num].sq_tail = val;
+            trace_e1000_rdma_doorbell(qp_num, s->rdma.qp[qp_num].sq_head, val);
             e1000_rdma_process_sq(s, qp_num);
             break;
 
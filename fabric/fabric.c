@@ -0,0 +1,468 @@
+// fabric - an impaired link between two QEMU socket netdevs.
+//
+// The VMs normally talk over one TCP connection that never drops,
+// delays or reorders a frame.  fabric sits in the middle instead and
+// forwards frames between two endpoints, applying netem-style
+// impairments on the way:
+//
+//   host A: -netdev socket,listen=:1234
+//   fabric -l 1 -d 2 -j 1 c:127.0.0.1:1234 l:1235
+//   host B: -netdev socket,connect=127.0.0.1:1235
+//
+// An endpoint is c:host:port (connect to a QEMU that listens) or
+// l:port (listen for a QEMU that connects).  Frames use QEMU's
+// stream framing, a 4-byte big-endian length before each frame.
+//
+// For each frame, in order: loss (optionally in bursts), rate
+// limiting with a bounded queue (tail drop), fixed delay plus
+// uniform jitter, reordering (the frame is held back so that later
+// frames overtake it), and duplication.  By default both directions
+// are impaired alike and every frame is subject to it; -D and -r
+// narrow that down.  Counters are printed every -i seconds and when
+// either VM goes away.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define ETHTYPE_RDMA 0x8915
+#define MAX_FRAME    65536
+#define NS           1000000000ull
+#define MS           1000000ull
+
+//
+// configuration
+//
+
+static double loss;          // probability a frame is dropped
+static double burst = 1;     // mean length of a loss burst, in frames
+static double dup_p;         // probability a frame is sent twice
+static double reorder;       // probability a frame is held back
+static uint64_t reorder_ns = 5 * MS;
+static uint64_t delay_ns;
+static uint64_t jitter_ns;
+static double rate_bps;      // 0 = unlimited
+static uint64_t qlimit = 64 * 1024;  // bytes waiting for the rate limiter
+static int impair_ab = 1, impair_ba = 1;
+static int rdma_only;
+static int interval = 0;     // seconds between counter reports, 0 = only at exit
+static int verbose;
+
+//
+// frames in flight
+//
+
+struct frame {
+  struct frame *next;
+  uint64_t arrived;
+  uint64_t when;             // departure time
+  uint32_t len;
+  uint8_t data[];
+};
+
+struct dir {
+  char *name;
+  int in, out;               // sockets
+  int impair;
+  struct frame *q;           // sorted by departure time
+  uint64_t link_free;        // when the rate limiter is idle again
+  int in_burst;
+  // counters
+  uint64_t rx, tx, bytes, lost, qdrops, dups, reordered;
+  uint64_t delay_sum;        // total time frames spent in the fabric
+};
+
+static struct dir dirs[2];
+static uint64_t start_ns;
+
+static void
+die(const char *s)
+{
+  perror(s);
+  exit(1);
+}
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NS + ts.tv_nsec;
+}
+
+// xorshift64*; seeded with -s so runs can be repeated.
+static uint64_t rng_state = 88172645463325252ull;
+
+static double
+rnd(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return ((rng_state * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//
+// endpoints
+//
+
+static int
+endpoint(const char *spec)
+{
+  struct sockaddr_in sa;
+  int fd, one = 1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  if(strncmp(spec, "l:", 2) == 0){
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if(lfd < 0)
+      die("socket");
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sa.sin_port = htons(atoi(spec + 2));
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+      die("bind");
+    if(listen(lfd, 1) < 0)
+      die("listen");
+    fprintf(stderr, "fabric: waiting for qemu on port %s\n", spec + 2);
+    if((fd = accept(lfd, 0, 0)) < 0)
+      die("accept");
+    close(lfd);
+  } else if(strncmp(spec, "c:", 2) == 0){
+    char host[256];
+    const char *colon = strrchr(spec + 2, ':');
+    if(colon == 0 || colon - (spec + 2) >= (int)sizeof(host))
+      return -1;
+    memcpy(host, spec + 2, colon - (spec + 2));
+    host[colon - (spec + 2)] = 0;
+    sa.sin_port = htons(atoi(colon + 1));
+    if(host[0] == 0)
+      sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    else if(inet_pton(AF_INET, host, &sa.sin_addr) != 1){
+      struct hostent *he = gethostbyname(host);
+      if(he == 0)
+        return -1;
+      memcpy(&sa.sin_addr, he->h_addr_list[0], 4);
+    }
+    if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+      die("socket");
+    if(connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+      die("connect");
+  } else {
+    return -1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+static int
+readn(int fd, void *buf, size_t n)
+{
+  size_t done = 0;
+  while(done < n){
+    ssize_t r = read(fd, (char *)buf + done, n - done);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0)
+      return -1;
+    done += r;
+  }
+  return 0;
+}
+
+static int
+writen(int fd, const void *buf, size_t n)
+{
+  size_t done = 0;
+  while(done < n){
+    ssize_t r = write(fd, (const char *)buf + done, n - done);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0)
+      return -1;
+    done += r;
+  }
+  return 0;
+}
+
+//
+// impairment
+//
+
+static void
+report(void)
+{
+  double secs = (now_ns() - start_ns) / 1e9;
+
+  for(int i = 0; i < 2; i++){
+    struct dir *d = &dirs[i];
+    printf("fabric: %s %.1fs rx=%lu tx=%lu bytes=%lu lost=%lu qdrops=%lu dups=%lu "
+           "reordered=%lu avg_delay_us=%lu\n",
+           d->name, secs, d->rx, d->tx, d->bytes, d->lost, d->qdrops, d->dups,
+           d->reordered, d->tx ? d->delay_sum / d->tx / 1000 : 0);
+  }
+  fflush(stdout);
+}
+
+static void
+enqueue(struct dir *d, struct frame *f)
+{
+  struct frame **pp = &d->q;
+
+  // after any frame due at the same time, to keep FIFO order.
+  while(*pp && (*pp)->when <= f->when)
+    pp = &(*pp)->next;
+  f->next = *pp;
+  *pp = f;
+}
+
+static struct frame *
+copy_frame(struct frame *f)
+{
+  struct frame *c = malloc(sizeof(*c) + f->len);
+  if(c == 0)
+    die("malloc");
+  memcpy(c, f, sizeof(*c) + f->len);
+  return c;
+}
+
+static int
+lose(struct dir *d)
+{
+  if(loss <= 0)
+    return 0;
+  // Gilbert model: the first loss of a burst happens with the
+  // probability that gives the configured overall loss rate; once in
+  // a burst, each further frame is lost with 1 - 1/burst.
+  if(d->in_burst){
+    if(rnd() < 1.0 - 1.0 / burst)
+      return 1;
+    d->in_burst = 0;
+    return 0;
+  }
+  if(rnd() < loss / burst){
+    d->in_burst = (burst > 1);
+    return 1;
+  }
+  return 0;
+}
+
+static void
+ingress(struct dir *d, struct frame *f, uint64_t now)
+{
+  int type = f->len >= 14 ? (f->data[12] << 8) | f->data[13] : 0;
+
+  d->rx++;
+  f->when = now;
+  if(!d->impair || (rdma_only && type != ETHTYPE_RDMA)){
+    enqueue(d, f);
+    return;
+  }
+
+  if(lose(d)){
+    d->lost++;
+    free(f);
+    return;
+  }
+
+  if(rate_bps > 0){
+    uint64_t begin = d->link_free > now ? d->link_free : now;
+    uint64_t backlog = (uint64_t)((begin - now) * rate_bps / 8 / NS);
+    if(backlog + f->len > qlimit){
+      d->qdrops++;
+      free(f);
+      return;
+    }
+    d->link_free = begin + (uint64_t)(f->len * 8 * (double)NS / rate_bps);
+    f->when = d->link_free;
+  }
+
+  f->when += delay_ns;
+  if(jitter_ns){
+    int64_t j = (int64_t)(rnd() * 2 * jitter_ns) - (int64_t)jitter_ns;
+    f->when = (j < 0 && (uint64_t)-j > f->when - now) ? now : f->when + j;
+  }
+  if(reorder > 0 && rnd() < reorder){
+    f->when += reorder_ns;
+    d->reordered++;
+  }
+  if(dup_p > 0 && rnd() < dup_p){
+    enqueue(d, copy_frame(f));
+    d->dups++;
+  }
+  enqueue(d, f);
+}
+
+// send everything that is due; returns -1 if the receiving VM is gone.
+static int
+egress(struct dir *d, uint64_t now)
+{
+  while(d->q && d->q->when <= now){
+    struct frame *f = d->q;
+    uint32_t belen = htonl(f->len);
+    d->q = f->next;
+    if(writen(d->out, &belen, 4) < 0 || writen(d->out, f->data, f->len) < 0){
+      free(f);
+      return -1;
+    }
+    d->tx++;
+    d->bytes += f->len;
+    d->delay_sum += now - f->arrived;
+    free(f);
+  }
+  return 0;
+}
+
+static struct frame *
+receive(int fd, uint64_t now)
+{
+  uint32_t belen, len;
+  struct frame *f;
+
+  if(readn(fd, &belen, 4) < 0)
+    return 0;
+  len = ntohl(belen);
+  if(len > MAX_FRAME)
+    return 0;
+  f = malloc(sizeof(*f) + len);
+  if(f == 0)
+    die("malloc");
+  f->len = len;
+  f->arrived = f->when = now;
+  if(readn(fd, f->data, len) < 0){
+    free(f);
+    return 0;
+  }
+  return f;
+}
+
+static volatile sig_atomic_t stop;
+
+static void
+onsig(int sig)
+{
+  (void)sig;
+  stop = 1;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+    "Usage: fabric [options] endpoint-a endpoint-b\n"
+    "  endpoint is c:host:port (connect) or l:port (listen)\n"
+    "  -l pct     frame loss, percent\n"
+    "  -b n       mean loss burst length in frames (default 1: independent)\n"
+    "  -d ms      one-way delay\n"
+    "  -j ms      uniform jitter, +/- ms (can reorder)\n"
+    "  -o pct     reorder: hold this percent of frames back by -O ms\n"
+    "  -O ms      how long reordered frames are held (default 5)\n"
+    "  -u pct     duplicate frames, percent\n"
+    "  -R mbit    rate limit, Mbit/s\n"
+    "  -q bytes   queue in front of the rate limiter (default 65536)\n"
+    "  -D dir     impair only ab (a to b) or ba (default both)\n"
+    "  -r         impair only RDMA frames (ethertype 0x8915)\n"
+    "  -s seed    random seed\n"
+    "  -i secs    print counters every secs seconds\n"
+    "  -v         log each frame\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int c;
+
+  while((c = getopt(argc, argv, "l:b:d:j:o:O:u:R:q:D:rs:i:v")) != -1){
+    switch(c){
+    case 'l': loss = atof(optarg) / 100; break;
+    case 'b': burst = atof(optarg); break;
+    case 'd': delay_ns = atof(optarg) * MS; break;
+    case 'j': jitter_ns = atof(optarg) * MS; break;
+    case 'o': reorder = atof(optarg) / 100; break;
+    case 'O': reorder_ns = atof(optarg) * MS; break;
+    case 'u': dup_p = atof(optarg) / 100; break;
+    case 'R': rate_bps = atof(optarg) * 1e6; break;
+    case 'q': qlimit = strtoull(optarg, 0, 0); break;
+    case 'D':
+      if(strcmp(optarg, "ab") == 0) impair_ba = 0;
+      else if(strcmp(optarg, "ba") == 0) impair_ab = 0;
+      else usage();
+      break;
+    case 'r': rdma_only = 1; break;
+    case 's': rng_state = strtoull(optarg, 0, 0) | 1; break;
+    case 'i': interval = atoi(optarg); break;
+    case 'v': verbose = 1; break;
+    default: usage();
+    }
+  }
+  if(optind != argc - 2 || burst < 1 || loss < 0 || loss > 1)
+    usage();
+
+  int a = endpoint(argv[optind]);
+  int b = endpoint(argv[optind + 1]);
+  if(a < 0 || b < 0)
+    usage();
+  setvbuf(stdout, 0, _IOLBF, 0);
+  signal(SIGINT, onsig);
+  signal(SIGTERM, onsig);
+  signal(SIGPIPE, SIG_IGN);
+
+  dirs[0] = (struct dir){ .name = "ab", .in = a, .out = b, .impair = impair_ab };
+  dirs[1] = (struct dir){ .name = "ba", .in = b, .out = a, .impair = impair_ba };
+  start_ns = now_ns();
+  uint64_t next_report = start_ns + interval * NS;
+
+  while(!stop){
+    struct pollfd pfd[2] = { { a, POLLIN, 0 }, { b, POLLIN, 0 } };
+    uint64_t now = now_ns(), wake = now + NS;
+    int timeout;
+
+    for(int i = 0; i < 2; i++)
+      if(dirs[i].q && dirs[i].q->when < wake)
+        wake = dirs[i].q->when;
+    if(interval && next_report < wake)
+      wake = next_report;
+    timeout = wake > now ? (wake - now + MS - 1) / MS : 0;
+    if(poll(pfd, 2, timeout) < 0 && errno != EINTR)
+      die("poll");
+
+    now = now_ns();
+    for(int i = 0; i < 2; i++){
+      if(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)){
+        struct frame *f = receive(pfd[i].fd, now);
+        if(f == 0){
+          fprintf(stderr, "fabric: endpoint %s closed\n", i == 0 ? "a" : "b");
+          stop = 1;
+          break;
+        }
+        if(verbose)
+          printf("fabric: %s len %u\n", dirs[i].name, f->len);
+        ingress(&dirs[i], f, now);
+      }
+    }
+
+    now = now_ns();
+    for(int i = 0; i < 2; i++)
+      if(egress(&dirs[i], now) < 0)
+        stop = 1;
+    if(interval && now >= next_report){
+      report();
+      next_report += interval * NS;
+    }
+  }
+  report();
+  return 0;
+}
@@ -0,0 +1,56 @@
+//
+// interface between the host build's kernel stubs (kstubs.c) and
+// the test and benchmark driver (rdmahost.c).
+//
+
+#define HOST_UMEM_SIZE  (1024 * 4096)   // the fake process's address space
+
+void    host_init(void);
+void   *host_uva(uint64 va);            // user virtual address -> host pointer
+int     host_net_poll(void);            // deliver queued frames; returns count
+extern uint64 host_tx_frames;
+extern uint64 host_tx_bytes;
+extern uint64 host_tx_kicks;            // doorbells: netdev_kick()s that had work
+extern uint64 host_tx_bcast;            // frames to ff:ff:ff:ff:ff:ff
+extern uint64 host_rx_udp;              // datagrams for sockets (dropped)
+extern uint64 host_tx_port_frames[NNETDEV];
+extern int host_tx_ring;                // TX ring slots per port, 0 = unlimited
+extern int host_tx_free[NNETDEV];
+extern int host_nports;                 // network ports, 1 by default
+extern int host_rx_reverse;             // deliver each batch backwards
+extern int host_rx_corrupt;             // damage the next frame delivered
+extern int host_rx_drop;                // lose the next frame delivered
+extern int host_rx_split;               // leave payloads where they arrived
+extern uint64 host_rx_split_frames;     // frames handed up that way
+extern int host_poll_wire;              // netdev_poll() drains the wire
+extern char *host_file;                 // what every inode reads
+extern uint host_file_size;
+extern uint64 host_file_writes;         // writei() calls
+extern struct inode *host_inode;        // the inode that reads host_file
+
+// kernel entry points the driver calls (see kernel/defs.h, which
+// cannot be included next to <stdio.h>).
+void    crc32c_init(void);
+uint32  crc32c(uint32 crc, const void *buf, uint n);
+uint32  crc32c_copy(uint32 crc, void *dst, const void *src, uint n);
+void    net_init(void);
+void    net_rx(struct mbuf *m);
+void    net_tick(void);
+int     net_tx_udp(struct mbuf *m, uint32 dip, uint16 sport, uint16 dport);
+void    rdma_init(void);
+void    rdma_net_init(void);
+int     netdev_mac(int port, uint8 mac[6]);
+void    netdev_kick(void);
+void    rdma_sched_run(void);
+struct buf;
+int     rdma_disk_attach(int qp_id, uint32 dir_mr, uint32 dir_rkey);
+int     rdma_disk_nblocks(void);
+void    rdma_disk_rw(struct buf *b, int write);
+int     rdma_disk_claim(int user);
+char*   rdma_disk_buf(int i);
+int     rdma_disk_swapout(uint *slot, int n);
+int     rdma_disk_swapin(uint slot, char *pa);
+int     rdma_disk_logstart(void);
+int     rdma_disk_logroom(uint seq);
+int     rdma_disk_logpost(uint seq, int n, int *block);
+int     rdma_disk_logwait(void);
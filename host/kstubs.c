@@ -0,0 +1,470 @@
+//
+// stand-ins for the parts of the kernel that kernel/rdma.c,
+// kernel/rdma_net.c and kernel/net.c use, so that those files can
+// be compiled and run as an ordinary Linux program.
+//
+// kalloc() hands out pages from an arena mapped at KERNBASE, so
+// addresses look like kernel direct-map addresses.  There is one
+// process, whose "user memory" is a separate host buffer mapped
+// 1:1 by walk().  netdev_transmit() queues frames on a software wire;
+// host_net_poll() feeds them back into net_rx() the way a NIC's
+// receive path would, so a QP connected to our own MAC talks to another local QP.
+// The wire can stand in for a TX ring of host_tx_ring slots per port:
+// once that many frames are queued on a port netdev_transmit() fails
+// for it until host_net_poll() drains them, as a full NIC ring does.
+// netdev_kick() counts doorbells in host_tx_kicks, and
+// host_tx_bcast counts frames sent to the broadcast MAC.
+// There are host_nports ports, port i's MAC being the base MAC with
+// i added to its fifth byte; a frame comes back in on the port it
+// left by.  With host_rx_reverse set, host_net_poll() delivers each
+// batch of frames in reverse order, as mismatched paths might; with
+// host_rx_corrupt set, it flips a bit in the middle of the next frame;
+// with host_rx_drop set, it throws the next frame away;
+// with host_rx_split set, it hands up frames the way ivshmem.c does,
+// the payload left in the wire's mbuf when rdma_net_split() says so,
+// and counts those in host_rx_split_frames.  With host_poll_wire set,
+// netdev_poll() drains the wire, as polling an ivshmem port would.
+// There is one file, whose contents are host_file: every inode reads
+// and writes it, host_inode is the one to pass, and host_file_writes
+// counts writei() calls.  begin_op() and end_op() do nothing.
+//
+// Spinlocks are real test-and-set locks but there is only one
+// thread, so acquire() of a held lock is a deadlock and panics, and
+// so is acquiresleep() of a held sleeplock.
+// sleep() stands for "wait for an interrupt": it delivers queued
+// frames instead, and panics if there are none to wait for.
+// printf() is the C library's; kernel/string.c replaces memmove()
+// and friends, as in the kernel.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/proc.h"
+#include "kernel/net.h"
+#include "host/host.h"
+
+#define ARENA_SIZE (16 * 1024 * 1024)
+
+static uint8 host_mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+
+static struct proc proc0;
+static char *umem;
+static struct mbufq wire;
+uint64 host_tx_frames;
+uint64 host_tx_bytes;
+uint64 host_tx_port_frames[NNETDEV];
+uint64 host_tx_kicks;
+uint64 host_tx_bcast;
+static int kick_pending;
+int host_tx_ring;       // TX ring slots per port; 0 = unlimited
+int host_tx_free[NNETDEV];  // slots free until the next host_net_poll()
+int host_nports = 1;
+int host_rx_reverse;
+int host_rx_corrupt;
+int host_rx_drop;
+int host_rx_split;
+uint64 host_rx_split_frames;
+int host_poll_wire;
+
+struct run {
+  struct run *next;
+};
+static struct run *freelist;
+
+void
+panic(char *s)
+{
+  fflush(stdout);
+  fprintf(stderr, "panic: %s\n", s);
+  abort();
+}
+
+//
+// kalloc.c
+//
+
+void
+kfree(void *pa)
+{
+  struct run *r;
+
+  if(((uint64)pa % PGSIZE) != 0 || (uint64)pa < KERNBASE || (uint64)pa >= KERNBASE + ARENA_SIZE)
+    panic("kfree");
+
+  // Fill with junk to catch dangling refs, as kalloc.c does.
+  memset(pa, 1, PGSIZE);
+  r = (struct run*)pa;
+  r->next = freelist;
+  freelist = r;
+}
+
+void *
+kalloc(void)
+{
+  struct run *r = freelist;
+
+  if(r){
+    freelist = r->next;
+    memset((char*)r, 5, PGSIZE);
+  }
+  return (void*)r;
+}
+
+//
+// spinlock.c
+//
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+  lk->name = name;
+  lk->locked = 0;
+  lk->cpu = 0;
+}
+
+void
+acquire(struct spinlock *lk)
+{
+  if(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    panic(lk->name);   // single thread: this would spin forever
+  __sync_synchronize();
+}
+
+void
+release(struct spinlock *lk)
+{
+  if(!lk->locked)
+    panic("release");
+  __sync_synchronize();
+  __sync_lock_release(&lk->locked);
+}
+
+int
+holding(struct spinlock *lk)
+{
+  return lk->locked;
+}
+
+//
+// sleeplock.c
+//
+
+void
+initsleeplock(struct sleeplock *lk, char *name)
+{
+  initlock(&lk->lk, "sleep lock");
+  lk->name = name;
+  lk->locked = 0;
+}
+
+void
+acquiresleep(struct sleeplock *lk)
+{
+  if(lk->locked)
+    panic(lk->name);
+  lk->locked = 1;
+}
+
+void
+releasesleep(struct sleeplock *lk)
+{
+  lk->locked = 0;
+}
+
+//
+// proc.c and vm.c
+//
+
+struct proc*
+myproc(void)
+{
+  return &proc0;
+}
+
+void
+sleep(void *chan, struct spinlock *lk)
+{
+  release(lk);
+  if(host_net_poll() == 0)
+    panic("sleep: nothing will wake us");
+  acquire(lk);
+}
+
+void
+wakeup(void *chan)
+{
+}
+
+int
+killed(struct proc *p)
+{
+  return 0;
+}
+
+//
+// trap.c
+//
+
+// in units of the time CSR, 100 ns.
+uint64
+readtime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64)ts.tv_sec * 1000000000 + ts.tv_nsec) / 100;
+}
+
+// user address va lives at umem + va.
+pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  static pte_t pte;
+
+  if(va >= proc0.sz)
+    return 0;
+  pte = PA2PTE((uint64)umem + PGROUNDDOWN(va)) | PTE_V | PTE_R | PTE_W | PTE_U;
+  return &pte;
+}
+
+// every page walk() knows is mapped, so there is nothing to fault in.
+uint64
+vmfault(pagetable_t pagetable, uint64 va, int read)
+{
+  return 0;
+}
+
+void *
+host_uva(uint64 va)
+{
+  return umem + va;
+}
+
+//
+// netdev.c
+//
+
+int
+netdev_nports(void)
+{
+  return host_nports;
+}
+
+int
+netdev_mac(int port, uint8 mac[6])
+{
+  if(port < 0 || port >= host_nports)
+    return -1;
+  memcpy(mac, host_mac, 6);
+  mac[4] += port;
+  return 0;
+}
+
+int
+netdev_transmit(struct mbuf *m)
+{
+  if(m->dev < 0 || m->dev >= host_nports)
+    return -1;
+  if(host_tx_ring){
+    if(host_tx_free[m->dev] == 0)
+      return -1;
+    host_tx_free[m->dev]--;
+  }
+  host_tx_frames++;
+  host_tx_bytes += m->len;
+  host_tx_port_frames[m->dev]++;
+  if(m->len >= 6 && memcmp(m->head, "\xff\xff\xff\xff\xff\xff", 6) == 0)
+    host_tx_bcast++;
+  mbufq_pushtail(&wire, m);
+  kick_pending = 1;
+  return 0;
+}
+
+// the wire is drained by host_net_poll(), and polled only if asked.
+void
+netdev_poll(void)
+{
+  if(host_poll_wire)
+    host_net_poll();
+}
+
+void
+netdev_kick(void)
+{
+  if(kick_pending)
+    host_tx_kicks++;
+  kick_pending = 0;
+}
+
+void net_rx(struct mbuf *m);
+uint32 rdma_net_split(char *frame, uint32 len);
+
+static void
+deliver(struct mbuf *m)
+{
+  uint32 split;
+
+  if(host_rx_drop){
+    mbuffree(m);
+    host_rx_drop = 0;
+    return;
+  }
+  if(host_rx_corrupt){
+    m->head[m->len / 2] ^= 0x10;
+    host_rx_corrupt = 0;
+  }
+  if(host_rx_split && (split = rdma_net_split(m->head, m->len)) > 0){
+    struct mbuf *h = mbufalloc(0);
+    if(h == 0)
+      panic("deliver");
+    memmove(mbufput(h, split), m->head, split);
+    h->ext = m->head + split;
+    h->extlen = m->len - split;
+    h->dev = m->dev;
+    net_rx(h);
+    mbuffree(m);
+    host_rx_split_frames++;
+    return;
+  }
+  net_rx(m);
+}
+
+// fs.c and log.c: every inode is the one file.
+char *host_file;
+uint host_file_size;
+uint64 host_file_writes;
+static char the_inode;
+struct inode *host_inode = (struct inode*)&the_inode;
+
+void
+begin_op(void)
+{
+}
+
+void
+end_op(void)
+{
+}
+
+struct inode*
+idup(struct inode *ip)
+{
+  return ip;
+}
+
+void
+iput(struct inode *ip)
+{
+}
+
+void
+ilock(struct inode *ip)
+{
+}
+
+void
+iunlock(struct inode *ip)
+{
+}
+
+int
+readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  if(off > host_file_size || off + n < off)
+    return 0;
+  if(off + n > host_file_size)
+    n = host_file_size - off;
+  memmove((void*)dst, host_file + off, n);
+  return n;
+}
+
+// as writei() does, writes may extend the file but not start past
+// its end; here the file can't grow past its buffer.
+int
+writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  if(off > host_file_size || off + n < off || off + n > host_file_size)
+    return -1;
+  memmove(host_file + off, (void*)src, n);
+  host_file_writes++;
+  return n;
+}
+
+// sysnet.c: there are no sockets here, so datagrams are dropped.
+uint64 host_rx_udp;
+
+void
+sockrecvudp(struct mbuf *m, uint32 sip, uint16 dport, uint16 sport)
+{
+  host_rx_udp++;
+  mbuffree(m);
+}
+
+// the "interrupt handler": hand every queued frame to the stack,
+// including ACKs generated while doing so.  Once the wire is empty
+// the ring has drained, and the scheduler refills it, as on TXQE.
+int
+host_net_poll(void)
+{
+  int n = 0;
+
+  do {
+    if(host_rx_reverse){
+      struct mbuf *batch = 0;
+      while(!mbufq_empty(&wire)){
+        struct mbuf *m = mbufq_pophead(&wire);
+        m->next = batch;
+        batch = m;
+      }
+      while(batch){
+        struct mbuf *m = batch;
+        batch = m->next;
+        deliver(m);
+        n++;
+      }
+    }
+    while(!mbufq_empty(&wire)){
+      deliver(mbufq_pophead(&wire));
+      n++;
+    }
+    for(int i = 0; i < NNETDEV; i++)
+      host_tx_free[i] = host_tx_ring;
+    rdma_sched_run();
+  } while(!mbufq_empty(&wire));
+  return n;
+}
+
+void
+host_init(void)
+{
+  char *arena = mmap((void*)KERNBASE, ARENA_SIZE, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
+  if(arena != (char*)KERNBASE){
+    perror("rdmahost: cannot map the kalloc arena at KERNBASE");
+    exit(1);
+  }
+  for(char *p = arena + ARENA_SIZE - PGSIZE; p >= arena; p -= PGSIZE)
+    kfree(p);
+
+  umem = mmap(0, HOST_UMEM_SIZE, PROT_READ|PROT_WRITE,
+              MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(umem == MAP_FAILED){
+    perror("rdmahost: mmap");
+    exit(1);
+  }
+  proc0.pid = 1;
+  proc0.state = RUNNING;
+  proc0.sz = HOST_UMEM_SIZE;
+  proc0.pagetable = (pagetable_t)umem;
+  strcpy(proc0.name, "rdmahost");
+  mbufq_init(&wire);
+}
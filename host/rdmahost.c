@@ -0,0 +1,1599 @@
+//
+// host-native tests and microbenchmarks for the RDMA core.
+//
+// "make host/rdmahost" compiles kernel/rdma.c, rdma_net.c, net.c and
+// string.c for Linux, against the stubs in host/kstubs.c.  Running
+// it calls rdma_init() as main() does at boot, which runs the
+// rdma_test.h suite (and aborts if a test fails), then runs the
+// benchmarks, all under perf, valgrind or gdb if wanted:
+//
+//   host/rdmahost [-t] [-v] [-n iters] [bench ...]
+//
+// -t stops after the tests; -v keeps the kernel's printf output
+// during benchmarks (it is still formatted, then discarded, by
+// default).  Results are one line per benchmark, in the format
+// scripts/kbench_compare.py reads:
+//
+//   rdmahost: <op> n=<ops> ns=<elapsed> mean=<ns per op> [kbps=<kbit/s>]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/spinlock.h"
+#include "kernel/proc.h"
+#include "kernel/sleeplock.h"
+#include "kernel/fs.h"
+#include "kernel/buf.h"
+#include "kernel/rdma.h"
+#include "kernel/rdma_net.h"   // includes net.h, which has no include guard
+#include "host/host.h"
+
+#define DEFAULT_ITERS 100000
+#define SRC_VA        (1 * PGSIZE)   // source buffer in the fake user memory
+#define DST_VA        (2 * PGSIZE)   // destination buffer
+#define RDISK_VA      (8 * PGSIZE)   // a disk server's pages, then its directory
+#define RDISK_PAGES   RLOG_PAGES     // enough for a log standby
+#define BATCH         16             // completions reaped per poll_cq call
+#define CM_QPS        8              // QP pairs per connection manager handshake
+#define CM_SERVICE    4791
+#define UD_QKEY       0x1234
+#define SCHED_BACKLOG 24             // WRITEs each bulk QP has queued
+#define REORDER_WRS   4              // WRITEs in flight when the wire reorders
+
+// frames to any MAC but our own go out on the software wire and come
+// straight back through host_net_poll(); frames to our own MAC take
+// the same-host fast path and never reach the wire.
+static uint8 peer_mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x57 };
+
+static int sizes[] = { 64, 256, 1024, 1400 };
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+static int big_sizes[] = { 2048, 4096 };   // an MR is at most a page
+#define NBIG (sizeof(big_sizes) / sizeof(big_sizes[0]))
+
+static long iters = DEFAULT_ITERS;
+static int verbose;
+static int saved_stdout = -1;
+
+static uint64
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+fail(char *what)
+{
+  fprintf(stderr, "rdmahost: %s failed\n", what);
+  exit(1);
+}
+
+// send the kernel's printf chatter to /dev/null while timing.
+static void
+quiet(int on)
+{
+  if(verbose)
+    return;
+  fflush(stdout);
+  if(on){
+    int fd = open("/dev/null", O_WRONLY);
+    saved_stdout = dup(1);
+    dup2(fd, 1);
+    close(fd);
+  } else {
+    dup2(saved_stdout, 1);
+    close(saved_stdout);
+  }
+}
+
+static void
+report(char *op, int size, long n, uint64 ns, uint64 bytes)
+{
+  char name[32];
+
+  if(size)
+    snprintf(name, sizeof(name), "%s%d", op, size);
+  else
+    snprintf(name, sizeof(name), "%s", op);
+  if(ns == 0)
+    ns = 1;
+  fprintf(stdout, "rdmahost: %s n=%ld ns=%lu mean=%lu", name, n, ns, ns / n);
+  if(bytes)
+    fprintf(stdout, " kbps=%lu", bytes * 8 * 1000000 / ns);
+  fprintf(stdout, "\n");
+  fflush(stdout);
+}
+
+// reap completions until want have arrived.  post_send and
+// host_net_poll() run synchronously, so they are all there already,
+// except for combined WRITEs: an empty poll_cq sends those, and one
+// more host_net_poll() brings back their ACKs.
+static void
+reap(int qp, int want)
+{
+  struct rdma_completion comps[BATCH];
+
+  while(want > 0){
+    int n = rdma_qp_poll_cq(qp, comps, want > BATCH ? BATCH : want);
+    if(n == 0 && host_net_poll() > 0)
+      continue;
+    if(n <= 0)
+      fail("poll_cq");
+    for(int i = 0; i < n; i++)
+      if(comps[i].status != RDMA_WC_SUCCESS)
+        fail("completion status");
+    want -= n;
+  }
+}
+
+static void
+build_write(struct rdma_work_request *wr, uint64 id, int src, int dst, int size)
+{
+  memset(wr, 0, sizeof(*wr));
+  wr->wr_id = id;
+  wr->opcode = RDMA_OP_WRITE;
+  wr->flags = RDMA_WR_SIGNALED;
+  wr->local_mr_id = src;
+  wr->local_offset = 0;
+  wr->remote_mr_id = dst;
+  wr->remote_addr = 0;
+  wr->remote_key = dst;
+  wr->length = size;
+}
+
+// a READ of size bytes of MR src into MR dst.
+static void
+build_read(struct rdma_work_request *wr, uint64 id, int dst, int src, int size)
+{
+  build_write(wr, id, dst, src, size);
+  wr->opcode = RDMA_OP_READ;
+}
+
+static void
+check_data(int size)
+{
+  if(memcmp(host_uva(SRC_VA), host_uva(DST_VA), size) != 0)
+    fail("data check");
+  memset(host_uva(DST_VA), 0, PGSIZE);
+}
+
+//
+// benchmarks
+//
+
+void
+b_mbuf(void)
+{
+  quiet(1);
+  uint64 t0 = now();
+  for(long i = 0; i < iters; i++){
+    struct mbuf *m = mbufalloc(0);
+    if(m == 0)
+      fail("mbufalloc");
+    mbuffree(m);
+  }
+  uint64 t1 = now();
+  quiet(0);
+  report("mbuf", 0, iters, t1 - t0, 0);
+}
+
+void
+b_mr(void)
+{
+  quiet(1);
+  uint64 t0 = now();
+  for(long i = 0; i < iters; i++){
+    int mr = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+    if(mr < 0 || rdma_mr_deregister(mr) < 0)
+      fail("mr register/deregister");
+  }
+  uint64 t1 = now();
+  quiet(0);
+  report("mr", 0, iters, t1 - t0, 0);
+}
+
+// software loopback: each WRITE is a memmove inside post_send.
+void
+b_loop(void)
+{
+  struct rdma_work_request wr;
+
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+  int qp = rdma_qp_create(64, 64);
+  quiet(0);
+  if(src < 0 || dst < 0 || qp < 0)
+    fail("loop setup");
+
+  for(int s = 0; s < NSIZES; s++){
+    int size = sizes[s];
+    quiet(1);
+    uint64 t0 = now();
+    for(long i = 0; i < iters; i++){
+      build_write(&wr, i, src, dst, size);
+      if(rdma_qp_post_send(qp, &wr) < 0)
+        fail("post_send");
+      if(i % BATCH == BATCH - 1)
+        reap(qp, BATCH);
+    }
+    reap(qp, iters % BATCH);
+    uint64 t1 = now();
+    quiet(0);
+    check_data(size);
+    report("loop", size, iters, t1 - t0, (uint64)iters * size);
+  }
+
+  quiet(1);
+  rdma_qp_destroy(qp);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+}
+
+// network path: QP a and QP b are connected through a peer MAC, so
+// each WRITE is built into a frame, "received" by net_rx(), applied
+// to b's MR, and ACKed back to a.  Each batch is posted with
+// RDMA_WR_MORE on all but its last WRITE, so WRITEs small enough to
+// be combined share frames (and ACKs), and must take fewer than
+// frames_per_op frames each.  Without the flag, one goes out at once.
+static void
+net(char *name, uint8 *mac, int frames_per_op)
+{
+  struct rdma_work_request wr;
+
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+  int a = rdma_qp_create(64, 64);
+  int b = rdma_qp_create(64, 64);
+  int r = (a < 0 || b < 0) ? -1 : rdma_qp_connect(a, mac, b) | rdma_qp_connect(b, mac, a);
+  quiet(0);
+  if(src < 0 || dst < 0 || r < 0)
+    fail("net setup");
+
+  for(int s = 0; s < NSIZES; s++){
+    int size = sizes[s];
+    uint64 frames = host_tx_frames;
+    quiet(1);
+    uint64 t0 = now();
+    for(long i = 0; i < iters; i++){
+      build_write(&wr, i, src, dst, size);
+      if(i % BATCH != BATCH - 1 && i != iters - 1)
+        wr.flags |= RDMA_WR_MORE;
+      if(rdma_qp_post_send(a, &wr) < 0)
+        fail("post_send");
+      host_net_poll();
+      if(i % BATCH == BATCH - 1){
+        reap(a, BATCH);
+        reap(b, BATCH);
+      }
+    }
+    reap(a, iters % BATCH);
+    reap(b, iters % BATCH);
+    uint64 t1 = now();
+    quiet(0);
+    uint64 sent = host_tx_frames - frames;
+    if(size <= RDMA_WC_MAX_LEN && frames_per_op > 0 && iters > 1 ?
+       sent >= frames_per_op * iters : sent != frames_per_op * iters)
+      fail("frame count");
+    check_data(size);
+    report(name, size, iters, t1 - t0, (uint64)iters * size);
+  }
+
+  uint64 frames = host_tx_frames;
+  build_write(&wr, 0, src, dst, sizes[0]);
+  quiet(1);
+  r = rdma_qp_post_send(a, &wr);
+  quiet(0);
+  if(r < 0 || host_tx_frames != frames + (frames_per_op > 0))
+    fail("small WRITE held back");
+  reap(a, 1);
+  reap(b, 1);
+
+  quiet(1);
+  rdma_qp_destroy(b);
+  rdma_qp_destroy(a);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+}
+
+void
+b_net(void)
+{
+  net("net", peer_mac, 2);
+}
+
+// same-host fast path: no frames at all, one WRITE and two
+// completions per op, as on the wire.
+void
+b_local(void)
+{
+  uint8 mac[6];
+
+  netdev_mac(0, mac);
+  net("local", mac, 0);
+
+  // a UD SEND to a QP on this node is delivered the same way.
+  struct rdma_work_request wr;
+  struct rdma_recv_request rr;
+  struct rdma_completion comp;
+  uint64 frames = host_tx_frames;
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ | RDMA_ACCESS_LOCAL_WRITE);
+  int qp = rdma_qp_create_type(16, 16, RDMA_QPT_UD, UD_QKEY);
+  memset(&rr, 0, sizeof(rr));
+  rr.mr_id = src;
+  rr.offset = PGSIZE / 2;
+  rr.length = PGSIZE / 2;
+  memset(&wr, 0, sizeof(wr));
+  wr.opcode = RDMA_OP_SEND;
+  wr.local_mr_id = src;
+  wr.remote_mr_id = qp;
+  for(int j = 0; j < 6; j++)
+    wr.remote_addr = (wr.remote_addr << 8) | mac[j];
+  wr.remote_key = UD_QKEY;
+  wr.length = 64;
+  if(src < 0 || qp < 0 || rdma_qp_post_recv(qp, &rr) < 0 || rdma_qp_post_send(qp, &wr) < 0)
+    fail("local ud setup");
+  int n = rdma_qp_poll_cq(qp, &comp, 1);
+  rdma_qp_destroy(qp);
+  rdma_mr_deregister(src);
+  quiet(0);
+  if(n != 1 || comp.opcode != RDMA_OP_RECV || comp.status != RDMA_WC_SUCCESS ||
+     host_tx_frames != frames)
+    fail("local ud");
+}
+
+// reap completions, without checking what they are.
+static int
+drain(int qp)
+{
+  struct rdma_completion comps[BATCH];
+  int n, total = 0;
+
+  while((n = rdma_qp_poll_cq(qp, comps, BATCH)) > 0)
+    total += n;
+  return total;
+}
+
+// unreliable datagrams: one UD QP sends to two others in turn, each
+// SEND naming its destination; the receivers keep a receive posted
+// and check the sender address and data. No ACKs cross the wire.
+void
+b_ud(void)
+{
+  struct rdma_work_request wr;
+  struct rdma_recv_request rr;
+  struct rdma_completion comp;
+  uint8 *mac = peer_mac, local[6];
+  int peer[2];
+
+  netdev_mac(0, local);
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE);
+  int a = rdma_qp_create_type(64, 64, RDMA_QPT_UD, UD_QKEY);
+  peer[0] = rdma_qp_create_type(64, 64, RDMA_QPT_UD, UD_QKEY);
+  peer[1] = rdma_qp_create_type(64, 64, RDMA_QPT_UD, UD_QKEY);
+  int r = (a < 0) ? -1 : rdma_qp_connect(a, mac, peer[0]);
+  quiet(0);
+  if(src < 0 || dst < 0 || a < 0 || peer[0] < 0 || peer[1] < 0)
+    fail("ud setup");
+  if(r == 0)
+    fail("connect of a UD QP");
+
+  for(int s = 0; s < NSIZES; s++){
+    int size = sizes[s];
+    uint64 frames = host_tx_frames;
+    quiet(1);
+    uint64 t0 = now();
+    for(long i = 0; i < iters; i++){
+      int to = peer[i & 1];
+      memset(&rr, 0, sizeof(rr));
+      rr.wr_id = i;
+      rr.mr_id = dst;
+      rr.length = PGSIZE;
+      if(rdma_qp_post_recv(to, &rr) < 0)
+        fail("post_recv");
+      memset(&wr, 0, sizeof(wr));
+      wr.wr_id = i;
+      wr.opcode = RDMA_OP_SEND;
+      wr.flags = (i % BATCH == BATCH - 1) ? RDMA_WR_SIGNALED : 0;
+      wr.local_mr_id = src;
+      wr.remote_mr_id = to;
+      for(int j = 0; j < 6; j++)
+        wr.remote_addr = (wr.remote_addr << 8) | mac[j];
+      wr.remote_key = UD_QKEY;
+      wr.length = size;
+      if(rdma_qp_post_send(a, &wr) < 0)
+        fail("post_send");
+      host_net_poll();
+      if(rdma_qp_poll_cq(to, &comp, 1) != 1 || comp.status != RDMA_WC_SUCCESS ||
+         comp.opcode != RDMA_OP_RECV || comp.wr_id != i ||
+         comp.byte_len != sizeof(struct rdma_ud_grh) + size)
+        fail("ud receive completion");
+      if(wr.flags)
+        reap(a, 1);
+    }
+    uint64 t1 = now();
+    quiet(0);
+    struct rdma_ud_grh *grh = host_uva(DST_VA);
+    if(memcmp(grh->smac, local, 6) != 0 || grh->src_qp != a)
+      fail("ud sender address");
+    if(memcmp(host_uva(SRC_VA), (char*)host_uva(DST_VA) + sizeof(*grh), size) != 0)
+      fail("data check");
+    memset(host_uva(DST_VA), 0, PGSIZE);
+    if(host_tx_frames - frames != iters)
+      fail("frame count");
+    report("ud", size, iters, t1 - t0, (uint64)iters * size);
+  }
+
+  // a wrong Q_Key, or no receive posted, drops the datagram.
+  quiet(1);
+  memset(&wr, 0, sizeof(wr));
+  wr.opcode = RDMA_OP_SEND;
+  wr.local_mr_id = src;
+  wr.remote_mr_id = peer[0];
+  for(int j = 0; j < 6; j++)
+    wr.remote_addr = (wr.remote_addr << 8) | mac[j];
+  wr.remote_key = UD_QKEY;
+  wr.length = 64;
+  rdma_qp_post_send(a, &wr);
+  host_net_poll();
+  memset(&rr, 0, sizeof(rr));
+  rr.mr_id = dst;
+  rr.length = PGSIZE;
+  rdma_qp_post_recv(peer[0], &rr);
+  wr.remote_key = UD_QKEY + 1;
+  rdma_qp_post_send(a, &wr);
+  host_net_poll();
+  r = drain(peer[0]) + drain(a);
+  quiet(0);
+  if(r != 0 || qp_table[peer[0]].stats_rx_drops != 2)
+    fail("ud drops");
+
+  quiet(1);
+  rdma_qp_destroy(peer[1]);
+  rdma_qp_destroy(peer[0]);
+  rdma_qp_destroy(a);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+}
+
+// connection manager: a REQ/REP/RTU handshake pairing CM_QPS QPs
+// with a listener's and swapping MR descriptors, then one WRITE
+// addressed purely from what the handshake returned.
+void
+b_cm(void)
+{
+  struct rdma_work_request wr;
+  struct rdma_cm_info info, ainfo;
+  int lqp[CM_QPS];
+  uint64 elapsed = 0;
+
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+  quiet(0);
+  if(src < 0 || dst < 0)
+    fail("cm setup");
+
+  for(long i = 0; i < iters; i++){
+    quiet(1);
+    memset(&info, 0, sizeof(info));
+    memset(info.mac, 0xff, 6);
+    info.service_id = CM_SERVICE;
+    info.nqp = CM_QPS;
+    for(int j = 0; j < CM_QPS; j++){
+      lqp[j] = rdma_qp_create(16, 16);
+      info.qp[j] = rdma_qp_create(16, 16);
+      if(lqp[j] < 0 || (int)info.qp[j] < 0)
+        fail("qp_create");
+    }
+
+    uint64 t0 = now();
+    if(rdma_cm_listen(CM_SERVICE, lqp, CM_QPS, &dst, 1) < 0)
+      fail("cm_listen");
+    if(rdma_cm_connect(&info, &src, 1) < 0)
+      fail("cm_connect");
+    if(rdma_cm_accept(CM_SERVICE, &ainfo) < 0)
+      fail("cm_accept");
+    if(rdma_cm_close(CM_SERVICE) < 0)
+      fail("cm_close");
+    elapsed += now() - t0;
+
+    if(info.nqp != CM_QPS || ainfo.nqp != CM_QPS || info.nmr != 1 || ainfo.nmr != 1)
+      fail("cm counts");
+    for(int j = 0; j < CM_QPS; j++)
+      if(info.remote_qp[j] != ainfo.qp[j] || ainfo.remote_qp[j] != info.qp[j])
+        fail("cm QP pairing");
+    if(info.mr[0].mr_id != dst || info.mr[0].addr != DST_VA || ainfo.mr[0].mr_id != src)
+      fail("cm MR descriptors");
+
+    if(i == 0){
+      build_write(&wr, 1, src, info.mr[0].mr_id, 64);
+      wr.remote_key = info.mr[0].rkey;
+      if(rdma_qp_post_send(info.qp[CM_QPS-1], &wr) < 0)
+        fail("post_send");
+      host_net_poll();
+      reap(info.qp[CM_QPS-1], 1);
+      reap(ainfo.qp[CM_QPS-1], 1);
+      quiet(0);
+      check_data(64);
+      quiet(1);
+    }
+
+    for(int j = 0; j < CM_QPS; j++){
+      rdma_qp_destroy(lqp[j]);
+      rdma_qp_destroy(info.qp[j]);
+    }
+    quiet(0);
+  }
+  report("cm", CM_QPS, iters, elapsed, 0);
+
+  quiet(1);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+}
+
+// transmit scheduling: with the TX ring full, two bulk QPs (weights
+// 1 and 3) queue SCHED_BACKLOG WRITEs each, then a strict-priority QP
+// queues one.  As slots free up, the priority QP's frame must go
+// first, and the bulk QPs must share the rest roughly 1:3.
+void
+b_sched(void)
+{
+  struct rdma_work_request wr;
+  struct rdma_qp_stats st[3];
+  int qp[3], peer[3];
+  int weight[3] = { 1, 3, 1 };
+  int prio[3] = { 0, 0, 1 };
+  int nwr[3] = { SCHED_BACKLOG, SCHED_BACKLOG, 1 };
+  uint64 elapsed = 0;
+
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+  for(int i = 0; i < 3; i++){
+    qp[i] = rdma_qp_create(64, 64);
+    peer[i] = rdma_qp_create(64, 64);
+    if(qp[i] < 0 || peer[i] < 0 ||
+       rdma_qp_connect(qp[i], peer_mac, peer[i]) < 0 ||
+       rdma_qp_connect(peer[i], peer_mac, qp[i]) < 0 ||
+       rdma_qp_set_sched(qp[i], weight[i], prio[i]) < 0)
+      fail("sched setup");
+  }
+  quiet(0);
+  if(src < 0 || dst < 0)
+    fail("sched setup");
+  if(rdma_qp_set_sched(qp[0], 0, 0) == 0 || rdma_qp_set_sched(qp[0], RDMA_SCHED_MAX_WEIGHT + 1, 0) == 0)
+    fail("sched weight range");
+
+  for(long n = 0; n < iters; n++){
+    quiet(1);
+    uint64 t0 = now();
+    host_tx_ring = 16;
+    host_tx_free[0] = 0;
+    for(int i = 0; i < 3; i++)
+      for(int j = 0; j < nwr[i]; j++){
+        build_write(&wr, j, src, dst, 1024);
+        if(rdma_qp_post_send(qp[i], &wr) < 0)
+          fail("post_send");
+      }
+
+    // one slot: the priority QP's frame
+    host_tx_free[0] = 1;
+    rdma_sched_run();
+    for(int i = 0; i < 3; i++)
+      rdma_qp_query(qp[i], &st[i]);
+    if(st[2].txq_len != 0 || st[0].txq_len != SCHED_BACKLOG || st[1].txq_len != SCHED_BACKLOG)
+      fail("strict priority");
+
+    // a ring's worth: split by weight
+    host_tx_free[0] = 16;
+    rdma_sched_run();
+    for(int i = 0; i < 2; i++)
+      rdma_qp_query(qp[i], &st[i]);
+    int sent0 = SCHED_BACKLOG - st[0].txq_len, sent1 = SCHED_BACKLOG - st[1].txq_len;
+    if(sent0 + sent1 != 16 || sent0 < 2 || sent1 < 2 * sent0)
+      fail("weighted share");
+
+    host_tx_ring = 0;
+    host_net_poll();
+    for(int i = 0; i < 3; i++){
+      reap(qp[i], nwr[i]);
+      reap(peer[i], nwr[i]);
+    }
+    elapsed += now() - t0;
+    quiet(0);
+  }
+
+  for(int i = 0; i < 3; i++){
+    rdma_qp_query(qp[i], &st[i]);
+    if(st[i].txq_len != 0 || st[i].txq_frames != nwr[i] * iters || st[i].txq_delay_ns == 0)
+      fail("sched stats");
+  }
+  report("sched", 0, iters, elapsed, 0);
+
+  quiet(1);
+  for(int i = 0; i < 3; i++){
+    rdma_qp_destroy(peer[i]);
+    rdma_qp_destroy(qp[i]);
+  }
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+}
+
+// reap n completions from qp, checking their byte counts against len[].
+static void
+reap_lens(int qp, int n, int *len)
+{
+  struct rdma_completion comps[REORDER_WRS];
+
+  for(int got = 0; got < n; ){
+    int k = rdma_qp_poll_cq(qp, comps, n - got);
+    if(k <= 0)
+      fail("poll_cq");
+    for(int i = 0; i < k; i++, got++)
+      if(comps[i].status != RDMA_WC_SUCCESS || comps[i].byte_len != len[got])
+        fail("segmented WRITE completion order");
+  }
+}
+
+// multipath: WRITEs bigger than a frame go as WRITE_SEG segments,
+// first over one path and then striped over two ports.  Each op is
+// one WRITE, its segments and a single ACK, with the segments split
+// evenly between the ports.  Then, with the wire delivering frames
+// backwards, REORDER_WRS WRITEs of different lengths must still
+// complete in posting order on both sides; and with port 1's ring
+// full, a QP using only port 0 must not wait behind the striped one.
+void
+b_stripe(void)
+{
+  struct rdma_work_request wr;
+  struct rdma_qp_stats st;
+  uint8 mac1[6];
+  int len[REORDER_WRS] = { 3000, 250, 300, 350 };
+  int off[REORDER_WRS] = { 0, 3072, 3328, 3640 };
+
+  memcpy(mac1, peer_mac, 6);
+  mac1[4]++;
+
+  quiet(1);
+  host_nports = 2;
+  rdma_net_init();
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+  int a = rdma_qp_create(64, 64);
+  int b = rdma_qp_create(64, 64);
+  int c = rdma_qp_create(64, 64);
+  int r = (a < 0 || b < 0 || c < 0) ? -1 :
+    rdma_qp_connect(a, peer_mac, b) | rdma_qp_connect(b, peer_mac, a) |
+    rdma_qp_connect(c, peer_mac, b);
+  quiet(0);
+  if(src < 0 || dst < 0 || r < 0)
+    fail("stripe setup");
+  if(rdma_qp_set_path(a, 2, 1, mac1) == 0 || rdma_qp_set_path(a, 1, 2, mac1) == 0)
+    fail("stripe path checks");
+
+  for(int paths = 1; paths <= 2; paths++){
+    if(paths == 2){
+      quiet(1);
+      r = rdma_qp_set_path(a, 1, 1, mac1);
+      quiet(0);
+      if(r < 0)
+        fail("set_path");
+    }
+    for(int s = 0; s < NBIG; s++){
+      int size = big_sizes[s];
+      int nseg = (size + RDMA_SEG_LEN - 1) / RDMA_SEG_LEN;
+      uint64 frames = host_tx_frames, port1 = host_tx_port_frames[1];
+      uint64 kicks = host_tx_kicks;
+      quiet(1);
+      uint64 t0 = now();
+      for(long i = 0; i < iters; i++){
+        build_write(&wr, i, src, dst, size);
+        if(rdma_qp_post_send(a, &wr) < 0)
+          fail("post_send");
+        host_net_poll();
+        reap(a, 1);
+        reap(b, 1);
+      }
+      uint64 t1 = now();
+      quiet(0);
+      uint64 on1 = host_tx_port_frames[1] - port1;
+      if(host_tx_frames - frames != (nseg + 1) * iters ||
+         (paths == 1 && on1 != 0) ||
+         (paths == 2 && on1 < nseg / 2 * iters))
+        fail("stripe frame count");
+      // a WRITE's segments share a doorbell, and so do its ACKs
+      if(host_tx_kicks - kicks > 2 * iters)
+        fail("stripe doorbells");
+      check_data(size);
+      report(paths == 1 ? "seg" : "stripe", size, iters, t1 - t0, (uint64)iters * size);
+    }
+  }
+
+  // reordered delivery: later WRITEs finish first, and wait
+  host_rx_reverse = 1;
+  quiet(1);
+  for(int i = 0; i < REORDER_WRS; i++){
+    build_write(&wr, i, src, dst, len[i]);
+    wr.local_offset = off[i];
+    wr.remote_addr = off[i];
+    if(rdma_qp_post_send(a, &wr) < 0)
+      fail("post_send");
+  }
+  host_net_poll();
+  quiet(0);
+  host_rx_reverse = 0;
+  reap_lens(b, REORDER_WRS, len);
+  reap(a, REORDER_WRS);
+  for(int i = 0; i < REORDER_WRS; i++)
+    if(memcmp((char*)host_uva(SRC_VA) + off[i], (char*)host_uva(DST_VA) + off[i], len[i]) != 0)
+      fail("reordered data check");
+  memset(host_uva(DST_VA), 0, PGSIZE);
+
+  // a lost segment: its WRITE never completes, but once the receiver
+  // has given up on it the next one isn't held up behind it
+  quiet(1);
+  host_rx_drop = 1;
+  build_write(&wr, 0, src, dst, 3000);
+  if(rdma_qp_post_send(a, &wr) < 0)
+    fail("post_send");
+  host_net_poll();
+  usleep(RDMA_SEG_TIMEOUT / 10 + 100000);
+  build_write(&wr, 1, src, dst, 3000);
+  if(rdma_qp_post_send(a, &wr) < 0)
+    fail("post_send");
+  host_net_poll();
+  quiet(0);
+  reap(b, 1);
+  reap(a, 1);
+  check_data(3000);
+
+  // port 1 full: a's striped WRITE stalls, c's goes out on port 0
+  quiet(1);
+  host_tx_ring = 16;
+  host_tx_free[0] = 16;
+  host_tx_free[1] = 0;
+  build_write(&wr, 0, src, dst, 4096);
+  if(rdma_qp_post_send(a, &wr) < 0)
+    fail("post_send");
+  build_write(&wr, 0, src, dst, 1024);
+  if(rdma_qp_post_send(c, &wr) < 0)
+    fail("post_send");
+  rdma_qp_query(c, &st);
+  r = st.txq_len;
+  rdma_qp_query(a, &st);
+  quiet(0);
+  if(r != 0 || st.txq_len == 0)
+    fail("per-port ring");
+  host_tx_ring = 0;
+  host_net_poll();
+  reap(a, 1);
+  reap(c, 1);
+  reap(b, 2);
+  rdma_qp_query(a, &st);
+  if(st.seg_frames == 0 || st.txq_len != 0)
+    fail("stripe stats");
+
+  quiet(1);
+  rdma_qp_destroy(c);
+  rdma_qp_destroy(b);
+  rdma_qp_destroy(a);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  host_nports = 1;
+  rdma_net_init();
+  quiet(0);
+}
+
+// RoCEv2-style: both ends of a connected pair put their path in UDP,
+// so each frame grows by an IP and a UDP header and comes back in
+// through net_rx_ip().  Small WRITEs take as many frames as raw;
+// large ones are cut into shorter segments.
+void
+b_udp(void)
+{
+  struct rdma_work_request wr;
+  int all[NSIZES + NBIG];
+
+  memcpy(all, sizes, sizeof(sizes));
+  memcpy(all + NSIZES, big_sizes, sizeof(big_sizes));
+
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+  int a = rdma_qp_create(64, 64);
+  int b = rdma_qp_create(64, 64);
+  int r = (a < 0 || b < 0) ? -1 :
+    rdma_qp_connect(a, peer_mac, b) | rdma_qp_connect(b, peer_mac, a);
+  quiet(0);
+  if(src < 0 || dst < 0 || r < 0)
+    fail("udp setup");
+  if(rdma_qp_set_udp(a, 1, MAKE_IP_ADDR(10, 0, 2, 15), 0) == 0)
+    fail("udp path check");
+
+  for(int s = 0; s < NSIZES + NBIG; s++){
+    int size = all[s];
+    uint64 raw_frames = 0, raw_bytes = 0;
+    for(int udp = 0; udp <= 1; udp++){
+      quiet(1);
+      r = rdma_qp_set_udp(a, 0, udp ? MAKE_IP_ADDR(10, 0, 2, 15) : 0, 0) |
+          rdma_qp_set_udp(b, 0, udp ? MAKE_IP_ADDR(10, 0, 2, 15) : 0, 0);
+      quiet(0);
+      if(r < 0)
+        fail("set_udp");
+      uint64 frames = host_tx_frames, bytes = host_tx_bytes;
+      quiet(1);
+      uint64 t0 = now();
+      for(long i = 0; i < iters; i++){
+        build_write(&wr, i, src, dst, size);
+        if(rdma_qp_post_send(a, &wr) < 0)
+          fail("post_send");
+        host_net_poll();
+        reap(a, 1);
+        reap(b, 1);
+      }
+      uint64 t1 = now();
+      quiet(0);
+      frames = host_tx_frames - frames;
+      bytes = host_tx_bytes - bytes;
+      check_data(size);
+      if(!udp){
+        raw_frames = frames;
+        raw_bytes = bytes;
+        continue;
+      }
+      if(size <= RDMA_SEG_LEN - RDMA_UDP_HDRLEN ?
+         frames != raw_frames || bytes != raw_bytes + frames * RDMA_UDP_HDRLEN :
+         frames < raw_frames || bytes <= raw_bytes)
+        fail("udp frame count");
+      report("udp", size, iters, t1 - t0, (uint64)iters * size);
+    }
+  }
+
+  quiet(1);
+  rdma_qp_destroy(b);
+  rdma_qp_destroy(a);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+}
+
+// one UDP datagram of size bytes to dip, port 9 (discard).
+static void
+send_udp(uint32 dip, int size)
+{
+  struct mbuf *m = mbufalloc(MBUF_DEFAULT_HEADROOM);
+  if(m == 0)
+    fail("mbufalloc");
+  mbufput(m, size);
+  net_tx_udp(m, dip, 2000, 9);
+  netdev_kick();
+}
+
+// hand net_rx() an ARP reply saying ip is at mac.
+static void
+arp_reply(uint32 ip, uint8 *mac)
+{
+  struct mbuf *m = mbufalloc(MBUF_DEFAULT_HEADROOM);
+  struct eth *eth = mbufputhdr(m, *eth);
+  struct arp *arp = mbufputhdr(m, *arp);
+  uint8 us[6];
+
+  netdev_mac(0, us);
+  memcpy(eth->dhost, us, 6);
+  memcpy(eth->shost, mac, 6);
+  eth->type = htons(ETHTYPE_ARP);
+  arp->hrd = htons(ARP_HRD_ETHER);
+  arp->pro = htons(ETHTYPE_IP);
+  arp->hln = 6;
+  arp->pln = 4;
+  arp->op = htons(ARP_OP_REPLY);
+  memcpy(arp->sha, mac, 6);
+  arp->sip = htonl(ip);
+  memcpy(arp->tha, us, 6);
+  arp->tip = htonl(MAKE_IP_ADDR(10, 0, 2, 15));
+  net_rx(m);
+}
+
+// IP transmit through the ARP cache: the first datagram to the
+// gateway waits for an ARP reply, then it and every later one go
+// unicast, as do datagrams off the subnet, which route through it.
+// an unanswered request is repeated, then given up on.  datagrams
+// to our own IP loop back without touching the wire.
+void
+b_arp(void)
+{
+  uint8 gw_mac[6] = { 0x52, 0x55, 0x0a, 0x00, 0x02, 0x02 };
+  uint32 gw = MAKE_IP_ADDR(10, 0, 2, 2);
+
+  quiet(1);
+  uint64 frames = host_tx_frames, bcast = host_tx_bcast;
+  send_udp(gw, 64);
+  host_net_poll();          // our own request comes back; it teaches nothing
+  int asked = host_tx_frames - frames == 1 && host_tx_bcast - bcast == 1;
+  arp_reply(gw, gw_mac);
+  host_net_poll();
+  quiet(0);
+  if(!asked || host_tx_frames - frames != 2 || host_tx_bcast - bcast != 1)
+    fail("arp resolve");
+
+  for(int s = 0; s < NSIZES; s++){
+    int size = sizes[s];
+    frames = host_tx_frames;
+    bcast = host_tx_bcast;
+    quiet(1);
+    uint64 t0 = now();
+    for(long i = 0; i < iters; i++){
+      send_udp(i & 1 ? gw : MAKE_IP_ADDR(8, 8, 8, 8), size);
+      if(i % BATCH == BATCH - 1)
+        host_net_poll();
+    }
+    host_net_poll();
+    uint64 t1 = now();
+    quiet(0);
+    if(host_tx_frames - frames != iters || host_tx_bcast != bcast)
+      fail("arp unicast");
+    report("udp_tx", size, iters, t1 - t0, (uint64)iters * size);
+  }
+
+  // no reply: ARP_TRIES requests, ARP_PENDING packets kept, then none
+  quiet(1);
+  frames = host_tx_frames;
+  bcast = host_tx_bcast;
+  for(int i = 0; i < ARP_PENDING + 2; i++)
+    send_udp(MAKE_IP_ADDR(10, 0, 2, 99), 64);
+  for(int i = 0; i < ARP_RETRY * (ARP_TRIES + 1); i++)
+    net_tick();
+  host_net_poll();
+  arp_reply(MAKE_IP_ADDR(10, 0, 2, 99), gw_mac);  // too late: nothing left to send
+  host_net_poll();
+  quiet(0);
+  if(host_tx_bcast - bcast != ARP_TRIES || host_tx_frames - frames != ARP_TRIES)
+    fail("arp give up");
+
+  // to our own IP: straight to the sockets, no frame
+  frames = host_tx_frames;
+  uint64 rx = host_rx_udp;
+  quiet(1);
+  send_udp(MAKE_IP_ADDR(10, 0, 2, 15), 64);
+  quiet(0);
+  if(host_tx_frames != frames || host_rx_udp - rx != 1)
+    fail("udp loopback");
+}
+
+// end-to-end CRC32C: the same WRITEs as "net", small ones combined
+// and large ones segmented, with a check on each frame.  A frame
+// damaged on the wire is dropped before it reaches the MR, and
+// counted.
+void
+b_crc(void)
+{
+  struct rdma_work_request wr;
+  struct rdma_qp_stats st;
+  int all[NSIZES + NBIG];
+
+  memcpy(all, sizes, sizeof(sizes));
+  memcpy(all + NSIZES, big_sizes, sizeof(big_sizes));
+
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+  int a = rdma_qp_create(64, 64);
+  int b = rdma_qp_create(64, 64);
+  int r = (a < 0 || b < 0) ? -1 :
+    rdma_qp_connect(a, peer_mac, b) | rdma_qp_connect(b, peer_mac, a) |
+    rdma_qp_set_crc(a, 1);
+  quiet(0);
+  if(src < 0 || dst < 0 || r < 0)
+    fail("crc setup");
+
+  for(int s = 0; s < NSIZES + NBIG; s++){
+    int size = all[s];
+    quiet(1);
+    uint64 t0 = now();
+    for(long i = 0; i < iters; i++){
+      build_write(&wr, i, src, dst, size);
+      if(rdma_qp_post_send(a, &wr) < 0)
+        fail("post_send");
+      host_net_poll();
+      reap(a, 1);
+      reap(b, 1);
+    }
+    uint64 t1 = now();
+    quiet(0);
+    check_data(size);
+    report("crc", size, iters, t1 - t0, (uint64)iters * size);
+  }
+
+  for(int s = 0; s < NBIG + 1; s++){
+    int size = s < NBIG ? big_sizes[s] : 1024;
+    quiet(1);
+    host_rx_corrupt = 1;
+    build_write(&wr, 0, src, dst, size);
+    if(rdma_qp_post_send(a, &wr) < 0)
+      fail("post_send");
+    host_net_poll();
+    rdma_qp_query(b, &st);
+    quiet(0);
+    if(st.crc_errors != s + 1)
+      fail("crc error count");
+    if(size < PGSIZE && ((char*)host_uva(DST_VA))[size / 2] != 0)
+      fail("damaged frame placed");
+    memset(host_uva(DST_VA), 0, PGSIZE);
+  }
+
+  quiet(1);
+  rdma_qp_destroy(b);
+  rdma_qp_destroy(a);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+}
+
+// direct placement: the same WRITEs as "net", but received as
+// ivshmem receives them, with only the headers copied into an mbuf
+// and the payload read into the MR from where it arrived.  Frames
+// with short payloads are still copied whole.
+void
+b_place(void)
+{
+  struct rdma_work_request wr;
+  int all[NSIZES + NBIG];
+
+  memcpy(all, sizes, sizeof(sizes));
+  memcpy(all + NSIZES, big_sizes, sizeof(big_sizes));
+
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+  int a = rdma_qp_create(64, 64);
+  int b = rdma_qp_create(64, 64);
+  int r = (a < 0 || b < 0) ? -1 :
+    rdma_qp_connect(a, peer_mac, b) | rdma_qp_connect(b, peer_mac, a);
+  quiet(0);
+  if(src < 0 || dst < 0 || r < 0)
+    fail("place setup");
+
+  host_rx_split = 1;
+  for(int s = 0; s < NSIZES + NBIG; s++){
+    int size = all[s];
+    uint64 split = host_rx_split_frames;
+    quiet(1);
+    uint64 t0 = now();
+    for(long i = 0; i < iters; i++){
+      build_write(&wr, i, src, dst, size);
+      if(rdma_qp_post_send(a, &wr) < 0)
+        fail("post_send");
+      host_net_poll();
+      reap(a, 1);
+      reap(b, 1);
+    }
+    uint64 t1 = now();
+    quiet(0);
+    check_data(size);
+    if((size >= RDMA_SPLIT_MIN) != (host_rx_split_frames > split))
+      fail("frames split");
+    report("place", size, iters, t1 - t0, (uint64)iters * size);
+  }
+  host_rx_split = 0;
+
+  quiet(1);
+  rdma_qp_destroy(b);
+  rdma_qp_destroy(a);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+}
+
+// sendfile: WRITEs straight from a file, against reading the file
+// into a registered buffer and WRITEing that, as a server would
+// without rdma_qp_sendfile().
+void
+b_sendfile(void)
+{
+  struct rdma_work_request wr;
+  int all[NSIZES + NBIG];
+  static char file[8 * PGSIZE];
+
+  memcpy(all, sizes, sizeof(sizes));
+  memcpy(all + NSIZES, big_sizes, sizeof(big_sizes));
+  for(int i = 0; i < sizeof(file); i++)
+    file[i] = i * 7 + (i >> 8);
+  host_file = file;
+  host_file_size = sizeof(file);
+
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+  int a = rdma_qp_create(64, 64);
+  int b = rdma_qp_create(64, 64);
+  int r = (a < 0 || b < 0) ? -1 :
+    rdma_qp_connect(a, peer_mac, b) | rdma_qp_connect(b, peer_mac, a);
+  quiet(0);
+  if(src < 0 || dst < 0 || r < 0)
+    fail("sendfile setup");
+
+  for(int s = 0; s < NSIZES + NBIG; s++){
+    int size = all[s];
+    uint64 off = 1000 + s * PGSIZE;
+
+    // read() into the buffer, then WRITE it
+    quiet(1);
+    uint64 t0 = now();
+    for(long i = 0; i < iters; i++){
+      memcpy(host_uva(SRC_VA), file + off, size);
+      build_write(&wr, i, src, dst, size);
+      if(rdma_qp_post_send(a, &wr) < 0)
+        fail("post_send");
+      host_net_poll();
+      reap(a, 1);
+      reap(b, 1);
+    }
+    uint64 t1 = now();
+    quiet(0);
+    check_data(size);
+    report("readwrite", size, iters, t1 - t0, (uint64)iters * size);
+
+    quiet(1);
+    t0 = now();
+    for(long i = 0; i < iters; i++){
+      build_write(&wr, i, 0, dst, size);
+      wr.local_offset = off;
+      if(rdma_qp_sendfile(a, host_inode, &wr) < 0)
+        fail("sendfile");
+      host_net_poll();
+      reap(a, 1);
+      reap(b, 1);
+    }
+    t1 = now();
+    quiet(0);
+    if(memcmp(host_uva(DST_VA), file + off, size) != 0)
+      fail("sendfile data");
+    memset(host_uva(DST_VA), 0, PGSIZE);
+    report("sendfile", size, iters, t1 - t0, (uint64)iters * size);
+  }
+
+  // past the end of the file, or too long for one WRITE
+  uint64 frames = host_tx_frames;
+  build_write(&wr, 0, 0, dst, 100);
+  wr.local_offset = sizeof(file) - 50;
+  quiet(1);
+  int r1 = rdma_qp_sendfile(a, host_inode, &wr);
+  build_write(&wr, 0, 0, dst, 32 * PGSIZE);
+  int r2 = rdma_qp_sendfile(a, host_inode, &wr);
+  quiet(0);
+  if(r1 >= 0 || r2 >= 0 || host_tx_frames != frames)
+    fail("sendfile out of range");
+
+  quiet(1);
+  rdma_qp_destroy(b);
+  rdma_qp_destroy(a);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+}
+
+// filemr: a peer READs an MR over a file, and WRITEs into it; the
+// WRITEs reach the file, only the blocks they touched, when the MR
+// is synced.  READs of an MR over process memory for comparison.
+void
+b_filemr(void)
+{
+  struct rdma_work_request wr;
+  struct rdma_completion c;
+  static char file[4 * PGSIZE];
+  uint off = PGSIZE + 100;   // not block aligned: the MR spans five blocks
+
+  for(int i = 0; i < sizeof(file); i++)
+    file[i] = i * 13 + (i >> 9);
+  host_file = file;
+  host_file_size = sizeof(file);
+  for(int i = 0; i < PGSIZE; i++)
+    ((char*)host_uva(SRC_VA))[i] = i * 3;
+
+  quiet(1);
+  int src = rdma_mr_register(SRC_VA, PGSIZE, RDMA_ACCESS_LOCAL_READ | RDMA_ACCESS_REMOTE_READ);
+  int dst = rdma_mr_register(DST_VA, PGSIZE, RDMA_ACCESS_LOCAL_WRITE);
+  int f = rdma_mr_register_file(host_inode, off, PGSIZE,
+                                RDMA_ACCESS_REMOTE_READ | RDMA_ACCESS_REMOTE_WRITE);
+  int past = rdma_mr_register_file(host_inode, sizeof(file) - 100, 200, RDMA_ACCESS_REMOTE_READ);
+  int a = rdma_qp_create(64, 64);
+  int b = rdma_qp_create(64, 64);
+  int r = (a < 0 || b < 0) ? -1 :
+    rdma_qp_connect(a, peer_mac, b) | rdma_qp_connect(b, peer_mac, a);
+  quiet(0);
+  if(src < 0 || dst < 0 || f < 0 || r < 0)
+    fail("filemr setup");
+  if(past >= 0)
+    fail("file MR past the end of the file");
+
+  for(int s = 0; s < NSIZES; s++){
+    int size = sizes[s];
+    uint64 moff = s * 512;
+
+    quiet(1);
+    uint64 t0 = now();
+    for(long i = 0; i < iters; i++){
+      build_read(&wr, i, dst, src, size);
+      if(rdma_qp_post_send(a, &wr) < 0)
+        fail("post_send");
+      host_net_poll();
+      reap(a, 1);
+    }
+    uint64 t1 = now();
+    quiet(0);
+    check_data(size);
+    report("read", size, iters, t1 - t0, (uint64)iters * size);
+
+    quiet(1);
+    t0 = now();
+    for(long i = 0; i < iters; i++){
+      build_read(&wr, i, dst, f, size);
+      wr.remote_addr = moff;
+      if(rdma_qp_post_send(a, &wr) < 0)
+        fail("post_send");
+      host_net_poll();
+      reap(a, 1);
+    }
+    t1 = now();
+    quiet(0);
+    if(memcmp(host_uva(DST_VA), file + off + moff, size) != 0)
+      fail("file READ data");
+    memset(host_uva(DST_VA), 0, PGSIZE);
+    report("fileread", size, iters, t1 - t0, (uint64)iters * size);
+  }
+
+  // longer than one response frame
+  build_read(&wr, 0, dst, f, 2048);
+  quiet(1);
+  if(rdma_qp_post_send(a, &wr) < 0 || rdma_qp_poll_cq(a, &c, 1) != 1)
+    fail("post_send");
+  quiet(0);
+  if(c.status == RDMA_WC_SUCCESS)
+    fail("READ longer than a frame");
+
+  // a READ into an MR without local write access fails alike over
+  // the wire, to a QP on this node and on a loopback QP
+  uint8 mac[6];
+  int bad = 0;
+  netdev_mac(0, mac);
+  quiet(1);
+  int l = rdma_qp_create(64, 64);
+  int lo = rdma_qp_create(64, 64);
+  r = (l < 0 || lo < 0) ? -1 : rdma_qp_connect(l, mac, b);
+  int qps[] = { a, l, lo };
+  for(int i = 0; i < 3 && r == 0; i++){
+    build_read(&wr, 0, src, f, 64);
+    r = rdma_qp_post_send(qps[i], &wr);
+    host_net_poll();
+    if(rdma_qp_poll_cq(qps[i], &c, 1) != 1 || c.status != RDMA_WC_LOC_PROT_ERR)
+      bad = 1;
+  }
+  rdma_qp_destroy(lo);
+  rdma_qp_destroy(l);
+  quiet(0);
+  if(r < 0)
+    fail("post_send");
+  if(bad)
+    fail("READ into a read-only MR");
+
+  // two WRITEs, into the MR's first and third blocks
+  uint64 writes = host_file_writes;
+  quiet(1);
+  build_write(&wr, 0, src, f, 10);
+  r = rdma_qp_post_send(a, &wr);
+  build_write(&wr, 1, src, f, 100);
+  wr.remote_addr = 2000;
+  r |= rdma_qp_post_send(a, &wr);
+  host_net_poll();
+  reap(a, 2);
+  quiet(0);
+  if(r < 0)
+    fail("post_send");
+  if(host_file_writes != writes || memcmp(file + off, host_uva(SRC_VA), 10) == 0)
+    fail("file written before sync");
+  quiet(1);
+  r = rdma_mr_sync(f);
+  quiet(0);
+  if(r < 0 || host_file_writes != writes + 2)
+    fail("sync of the dirty blocks");
+  if(memcmp(file + off, host_uva(SRC_VA), 10) != 0 ||
+     memcmp(file + off + 2000, host_uva(SRC_VA), 100) != 0)
+    fail("file data after sync");
+  quiet(1);
+  r = rdma_mr_sync(f) | rdma_mr_sync(src);
+  quiet(0);
+  if(r != -1 || host_file_writes != writes + 2)
+    fail("sync with nothing dirty");
+
+  quiet(1);
+  rdma_qp_destroy(b);
+  rdma_qp_destroy(a);
+  r = rdma_mr_deregister(f);
+  rdma_mr_deregister(dst);
+  rdma_mr_deregister(src);
+  quiet(0);
+  if(r < 0)
+    fail("file MR deregister");
+}
+
+// rdisk: the remote disk driver's block WRITEs and READs, over a QP
+// handed to the kernel, into MRs standing for a disk server's pages.
+// A directory with a bad magic number is refused and the QP given
+// back; once attached, the QP is no longer the process's.  Then the
+// same disk as a log standby, with this process standing in for the
+// standby's replay, and as swap space.
+void
+b_rdisk(void)
+{
+  static struct buf b;
+  struct rdisk_dir *dir = host_uva(RDISK_VA + RDISK_PAGES * PGSIZE);
+  struct rdma_completion c;
+  int nblocks = RDISK_PAGES * (PGSIZE / BSIZE);
+  int mr = 0;
+
+  quiet(1);
+  memset(dir, 0, PGSIZE);
+  dir->nblocks = nblocks;
+  dir->npages = RDISK_PAGES;
+  for(int i = 0; i < RDISK_PAGES; i++){
+    int m = rdma_mr_register(RDISK_VA + i * PGSIZE, PGSIZE,
+                             RDMA_ACCESS_REMOTE_READ | RDMA_ACCESS_REMOTE_WRITE);
+    dir->page[i].mr_id = m;
+    dir->page[i].rkey = m;
+    mr |= m;
+  }
+  int d = rdma_mr_register(RDISK_VA + RDISK_PAGES * PGSIZE, PGSIZE, RDMA_ACCESS_REMOTE_READ);
+  int a = rdma_qp_create(64, 64);
+  int s = rdma_qp_create(64, 64);
+  int r = (mr < 0 || d < 0 || a < 0 || s < 0) ? -1 :
+    rdma_qp_connect(a, peer_mac, s) | rdma_qp_connect(s, peer_mac, a);
+  host_poll_wire = 1;   // the driver waits by polling
+  int bad = rdma_disk_attach(a, d, d);
+  dir->magic = RDISK_MAGIC;
+  if(r == 0)
+    r = rdma_disk_attach(a, d, d);
+  int again = rdma_disk_attach(a, d, d);
+  quiet(0);
+  if(r < 0 || bad >= 0 || again >= 0 || rdma_disk_nblocks() != nblocks)
+    fail("rdisk attach");
+  if(rdma_qp_poll_cq(a, &c, 1) >= 0)
+    fail("process polls the kernel's QP");
+
+  quiet(1);
+  uint64 t0 = now();
+  for(long i = 0; i < iters; i++){
+    b.blockno = i % nblocks;
+    b.data[0] = i;
+    rdma_disk_rw(&b, 1);
+  }
+  uint64 t1 = now();
+  for(int k = 0; k < nblocks; k++){
+    b.blockno = k;
+    memset(b.data, k + 1, BSIZE);
+    rdma_disk_rw(&b, 1);
+  }
+  quiet(0);
+  report("rdiskwrite", BSIZE, iters, t1 - t0, (uint64)iters * BSIZE);
+  for(int k = 0; k < nblocks; k++){
+    char *blk = (char*)host_uva(RDISK_VA) + k * BSIZE;
+    if(blk[0] != (char)(k + 1) || blk[BSIZE - 1] != (char)(k + 1))
+      fail("rdisk write data");
+  }
+
+  quiet(1);
+  t0 = now();
+  for(long i = 0; i < iters; i++){
+    b.blockno = i % nblocks;
+    rdma_disk_rw(&b, 0);
+    if(b.data[0] != (uchar)(b.blockno + 1) || b.data[BSIZE - 1] != (uchar)(b.blockno + 1))
+      fail("rdisk read data");
+  }
+  t1 = now();
+  quiet(0);
+  report("rdiskread", BSIZE, iters, t1 - t0, (uint64)iters * BSIZE);
+
+  // a log standby: two-block transactions into the slots, which the
+  // "standby" applies as soon as each is there
+  struct rlog_ctl *ctl = host_uva(RDISK_VA);
+  int block[LOGBLOCKS];
+  quiet(1);
+  int npages = rdma_disk_claim(RDISK_LOG);
+  int notyet = rdma_disk_logstart();
+  ctl->magic = RLOG_MAGIC;
+  ctl->applied = 0;
+  if(npages != RDISK_PAGES || notyet >= 0 || rdma_disk_logstart() != 0 ||
+     rdma_disk_nblocks() != 0 || rdma_disk_claim(RDISK_SWAP) >= 0){
+    quiet(0);
+    fail("rdisk log claim");
+  }
+  t0 = now();
+  for(long i = 0; i <= iters; i++){
+    uint seq = i + 1;
+    int n = i < iters ? 2 : LOGBLOCKS;   // the last one as big as they come
+    for(int k = 0; k < n; k++){
+      char *p = rdma_disk_buf(k * BSIZE / PGSIZE) + k * BSIZE % PGSIZE;
+      p[0] = p[BSIZE - 1] = seq + k;
+      block[k] = 100 + k;
+    }
+    if(rdma_disk_logroom(seq) < 0 || rdma_disk_logpost(seq, n, block) < 0 ||
+       rdma_disk_logwait() < 0)
+      fail("rdisk log commit");
+    char *slot = host_uva(RDISK_VA + (1 + (seq % RLOG_SLOTS) * RLOG_SLOT_PAGES) * PGSIZE);
+    struct rlog_head *h = (struct rlog_head*)(slot + RLOG_HEAD_BLOCK * BSIZE);
+    char *last = slot + (n - 1) * BSIZE;
+    if(h->magic != RLOG_MAGIC || h->seq != seq || h->n != n || h->block[n - 1] != 100 + n - 1 ||
+       last[0] != (char)(seq + n - 1) || last[BSIZE - 1] != (char)(seq + n - 1))
+      fail("rdisk log slot");
+    ctl->applied = seq;
+  }
+  t1 = now();
+  int toobig = rdma_disk_logpost(iters + 2, LOGBLOCKS + 1, block);
+  quiet(0);
+  if(toobig >= 0)
+    fail("rdisk log transaction too big");
+  report("logcommit", 2 * BSIZE, iters, t1 - t0, (uint64)iters * 2 * BSIZE);
+
+  // the same disk as swap space: batches of pages out, pages back in
+  static char page[PGSIZE];
+  uint slot[RDISK_BATCH];
+  quiet(1);
+  int blk = rdma_disk_claim(RDISK_BLK) == RDISK_PAGES && rdma_disk_nblocks() == nblocks;
+  int nslots = rdma_disk_claim(RDISK_SWAP);
+  if(!blk || nslots != RDISK_PAGES || rdma_disk_claim(RDISK_LOG) >= 0 ||
+     rdma_disk_nblocks() != 0){
+    quiet(0);
+    fail("rdisk swapon");
+  }
+  // every slot is written at least once, for the checks below
+  long batches = iters;
+  if(batches * RDISK_BATCH < nslots)
+    batches = (nslots + RDISK_BATCH - 1) / RDISK_BATCH;
+  t0 = now();
+  for(long i = 0; i < batches; i++){
+    for(int k = 0; k < RDISK_BATCH; k++){
+      slot[k] = (i * RDISK_BATCH + k) % nslots;
+      char *p = rdma_disk_buf(k);
+      p[0] = p[PGSIZE - 1] = slot[k] + 1;
+    }
+    if(rdma_disk_swapout(slot, RDISK_BATCH) < 0)
+      fail("rdisk swapout");
+  }
+  t1 = now();
+  quiet(0);
+  report("swapout", PGSIZE, batches * RDISK_BATCH, t1 - t0, (uint64)batches * RDISK_BATCH * PGSIZE);
+  for(int k = 0; k < nslots; k++){
+    char *p = (char*)host_uva(RDISK_VA) + k * PGSIZE;
+    if(p[0] != (char)(k + 1) || p[PGSIZE - 1] != (char)(k + 1))
+      fail("swapout data");
+  }
+
+  quiet(1);
+  t0 = now();
+  for(long i = 0; i < iters; i++){
+    int k = i % nslots;
+    if(rdma_disk_swapin(k, page) < 0 || page[0] != (char)(k + 1) ||
+       page[PGSIZE - 1] != (char)(k + 1))
+      fail("rdisk swapin");
+  }
+  t1 = now();
+  quiet(0);
+  report("swapin", PGSIZE, iters, t1 - t0, (uint64)iters * PGSIZE);
+
+  // a lost frame costs the pager a second try, not the page; the
+  // completions the first try left behind are passed over
+  quiet(1);
+  host_rx_drop = 1;
+  int in = rdma_disk_swapin(1, page) == 0 && page[0] == 2;
+  char *p = rdma_disk_buf(0);
+  p[0] = p[PGSIZE - 1] = 3;
+  slot[0] = 2;
+  host_rx_drop = 1;
+  int out = rdma_disk_swapout(slot, 1) == 0;
+  int after = rdma_disk_swapin(2, page) == 0 && page[0] == 3 && page[PGSIZE - 1] == 3;
+  quiet(0);
+  if(!in || !out || !after)
+    fail("rdisk swap with a lost frame");
+  host_poll_wire = 0;
+}
+
+struct bench {
+  void (*f)(void);
+  char *s;
+} benches[] = {
+  {b_mbuf, "mbuf"},
+  {b_mr, "mr"},
+  {b_loop, "loop"},
+  {b_net, "net"},
+  {b_local, "local"},
+  {b_cm, "cm"},
+  {b_ud, "ud"},
+  {b_sched, "sched"},
+  {b_stripe, "stripe"},
+  {b_udp, "udp"},
+  {b_arp, "arp"},
+  {b_crc, "crc"},
+  {b_place, "place"},
+  {b_sendfile, "sendfile"},
+  {b_filemr, "filemr"},
+  {b_rdisk, "rdisk"},
+  {0, 0},
+};
+
+static void
+usage(void)
+{
+  fprintf(stderr, "Usage: rdmahost [-t] [-v] [-n iters] [");
+  for(struct bench *b = benches; b->s != 0; b++)
+    fprintf(stderr, b == benches ? "%s" : "|%s", b->s);
+  fprintf(stderr, "] ...\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int tests_only = 0;
+  int c;
+
+  while((c = getopt(argc, argv, "tvn:")) != -1){
+    switch(c){
+    case 't': tests_only = 1; break;
+    case 'v': verbose = 1; break;
+    case 'n': iters = atol(optarg); break;
+    default: usage();
+    }
+  }
+  if(iters <= 0)
+    usage();
+  for(int i = optind; i < argc; i++){
+    struct bench *b;
+    for(b = benches; b->s != 0; b++)
+      if(strcmp(b->s, argv[i]) == 0)
+        break;
+    if(b->s == 0)
+      usage();
+  }
+
+  // as in main.c; rdma_init() runs rdma_run_kernel_tests().
+  host_init();
+  crc32c_init();
+  net_init();
+  rdma_init();
+  rdma_net_init();
+  fflush(stdout);
+  if(tests_only)
+    return 0;
+
+  for(int i = 0; i < PGSIZE; i++)
+    ((char*)host_uva(SRC_VA))[i] = i * 7;
+
+  for(struct bench *b = benches; b->s != 0; b++){
+    int run = (optind == argc);
+    for(int i = optind; i < argc; i++)
+      if(strcmp(b->s, argv[i]) == 0)
+        run = 1;
+    if(run)
+      b->f();
+  }
+  fprintf(stdout, "rdmahost: done\n");
+  return 0;
+}
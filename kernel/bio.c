@@ -12,6 +12,8 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * Blocks of device RDISKDEV are in another node's memory,
+//     read and written by RDMA (rdma_disk.c).
 
 
 #include "types.h"
@@ -88,6 +90,16 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
+// Read or write b on the device it belongs to.
+static void
+disk_rw(struct buf *b, int write)
+{
+  if(b->dev == RDISKDEV)
+    rdma_disk_rw(b, write);
+  else
+    virtio_disk_rw(b, write);
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
@@ -96,7 +108,7 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    disk_rw(b, 0);
     b->valid = 1;
   }
   return b;
@@ -108,7 +120,7 @@ bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  disk_rw(b, 1);
 }
 
 // Release a locked buffer.
@@ -0,0 +1,108 @@
+//
+// CRC32C (Castagnoli), the CRC of iSCSI and SCTP, for checking RDMA
+// payloads end to end.
+//
+// table-driven, slicing-by-8: each step folds eight bytes in with
+// eight lookups in eight 256-entry tables, rather than one byte per
+// lookup.  crc32c_copy() does the same while it copies, so a payload
+// that is being copied anyway is checked for the cost of the lookups.
+//
+// crc32c(0, p, n) is the standard CRC32C of p; passing a previous
+// result as crc continues it, so crc32c(crc32c(0, a, na), b, nb) is
+// the CRC of a followed by b.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define CRC32C_POLY 0x82F63B78  // reversed 0x1EDC6F41
+
+static uint32 table[8][256];
+
+void
+crc32c_init(void)
+{
+  for(int i = 0; i < 256; i++){
+    uint32 c = i;
+    for(int k = 0; k < 8; k++)
+      c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    table[0][i] = c;
+  }
+  // table[t][i]: byte i followed by t zero bytes
+  for(int t = 1; t < 8; t++)
+    for(int i = 0; i < 256; i++)
+      table[t][i] = (table[t-1][i] >> 8) ^ table[0][table[t-1][i] & 0xff];
+}
+
+static inline uint32
+crc32c_byte(uint32 c, uchar b)
+{
+  return table[0][(c ^ b) & 0xff] ^ (c >> 8);
+}
+
+// eight bytes, the first in w's low byte.
+static inline uint32
+crc32c_word(uint32 c, uint64 w)
+{
+  uint32 lo = (uint32)w ^ c;
+  uint32 hi = w >> 32;
+
+  return table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+         table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+         table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+         table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+}
+
+uint32
+crc32c(uint32 crc, const void *buf, uint n)
+{
+  const uchar *p = buf;
+  uint32 c = ~crc;
+
+  // bytes up to an 8-byte boundary, then words
+  for(; n > 0 && ((uint64)p & 7); n--)
+    c = crc32c_byte(c, *p++);
+  for(; n >= 8; n -= 8, p += 8)
+    c = crc32c_word(c, *(const uint64*)p);
+  for(; n > 0; n--)
+    c = crc32c_byte(c, *p++);
+  return ~c;
+}
+
+// copies n bytes from src to dst, which must not overlap, and
+// returns crc continued over them.
+uint32
+crc32c_copy(uint32 crc, void *dst, const void *src, uint n)
+{
+  const uchar *s = src;
+  uchar *d = dst;
+  uint32 c = ~crc;
+
+  for(; n > 0 && ((uint64)s & 7); n--){
+    uchar b = *s++;
+    *d++ = b;
+    c = crc32c_byte(c, b);
+  }
+  if(((uint64)d & 7) == 0){
+    for(; n >= 8; n -= 8, s += 8, d += 8){
+      uint64 w = *(const uint64*)s;
+      *(uint64*)d = w;
+      c = crc32c_word(c, w);
+    }
+  } else {
+    // dst is out of step with src: load words, store bytes
+    for(; n >= 8; n -= 8, s += 8, d += 8){
+      uint64 w = *(const uint64*)s;
+      for(int k = 0; k < 8; k++)
+        d[k] = w >> (8 * k);
+      c = crc32c_word(c, w);
+    }
+  }
+  for(; n > 0; n--){
+    uchar b = *s++;
+    *d++ = b;
+    c = crc32c_byte(c, b);
+  }
+  return ~c;
+}
@@ -3,13 +3,18 @@ struct context;
 struct file;
 struct inode;
 struct pipe;
+struct sock;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct swapstat;
 struct mbuf;
+struct netdev;
+struct rdma_path;
 struct rdma_qp;
+struct rdma_qp_stats;
 struct rdma_work_request;
 
 // bio.c
@@ -57,16 +62,20 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 void            ireclaim(int);
+void            iinvalidate(uint, uint);
 
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+int             kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+int             log_mirror(uint, int);
+int             log_replay(int, int*, uint64);
 void            end_op(void);
 
 // pipe.c
@@ -105,6 +114,15 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// swap.c
+void            swapinit(void);
+int             swapon(int);
+void*           swapalloc(void);
+uint64          swapin(pagetable_t, uint64);
+int             swapread(pte_t *, char *);
+int             swapfree(pte_t *);
+void            swapstat(struct swapstat *);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -122,6 +140,11 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// crc32c.c
+void            crc32c_init(void);
+uint32          crc32c(uint32, const void*, uint);
+uint32          crc32c_copy(uint32, void*, const void*, uint);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -145,6 +168,7 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            prepare_return(void);
+uint64          readtime(void);
 
 // uart.c
 void            uartinit(void);
@@ -187,23 +211,92 @@ void            virtio_disk_intr(void);
 // E1000 driver
 void            e1000_init(void);
 void            e1000_intr(void);
-void            e1000_recv(void);
-int             e1000_transmit(struct mbuf *m);
-void            e1000_get_mac(uint8 mac[6]);
+
+// virtio_net.c
+void            virtio_net_init(void);
+void            virtio_net_intr(void);
+
+// ivshmem.c
+void            ivshmem_init(void);
+void            ivshmem_intr(void);
+
+// netdev.c
+int             netdev_register(struct netdev*);
+int             netdev_nports(void);
+int             netdev_mac(int, uint8[6]);
+int             netdev_transmit(struct mbuf*);
+void            netdev_kick(void);
+void            netdev_recv(void);
+void            netdev_poll(void);
+void            netdev_inithart(void);
+void            netdev_rx(struct mbuf*);
+int             netdev_rx_here(struct mbuf*);
+void            netdev_rxintr(void);
 
 // net.c
 void            net_init(void);
 void            net_rx(struct mbuf *m);
-void            sockrecvudp(struct mbuf *m, uint32 sip, uint16 dport, uint16 sport); 
+void            net_tick(void);
+int             net_tx_udp(struct mbuf *m, uint32 dip, uint16 sport, uint16 dport);
+void            net_udp_put(struct mbuf *m, uint32 dip, uint16 sport, uint16 dport);
+void            net_udp_fill(struct mbuf *m, unsigned int off);
+
+// sysnet.c
+void            sockinit(void);
+int             sockalloc(struct file **, uint16, int);
+void            sockclose(struct sock *);
+int             sockread(struct sock *, uint64, int);
+int             sockrecvmmsg(struct sock *, uint64, int, int);
+int             socksendmmsg(struct sock *, uint64, int);
+void            sockrecvudp(struct mbuf *m, uint32 sip, uint16 dport, uint16 sport);
+int             sockcpu(uint16);
 
 // rdma.c
 void            rdma_init(void);
+int             rdma_qp_cpu(int);
 
 // rdma_net.c
 void            rdma_net_init(void);
-void            rdma_net_rx(struct mbuf*, uint8*);
+void            rdma_net_rx(struct mbuf*, uint8*, uint32);
+uint32          rdma_net_split(char*, uint32);
+uint32          rdma_net_seg_len(struct rdma_qp*);
+int             rdma_net_tx_prefilled(struct rdma_qp*, struct rdma_work_request*, struct mbuf**, uint32);
 int             rdma_net_tx_write(struct rdma_qp*, struct rdma_work_request*);
-void            rdma_net_tx_ack(struct rdma_qp*, uint16, uint32, uint8*);
+int             rdma_net_tx_read(struct rdma_qp*, struct rdma_work_request*);
+int             rdma_net_tx_ud(struct rdma_qp*, struct rdma_work_request*);
+void            rdma_net_tx_ack(struct rdma_qp*, uint16, uint32, uint32, struct rdma_path*);
+void            rdma_net_flush(struct rdma_qp*);
+void            rdma_net_tick(void);
+int             rdma_net_tx_cm(uint8*, uint8, void*, uint32);
+
+// rdma_cm.c
+void            rdma_cm_rx(struct mbuf*, uint8*, uint8, uint32);
+void            rdma_cm_tick(void);
+
+// rdma_disk.c
+void            rdma_disk_init(void);
+int             rdma_disk_attach(int, uint32, uint32);
+int             rdma_disk_nblocks(void);
+void            rdma_disk_rw(struct buf *, int);
+int             rdma_disk_claim(int);
+char*           rdma_disk_buf(int);
+int             rdma_disk_swapout(uint *, int);
+int             rdma_disk_swapin(uint, char *);
+int             rdma_disk_logstart(void);
+int             rdma_disk_logroom(uint);
+int             rdma_disk_logpost(uint, int, int *);
+int             rdma_disk_logwait(void);
+
+// rdma_sched.c
+void            rdma_sched_init(void);
+void            rdma_sched_qp_init(struct rdma_qp*);
+void            rdma_sched_qp_purge(struct rdma_qp*);
+void            rdma_sched_set(struct rdma_qp*, uint32, uint32);
+void            rdma_sched_stats(struct rdma_qp*, struct rdma_qp_stats*);
+int             rdma_sched_xmit(struct rdma_qp*, struct mbuf*);
+int             rdma_sched_xmitv(struct rdma_qp*, struct mbuf**, int);
+uint32          rdma_sched_room(struct rdma_qp*);
+void            rdma_sched_run(void);
 
 
 // number of elements in fixed-size array
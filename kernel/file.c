@@ -79,6 +79,8 @@ fileclose(struct file *f)
     begin_op();
     iput(ff.ip);
     end_op();
+  } else if(ff.type == FD_SOCK){
+    sockclose(ff.sock);
   }
 }
 
@@ -122,6 +124,8 @@ fileread(struct file *f, uint64 addr, int n)
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
+  } else if(f->type == FD_SOCK){
+    r = sockread(f->sock, addr, n);
   } else {
     panic("fileread");
   }
@@ -392,6 +392,29 @@ ireclaim(int dev)
   }
 }
 
+// Disk block blockno of dev has been rewritten under the inode
+// table, by log_replay(): have the cached inodes it holds re-read
+// from it the next time they are locked.
+void
+iinvalidate(uint dev, uint blockno)
+{
+  struct inode *ip;
+
+  acquire(&itable.lock);
+  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+    if(ip->ref > 0 && ip->dev == dev && IBLOCK(ip->inum, sb) == blockno){
+      ip->ref++;
+      release(&itable.lock);
+      acquiresleep(&ip->lock);
+      ip->valid = 0;
+      releasesleep(&ip->lock);
+      acquire(&itable.lock);
+      ip->ref--;
+    }
+  }
+  release(&itable.lock);
+}
+
 // Inode content
 //
 // The content (data) associated with each inode is stored
@@ -0,0 +1,346 @@
+//
+// a network port made of memory shared with another VM on the same
+// host: qemu's ivshmem PCI device (1af4:1110).
+//
+// qemu ... -object memory-backend-file,id=ivs,share=on,mem-path=/dev/shm/xv6-rdma,size=2M
+//          -device ivshmem-plain,memdev=ivs
+// or, for doorbell interrupts, with ivshmem-server running:
+// qemu ... -chardev socket,path=/tmp/xv6-ivshmem,id=ivs
+//          -device ivshmem-doorbell,chardev=ivs,vectors=1
+//
+// the region holds two rings of frame slots, one per direction.
+// each end takes a side: from the server's IVPosition if there is
+// one, else by claiming it in the region's header, so the file
+// must be new when the first VM boots (scripts/run_host_a.sh
+// recreates it).  a frame is copied into the ring on transmit and
+// out of it on receive; it never touches the host's network stack.
+// a large RDMA payload isn't copied out into an mbuf: only its
+// headers are, and rdma_net_rx() copies the payload from the slot
+// straight into its MR before the slot is given back.
+//
+// ivshmem-doorbell interrupts the receiver when a kick publishes
+// frames and the receiver said it was idle, and the sender when the
+// receiver frees room in a ring the sender found full.
+// ivshmem-plain has no interrupts: the port is polled, by
+// netdev_poll() each time a process polls an empty CQ, and on the
+// clock tick.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "net.h"
+#include "defs.h"
+
+// BAR0 registers
+#define IVS_INTRMASK   0
+#define IVS_INTRSTATUS 1  // reading clears it
+#define IVS_IVPOSITION 2  // our id from ivshmem-server, -1 without one
+#define IVS_DOORBELL   3  // (peer id << 16) | vector
+
+#define IVS_SLOTS 256        // frames per ring
+#define IVS_SLOT_SIZE 2048
+
+// one side's ring: the sender owns prod, the receiver cons.  the
+// flags ask the other end for a doorbell.  each word has a cache
+// line of its own.
+struct ivs_ctl {
+  volatile uint32 prod;    // frames published
+  uint32 pad0[15];
+  volatile uint32 cons;    // frames taken
+  uint32 pad1[15];
+  volatile uint32 rx_idle; // receiver wants a doorbell for new frames
+  uint32 pad2[15];
+  volatile uint32 tx_full; // sender wants a doorbell for room
+  uint32 pad3[15];
+};
+
+struct ivs_slot {
+  uint32 len;
+  char data[IVS_SLOT_SIZE - 4];
+};
+
+// the layout of the shared region; ring s carries side s's frames.
+struct ivs_shared {
+  volatile uint32 claimed[2];
+  char pad[PGSIZE - 8];
+  struct ivs_ctl ctl[2];
+  char pad2[PGSIZE - 2 * sizeof(struct ivs_ctl)];
+  struct ivs_slot slots[2][IVS_SLOTS];
+};
+
+static struct ivshmem {
+  volatile uint32 *regs;
+  struct ivs_shared *sh;
+  int side;       // we send on ring side, receive on ring 1-side
+  int doorbell;   // ivshmem-doorbell: the peer can be interrupted
+  int port;       // netdev port number
+  uint32 tx_prod; // frames queued; ctl.prod lags until a kick
+  int rx_busy;    // a hart is in ivshmem_recv()
+  int rx_again;   // and should look again before it stops
+  struct spinlock lock;
+} ivs;
+
+static int ivshmem_transmit(int unit, struct mbuf *m);
+static void ivshmem_kick(int unit);
+static void ivshmem_recv(int unit);
+
+// find the ivshmem device on PCI bus 0 and give it BAR0 and BAR2.
+// returns 0, or -1 if there is none.
+static int
+ivshmem_pci(void)
+{
+  volatile uint32 *ecam = (volatile uint32 *)PCIE_ECAM;
+
+  for(int dev = 0; dev < 32; dev++){
+    volatile uint32 *cfg = ecam + (dev << 15) / 4;
+    if(cfg[0] != 0x11101af4)
+      continue;
+
+    // BAR2 is the shared memory, a 64-bit BAR; its size is set
+    // on the qemu command line.
+    cfg[0x18/4] = 0xffffffff;
+    uint64 size = ~(cfg[0x18/4] & ~0xF) + 1;
+    if((uint32)size < IVSHMEM_SIZE){
+      printf("ivshmem: shared memory is 0x%lx bytes, need 0x%lx\n",
+             size & 0xffffffff, IVSHMEM_SIZE);
+      return -1;
+    }
+    cfg[0x18/4] = IVSHMEM_BASE;
+    cfg[0x1c/4] = IVSHMEM_BASE >> 32;
+    cfg[0x10/4] = IVSHMEM_REGS;
+    cfg[0x04/4] = 0x0002;  // memory space
+    printf("ivshmem: PCI bus 0 dev %d\n", dev);
+    ivs.regs = (volatile uint32 *)IVSHMEM_REGS;
+    ivs.sh = (struct ivs_shared *)IVSHMEM_BASE;
+    return 0;
+  }
+  return -1;
+}
+
+void
+ivshmem_init(void)
+{
+  initlock(&ivs.lock, "ivshmem");
+
+  if(ivshmem_pci() < 0)
+    return;
+
+  int id = ivs.regs[IVS_IVPOSITION];
+  if(id >= 0){
+    // ivshmem-server numbers its clients 0, 1, ...
+    ivs.doorbell = 1;
+    ivs.side = id & 1;
+  } else {
+    ivs.side = -1;
+    for(int s = 0; s < 2 && ivs.side < 0; s++)
+      if(__sync_val_compare_and_swap(&ivs.sh->claimed[s], 0, 1) == 0)
+        ivs.side = s;
+    if(ivs.side < 0){
+      printf("ivshmem: both sides already taken; recreate the file\n");
+      return;
+    }
+  }
+
+  // the ring we receive on may hold a previous boot's frames.
+  struct ivs_ctl *rx = &ivs.sh->ctl[1 - ivs.side];
+  rx->cons = rx->prod;
+  ivs.tx_prod = ivs.sh->ctl[ivs.side].prod;
+
+  if(ivs.doorbell){
+    ivs.regs[IVS_INTRMASK] = 1;
+    rx->rx_idle = 1;
+  }
+
+  // the MAC follows the run_host scripts: port p of host A (side 0)
+  // is 52:54:00:12:34+p:56, of host B 52:54:00:12:34+p:57.
+  int port = netdev_nports();
+  struct netdev nd = {
+    .name = "ivshmem",
+    .unit = 0,
+    .mac = { 0x52, 0x54, 0x00, 0x12, 0x34 + port, 0x56 + ivs.side },
+    .polled = !ivs.doorbell,
+    .transmit = ivshmem_transmit,
+    .kick = ivshmem_kick,
+    .recv = ivshmem_recv,
+  };
+  ivs.port = netdev_register(&nd);
+  printf("ivshmem: side %d, %s\n", ivs.side,
+         ivs.doorbell ? "doorbell" : "polled");
+}
+
+static void
+ivshmem_ring(void)
+{
+  ivs.regs[IVS_DOORBELL] = (ivs.side ^ 1) << 16;
+}
+
+// copy m into the next slot and free it.  the peer doesn't see it
+// until ivshmem_kick().  returns 0, or -1 if the ring is full.
+static int
+ivshmem_transmit(int unit, struct mbuf *m)
+{
+  struct ivs_ctl *tx = &ivs.sh->ctl[ivs.side];
+
+  if(m->len > sizeof(ivs.sh->slots[0][0].data))
+    return -1;
+
+  acquire(&ivs.lock);
+  if(ivs.tx_prod - tx->cons >= IVS_SLOTS){
+    // full: ask for a doorbell when there is room, then look once
+    // more in case the peer made room before it saw the request.
+    tx->tx_full = 1;
+    __sync_synchronize();
+    if(ivs.tx_prod - tx->cons >= IVS_SLOTS){
+      release(&ivs.lock);
+      return -1;
+    }
+  }
+  struct ivs_slot *s = &ivs.sh->slots[ivs.side][ivs.tx_prod % IVS_SLOTS];
+  s->len = m->len;
+  memmove(s->data, m->head, m->len);
+  ivs.tx_prod++;
+  release(&ivs.lock);
+
+  mbuffree(m);
+  return 0;
+}
+
+// publish the frames queued since the last kick, and ring the
+// peer if it is waiting for them.
+static void
+ivshmem_kick(int unit)
+{
+  struct ivs_ctl *tx = &ivs.sh->ctl[ivs.side];
+
+  acquire(&ivs.lock);
+  if(tx->prod != ivs.tx_prod){
+    __sync_synchronize(); // slots before prod
+    tx->prod = ivs.tx_prod;
+    __sync_synchronize(); // prod before reading rx_idle
+    if(ivs.doorbell && tx->rx_idle){
+      tx->rx_idle = 0;
+      ivshmem_ring();
+    }
+  }
+  release(&ivs.lock);
+}
+
+// hand the frames in head up to net_rx().
+static void
+ivshmem_deliver(struct mbuf *head)
+{
+  while(head){
+    struct mbuf *m = head;
+    head = m->next;
+    m->next = 0;
+    netdev_rx(m);
+  }
+}
+
+// hand a slot's frame up with its payload left in the slot, if
+// rdma_net_split() says to and it can be received on this hart.
+// returns 0 if it was, and the slot can be reused.  called with
+// ivs.lock held, which it drops while the frame is received.
+static int
+ivshmem_recv_split(struct ivs_slot *s, struct mbuf **head, struct mbuf ***tail)
+{
+  uint32 split = rdma_net_split(s->data, s->len);
+  struct mbuf *m;
+  int r;
+
+  if(split == 0 || (m = mbufalloc(0)) == 0)
+    return -1;
+  memmove(mbufput(m, split), s->data, split);
+  m->ext = s->data + split;
+  m->extlen = s->len - split;
+  m->dev = ivs.port;
+
+  // net_rx() may transmit, so it must not hold ivs.lock; the
+  // frames before this one go first.
+  release(&ivs.lock);
+  ivshmem_deliver(*head);
+  *head = 0;
+  *tail = head;
+  r = netdev_rx_here(m);
+  acquire(&ivs.lock);
+  if(r < 0)
+    mbuffree(m);
+  return r;
+}
+
+// hand up every frame the peer has published.  one hart at a time
+// takes frames, since split ones are received before their slots
+// are given back.
+static void
+ivshmem_recv(int unit)
+{
+  struct ivs_ctl *rx;
+  struct mbuf *head = 0, **tail = &head;
+
+  if(ivs.sh == 0 || ivs.side < 0)
+    return;
+  rx = &ivs.sh->ctl[1 - ivs.side];
+
+  acquire(&ivs.lock);
+  if(ivs.rx_busy){
+    ivs.rx_again = 1;
+    release(&ivs.lock);
+    return;
+  }
+  ivs.rx_busy = 1;
+  do {
+    ivs.rx_again = 0;
+    uint32 cons = rx->cons;
+    while(cons != rx->prod){
+      __sync_synchronize(); // prod before the slots
+      struct ivs_slot *s = &ivs.sh->slots[1 - ivs.side][cons % IVS_SLOTS];
+      if(s->len > sizeof(s->data) || ivshmem_recv_split(s, &head, &tail) == 0){
+        cons++;
+        continue;
+      }
+      struct mbuf *m = mbufalloc(0);
+      if(m){
+        memmove(mbufput(m, s->len), s->data, s->len);
+        m->dev = ivs.port;
+        *tail = m;
+        tail = &m->next;
+      }
+      cons++;
+    }
+    __sync_synchronize(); // done with the slots before giving them back
+    rx->cons = cons;
+    __sync_synchronize();
+    if(ivs.doorbell && rx->tx_full){
+      rx->tx_full = 0;
+      ivshmem_ring();
+    }
+    if(ivs.doorbell){
+      // ring us for the next frame, then look once more in case it
+      // was published before the peer saw the request.
+      rx->rx_idle = 1;
+      __sync_synchronize();
+      if(rx->cons != rx->prod)
+        rx->rx_idle = 0;
+    }
+  } while(rx->cons != rx->prod || ivs.rx_again);
+  ivs.rx_busy = 0;
+  release(&ivs.lock);
+
+  // netdev_rx() may transmit, so it must not hold ivs.lock.
+  ivshmem_deliver(head);
+}
+
+// called for every PCI INTx interrupt, which the e1000s share.
+void
+ivshmem_intr(void)
+{
+  if(!ivs.doorbell || ivs.regs[IVS_INTRSTATUS] == 0)
+    return;
+  ivshmem_recv(0);
+  // the peer may have made room: refill the ring
+  rdma_sched_run();
+}
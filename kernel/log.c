@@ -4,6 +4,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 
@@ -29,6 +30,14 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Once log_mirror() is on, commit() also WRITEs each transaction to
+// a standby node over RDMA (rdma_disk.c), ahead of the local log,
+// and the transaction commits when the standby has it as well as,
+// or instead of, when the local header is written.  The standby
+// applies the transactions it is sent to its own disk, through its
+// own log, with log_replay(): it starts from the same file system
+// and can take over with it.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -40,13 +49,23 @@ struct logheader {
 struct log {
   struct spinlock lock;
   int start;
+  int size;        // blocks in the file system
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
   int dev;
   struct logheader lh;
+  int mirror;      // sending transactions to a standby
+  int remote;      // and not writing them to the local log
+  int lost;        // the standby stopped answering
+  uint seq;        // the last transaction sent to the standby
 };
 struct log log;
 
+// what install_trans() is installing
+#define INSTALL_COMMIT  0  // a transaction this node just committed
+#define INSTALL_RECOVER 1  // one found in the log at boot
+#define INSTALL_REPLAY  2  // one a primary sent, for log_replay()
+
 static void recover_from_log(void);
 static void commit();
 
@@ -58,25 +77,26 @@ initlog(int dev, struct superblock *sb)
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
+  log.size = sb->size;
   log.dev = dev;
   recover_from_log();
 }
 
 // Copy committed blocks from log to their home location
 static void
-install_trans(int recovering)
+install_trans(int how)
 {
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    if(recovering) {
+    if(how == INSTALL_RECOVER) {
       printf("recovering tail %d dst %d\n", tail, log.lh.block[tail]);
     }
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
+    if(how == INSTALL_COMMIT)
       bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
@@ -118,7 +138,7 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  install_trans(INSTALL_RECOVER); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
 }
@@ -191,18 +211,140 @@ write_log(void)
   }
 }
 
+// Start sending the transaction to the standby: copy its blocks into
+// the remote disk's bounce pages and post the WRITEs.
+// Returns 0, or -1 if the standby didn't take it.
+static int
+mirror_post(void)
+{
+  int tail;
+
+  // the standby's slot for it must be free, and the bounce pages
+  if(rdma_disk_logroom(log.seq+1) < 0)
+    return -1;
+  for (tail = 0; tail < log.lh.n; tail++) {
+    char *to = rdma_disk_buf(tail*BSIZE / PGSIZE) + tail*BSIZE % PGSIZE;
+    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+    memmove(to, from->data, BSIZE);
+    brelse(from);
+  }
+  if(rdma_disk_logpost(log.seq+1, log.lh.n, log.lh.block) < 0)
+    return -1;
+  log.seq++;
+  return 0;
+}
+
+// The standby is gone: carry on with the local log alone.
+static void
+mirror_lost(void)
+{
+  printf("log: lost the standby after transaction %d, logging locally\n", log.seq);
+  log.mirror = 0;
+  log.lost = 1;
+}
+
 static void
 commit()
 {
+  int local = 0;
+
   if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+    if(log.mirror && mirror_post() < 0)
+      mirror_lost();
+    if(!log.mirror || !log.remote){
+      write_log();     // Write modified blocks from cache to log
+      write_head();    // Write header to disk -- the real commit
+      local = 1;
+    }
+    // the standby's copy is written while the local one is
+    if(log.mirror && rdma_disk_logwait() < 0){
+      mirror_lost();
+      if(!local){
+        write_log();
+        write_head();
+        local = 1;
+      }
+    }
+    install_trans(INSTALL_COMMIT); // Now install writes to home locations
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    if(local)
+      write_head();    // Erase the transaction from the log
   }
 }
 
+// Send each transaction from now on to the standby on the remote
+// disk too, which has applied transactions up to applied, and, if
+// remote, don't write it to the local log.  Returns 0, or -1 if a
+// standby has been lost already.
+int
+log_mirror(uint applied, int remote)
+{
+  int r = -1;
+
+  acquire(&log.lock);
+  while(log.committing)
+    sleep(&log, &log.lock);
+  if(!log.lost){
+    if(!log.mirror){
+      log.seq = applied;
+      log.mirror = 1;
+    }
+    log.remote = remote;
+    r = 0;
+  }
+  release(&log.lock);
+  return r;
+}
+
+// On a standby: apply a transaction its primary sent, n blocks
+// at user address src going to block[], as one of our own.
+// Returns 0, or -1 if it isn't one we can apply.
+int
+log_replay(int n, int *block, uint64 src)
+{
+  struct proc *p = myproc();
+  int tail, r = 0;
+
+  if(n < 0 || n > LOGBLOCKS)
+    return -1;
+  for (tail = 0; tail < n; tail++) {
+    if(block[tail] <= log.start+LOGBLOCKS || block[tail] >= log.size)
+      return -1;
+  }
+
+  // the transaction takes the log to itself, as commit() does
+  acquire(&log.lock);
+  while(log.committing || log.outstanding > 0)
+    sleep(&log, &log.lock);
+  log.committing = 1;
+  release(&log.lock);
+
+  for (tail = 0; tail < n && r == 0; tail++) {
+    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+    if((r = copyin(p->pagetable, (char*)to->data, src + tail*BSIZE, BSIZE)) == 0)
+      bwrite(to);
+    brelse(to);
+  }
+  if(r == 0){
+    log.lh.n = n;
+    for (tail = 0; tail < n; tail++)
+      log.lh.block[tail] = block[tail];
+    write_head();    // the standby's commit
+    install_trans(INSTALL_REPLAY);
+    log.lh.n = 0;
+    write_head();
+    // cached inodes may be stale now
+    for (tail = 0; tail < n; tail++)
+      iinvalidate(log.dev, block[tail]);
+  }
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+  return r;
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
 // commit()/write_log() will do the disk write.
@@ -22,14 +22,20 @@ main()
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
+    netdev_inithart(); // take frames steered to this hart
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    swapinit();      // paging to remote memory
     iinit();         // inode table
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
-    e1000_init();      // initialize E1000 network device
-    net_init();        // initialize network layer (get MAC from E1000)
+    e1000_init();      // initialize E1000 network devices
+    virtio_net_init(); // and the virtio one, if present
+    ivshmem_init();    // and memory shared with a co-located VM
+    crc32c_init();     // CRC32C tables
+    net_init();        // initialize network layer (get MAC from port 0)
+    sockinit();        // UDP sockets
     rdma_init();      // initialize RDMA subsystem
     rdma_net_init();  // initialize RDMA network layer
     userinit();      // first user process
@@ -42,6 +48,7 @@ main()
     printf("hart %d starting\n", cpuid());
     kvminithart();    // turn on paging
     trapinithart();   // install kernel trap vector
+    netdev_inithart(); // take frames steered to this hart
     plicinithart();   // ask PLIC for device interrupts
   }
 
@@ -21,9 +21,16 @@
 #define UART0 0x10000000L
 #define UART0_IRQ 10
 
-// virtio mmio interface
+// virtio mmio interface: the disk, then the network card
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
+#define VIRTIO1 0x10002000
+#define VIRTIO1_IRQ 2
+
+// core local interruptor (CLINT); writing 1 to a hart's MSIP word
+// sends it a machine-mode software interrupt.
+#define CLINT 0x02000000L
+#define CLINT_MSIP(hart) (CLINT + 4*(hart))
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -65,7 +72,16 @@
 // E1000 NIC (on PCI bus)
 // QEMU virt machine: PCIe ECAM is at 0x30000000, size 0x10000000
 // E1000 typically appears at bus 0, device 1, function 0
-// BAR0 (memory mapped registers) will be allocated by firmware/QEMU
+// BAR0 (memory mapped registers) will be allocated by firmware/QEMU;
+// if not, port i gets the 128KB window at E1000_BASE + i*E1000_MMIO_SIZE.
+// PCI INTA..INTD are PLIC IRQs 32..35, swizzled by slot number.
 #define PCIE_ECAM 0x30000000L
 #define E1000_BASE 0x40000000L  // PCI MMIO region base (BAR0, set by QEMU)
-#define E1000_IRQ 33             // PCI interrupt (PLIC IRQ 33 for PCI INTA)
+#define E1000_MMIO_SIZE 0x20000L
+// the ivshmem device's registers (BAR0) and shared memory (BAR2),
+// placed after the e1000s'; BAR2 must be size-aligned.
+#define IVSHMEM_REGS 0x40100000L
+#define IVSHMEM_BASE 0x40200000L
+#define IVSHMEM_SIZE 0x200000L   // size=2M on the qemu command line
+#define PCIE_IRQ 32              // first PCI interrupt line
+#define NPCIE_IRQ 4
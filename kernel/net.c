@@ -12,15 +12,41 @@
 #include "defs.h"
 
 static uint32 local_ip = MAKE_IP_ADDR(10, 0, 2, 15); // qemu's idea of the guest IP
-static uint8 local_mac[ETHADDR_LEN]; // Will be initialized from E1000
+static uint32 gateway_ip = MAKE_IP_ADDR(10, 0, 2, 2); // qemu's slirp router
+static uint32 net_mask = MAKE_IP_ADDR(255, 255, 255, 0);
+static uint8 local_mac[ETHADDR_LEN]; // Will be initialized from port 0
 static uint8 broadcast_mac[ETHADDR_LEN] = { 0xFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF };
-
-// Initialize network layer - must be called after e1000_init()
+static uint8 zero_mac[ETHADDR_LEN];
+
+// the ARP cache maps next-hop IPs to MACs.  an entry is ARP_WAIT
+// while its request is out: IP packets for it queue on it (the
+// newest ARP_PENDING of them) and leave when the reply comes.
+// net_tick() repeats the request, then gives up after ARP_TRIES.
+// a resolved entry is good for ARP_TTL and is then looked up again.
+enum { ARP_FREE, ARP_WAIT, ARP_VALID };
+
+static struct arp_entry {
+  int state;
+  uint32 ip;
+  uint8 mac[ETHADDR_LEN];
+  uint64 expires;   // readtime() when an ARP_VALID entry goes stale
+  int tries;        // requests sent while ARP_WAIT
+  int retry;        // net_tick()s until the next one
+  struct mbufq q;   // IP packets waiting for the MAC
+  int qlen;
+} arp_cache[NARP];
+static struct spinlock arp_lock;
+
+// Initialize network layer - must be called after the NIC drivers' init
 void
 net_init(void)
 {
-  // Get MAC address from E1000 NIC
-  e1000_get_mac(local_mac);
+  initlock(&arp_lock, "arp");
+  for (int i = 0; i < NARP; i++)
+    arp_cache[i].state = ARP_FREE;
+
+  // Get MAC address of the primary link (port 0)
+  netdev_mac(0, local_mac);
   printf("net: initialized with MAC %x:%x:%x:%x:%x:%x\n",
          local_mac[0], local_mac[1], local_mac[2],
          local_mac[3], local_mac[4], local_mac[5]);
@@ -86,6 +112,10 @@ mbufalloc(unsigned int headroom)
   m->next = 0;
   m->head = (char *)m->buf + headroom;
   m->len = 0;
+  m->tstamp = 0;
+  m->dev = 0;
+  m->ext = 0;
+  m->extlen = 0;
   memset(m->buf, 0, sizeof(m->buf));
   return m;
 }
@@ -135,61 +165,251 @@ mbufq_init(struct mbufq *q)
   q->head = 0;
 }
 
-// This code is lifted from FreeBSD's ping.c, and is copyright by the Regents
-// of the University of California.
-static unsigned short
-in_cksum(const unsigned char *addr, int len)
+// the one's-complement sum of len bytes at addr (RFC 1071), added
+// to sum and not yet folded, so that pieces can be summed separately
+// if all but the last are of even length.  a 64-bit accumulator
+// takes 32-bit words, four per iteration, and can't overflow for any
+// packet; 16-bit fields add up the same either way.
+static uint64
+cksum_add(uint64 sum, const unsigned char *addr, int len)
 {
-  int nleft = len;
-  const unsigned short *w = (const unsigned short *)addr;
-  unsigned int sum = 0;
-  unsigned short answer = 0;
-
-  /*
-   * Our algorithm is simple, using a 32 bit accumulator (sum), we add
-   * sequential 16 bit words to it, and at the end, fold back all the
-   * carry bits from the top 16 bits into the lower 16 bits.
-   */
-  while (nleft > 1)  {
-    sum += *w++;
-    nleft -= 2;
-  }
-
-  /* mop up an odd byte, if necessary */
-  if (nleft == 1) {
-    *(unsigned char *)(&answer) = *(const unsigned char *)w;
-    sum += answer;
+  const unsigned char *p = addr;
+
+  if ((uint64)p & 1) {
+    // odd address: no aligned loads, so a 16-bit word at a time
+    for (; len > 1; len -= 2, p += 2)
+      sum += p[0] | (p[1] << 8);
+  } else {
+    if (((uint64)p & 2) && len > 1) {
+      sum += *(const uint16 *)p;
+      p += 2;
+      len -= 2;
+    }
+    for (; len >= 16; len -= 16, p += 16) {
+      const uint32 *w = (const uint32 *)p;
+      sum += (uint64)w[0] + w[1] + w[2] + w[3];
+    }
+    for (; len >= 4; len -= 4, p += 4)
+      sum += *(const uint32 *)p;
+    if (len > 1) {
+      sum += *(const uint16 *)p;
+      p += 2;
+      len -= 2;
+    }
   }
+  // mop up an odd byte, if necessary
+  if (len == 1)
+    sum += *p;
+  return sum;
+}
 
-  /* add back carry outs from top 16 bits to low 16 bits */
+// folds a cksum_add() sum to 16 bits and complements it.
+static unsigned short
+cksum_fold(uint64 sum)
+{
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
   sum = (sum & 0xffff) + (sum >> 16);
-  sum += (sum >> 16);
-  /* guaranteed now that the lower 16 bits of sum are correct */
+  sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum & 0xffff;
+}
+
+static unsigned short
+in_cksum(const unsigned char *addr, int len)
+{
+  return cksum_fold(cksum_add(0, addr, len));
+}
+
+// the UDP checksum of a datagram of len bytes at udphdr, with the
+// pseudo-header from iphdr; addresses are in network byte order.
+static unsigned short
+udp_cksum(uint32 src, uint32 dst, struct udp *udphdr, uint16 len)
+{
+  uint64 sum = 0;
 
-  answer = ~sum; /* truncate to 16 bits */
-  return answer;
+  sum += (uint64)src + dst + htons(IPPROTO_UDP) + htons(len);
+  return cksum_fold(cksum_add(sum, (const unsigned char *)udphdr, len));
 }
 
-// sends an ethernet packet
-static void
-net_tx_eth(struct mbuf *m, uint16 ethtype)
+static int net_tx_arp(uint16 op, uint8 dmac[ETHADDR_LEN], uint32 dip);
+
+static void net_rx_ip(struct mbuf *m, uint8 *src_mac);
+
+// queues an ethernet packet on port 0.  the caller rings the NIC
+// with netdev_kick(), once for a whole batch.  returns 0, or -1 if
+// the packet was dropped.
+static int
+net_tx_eth(struct mbuf *m, uint16 ethtype, uint8 dmac[ETHADDR_LEN])
 {
   struct eth *ethhdr;
 
   ethhdr = mbufpushhdr(m, *ethhdr);
   memmove(ethhdr->shost, local_mac, ETHADDR_LEN);
-  // In a real networking stack, dhost would be set to the address discovered
-  // through ARP. Because we don't support enough of the ARP protocol, set it
-  // to broadcast instead.
-  memmove(ethhdr->dhost, broadcast_mac, ETHADDR_LEN);
+  memmove(ethhdr->dhost, dmac, ETHADDR_LEN);
   ethhdr->type = htons(ethtype);
-  if (e1000_transmit(m)) {
-    mbuffree(m);
+  if (netdev_transmit(m)) {
+    // ring full: starting what is queued may make room
+    netdev_kick();
+    if (netdev_transmit(m)) {
+      mbuffree(m);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// the cache entry for ip, or 0.  caller holds arp_lock.
+static struct arp_entry *
+arp_find(uint32 ip)
+{
+  for (int i = 0; i < NARP; i++)
+    if (arp_cache[i].state != ARP_FREE && arp_cache[i].ip == ip)
+      return &arp_cache[i];
+  return 0;
+}
+
+// a free entry for ip, evicting the resolved entry nearest to
+// expiry if need be; 0 if every entry is waiting for a reply.
+// caller holds arp_lock.
+static struct arp_entry *
+arp_alloc(uint32 ip)
+{
+  struct arp_entry *e = 0;
+
+  for (int i = 0; i < NARP; i++) {
+    struct arp_entry *x = &arp_cache[i];
+    if (x->state == ARP_FREE) {
+      e = x;
+      break;
+    }
+    if (x->state == ARP_VALID && (e == 0 || x->expires < e->expires))
+      e = x;
+  }
+  if (e) {
+    e->ip = ip;
+    e->qlen = 0;
+    mbufq_init(&e->q);
   }
+  return e;
 }
 
-// sends an IP packet
+// sends IP packet m to dip's next hop: at once if its MAC is
+// cached, else once an ARP reply brings it.  packets for our own
+// IP are received instead.
+static int
+net_tx_route(struct mbuf *m, uint32 dip)
+{
+  struct arp_entry *e;
+  uint8 mac[ETHADDR_LEN];
+  uint32 hop;
+  int request = 0;
+
+  if (dip == local_ip) {
+    net_rx_ip(m, local_mac);
+    return 0;
+  }
+  if ((dip & ~net_mask) == ~net_mask) {
+    // limited or subnet broadcast
+    return net_tx_eth(m, ETHTYPE_IP, broadcast_mac);
+  }
+  hop = ((dip ^ local_ip) & net_mask) ? gateway_ip : dip;
+
+  acquire(&arp_lock);
+  e = arp_find(hop);
+  if (e && e->state == ARP_VALID && readtime() < e->expires) {
+    memmove(mac, e->mac, ETHADDR_LEN);
+    release(&arp_lock);
+    return net_tx_eth(m, ETHTYPE_IP, mac);
+  }
+  if (e == 0 || e->state == ARP_VALID) {
+    // unknown, or stale: ask
+    if (e == 0 && (e = arp_alloc(hop)) == 0) {
+      release(&arp_lock);
+      mbuffree(m);
+      return -1;
+    }
+    e->state = ARP_WAIT;
+    e->tries = 1;
+    e->retry = ARP_RETRY;
+    request = 1;
+  }
+  if (e->qlen == ARP_PENDING) {
+    mbuffree(mbufq_pophead(&e->q));
+    e->qlen--;
+  }
+  mbufq_pushtail(&e->q, m);
+  e->qlen++;
+  release(&arp_lock);
+
+  if (request)
+    net_tx_arp(ARP_OP_REQUEST, zero_mac, hop);
+  return 0;
+}
+
+// records that ip is at mac, if ip is in the cache or create is
+// set, and sends the packets that were waiting for it.
 static void
+arp_learn(uint32 ip, uint8 mac[ETHADDR_LEN], int create)
+{
+  struct arp_entry *e;
+  struct mbufq q;
+
+  acquire(&arp_lock);
+  e = arp_find(ip);
+  if (e == 0 && create)
+    e = arp_alloc(ip);
+  if (e == 0) {
+    release(&arp_lock);
+    return;
+  }
+  memmove(e->mac, mac, ETHADDR_LEN);
+  e->state = ARP_VALID;
+  e->expires = readtime() + ARP_TTL;
+  q = e->q;
+  mbufq_init(&e->q);
+  e->qlen = 0;
+  release(&arp_lock);
+
+  if (mbufq_empty(&q))
+    return;
+  while (!mbufq_empty(&q))
+    net_tx_eth(mbufq_pophead(&q), ETHTYPE_IP, mac);
+  netdev_kick();
+}
+
+// called on every clock tick: repeats unanswered ARP requests, and
+// drops the packets waiting on one that has had ARP_TRIES.
+void
+net_tick(void)
+{
+  uint32 ask[NARP];
+  int n = 0;
+
+  acquire(&arp_lock);
+  for (int i = 0; i < NARP; i++) {
+    struct arp_entry *e = &arp_cache[i];
+    if (e->state != ARP_WAIT || --e->retry > 0)
+      continue;
+    if (e->tries == ARP_TRIES) {
+      while (!mbufq_empty(&e->q))
+        mbuffree(mbufq_pophead(&e->q));
+      e->qlen = 0;
+      e->state = ARP_FREE;
+      continue;
+    }
+    e->tries++;
+    e->retry = ARP_RETRY;
+    ask[n++] = e->ip;
+  }
+  release(&arp_lock);
+
+  for (int i = 0; i < n; i++)
+    net_tx_arp(ARP_OP_REQUEST, zero_mac, ask[i]);
+}
+
+// sends an IP packet
+static int
 net_tx_ip(struct mbuf *m, uint8 proto, uint32 dip)
 {
   struct ip *iphdr;
@@ -206,11 +426,12 @@ net_tx_ip(struct mbuf *m, uint8 proto, uint32 dip)
   iphdr->ip_sum = in_cksum((unsigned char *)iphdr, sizeof(*iphdr));
 
   // now on to the ethernet layer
-  net_tx_eth(m, ETHTYPE_IP);
+  return net_tx_route(m, dip);
 }
 
-// sends a UDP packet
-void
+// sends a UDP packet; the caller calls netdev_kick() after the
+// last of a batch.  returns 0, or -1 if it was dropped.
+int
 net_tx_udp(struct mbuf *m, uint32 dip,
            uint16 sport, uint16 dport)
 {
@@ -221,10 +442,51 @@ net_tx_udp(struct mbuf *m, uint32 dip,
   udphdr->sport = htons(sport);
   udphdr->dport = htons(dport);
   udphdr->ulen = htons(m->len);
-  udphdr->sum = 0; // zero means no checksum is provided
+  udphdr->sum = 0;
+  udphdr->sum = udp_cksum(htonl(local_ip), htonl(dip), udphdr, m->len);
+  if (udphdr->sum == 0)
+    udphdr->sum = 0xffff; // zero would mean no checksum
 
   // now on to the IP layer
-  net_tx_ip(m, IPPROTO_UDP, dip);
+  return net_tx_ip(m, IPPROTO_UDP, dip);
+}
+
+// appends IP and UDP headers to m, which holds just an Ethernet
+// header so far, for a datagram built in place after them (as RDMA
+// frames are).  net_udp_fill() sets the lengths and the checksum
+// once the payload is in.
+void
+net_udp_put(struct mbuf *m, uint32 dip, uint16 sport, uint16 dport)
+{
+  struct ip *iphdr;
+  struct udp *udphdr;
+
+  iphdr = mbufputhdr(m, *iphdr);
+  memset(iphdr, 0, sizeof(*iphdr));
+  iphdr->ip_vhl = (4 << 4) | (20 >> 2);
+  iphdr->ip_p = IPPROTO_UDP;
+  iphdr->ip_src = htonl(local_ip);
+  iphdr->ip_dst = htonl(dip);
+  iphdr->ip_ttl = 100;
+
+  udphdr = mbufputhdr(m, *udphdr);
+  udphdr->sport = htons(sport);
+  udphdr->dport = htons(dport);
+  udphdr->ulen = 0;
+  udphdr->sum = 0; // none, as RoCEv2 does; RDMA has its own CRC option
+}
+
+// finishes the headers net_udp_put() left at offset off in m.
+void
+net_udp_fill(struct mbuf *m, unsigned int off)
+{
+  struct ip *iphdr = (struct ip *)(m->head + off);
+  struct udp *udphdr = (struct udp *)(iphdr + 1);
+
+  iphdr->ip_len = htons(m->len - off);
+  iphdr->ip_sum = 0;
+  iphdr->ip_sum = in_cksum((unsigned char *)iphdr, sizeof(*iphdr));
+  udphdr->ulen = htons(m->len - off - sizeof(*iphdr));
 }
 
 // sends an ARP packet
@@ -252,8 +514,11 @@ net_tx_arp(uint16 op, uint8 dmac[ETHADDR_LEN], uint32 dip)
   memmove(arphdr->tha, dmac, ETHADDR_LEN);
   arphdr->tip = htonl(dip);
 
-  // header is ready, send the packet
-  net_tx_eth(m, ETHTYPE_ARP);
+  // header is ready, send the packet: requests to everyone,
+  // replies to the asker
+  if (net_tx_eth(m, ETHTYPE_ARP, op == ARP_OP_REQUEST ? broadcast_mac : dmac) < 0)
+    return -1;
+  netdev_kick();
   return 0;
 }
 
@@ -277,16 +542,19 @@ net_rx_arp(struct mbuf *m)
     goto done;
   }
 
-  // only requests are supported so far
-  // check if our IP was solicited
-  tip = ntohl(arphdr->tip); // target IP address
-  if (ntohs(arphdr->op) != ARP_OP_REQUEST || tip != local_ip)
-    goto done;
-
-  // handle the ARP request
   memmove(smac, arphdr->sha, ETHADDR_LEN); // sender's ethernet address
   sip = ntohl(arphdr->sip); // sender's IP address (qemu's slirp)
-  net_tx_arp(ARP_OP_REPLY, smac, sip);
+  tip = ntohl(arphdr->tip); // target IP address
+
+  // a request or reply tells us where its sender is (RFC 826):
+  // update a cached entry, or add one if it was meant for us.
+  // probes (sender 0) and our own requests teach nothing.
+  if (sip != 0 && sip != local_ip)
+    arp_learn(sip, smac, tip == local_ip);
+
+  // answer requests for our IP
+  if (ntohs(arphdr->op) == ARP_OP_REQUEST && tip == local_ip)
+    net_tx_arp(ARP_OP_REPLY, smac, sip);
 
 done:
   mbuffree(m);
@@ -294,7 +562,7 @@ done:
 
 // receives a UDP packet
 static void
-net_rx_udp(struct mbuf *m, uint16 len, struct ip *iphdr)
+net_rx_udp(struct mbuf *m, uint16 len, struct ip *iphdr, uint8 *src_mac)
 {
   struct udp *udphdr;
   uint32 sip;
@@ -305,14 +573,17 @@ net_rx_udp(struct mbuf *m, uint16 len, struct ip *iphdr)
   if (!udphdr)
     goto fail;
 
-  // TODO: validate UDP checksum
-
   // validate lengths reported in headers
-  if (ntohs(udphdr->ulen) != len)
+  if (ntohs(udphdr->ulen) != len || len < sizeof(*udphdr))
     goto fail;
   len -= sizeof(*udphdr);
   if (len > m->len)
     goto fail;
+
+  // validate the checksum, if the sender gave one
+  if (udphdr->sum != 0 &&
+      udp_cksum(iphdr->ip_src, iphdr->ip_dst, udphdr, len + sizeof(*udphdr)) != 0)
+    goto fail;
   // minimum packet size could be larger than the payload
   mbuftrim(m, m->len - len);
 
@@ -320,6 +591,11 @@ net_rx_udp(struct mbuf *m, uint16 len, struct ip *iphdr)
   sip = ntohl(iphdr->ip_src);
   sport = ntohs(udphdr->sport);
   dport = ntohs(udphdr->dport);
+  if (dport == RDMA_UDP_PORT) {
+    // encapsulated RDMA: m now starts at the RDMA header
+    rdma_net_rx(m, src_mac, sip);
+    return;
+  }
   sockrecvudp(m, sip, dport, sport);
   return;
 
@@ -329,7 +605,7 @@ fail:
 
 // receives an IP packet
 static void
-net_rx_ip(struct mbuf *m)
+net_rx_ip(struct mbuf *m, uint8 *src_mac)
 {
   struct ip *iphdr;
   uint16 len;
@@ -355,14 +631,14 @@ net_rx_ip(struct mbuf *m)
     goto fail;
 
   len = ntohs(iphdr->ip_len) - sizeof(*iphdr);
-  net_rx_udp(m, len, iphdr);
+  net_rx_udp(m, len, iphdr, src_mac);
   return;
 
 fail:
   mbuffree(m);
 }
 
-// called by e1000 driver's interrupt handler to deliver a packet to the
+// called by a NIC driver's interrupt handler to deliver a packet to the
 // networking stack
 void net_rx(struct mbuf *m)
 {
@@ -380,25 +656,13 @@ void net_rx(struct mbuf *m)
   memmove(src_mac, ethhdr->shost, 6);
 
   type = ntohs(ethhdr->type);
-  printf("net_rx: received packet type=0x%x\n", type);
-  
   if (type == ETHTYPE_IP)
-    net_rx_ip(m);
+    net_rx_ip(m, src_mac);
   else if (type == ETHTYPE_ARP)
     net_rx_arp(m);
   else if (type == ETHTYPE_RDMA) {
-    printf("net_rx: routing to rdma_net_rx\n");
-    rdma_net_rx(m, src_mac);
+    rdma_net_rx(m, src_mac, 0);
   }
   else
     mbuffree(m);
 }
-
-// Stub implementation of sockrecvudp - socket support not yet implemented
-void
-sockrecvudp(struct mbuf *m, uint32 sip, uint16 dport, uint16 sport)
-{
-  // TODO: implement socket support for UDP
-  // For now, just free the mbuf
-  mbuffree(m);
-}
@@ -9,9 +9,24 @@ struct mbuf {
   struct mbuf  *next; // the next mbuf in the chain
   char         *head; // the current start position of the buffer
   unsigned int len;   // the length of the buffer
+  uint64       tstamp; // when queued for transmit (rdma_sched.c)
+  int          dev;    // port it arrived on or leaves by (netdev.c)
+  char         *ext;   // the rest of a received frame, left in the
+  unsigned int extlen; // driver's buffer (see rdma_net_split())
   char         buf[MBUF_SIZE]; // the backing store
 };
 
+// a network port, as a driver registers it with netdev.c.
+struct netdev {
+  char *name;
+  int unit;                                 // the driver's own number for it
+  uint8 mac[6];
+  int  (*transmit)(int unit, struct mbuf *m); // -1 if the ring is full
+  void (*kick)(int unit);                   // start queued transmits
+  void (*recv)(int unit);                   // deliver received frames
+  int polled;                               // no interrupts: recv must be polled
+};
+
 char *mbufpull(struct mbuf *m, unsigned int len);
 char *mbufpush(struct mbuf *m, unsigned int len);
 char *mbufput(struct mbuf *m, unsigned int len);
@@ -116,6 +131,26 @@ struct udp {
   uint16 sum;   // checksum
 };
 
+#define RDMA_UDP_PORT 4791 // RDMA over UDP (RoCEv2's port), see rdma_net.c
+
+// UDP sockets (sysnet.c).  a datagram as udp_sendmmsg() and
+// udp_recvmmsg() take it; user/user.h has the same struct.
+struct udp_msg {
+  uint32 addr;  // peer IP, host byte order
+  uint16 port;  // peer port
+  uint16 flags; // UDP_MSG_*, set by udp_recvmmsg()
+  uint32 len;   // send: bytes in buf; receive: room in buf, then bytes
+  uint32 pad;
+  uint64 buf;   // user address
+};
+
+#define UDP_MSG_TRUNC 0x1       // the datagram was longer than buf
+#define UDP_NONBLOCK  0x1       // udp_bind(): udp_recvmmsg() doesn't wait
+#define UDP_DONTWAIT  0x1       // udp_recvmmsg(): don't wait, this once
+#define UDP_MAX_DATA  1472      // largest payload: a 1500-byte IP packet
+#define UDP_MMSG_MAX  64        // datagrams per udp_*mmsg() call
+#define SOCK_RXQ      128       // datagrams a socket holds before dropping
+
 // an ARP packet (comes after an Ethernet header).
 struct arp {
   uint16 hrd; // format of hardware address
@@ -137,6 +172,13 @@ enum {
   ARP_OP_REPLY = 2,   // replies a hw addr given protocol addr
 };
 
+// the ARP cache (net.c)
+#define NARP        16                // entries
+#define ARP_PENDING 8                 // IP packets held per unresolved entry
+#define ARP_TTL     (60 * 10000000UL) // readtime() units an entry is good for: 60 s
+#define ARP_RETRY   10                // clock ticks between requests: 1 s
+#define ARP_TRIES   3                 // requests before giving up
+
 // an DNS packet (comes after an UDP header).
 struct dns {
   uint16 id;  // request ID
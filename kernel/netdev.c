@@ -0,0 +1,298 @@
+//
+// network ports: every NIC the drivers found, numbered in the order
+// they registered (the e1000s, virtio-net, then ivshmem).  mbuf.dev names a
+// port; port 0 is the node's primary link, the one IP uses.  A QP
+// picks its ports with rdma_set_qp_path().
+//
+// drivers hand received frames to netdev_rx(), which steers each
+// flow (an RDMA QP, or a UDP port and its peer) to one hart: the
+// one the flow's process last ran on, or else one picked by hash.
+// frames for another hart wait on its backlog, and an
+// inter-processor interrupt tells it to run them through net_rx().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "rdma.h"
+#include "rdma_net.h"
+
+#define NFLOW 256          // flow buckets steering remembers
+#define NETDEV_BACKLOG 256 // frames waiting per hart; more are dropped
+
+static struct netdev netdevs[NNETDEV];
+static int nnetdev;
+
+// frames steered to each hart, waiting for it to take them.
+static struct backlog {
+  struct spinlock lock;
+  struct mbufq q;
+  int qlen;
+  int busy;       // frames steered here, queued or not, not yet through net_rx()
+  int online;     // the hart is running and takes IPIs
+  uint64 drops;   // frames that found q full
+} backlogs[NCPU];
+
+// the hart each flow bucket last went to.  flowlock makes looking
+// at the old hart's busy count and steering a frame there, which
+// adds to it, one step.
+static struct spinlock flowlock;
+static int flowcpu[NFLOW];
+
+// called by a driver's init for each NIC it finds; nd is copied.
+// returns the port number, or -1 if there are too many.
+int
+netdev_register(struct netdev *nd)
+{
+  if(nnetdev >= NNETDEV)
+    return -1;
+  netdevs[nnetdev] = *nd;
+  printf("netdev: port %d is %s%d (MAC %x:%x:%x:%x:%x:%x)\n",
+         nnetdev, nd->name, nd->unit, nd->mac[0], nd->mac[1], nd->mac[2],
+         nd->mac[3], nd->mac[4], nd->mac[5]);
+  return nnetdev++;
+}
+
+int
+netdev_nports(void)
+{
+  return nnetdev;
+}
+
+// returns 0, or -1 if there is no such port.
+int
+netdev_mac(int port, uint8 mac[6])
+{
+  if(port < 0 || port >= nnetdev)
+    return -1;
+  memmove(mac, netdevs[port].mac, 6);
+  return 0;
+}
+
+// queue m on port m->dev.  the device may not see it until
+// netdev_kick(), so that a batch costs one notification.
+// returns 0 on success, -1 if that port's TX ring is full.
+int
+netdev_transmit(struct mbuf *m)
+{
+  if(m->dev < 0 || m->dev >= nnetdev)
+    return -1;
+  return netdevs[m->dev].transmit(netdevs[m->dev].unit, m);
+}
+
+// tell every port about the frames queued since the last kick.
+void
+netdev_kick(void)
+{
+  for(int i = 0; i < nnetdev; i++)
+    netdevs[i].kick(netdevs[i].unit);
+}
+
+// deliver whatever any port has received; the clock's fallback
+// for lost interrupts.
+void
+netdev_recv(void)
+{
+  for(int i = 0; i < nnetdev; i++)
+    netdevs[i].recv(netdevs[i].unit);
+}
+
+// deliver what the ports without interrupts have received; called
+// whenever a process finds its CQ empty.
+void
+netdev_poll(void)
+{
+  for(int i = 0; i < nnetdev; i++)
+    if(netdevs[i].polled)
+      netdevs[i].recv(netdevs[i].unit);
+}
+
+// called by each hart as it starts, before it takes interrupts.
+void
+netdev_inithart(void)
+{
+  struct backlog *b = &backlogs[cpuid()];
+
+  initlock(&b->lock, "backlog");
+  mbufq_init(&b->q);
+  if(cpuid() == 0){
+    initlock(&flowlock, "flowcpu");
+    memset(flowcpu, -1, sizeof(flowcpu));
+  }
+  __sync_synchronize();
+  b->online = 1;
+}
+
+// finds the flow frame m belongs to: *key names it, and *want is
+// the hart its process last ran on, or -1.  returns -1 for frames
+// that aren't part of a flow (ARP, ICMP, ...).
+static int
+netdev_flow(struct mbuf *m, uint32 *key, int *want)
+{
+  struct eth *eth = (struct eth *)m->head;
+  struct ip *ip = (struct ip *)(eth + 1);
+  struct udp *udp = (struct udp *)(ip + 1);
+  struct rdma_pkt_hdr *hdr;
+
+  if(m->len < sizeof(*eth))
+    return -1;
+  if(ntohs(eth->type) == ETHTYPE_RDMA){
+    hdr = (struct rdma_pkt_hdr *)(eth + 1);
+  } else if(ntohs(eth->type) == ETHTYPE_IP){
+    if(m->len < sizeof(*eth) + sizeof(*ip) + sizeof(*udp) ||
+       ip->ip_vhl != ((4 << 4) | (20 >> 2)) || ip->ip_p != IPPROTO_UDP)
+      return -1;
+    if(ntohs(udp->dport) != RDMA_UDP_PORT){
+      *key = ip->ip_src ^ ((uint32)udp->sport << 16 | udp->dport);
+      *want = sockcpu(ntohs(udp->dport));
+      return 0;
+    }
+    hdr = (struct rdma_pkt_hdr *)(udp + 1);
+  } else {
+    return -1;
+  }
+
+  // raw and UDP frames for one QP are one flow
+  if((char *)(hdr + 1) > m->head + m->len)
+    return -1;
+  *key = ntohs(hdr->dst_qp);
+  *want = rdma_qp_cpu(ntohs(hdr->dst_qp));
+  return 0;
+}
+
+// the hart that should receive m, counted in its busy, or -1 for
+// this one if m is not part of a flow.
+static int
+netdev_steer(struct mbuf *m)
+{
+  uint32 key;
+  int want, old, bucket;
+
+  if(netdev_flow(m, &key, &want) < 0)
+    return -1;
+  key *= 2654435761U;  // Knuth's multiplicative hash
+  bucket = (key >> 16) % NFLOW;
+
+  if(want < 0 || want >= NCPU || !backlogs[want].online){
+    // no process to follow: spread flows over the harts
+    want = (key >> 24) % NCPU;
+    while(!backlogs[want].online)
+      want = (want + 1) % NCPU;
+  }
+
+  // a flow moves only once its old hart has received every frame
+  // steered to it, so that its frames stay in order.
+  acquire(&flowlock);
+  old = flowcpu[bucket];
+  if(old >= 0 && old != want && backlogs[old].busy > 0)
+    want = old;
+  flowcpu[bucket] = want;
+  __sync_fetch_and_add(&backlogs[want].busy, 1);
+  release(&flowlock);
+  return want;
+}
+
+// take every frame steered to this hart.
+static void
+netdev_backlog_run(struct backlog *b)
+{
+  struct mbufq q;
+
+  for(;;){
+    acquire(&b->lock);
+    q = b->q;
+    mbufq_init(&b->q);
+    b->qlen = 0;
+    release(&b->lock);
+    if(mbufq_empty(&q))
+      break;
+    while(!mbufq_empty(&q)){
+      net_rx(mbufq_pophead(&q));
+      __sync_fetch_and_sub(&b->busy, 1);
+    }
+  }
+}
+
+// runs m through net_rx() on this hart if steering keeps it here,
+// and returns -1; else returns the hart it belongs to, whose busy
+// count holds it until it has been received there.
+static int
+netdev_rx_local(struct mbuf *m)
+{
+  int me, cpu;
+
+  push_off();
+  me = cpuid();
+  cpu = netdev_steer(m);
+  if(cpu >= 0 && cpu != me){
+    pop_off();
+    return cpu;
+  }
+  // earlier frames for this hart go first
+  if(backlogs[me].qlen > 0)
+    netdev_backlog_run(&backlogs[me]);
+  pop_off();
+  net_rx(m);
+  if(cpu >= 0)
+    __sync_fetch_and_sub(&backlogs[cpu].busy, 1);
+  return -1;
+}
+
+// called by a driver for each received frame, with none of its
+// locks held: net_rx() may transmit.
+void
+netdev_rx(struct mbuf *m)
+{
+  struct backlog *b;
+  int cpu, wake;
+
+  if((cpu = netdev_rx_local(m)) < 0)
+    return;
+
+  b = &backlogs[cpu];
+  acquire(&b->lock);
+  if(b->qlen >= NETDEV_BACKLOG){
+    b->drops++;
+    release(&b->lock);
+    mbuffree(m);
+    __sync_fetch_and_sub(&b->busy, 1);
+    return;
+  }
+  mbufq_pushtail(&b->q, m);
+  wake = b->qlen++ == 0;
+  release(&b->lock);
+
+  // a hart with frames already queued has an IPI coming
+  if(wake)
+    *(volatile uint32 *)CLINT_MSIP(cpu) = 1;
+}
+
+// like netdev_rx(), for a frame whose payload is still in the
+// driver's buffer (m->ext): it can't wait on another hart's
+// backlog, since the driver wants the buffer back.  returns 0 once
+// m has been received, or -1, leaving m to the caller, if it
+// belongs on another hart.
+int
+netdev_rx_here(struct mbuf *m)
+{
+  int cpu;
+
+  if((cpu = netdev_rx_local(m)) < 0)
+    return 0;
+  // the caller's copy is steered again
+  __sync_fetch_and_sub(&backlogs[cpu].busy, 1);
+  return -1;
+}
+
+// another hart queued frames for this one; called from devintr().
+void
+netdev_rxintr(void)
+{
+  netdev_backlog_run(&backlogs[cpuid()]);
+  // frames may have been ACKs that make room to send
+  rdma_sched_run();
+}
@@ -5,6 +5,7 @@
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define RDISKDEV      2  // device number of the RDMA remote disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
@@ -12,4 +13,6 @@
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define NE1000       4     // maximum number of e1000 NICs
+#define NNETDEV      (NE1000+2)  // network ports: the e1000s, virtio-net, ivshmem
 
@@ -14,7 +14,9 @@ plicinit(void)
   // set desired IRQ priorities non-zero (otherwise disabled).
   *(uint32*)(PLIC + UART0_IRQ*4) = 1;
   *(uint32*)(PLIC + VIRTIO0_IRQ*4) = 1;
-  *(uint32*)(PLIC + E1000_IRQ*4) = 1;  // E1000 interrupt
+  *(uint32*)(PLIC + VIRTIO1_IRQ*4) = 1;
+  for(int irq = PCIE_IRQ; irq < PCIE_IRQ + NPCIE_IRQ; irq++)
+    *(uint32*)(PLIC + irq*4) = 1;  // E1000 and ivshmem interrupts
 }
 
 void
@@ -23,10 +25,11 @@ plicinithart(void)
   int hart = cpuid();
   
   // set enable bits for this hart's S-mode
-  // for the uart and virtio disk.
-  *(uint32*)PLIC_SENABLE(hart) = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
-  // E1000_IRQ is 33, which is in the second enable register (bits 32-63)
-  *(uint32*)(PLIC_SENABLE(hart) + 4) = (1 << (E1000_IRQ - 32));
+  // for the uart, virtio disk and virtio network card.
+  *(uint32*)PLIC_SENABLE(hart) = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ) | (1 << VIRTIO1_IRQ);
+  // the PCI lines are 32-35, in the second enable register (bits 32-63);
+  // an e1000 may sit behind any of them.
+  *(uint32*)(PLIC_SENABLE(hart) + 4) = ((1 << NPCIE_IRQ) - 1) << (PCIE_IRQ - 32);
   
   // set this hart's S-mode priority threshold to 0.
   *(uint32*)PLIC_SPRIORITY(hart) = 0;
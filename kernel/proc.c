@@ -445,6 +445,7 @@ scheduler(void)
         // to release its lock and then reacquire it
         // before jumping back to us.
         p->state = RUNNING;
+        p->cpu = cpuid();
         c->proc = p;
         swtch(&c->context, &p->context);
 
@@ -6,6 +6,7 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "fs.h"
 #include "defs.h"
 #include "rdma.h"
 #include "rdma_net.h"
@@ -36,12 +37,15 @@ struct spinlock qp_lock;
 static void
 rdma_process_work_requests(int qp_id, struct rdma_qp *qp)
 {
+    int more = 0;
+    
     // Process all pending work requests
     while (qp->sq_head != qp->sq_tail) {
         struct rdma_work_request *wr = &qp->sq[qp->sq_head];
+        more = wr->flags & RDMA_WR_MORE;
         
         // Validate source MR
-        struct rdma_mr *src_mr = rdma_mr_get(wr->local_mr_id);
+        struct rdma_mr *src_mr = rdma_mr_get_owner(wr->local_mr_id, qp->owner);
         if (!src_mr) {
             // Post error completion
             struct rdma_completion comp = {
@@ -57,12 +61,38 @@ rdma_process_work_requests(int qp_id, struct rdma_qp *qp)
             goto next_wr;
         }
         
-        // Check operation mode: network vs loopback
-        if (qp->network_mode && qp->state == QP_STATE_RTS) {
+        // Check operation mode: datagram, network or loopback
+        if (qp->type == RDMA_QPT_UD) {
+            // UD: SENDs only, each to the address in the WR, no ACK
+            uint8 status = RDMA_WC_SUCCESS;
+            if (wr->opcode != RDMA_OP_SEND) {
+                status = RDMA_WC_LOC_PROT_ERR;
+            } else if (rdma_net_tx_ud(qp, wr) < 0) {
+                status = RDMA_WC_LOC_LEN_ERR;
+            }
+            
+            if ((wr->flags & RDMA_WR_SIGNALED) || status != RDMA_WC_SUCCESS) {
+                struct rdma_completion comp = {
+                    .wr_id = wr->wr_id,
+                    .byte_len = (status == RDMA_WC_SUCCESS) ? wr->length : 0,
+                    .status = status,
+                    .opcode = wr->opcode,
+                };
+                qp->cq[qp->cq_tail] = comp;
+                qp->cq_tail = (qp->cq_tail + 1) % qp->cq_size;
+                if (status == RDMA_WC_SUCCESS) {
+                    qp->stats_completions++;
+                } else {
+                    qp->stats_errors++;
+                }
+            }
+        } else if (qp->network_mode && qp->state == QP_STATE_RTS) {
             // Network mode: Send RDMA packet
             switch (wr->opcode) {
             case RDMA_OP_WRITE:
-                if (rdma_net_tx_write(qp, wr) < 0) {
+            case RDMA_OP_READ:
+                if ((wr->opcode == RDMA_OP_WRITE ? rdma_net_tx_write(qp, wr)
+                                                 : rdma_net_tx_read(qp, wr)) < 0) {
                     // Post error completion
                     struct rdma_completion comp = {
                         .wr_id = wr->wr_id,
@@ -74,7 +104,7 @@ rdma_process_work_requests(int qp_id, struct rdma_qp *qp)
                     qp->cq_tail = (qp->cq_tail + 1) % qp->cq_size;
                     qp->stats_errors++;
                 }
-                // Note: Completion will be posted when ACK is received
+                // Note: Completion will be posted when ACK (or READ_RESP) is received
                 break;
                 
             default:
@@ -90,7 +120,7 @@ rdma_process_work_requests(int qp_id, struct rdma_qp *qp)
             switch (wr->opcode) {
             case RDMA_OP_WRITE: {
                 // Validate destination MR
-                struct rdma_mr *dst_mr = rdma_mr_get(wr->remote_mr_id);
+                struct rdma_mr *dst_mr = rdma_mr_get_owner(wr->remote_mr_id, qp->owner);
                 if (!dst_mr) {
                     status = RDMA_WC_REM_ACCESS_ERR;
                     break;
@@ -131,14 +161,42 @@ rdma_process_work_requests(int qp_id, struct rdma_qp *qp)
                 
                 // Copy memory directly (destination, source, length)
                 memmove((void *)dst_addr, (void *)src_addr, wr->length);
+                rdma_mr_dirty(dst_mr, offset, wr->length);
                 
                 break;
             }
             
-            case RDMA_OP_READ:
-                // Not yet implemented - return error
-                status = RDMA_WC_LOC_PROT_ERR;
+            case RDMA_OP_READ: {
+                // The WRITE the other way round: remote MR into local
+                if (!(src_mr->hw.access_flags & RDMA_ACCESS_LOCAL_WRITE)) {
+                    status = RDMA_WC_LOC_PROT_ERR;
+                    break;
+                }
+                struct rdma_mr *rsrc_mr = rdma_mr_get_owner(wr->remote_mr_id, qp->owner);
+                if (!rsrc_mr || !(rsrc_mr->hw.access_flags & RDMA_ACCESS_REMOTE_READ)) {
+                    status = RDMA_WC_REM_ACCESS_ERR;
+                    break;
+                }
+                
+                uint64 offset;
+                if (wr->remote_addr >= rsrc_mr->hw.vaddr && 
+                    wr->remote_addr < rsrc_mr->hw.vaddr + rsrc_mr->hw.length) {
+                    offset = wr->remote_addr - rsrc_mr->hw.vaddr;
+                } else if (wr->remote_addr < rsrc_mr->hw.length) {
+                    offset = wr->remote_addr;
+                } else {
+                    status = RDMA_WC_REM_INV_REQ;
+                    break;
+                }
+                if (offset + wr->length > rsrc_mr->hw.length) {
+                    status = RDMA_WC_REM_INV_REQ;
+                    break;
+                }
+                
+                memmove((void *)wr->local_offset, (void *)(rsrc_mr->hw.paddr + offset), wr->length);
+                rdma_mr_dirty(src_mr, wr->local_offset - src_mr->hw.paddr, wr->length);
                 break;
+            }
                 
             case RDMA_OP_SEND:
                 // Not yet implemented - return error
@@ -181,6 +239,12 @@ next_wr:
         qp->sq_head = (qp->sq_head + 1) % qp->sq_size;
         qp->outstanding_ops--;
     }
+    
+    // Send the WRITEs this pass combined, unless the poster has more
+    // for the same frame
+    if (!more) {
+        rdma_net_flush(qp);
+    }
 }
 
 /* ============================================
@@ -199,6 +263,7 @@ rdma_mr_init(void)
         mr_table[i].owner = 0;
         mr_table[i].owner_pid = 0;
         mr_table[i].refcount = 0;
+        mr_table[i].ip = 0;
     }
     
     printf("rdma_mr: initialized %d MR slots\n", MAX_MRS);
@@ -209,7 +274,7 @@ rdma_mr_init(void)
  * This is one of the most important functions! It:
  * 1. Validates the user memory address
  * 2. Translates virtual -> physical address
- * 3. "Pins" the memory (in xv6, memory is already pinned - no swapping)
+ * 3. "Pins" the memory (swap.c leaves pages under an MR alone)
  * 4. Records the registration for future validation
  * 
  * Returns: MR ID (1-based) on success, -1 on error
@@ -245,6 +310,14 @@ rdma_mr_register(uint64 addr, uint64 len, int flags)
         return -1;
     }
 
+    // A page not touched yet, or paged out, is brought in first:
+    // vmfault() can sleep, so not under mr_lock
+    pte_t *pte = walk(p->pagetable, addr, 0);
+    if ((pte == 0 || (*pte & PTE_V) == 0) && vmfault(p->pagetable, addr, 0) == 0) {
+        printf("rdma_mr_register: page not mapped\n");
+        return -1;
+    }
+
     // Find free MR slot
     acquire(&mr_lock);
     
@@ -263,7 +336,7 @@ rdma_mr_register(uint64 addr, uint64 len, int flags)
     }
     
     // Translate virtual to physical address using page table walk
-    pte_t *pte = walk(p->pagetable, addr, 0);
+    pte = walk(p->pagetable, addr, 0);
     if (pte == 0 || (*pte & PTE_V) == 0) {
         release(&mr_lock);
         printf("rdma_mr_register: page not mapped\n");
@@ -289,6 +362,8 @@ rdma_mr_register(uint64 addr, uint64 len, int flags)
     mr->owner = p;
     mr->owner_pid = p->pid;
     mr->refcount = 0;
+    mr->ip = 0;
+    mr->dirty = 0;
     
     release(&mr_lock);
     
@@ -298,6 +373,196 @@ rdma_mr_register(uint64 addr, uint64 len, int flags)
     return mr_id;
 }
 
+/* Register bytes [off, off + len) of a file as an MR
+ * 
+ * xv6 has no page cache to map, so the MR gets a kernel page of its
+ * own, filled from the buffer cache here, while the caller can still
+ * sleep on the disk: remote access arrives in interrupt context and
+ * can't. Peers READ from that page. A WRITE, remote or local, changes
+ * the page and marks the file blocks it touched dirty, and
+ * rdma_mr_sync() or deregistering writes those back through the log.
+ * Writes to the file by other means are not seen by the MR.
+ * 
+ * The range must lie within the file and within one page's worth of
+ * bytes. The MR's vaddr is 0, so peers address it by offset.
+ * 
+ * Returns: MR ID (1-based) on success, -1 on error
+ */
+int
+rdma_mr_register_file(struct inode *ip, uint32 off, uint32 len, int flags)
+{
+    struct proc *p = myproc();
+    struct rdma_mr *mr = 0;
+    int mr_id = -1;
+    
+    if (len == 0 || len > PGSIZE || off + len < off) {
+        printf("rdma_mr_register_file: invalid range (off=%d len=%d)\n", off, len);
+        return -1;
+    }
+    
+    char *page = kalloc();
+    if (!page) {
+        return -1;
+    }
+    
+    // readi() comes up short at the end of the file
+    ilock(ip);
+    int n = readi(ip, 0, (uint64)page, off, len);
+    iunlock(ip);
+    if (n != len) {
+        kfree(page);
+        printf("rdma_mr_register_file: range past the end of the file\n");
+        return -1;
+    }
+    
+    acquire(&mr_lock);
+    
+    for (int i = 0; i < MAX_MRS; i++) {
+        if (!mr_table[i].hw.valid) {
+            mr = &mr_table[i];
+            mr_id = i + 1;
+            break;
+        }
+    }
+    
+    if (!mr) {
+        release(&mr_lock);
+        kfree(page);
+        printf("rdma_mr_register_file: no free MR slots\n");
+        return -1;
+    }
+    
+    mr->hw.id = mr_id;
+    mr->hw.access_flags = flags;
+    mr->hw.vaddr = 0;
+    mr->hw.paddr = (uint64)page;  // kernel memory is mapped one to one
+    mr->hw.length = len;
+    mr->hw.lkey = mr_id;
+    mr->hw.rkey = mr_id;
+    mr->hw.valid = 1;
+    
+    mr->owner = p;
+    mr->owner_pid = p->pid;
+    mr->refcount = 0;
+    mr->ip = idup(ip);
+    mr->file_off = off;
+    mr->dirty = 0;
+    
+    release(&mr_lock);
+    
+    printf("rdma_mr: registered MR %d for PID %d: file off=%d len=%d flags=0x%x\n",
+        mr_id, p->pid, off, len, flags);
+    
+    return mr_id;
+}
+
+/* Register len bytes of kernel memory at addr as an MR of the
+ * kernel's own, for the kernel's QPs (see rdma_qp_set_owner())
+ * 
+ * Like a process's MR it must not cross a page boundary. Kernel
+ * memory is mapped one to one, so addr is the physical address too;
+ * the MR's vaddr is 0 and peers address it by offset. The caller
+ * keeps the memory for as long as the MR lives.
+ * 
+ * Returns: MR ID (1-based) on success, -1 on error
+ */
+int
+rdma_mr_register_kernel(char *addr, uint32 len, int flags)
+{
+    struct rdma_mr *mr = 0;
+    int mr_id = -1;
+    
+    if (addr == 0 || len == 0 ||
+        PGROUNDDOWN((uint64)addr) != PGROUNDDOWN((uint64)addr + len - 1)) {
+        return -1;
+    }
+    
+    acquire(&mr_lock);
+    
+    for (int i = 0; i < MAX_MRS; i++) {
+        if (!mr_table[i].hw.valid) {
+            mr = &mr_table[i];
+            mr_id = i + 1;
+            break;
+        }
+    }
+    
+    if (!mr) {
+        release(&mr_lock);
+        printf("rdma_mr_register_kernel: no free MR slots\n");
+        return -1;
+    }
+    
+    mr->hw.id = mr_id;
+    mr->hw.access_flags = flags;
+    mr->hw.vaddr = 0;
+    mr->hw.paddr = (uint64)addr;
+    mr->hw.length = len;
+    mr->hw.lkey = mr_id;
+    mr->hw.rkey = mr_id;
+    mr->hw.valid = 1;
+    
+    mr->owner = 0;
+    mr->owner_pid = 0;
+    mr->refcount = 0;
+    mr->ip = 0;
+    mr->dirty = 0;
+    
+    release(&mr_lock);
+    
+    return mr_id;
+}
+
+/* Note that bytes [offset, offset + len) of mr have changed
+ * 
+ * For a file-backed MR this marks the file blocks they lie in for
+ * rdma_mr_sync(); for any other MR it does nothing. Called wherever
+ * data lands in an MR, without mr_lock.
+ */
+void
+rdma_mr_dirty(struct rdma_mr *mr, uint64 offset, uint32 len)
+{
+    if (!mr->ip || len == 0) {
+        return;
+    }
+    uint32 base = mr->file_off / BSIZE;
+    uint32 first = (mr->file_off + offset) / BSIZE - base;
+    uint32 last = (mr->file_off + offset + len - 1) / BSIZE - base;
+    __sync_fetch_and_or(&mr->dirty, ((2u << last) - 1) & ~((1u << first) - 1));
+}
+
+/* Write the blocks dirty names from a file-backed MR's page back to
+ * the file, in one log transaction
+ * 
+ * Returns: 0 on success, -1 if a block could not be written
+ */
+static int
+rdma_mr_writeback(struct inode *ip, char *page, uint32 off, uint32 len, uint32 dirty)
+{
+    int r = 0;
+    
+    if (dirty == 0) {
+        return 0;
+    }
+    begin_op();
+    ilock(ip);
+    for (uint32 b = 0; (dirty >> b) != 0; b++) {
+        if (!(dirty & (1u << b))) {
+            continue;
+        }
+        uint32 start = (off / BSIZE + b) * BSIZE;
+        uint32 end = start + BSIZE;
+        if (start < off) start = off;
+        if (end > off + len) end = off + len;
+        if (writei(ip, 0, (uint64)(page + (start - off)), start, end - start) != end - start) {
+            r = -1;
+        }
+    }
+    iunlock(ip);
+    end_op();
+    return r;
+}
+
 /* Deregister a memory region
  * 
  * Safely removes an MR, checking:
@@ -343,40 +608,143 @@ rdma_mr_deregister(int mr_id)
     }
     
     // Clear the MR
+    struct inode *ip = mr->ip;
+    char *page = (char*)mr->hw.paddr;
+    uint32 file_off = mr->file_off;
+    uint32 length = mr->hw.length;
+    uint32 dirty = __sync_fetch_and_and(&mr->dirty, 0);
     mr->hw.valid = 0;
     mr->hw.id = 0;
     mr->owner = 0;
     mr->owner_pid = 0;
+    mr->ip = 0;
     
     release(&mr_lock);
     
+    if (ip) {
+        // Remote access runs under qp_lock: once we have held it, no
+        // WRITE can still be landing in the page
+        acquire(&qp_lock);
+        release(&qp_lock);
+        dirty |= __sync_fetch_and_and(&mr->dirty, 0);
+        rdma_mr_writeback(ip, page, file_off, length, dirty);
+        begin_op();
+        iput(ip);
+        end_op();
+        kfree(page);
+    }
+    
     printf("rdma_mr: deregistered MR %d\n", mr_id);
     
     return 0;
 }
 
+/* Write the file blocks remote WRITEs have changed in a file-backed
+ * MR back to the file
+ * 
+ * WRITEs that land while this runs mark their blocks again, for the
+ * next sync.
+ * 
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_mr_sync(int mr_id)
+{
+    acquire(&mr_lock);
+    struct rdma_mr *mr = rdma_mr_get(mr_id);
+    if (!mr || !mr->ip) {
+        release(&mr_lock);
+        return -1;
+    }
+    mr->refcount++;     // holds off deregistration
+    release(&mr_lock);
+    
+    int r = rdma_mr_writeback(mr->ip, (char*)mr->hw.paddr, mr->file_off, mr->hw.length,
+                              __sync_fetch_and_and(&mr->dirty, 0));
+    
+    acquire(&mr_lock);
+    mr->refcount--;
+    release(&mr_lock);
+    return r;
+}
+
 /* Get MR by ID - returns NULL if invalid or not owned by current process
  * 
  * Note: Caller should hold mr_lock if they need consistent view
  */
 struct rdma_mr*
 rdma_mr_get(int mr_id)
+{
+    return rdma_mr_get_owner(mr_id, myproc());
+}
+
+/* Get MR by ID on behalf of owner, a process or 0 for the kernel -
+ * returns NULL if invalid or owned by anyone else
+ * 
+ * A work request's MRs must belong to its QP's owner, which is the
+ * calling process except on the kernel's own QPs.
+ */
+struct rdma_mr*
+rdma_mr_get_owner(int mr_id, struct proc *owner)
+{
+    if (mr_id < 1 || mr_id > MAX_MRS) {
+        return 0;
+    }
+    
+    struct rdma_mr *mr = &mr_table[mr_id - 1];
+    
+    // Only return if valid and owned by owner
+    if (!mr->hw.valid || mr->owner != owner ||
+        mr->owner_pid != (owner ? owner->pid : 0)) {
+        return 0;
+    }
+    
+    return mr;
+}
+
+/* Get MR by ID on behalf of a remote peer - returns NULL if invalid
+ * or if rkey does not match
+ * 
+ * Incoming packets are handled in interrupt context, where myproc()
+ * is whichever process happens to be running, so ownership cannot be
+ * checked as in rdma_mr_get(). The peer proves access with the rkey.
+ */
+struct rdma_mr*
+rdma_mr_get_remote(int mr_id, uint32 rkey)
 {
     if (mr_id < 1 || mr_id > MAX_MRS) {
         return 0;
     }
     
-    struct proc *p = myproc();
     struct rdma_mr *mr = &mr_table[mr_id - 1];
     
-    // Only return if valid and owned by calling process
-    if (!mr->hw.valid || mr->owner != p || mr->owner_pid != p->pid) {
+    if (!mr->hw.valid || mr->hw.rkey != rkey) {
         return 0;
     }
     
     return mr;
 }
 
+/* Is the physical page at pa under a valid MR?
+ * 
+ * swap.c won't page such a page out: peers and the NIC side of the
+ * stack reach it by physical address, not through the page table.
+ */
+int
+rdma_mr_pinned(uint64 pa)
+{
+    int pinned = 0;
+    
+    acquire(&mr_lock);
+    for (int i = 0; i < MAX_MRS && !pinned; i++) {
+        if (mr_table[i].hw.valid && PGROUNDDOWN(mr_table[i].hw.paddr) == pa) {
+            pinned = 1;
+        }
+    }
+    release(&mr_lock);
+    return pinned;
+}
+
 /* ============================================
  * QUEUE PAIR MANAGEMENT
  * ============================================ */
@@ -401,19 +769,31 @@ rdma_qp_init(void)
     printf("rdma_qp: initialized %d QP slots\n", MAX_QPS);
 }
 
-/* Create a queue pair
+/* Create a reliable connected queue pair */
+int
+rdma_qp_create(uint32 sq_size, uint32 cq_size)
+{
+    return rdma_qp_create_type(sq_size, cq_size, RDMA_QPT_RC, 0);
+}
+
+/* Create a queue pair of the given type (RDMA_QPT_*)
  * 
- * Allocates kernel memory for SQ and CQ, configures hardware
+ * Allocates kernel memory for SQ and CQ, configures hardware.
+ * UD QPs start out ready to send; qkey is their Q_Key.
  * 
  * Returns: QP ID (0-based) on success, -1 on error
  */
 int
-rdma_qp_create(uint32 sq_size, uint32 cq_size)
+rdma_qp_create_type(uint32 sq_size, uint32 cq_size, int type, uint32 qkey)
 {
     struct proc *p = myproc();
     struct rdma_qp *qp = 0;
     int qp_id = -1;
     
+    if (type != RDMA_QPT_RC && type != RDMA_QPT_UD) {
+        return -1;
+    }
+    
     // Validate sizes - must be power of 2 for efficient ring buffer
     if (sq_size == 0 || (sq_size & (sq_size - 1)) != 0 ||
         cq_size == 0 || (cq_size & (cq_size - 1)) != 0) {
@@ -496,11 +876,31 @@ rdma_qp_create(uint32 sq_size, uint32 cq_size)
     for (int i = 0; i < 64; i++) {
         qp->pending_acks[i].valid = 0;
     }
+    qp->wc_m = 0;
+    qp->wc_count = 0;
+    qp->stats_wc_writes = 0;
+    qp->stats_wc_frames = 0;
+    qp->npaths = 0;
+    qp->stats_seg_frames = 0;
+    qp->crc = 0;
+    qp->stats_crc_errors = 0;
+    rdma_sched_qp_init(qp);
+    
+    // Datagram QPs need no connection: ready to send at once
+    qp->type = type;
+    qp->qkey = qkey;
+    qp->rq_head = 0;
+    qp->rq_tail = 0;
+    qp->stats_rx_drops = 0;
+    if (type == RDMA_QPT_UD) {
+        qp->network_mode = 1;
+        qp->state = QP_STATE_RTS;
+    }
     
     release(&qp_lock);
     
-    printf("rdma_qp: created QP %d for PID %d (sq_size=%d cq_size=%d)\n",
-           qp_id, p->pid, sq_size, cq_size);
+    printf("rdma_qp: created %s QP %d for PID %d (sq_size=%d cq_size=%d)\n",
+           type == RDMA_QPT_UD ? "UD" : "RC", qp_id, p->pid, sq_size, cq_size);
     
     return qp_id;
 }
@@ -538,13 +938,21 @@ rdma_qp_destroy(int qp_id)
                qp_id, qp->outstanding_ops);
     }
     
+    // Posted WRITEs still waiting to be combined go out now, if the
+    // TX ring has room; frames still queued after that are dropped
+    rdma_net_flush(qp);
+    rdma_sched_qp_purge(qp);
+    
     // Free memory
     if (qp->sq) kfree((void *)qp->sq);
     if (qp->cq) kfree((void *)qp->cq);
     
     // Print statistics before destroying
-    printf("rdma_qp: destroying QP %d (sends=%d comps=%d errors=%d)\n",
-           qp_id, qp->stats_sends, qp->stats_completions, qp->stats_errors);
+    struct rdma_qp_stats st;
+    rdma_sched_stats(qp, &st);
+    printf("rdma_qp: destroying QP %d (sends=%d comps=%d errors=%d txq_frames=%d txq_delay_max=%dns)\n",
+           qp_id, qp->stats_sends, qp->stats_completions, qp->stats_errors,
+           st.txq_frames, (int)st.txq_delay_max_ns);
     
     // Mark invalid
     qp->valid = 0;
@@ -556,7 +964,7 @@ rdma_qp_destroy(int qp_id)
     return 0;
 }
 
-/* Post a work request to the send queue
+/* Post a work request to the send queue of a QP owner owns
  * 
  * This is where zero-copy happens! We:
  * 1. Validate the MR and QP state
@@ -570,20 +978,18 @@ rdma_qp_destroy(int qp_id)
  * NOTE: 'wr' MUST point to kernel memory. Syscall handlers must
  * use copyin() to copy user WRs into kernel space first.
  */
-int
-rdma_qp_post_send(int qp_id, struct rdma_work_request *wr)
+static int
+rdma_qp_post_send_owner(int qp_id, struct rdma_work_request *wr, struct proc *owner)
 {
     if (qp_id < 0 || qp_id >= MAX_QPS || !wr) {
         printf("rdma_qp_post_send: invalid parameters\n");
         return -1;
     }
     
-    struct proc *p = myproc();
-    
     // This prevents lock ordering issues
     acquire(&mr_lock);
     
-    struct rdma_mr *mr = rdma_mr_get(wr->local_mr_id);
+    struct rdma_mr *mr = rdma_mr_get_owner(wr->local_mr_id, owner);
     if (!mr) {
         release(&mr_lock);
         printf("rdma_qp_post_send: invalid MR ID %d\n", wr->local_mr_id);
@@ -611,7 +1017,7 @@ rdma_qp_post_send(int qp_id, struct rdma_work_request *wr)
     struct rdma_qp *qp = &qp_table[qp_id];
     
     // Check ownership
-    if (!qp->valid || qp->owner != p) {
+    if (!qp->valid || qp->owner != owner) {
         release(&qp_lock);
         // Undo refcount increment
         acquire(&mr_lock);
@@ -669,15 +1075,106 @@ rdma_qp_post_send(int qp_id, struct rdma_work_request *wr)
     return 0;
 }
 
-/* Poll completion queue for completed operations
+/* Post a work request to one of the calling process's QPs */
+int
+rdma_qp_post_send(int qp_id, struct rdma_work_request *wr)
+{
+    return rdma_qp_post_send_owner(qp_id, wr, myproc());
+}
+
+/* Post a work request to one of the kernel's QPs, naming kernel MRs */
+int
+rdma_qp_post_send_kernel(int qp_id, struct rdma_work_request *wr)
+{
+    return rdma_qp_post_send_owner(qp_id, wr, 0);
+}
+
+/* WRITE wr->length bytes of a file, from byte wr->local_offset on,
+ * to the peer's MR
+ * 
+ * The data goes from the buffer cache straight into the frames,
+ * with no copy to user space and no MR: local_mr_id is unused. The
+ * file's own offset is neither used nor moved, as for pread(). The
+ * QP must be a connected RC QP whose peer is on another node, and
+ * the WRITE may take at most RDMA_SEG_MAX frames. It completes as
+ * any WRITE does, when the peer ACKs it.
+ * 
+ * Returns: 0 on success, -1 on error, including a range that runs
+ * past the end of the file and a TX queue with no room for it
+ */
+int
+rdma_qp_sendfile(int qp_id, struct inode *ip, struct rdma_work_request *wr)
+{
+    struct mbuf *segs[RDMA_SEG_MAX];
+    uint32 seg_len, count, n;
+    int ret = -1;
+    
+    if (qp_id < 0 || qp_id >= MAX_QPS || wr->length == 0 ||
+        wr->local_offset + wr->length > 0xFFFFFFFFULL) {
+        return -1;
+    }
+    
+    acquire(&qp_lock);
+    struct rdma_qp *qp = &qp_table[qp_id];
+    if (!qp->valid || qp->owner != myproc() || qp->type != RDMA_QPT_RC ||
+        !qp->network_mode) {
+        release(&qp_lock);
+        return -1;
+    }
+    seg_len = rdma_net_seg_len(qp);
+    release(&qp_lock);
+    
+    count = (wr->length + seg_len - 1) / seg_len;
+    if (count > RDMA_SEG_MAX) {
+        return -1;
+    }
+    
+    // Read the file into the frames, behind room for their headers;
+    // readi() may sleep, so qp_lock can't be held
+    ilock(ip);
+    for (n = 0; n < count; n++) {
+        uint32 off = n * seg_len;
+        uint32 len = wr->length - off < seg_len ? wr->length - off : seg_len;
+        if ((segs[n] = mbufalloc(MBUF_DEFAULT_HEADROOM)) == 0) {
+            break;
+        }
+        if (readi(ip, 0, (uint64)mbufput(segs[n], len), wr->local_offset + off, len) != len) {
+            mbuffree(segs[n]);
+            break;
+        }
+    }
+    iunlock(ip);
+    
+    if (n == count) {
+        acquire(&qp_lock);
+        if (qp->valid && qp->owner == myproc() &&
+            (qp->state == QP_STATE_RTR || qp->state == QP_STATE_RTS)) {
+            ret = rdma_net_tx_prefilled(qp, wr, segs, count);
+        }
+        if (ret == 0) {
+            qp->stats_sends++;
+        }
+        release(&qp_lock);
+    }
+    
+    if (ret < 0) {
+        while (n > 0) {
+            mbuffree(segs[--n]);
+        }
+    }
+    return ret;
+}
+
+/* Poll the completion queue of a QP owner owns
  * 
  * In software loopback mode, this is simplified since work requests
  * are processed synchronously in rdma_qp_post_send.
  * 
  * Returns: number of completions found (0 to max_comps), -1 on error
  */
-int
-rdma_qp_poll_cq(int qp_id, struct rdma_completion *comp_array, int max_comps)
+static int
+rdma_qp_poll_cq_owner(int qp_id, struct rdma_completion *comp_array, int max_comps,
+                      struct proc *owner)
 {
     if (qp_id < 0 || qp_id >= MAX_QPS || !comp_array || max_comps <= 0) {
         printf("rdma_qp_poll_cq: invalid parameters\n");
@@ -689,7 +1186,7 @@ rdma_qp_poll_cq(int qp_id, struct rdma_completion *comp_array, int max_comps)
     struct rdma_qp *qp = &qp_table[qp_id];
     
     // Check ownership
-    if (!qp->valid || qp->owner != myproc()) {
+    if (!qp->valid || qp->owner != owner) {
         release(&qp_lock);
         return -1;
     }
@@ -714,11 +1211,341 @@ rdma_qp_poll_cq(int qp_id, struct rdma_completion *comp_array, int max_comps)
         n++;
     }
     
+    // Nothing to report: the caller is waiting, so stop holding back
+    // combined WRITEs whose ACKs it may be waiting for
+    if (n == 0) {
+        rdma_net_flush(qp);
+        rdma_sched_run();
+    }
+    
     release(&qp_lock);
     
+    // and look at the ports that don't interrupt, for its next poll
+    if (n == 0) {
+        netdev_poll();
+    }
+    
     return n;
 }
 
+/* Poll the CQ of one of the calling process's QPs */
+int
+rdma_qp_poll_cq(int qp_id, struct rdma_completion *comp_array, int max_comps)
+{
+    return rdma_qp_poll_cq_owner(qp_id, comp_array, max_comps, myproc());
+}
+
+/* Poll the CQ of one of the kernel's QPs */
+int
+rdma_qp_poll_cq_kernel(int qp_id, struct rdma_completion *comp_array, int max_comps)
+{
+    return rdma_qp_poll_cq_owner(qp_id, comp_array, max_comps, 0);
+}
+
+/* Post a receive buffer to a UD queue pair
+ * 
+ * The next datagram addressed to the QP lands in the buffer, after a
+ * struct rdma_ud_grh naming its sender.
+ * 
+ * Returns: 0 on success, -1 on error
+ * 
+ * NOTE: 'rr' MUST point to kernel memory.
+ */
+int
+rdma_qp_post_recv(int qp_id, struct rdma_recv_request *rr)
+{
+    if (qp_id < 0 || qp_id >= MAX_QPS || !rr) {
+        return -1;
+    }
+    
+    struct proc *p = myproc();
+    
+    acquire(&mr_lock);
+    
+    struct rdma_mr *mr = rdma_mr_get(rr->mr_id);
+    if (!mr || !(mr->hw.access_flags & RDMA_ACCESS_LOCAL_WRITE) ||
+        rr->length < sizeof(struct rdma_ud_grh) ||
+        rr->offset + rr->length > mr->hw.length) {
+        release(&mr_lock);
+        printf("rdma_qp_post_recv: bad receive buffer (MR %d)\n", rr->mr_id);
+        return -1;
+    }
+    
+    release(&mr_lock);
+    
+    acquire(&qp_lock);
+    
+    struct rdma_qp *qp = &qp_table[qp_id];
+    
+    if (!qp->valid || qp->owner != p || qp->type != RDMA_QPT_UD) {
+        release(&qp_lock);
+        printf("rdma_qp_post_recv: QP %d is not a UD QP owned by PID %d\n", qp_id, p->pid);
+        return -1;
+    }
+    
+    // Check if receive queue is full
+    uint32 next_tail = (qp->rq_tail + 1) % RDMA_RQ_SIZE;
+    if (next_tail == qp->rq_head) {
+        release(&qp_lock);
+        return -1;
+    }
+    
+    qp->rq[qp->rq_tail].wr_id = rr->wr_id;
+    qp->rq[qp->rq_tail].mr_id = rr->mr_id;
+    qp->rq[qp->rq_tail].offset = rr->offset;
+    qp->rq[qp->rq_tail].length = rr->length;
+    qp->rq_tail = next_tail;
+    
+    release(&qp_lock);
+    
+    return 0;
+}
+
+/* Set a QP's transmit scheduling class
+ * 
+ * prio != 0 puts the QP in the strict-priority class, ahead of every
+ * other QP; otherwise it shares the link with the rest in proportion
+ * to weight (see rdma_sched.c).
+ * 
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_qp_set_sched(int qp_id, uint32 weight, uint32 prio)
+{
+    if (qp_id < 0 || qp_id >= MAX_QPS ||
+        weight < 1 || weight > RDMA_SCHED_MAX_WEIGHT) {
+        return -1;
+    }
+    
+    acquire(&qp_lock);
+    
+    struct rdma_qp *qp = &qp_table[qp_id];
+    
+    if (!qp->valid || qp->owner != myproc()) {
+        release(&qp_lock);
+        return -1;
+    }
+    
+    rdma_sched_set(qp, weight, prio ? 1 : 0);
+    
+    release(&qp_lock);
+    
+    return 0;
+}
+
+/* Report a QP's statistics
+ * 
+ * Returns: 0 on success, -1 on error
+ * 
+ * NOTE: 'st' MUST point to kernel memory.
+ */
+int
+rdma_qp_query(int qp_id, struct rdma_qp_stats *st)
+{
+    if (qp_id < 0 || qp_id >= MAX_QPS || !st) {
+        return -1;
+    }
+    
+    acquire(&qp_lock);
+    
+    struct rdma_qp *qp = &qp_table[qp_id];
+    
+    if (!qp->valid || qp->owner != myproc()) {
+        release(&qp_lock);
+        return -1;
+    }
+    
+    memset(st, 0, sizeof(*st));
+    st->sends = qp->stats_sends;
+    st->completions = qp->stats_completions;
+    st->errors = qp->stats_errors;
+    st->rx_drops = qp->stats_rx_drops;
+    st->wc_writes = qp->stats_wc_writes;
+    st->wc_frames = qp->stats_wc_frames;
+    st->seg_frames = qp->stats_seg_frames;
+    st->crc_errors = qp->stats_crc_errors;
+    rdma_sched_stats(qp, st);
+    
+    release(&qp_lock);
+    
+    return 0;
+}
+
+/* Set one of a connected QP's paths: frames on it leave by network
+ * port 'port' for the peer's MAC 'mac'
+ * 
+ * Paths are numbered from 0, which rdma_qp_connect() set up and
+ * which this can move; a new path must come right after the last.
+ * With more than one path, WRITEs are striped across them (see
+ * rdma_net_tx_seg). The peer's QP needs no paths of its own: it
+ * ACKs each WRITE out of the port the WRITE came in on.
+ * 
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_qp_set_path(int qp_id, uint32 path, uint32 port, uint8 mac[6])
+{
+    if (qp_id < 0 || qp_id >= MAX_QPS || !mac ||
+        path >= RDMA_MAX_PATHS || port >= netdev_nports()) {
+        return -1;
+    }
+    
+    acquire(&qp_lock);
+    
+    struct rdma_qp *qp = &qp_table[qp_id];
+    
+    if (!qp->valid || qp->owner != myproc() ||
+        qp->type != RDMA_QPT_RC || !qp->connected || path > qp->npaths) {
+        release(&qp_lock);
+        return -1;
+    }
+    
+    // Frames already combined go out the old way
+    rdma_net_flush(qp);
+    
+    qp->paths[path].port = port;
+    memmove(qp->paths[path].mac, mac, 6);
+    qp->paths[path].ip = 0;
+    qp->paths[path].udp_port = 0;
+    if (path == 0) {
+        memmove(qp->remote_mac, mac, 6);
+    }
+    if (path == qp->npaths) {
+        qp->npaths++;
+    }
+    qp->next_path = 0;
+    
+    release(&qp_lock);
+    
+    printf("rdma_qp_set_path: QP %d path %d via port %d (MAC: %x:%x:%x:%x:%x:%x)\n",
+           qp_id, path, port, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    
+    return 0;
+}
+
+/* Carry a connected QP's path 'path' in UDP to ip:udp_port, or
+ * (ip 0) go back to raw Ethernet frames
+ * 
+ * The path's MAC is then the next hop's: the peer on a flat link,
+ * or e.g. the gateway under QEMU's user networking. udp_port 0 means
+ * RDMA_UDP_PORT. The peer ACKs by UDP too, to the port its own
+ * matching path names (RDMA_UDP_PORT if none), so both ends should
+ * set one.
+ * 
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_qp_set_udp(int qp_id, uint32 path, uint32 ip, uint32 udp_port)
+{
+    if (qp_id < 0 || qp_id >= MAX_QPS || path >= RDMA_MAX_PATHS || udp_port > 0xFFFF) {
+        return -1;
+    }
+    
+    acquire(&qp_lock);
+    
+    struct rdma_qp *qp = &qp_table[qp_id];
+    
+    if (!qp->valid || qp->owner != myproc() ||
+        qp->type != RDMA_QPT_RC || !qp->connected || path >= qp->npaths) {
+        release(&qp_lock);
+        return -1;
+    }
+    
+    // Frames already combined go out the old way
+    rdma_net_flush(qp);
+    
+    qp->paths[path].ip = ip;
+    udp_port = ip ? (udp_port ? udp_port : RDMA_UDP_PORT) : 0;
+    qp->paths[path].udp_port = udp_port;
+    
+    release(&qp_lock);
+    
+    printf("rdma_qp_set_udp: QP %d path %d to %d.%d.%d.%d:%d\n", qp_id, path,
+           ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF, udp_port);
+    
+    return 0;
+}
+
+/* Have a connected QP's WRITE frames carry a CRC32C of their
+ * payload, or stop
+ * 
+ * The receiver checks any frame that has one, whether or not its
+ * own QP sends them, and drops it if it doesn't match.
+ * 
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_qp_set_crc(int qp_id, int on)
+{
+    if (qp_id < 0 || qp_id >= MAX_QPS) {
+        return -1;
+    }
+    
+    acquire(&qp_lock);
+    
+    struct rdma_qp *qp = &qp_table[qp_id];
+    
+    if (!qp->valid || qp->owner != myproc() || qp->type != RDMA_QPT_RC) {
+        release(&qp_lock);
+        return -1;
+    }
+    
+    // Frames already combined go out the old way
+    rdma_net_flush(qp);
+    qp->crc = on != 0;
+    
+    release(&qp_lock);
+    
+    return 0;
+}
+
+/* Hand a connected RC QP from owner from to owner to, either a
+ * process or 0 for the kernel
+ * 
+ * A kernel client lets a process make the connection, through the
+ * CM, then takes the QP over; from then on only the kernel can post
+ * to it or poll it, and only with kernel MRs.
+ * 
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_qp_set_owner(int qp_id, struct proc *from, struct proc *to)
+{
+    if (qp_id < 0 || qp_id >= MAX_QPS) {
+        return -1;
+    }
+    
+    acquire(&qp_lock);
+    struct rdma_qp *qp = &qp_table[qp_id];
+    if (!qp->valid || qp->owner != from || qp->type != RDMA_QPT_RC ||
+        !qp->network_mode) {
+        release(&qp_lock);
+        return -1;
+    }
+    qp->owner = to;
+    release(&qp_lock);
+    
+    return 0;
+}
+
+/* The CPU the QP's owner last ran on, or -1
+ * 
+ * Receive steering (netdev_rx()) calls this for every frame, so it
+ * takes no lock: the answer is only a hint, and a QP destroyed
+ * meanwhile just steers one frame to a stale CPU.
+ */
+int
+rdma_qp_cpu(int qp_id)
+{
+    if (qp_id < 0 || qp_id >= MAX_QPS || !qp_table[qp_id].valid) {
+        return -1;
+    }
+    
+    struct proc *owner = qp_table[qp_id].owner;
+    
+    return owner ? owner->cpu : -1;
+}
+
 /* Connect QP to remote peer (for network RDMA)
  * 
  * Sets up connection parameters for two-host RDMA
@@ -742,6 +1569,13 @@ rdma_qp_connect(int qp_id, uint8 mac[6], uint32 remote_qp)
         return -1;
     }
     
+    // Datagram QPs address each SEND instead
+    if (qp->type != RDMA_QPT_RC) {
+        release(&qp_lock);
+        printf("rdma_qp_connect: QP %d is not a connected QP\n", qp_id);
+        return -1;
+    }
+    
     // QP must be in INIT state
     if (qp->state != QP_STATE_INIT) {
         release(&qp_lock);
@@ -749,6 +1583,29 @@ rdma_qp_connect(int qp_id, uint8 mac[6], uint32 remote_qp)
         return -1;
     }
     
+    // Transition to RTR (Ready To Receive) then immediately to RTS (Ready To Send)
+    // In a real RDMA implementation, RTR→RTS would be a separate step,
+    // but for our simple implementation we can do it immediately
+    rdma_qp_connect_locked(qp, mac, remote_qp, QP_STATE_RTS);
+    
+    release(&qp_lock);
+    
+    printf("rdma_qp_connect: QP %d connected to remote QP %d (MAC: %x:%x:%x:%x:%x:%x)\n",
+           qp_id, remote_qp, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    
+    return 0;
+}
+
+/* Point a QP at its remote peer and move it to 'state'
+ * 
+ * Shared by rdma_qp_connect() and the connection manager, which
+ * connects a listener's QPs from interrupt context on its behalf.
+ * Caller holds qp_lock and has checked the QP is valid and in INIT.
+ */
+void
+rdma_qp_connect_locked(struct rdma_qp *qp, uint8 mac[6], uint32 remote_qp,
+                       enum rdma_qp_state state)
+{
     // Store remote connection information
     memmove(qp->remote_mac, mac, 6);
     qp->remote_qp_num = remote_qp;
@@ -759,17 +1616,20 @@ rdma_qp_connect(int qp_id, uint8 mac[6], uint32 remote_qp)
     qp->tx_seq_num = 1;
     qp->rx_expected_seq = 1;
     
-    // Transition to RTR (Ready To Receive) then immediately to RTS (Ready To Send)
-    // In a real RDMA implementation, RTR→RTS would be a separate step,
-    // but for our simple implementation we can do it immediately
-    qp->state = QP_STATE_RTS;
-    
-    release(&qp_lock);
-    
-    printf("rdma_qp_connect: QP %d connected to remote QP %d (MAC: %x:%x:%x:%x:%x:%x)\n",
-           qp_id, remote_qp, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    // One path, through port 0
+    qp->paths[0].port = 0;
+    memmove(qp->paths[0].mac, mac, 6);
+    qp->paths[0].ip = 0;
+    qp->paths[0].udp_port = 0;
+    qp->npaths = 1;
+    qp->next_path = 0;
+    qp->tx_msg = 0;
+    qp->rx_msg = 0;
+    for (int i = 0; i < RDMA_SEG_SLOTS; i++) {
+        qp->rx_seg[i].valid = 0;
+    }
     
-    return 0;
+    qp->state = state;
 }
 
 /* ============================================
@@ -791,6 +1651,9 @@ rdma_init(void)
     
     rdma_mr_init();
     rdma_qp_init();
+    rdma_cm_init();
+    rdma_sched_init();
+    rdma_disk_init();
     
     printf("rdma: initialization complete\n");
     
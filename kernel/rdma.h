@@ -6,11 +6,14 @@
 #include "types.h"
 #include "spinlock.h"
 
+struct inode;
+struct proc;
+
 /* ============================================
  * CONSTANTS AND CONFIGURATION
  * ============================================ */
 
-#define MAX_MRS 64              // Maximum memory regions system-wide
+#define MAX_MRS 256             // Maximum memory regions system-wide
 #define MAX_QPS 16              // Maximum queue pairs system-wide
 #define DEFAULT_SQ_SIZE 64      // Default send queue size
 #define DEFAULT_CQ_SIZE 64      // Default completion queue size
@@ -49,6 +52,12 @@ struct rdma_mr {
     struct proc *owner;          // Process that owns this MR (for fast access)
     int owner_pid;               // PID at registration time (for safe validation)
     int refcount;                // Reference count for in-flight operations
+    
+    /* File-backed MRs (rdma_mr_register_file): hw.paddr is a kernel
+     * page holding a copy of the file range */
+    struct inode *ip;            // The file, or 0 for process memory
+    uint32 file_off;             // File offset of the MR's first byte
+    uint32 dirty;                // Changed file blocks, bit 0 = the first
 };
 
 /* Global MR table and lock */
@@ -58,8 +67,15 @@ extern struct spinlock mr_lock;
 /* MR management functions */
 void rdma_mr_init(void);
 int rdma_mr_register(uint64 addr, uint64 len, int flags);
+int rdma_mr_register_file(struct inode *ip, uint32 off, uint32 len, int flags);
 int rdma_mr_deregister(int mr_id);
+int rdma_mr_sync(int mr_id);
+void rdma_mr_dirty(struct rdma_mr *mr, uint64 offset, uint32 len);
+int rdma_mr_register_kernel(char *addr, uint32 len, int flags);
 struct rdma_mr* rdma_mr_get(int mr_id);
+struct rdma_mr* rdma_mr_get_owner(int mr_id, struct proc *owner);
+struct rdma_mr* rdma_mr_get_remote(int mr_id, uint32 rkey);
+int rdma_mr_pinned(uint64 pa);
 
 /* ============================================
  * QUEUE PAIR (QP) MANAGEMENT
@@ -70,9 +86,93 @@ struct rdma_mr* rdma_mr_get(int mr_id);
 #define RDMA_OP_READ       0x02  // Read remote memory to local
 #define RDMA_OP_SEND       0x03  // Send message
 #define RDMA_OP_READ_RESP  0x04  // Response to READ request
+#define RDMA_OP_RECV       0x05  // Completion of a posted receive (UD)
+
+/* QP types */
+#define RDMA_QPT_RC        0     // Reliable connected: one peer, ACKed
+#define RDMA_QPT_UD        1     // Unreliable datagram: any peer, no ACKs
+
+/* Unreliable datagram (UD) QPs
+ * 
+ * A UD QP is never connected. Each SEND names its destination (the
+ * address handle) in fields an RC WRITE uses for the remote MR:
+ *   remote_addr   destination MAC, mac[0] in bits 47..40
+ *   remote_mr_id  destination QP
+ *   remote_key    destination Q_Key; datagrams whose Q_Key does not
+ *                 match the receiving QP's are dropped
+ * A datagram fills the receiving QP's oldest posted receive: the
+ * buffer starts with a struct rdma_ud_grh naming the sender, then the
+ * payload. With no receive posted, the datagram is dropped. Signaled
+ * SENDs complete once the frame is handed to the NIC.
+ */
+#define RDMA_RQ_SIZE       64    // Posted receives per UD QP
+#define RDMA_UD_MTU        1464  // Largest UD SEND (one Ethernet frame)
+
+/* Sender address, at the start of every UD receive buffer */
+struct rdma_ud_grh {
+    uint8 smac[6];               // Sender's MAC
+    uint16 src_qp;               // Sender's QP
+} __attribute__((packed));
+
+/* Receive Request - a buffer for one incoming UD datagram */
+struct rdma_recv_request {
+    uint64 wr_id;                // Returned in the RDMA_OP_RECV completion
+    uint32 mr_id;                // MR holding the buffer (LOCAL_WRITE)
+    uint32 length;               // Buffer size, including the GRH
+    uint64 offset;               // Offset of the buffer within the MR
+} __attribute__((packed));
+
+static inline void
+rdma_ud_mac(uint64 remote_addr, uint8 mac[6])
+{
+    for (int i = 0; i < 6; i++) {
+        mac[i] = remote_addr >> (8 * (5 - i));
+    }
+}
 
 /* Work Request flags */
 #define RDMA_WR_SIGNALED   (1 << 0)  // Generate completion entry when done
+#define RDMA_WR_MORE       (1 << 1)  // More WRs follow: a small WRITE may wait to share their frame
+
+/* Multipath
+ * 
+ * A connected QP reaches its peer by one or more paths, each a local
+ * network port (netdev.c) plus the peer MAC behind it. rdma_qp_connect() sets
+ * path 0 (port 0); rdma_qp_set_path() adds more. WRITEs too big for
+ * one frame, and every WRITE on a QP with more than one path, travel
+ * as WRITE_SEG frames dealt round robin across the paths. The
+ * receiver reassembles them and completes the WRITEs in the order
+ * they were posted, whatever order the paths delivered them in.
+ * 
+ * A path may carry its frames inside UDP/IP instead of raw Ethernet
+ * (RoCEv2 style, see rdma_qp_set_udp), so that they can cross
+ * anything that passes IP.
+ */
+#define RDMA_MAX_PATHS     4
+#define RDMA_SEG_SLOTS     8     // WRITEs a QP can be reassembling at once
+#define RDMA_SEG_MAX       64    // segments per WRITE (RDMA_TXQ_MAX)
+#define RDMA_SEG_TIMEOUT   10000000  // time CSR units (1s) before a partial WRITE is given up
+
+struct rdma_path {
+    int port;                    // netdev port frames leave by
+    uint8 mac[6];                // peer MAC reached through it (or next hop)
+    uint32 ip;                   // 0: raw frames; else UDP to ip
+    uint16 udp_port;             //   and this port
+};
+
+/* A segmented WRITE being reassembled */
+struct rdma_seg_rx {
+    int valid;
+    uint32 msg;                  // sender's segmented-WRITE number
+    uint32 seq;                  // sequence number to ACK
+    uint32 count;                // segments in all
+    uint64 got;                  // bitmap of segments placed
+    uint64 start;                // readtime() of its first segment
+    uint32 length;               // total bytes
+    int failed;                  // a segment was refused
+    uint16 src_qp;               // where the ACK goes: QP,
+    struct rdma_path from;       //   and the way the last segment came
+};
 
 /* QP State Machine - tracks queue pair lifecycle */
 enum rdma_qp_state {
@@ -133,6 +233,8 @@ struct rdma_qp {
     
     struct proc *owner;                  // Owning process
     int valid;                           // 1 = active, 0 = free
+    int type;                            // RDMA_QPT_*
+    uint32 qkey;                         // UD: Q_Key datagrams must carry
     
     /* State management and flow control */
     enum rdma_qp_state state;            // QP state machine
@@ -146,19 +248,87 @@ struct rdma_qp {
     uint32 tx_seq_num;                   // Next TX sequence number
     uint32 rx_expected_seq;              // Expected RX sequence number
     
-    /* Pending ACKs (for matching completions) */
+    /* Multipath (rdma_net.c); paths[0].mac is remote_mac */
+    struct rdma_path paths[RDMA_MAX_PATHS];
+    uint32 npaths;
+    uint32 next_path;                    // path the next segment takes
+    uint32 tx_msg;                       // next segmented WRITE's number
+    uint32 rx_msg;                       // next one to complete
+    struct rdma_seg_rx rx_seg[RDMA_SEG_SLOTS];  // indexed by msg
+    
+    /* Write combining: small WRITEs queued into one frame (rdma_net.c) */
+    struct mbuf *wc_m;                   // Frame being filled, or 0
+    uint32 wc_count;                     // WRITEs in it
+    
+    int crc;                             // append a CRC32C to WRITE frames
+    
+    /* Transmit scheduling (rdma_sched.c): under sched_lock, not qp_lock */
+    struct mbuf *txq_head;               // Frames waiting for the NIC
+    struct mbuf *txq_tail;
+    uint32 txq_len;
+    uint32 tx_weight;                    // DRR share, 1..RDMA_SCHED_MAX_WEIGHT
+    uint32 tx_prio;                      // 1 = strict-priority class
+    uint32 tx_deficit;                   // DRR byte credit
+    
+    /* Pending ACKs (for matching completions), and READs waiting
+     * for their response, signaled or not */
     struct {
         uint32 seq_num;
         uint64 wr_id;
         int valid;
+        uint8 opcode;                    // RDMA_OP_WRITE or RDMA_OP_READ
+        uint8 signaled;                  // READ: complete it
+        uint32 mr_id;                    // READ: where the data goes,
+        uint64 offset;                   //   rechecked on arrival
+        uint32 length;
     } pending_acks[64];
     
+    /* Receive Queue (UD only) - buffers for incoming datagrams */
+    struct {
+        uint64 wr_id;
+        uint32 mr_id;                    // Rechecked on arrival: the MR
+        uint64 offset;                   // may be gone by then
+        uint32 length;
+    } rq[RDMA_RQ_SIZE];
+    uint32 rq_head;                      // Next receive to fill
+    uint32 rq_tail;                      // Next free slot
+    
     /* Statistics and debugging (useful for evaluation phase) */
     uint32 stats_sends;                  // Total send operations posted
     uint32 stats_completions;            // Total completions received
     uint32 stats_errors;                 // Total errors encountered
+    uint32 stats_rx_drops;               // UD datagrams dropped on receive
+    uint32 stats_wc_writes;              // WRITEs sent in combined frames
+    uint32 stats_wc_frames;              // Combined frames sent
+    uint32 stats_seg_frames;             // WRITE_SEG frames sent
+    uint32 stats_txq_frames;             // Frames the scheduler sent
+    uint32 stats_txq_drops;              // Frames refused, queue full
+    uint64 stats_txq_delay;              // Sum of their queueing delays (time CSR units)
+    uint64 stats_txq_delay_max;          // Longest one
+    uint32 stats_crc_errors;             // Frames dropped for a bad CRC32C
+};
+
+/* Per-QP statistics, as returned by rdma_qp_query() */
+struct rdma_qp_stats {
+    uint32 sends;                        // WRs posted
+    uint32 completions;
+    uint32 errors;
+    uint32 rx_drops;                     // UD datagrams dropped
+    uint32 wc_writes;                    // WRITEs sent combined
+    uint32 wc_frames;                    // Combined frames sent
+    uint32 txq_len;                      // Frames waiting to transmit now
+    uint32 txq_frames;                   // Frames transmitted
+    uint32 txq_drops;                    // Frames refused, queue full
+    uint32 seg_frames;                   // WRITE segments sent
+    uint64 txq_delay_ns;                 // Total time frames spent queued
+    uint64 txq_delay_max_ns;             // Longest time one spent queued
+    uint32 crc_errors;                   // Frames received with a bad CRC32C
 };
 
+/* Transmit scheduling limits */
+#define RDMA_TXQ_MAX            64      // Frames queued per QP
+#define RDMA_SCHED_MAX_WEIGHT   64
+
 /* Global QP table and lock */
 extern struct rdma_qp qp_table[MAX_QPS];
 extern struct spinlock qp_lock;
@@ -166,12 +336,121 @@ extern struct spinlock qp_lock;
 /* QP management functions */
 void rdma_qp_init(void);
 int rdma_qp_create(uint32 sq_size, uint32 cq_size);
+int rdma_qp_create_type(uint32 sq_size, uint32 cq_size, int type, uint32 qkey);
 int rdma_qp_destroy(int qp_id);
 int rdma_qp_post_send(int qp_id, struct rdma_work_request *wr);
 int rdma_qp_poll_cq(int qp_id, struct rdma_completion *comp, int max_comps);
+int rdma_qp_post_send_kernel(int qp_id, struct rdma_work_request *wr);
+int rdma_qp_poll_cq_kernel(int qp_id, struct rdma_completion *comp, int max_comps);
+int rdma_qp_set_owner(int qp_id, struct proc *from, struct proc *to);
+int rdma_qp_post_recv(int qp_id, struct rdma_recv_request *rr);
+int rdma_qp_set_sched(int qp_id, uint32 weight, uint32 prio);
+int rdma_qp_query(int qp_id, struct rdma_qp_stats *st);
+int rdma_qp_set_path(int qp_id, uint32 path, uint32 port, uint8 mac[6]);
+int rdma_qp_set_udp(int qp_id, uint32 path, uint32 ip, uint32 udp_port);
+int rdma_qp_set_crc(int qp_id, int on);
+int rdma_qp_sendfile(int qp_id, struct inode *ip, struct rdma_work_request *wr);
 
 /* QP connection management (for network RDMA) */
 int rdma_qp_connect(int qp_id, uint8 mac[6], uint32 remote_qp);
+void rdma_qp_connect_locked(struct rdma_qp *qp, uint8 mac[6], uint32 remote_qp,
+                            enum rdma_qp_state state);
+
+/* ============================================
+ * CONNECTION MANAGER (CM)
+ * ============================================ */
+
+/* The CM resolves a service ID to a set of remote QPs and swaps MR
+ * descriptors, in one REQ/REP/RTU exchange on ETHTYPE_RDMA (see
+ * rdma_cm.c).  A listener offers a pool of INIT-state QPs; each REQ
+ * claims as many of them as it brings QPs of its own.
+ */
+#define RDMA_CM_MAX_QPS   MAX_QPS   // QPs connected per REQ
+#define RDMA_CM_MAX_MRS   8         // MR descriptors advertised per side
+
+/* MR descriptor: what a peer needs to target one of our MRs */
+struct rdma_cm_mr {
+    uint32 mr_id;                // remote_mr_id for work requests
+    uint32 rkey;                 // remote_key for work requests
+    uint64 addr;                 // MR start (valid remote_addr base)
+    uint64 length;               // MR size in bytes
+} __attribute__((packed));
+
+/* Result of a connect or accept (also the connect request) */
+struct rdma_cm_info {
+    uint8 mac[6];                // peer MAC (connect: ff:ff:.. = broadcast)
+    uint16 nqp;                  // number of QP pairs
+    uint32 service_id;           // service being connected to
+    uint32 nmr;                  // number of peer MR descriptors
+    uint32 qp[RDMA_CM_MAX_QPS];          // local QPs
+    uint32 remote_qp[RDMA_CM_MAX_QPS];   // peer QP paired with qp[i]
+    struct rdma_cm_mr mr[RDMA_CM_MAX_MRS]; // peer's MRs
+};
+
+void rdma_cm_init(void);
+int rdma_cm_listen(uint32 service_id, int *qps, int nqp, int *mrs, int nmr);
+int rdma_cm_accept(uint32 service_id, struct rdma_cm_info *info);
+int rdma_cm_connect(struct rdma_cm_info *info, int *mrs, int nmr);
+int rdma_cm_close(uint32 service_id);
+
+/* ============================================
+ * REMOTE BLOCK DEVICE
+ * ============================================ */
+
+/* A disk server exports a page of blocks per MR and lists the MRs in
+ * a directory, itself a page-long MR, which it offers through the CM
+ * under RDISK_SERVICE (see rdma_disk.c and user/rdisk.c).
+ */
+#define RDISK_SERVICE      0x7264       // "rd"
+#define RDISK_MAGIC        0x6b736964   // "disk"
+#define RDISK_MAX_PAGES    510          // entries that fit the directory page
+#define RDISK_BATCH        8            // bounce pages for swap and the log
+
+/* Who the disk is for: blkrw() until swap.c or log.c claims it */
+#define RDISK_BLK          0
+#define RDISK_SWAP         1
+#define RDISK_LOG          2
+
+struct rdisk_dir {
+    uint32 magic;                // RDISK_MAGIC
+    uint32 nblocks;              // disk size in BSIZE blocks
+    uint32 npages;               // MRs, each a page: block b is in page[b / 4]
+    struct {
+        uint32 mr_id;
+        uint32 rkey;
+    } page[RDISK_MAX_PAGES];
+} __attribute__((packed));
+
+/* A standby for the file system log (user/rlog.c) is a disk
+ * server with RLOG_PAGES pages: a control page, then RLOG_SLOTS slots
+ * of RLOG_SLOT_PAGES pages. log.c WRITEs transaction seq to slot
+ * seq % RLOG_SLOTS: its blocks, then its header in the slot's last
+ * block, then the header's magic and seq, which say it is all there.
+ * The standby applies the transactions in order and keeps the last
+ * one's seq in its control page, which the primary READs before it
+ * reuses a slot.
+ */
+#define RLOG_SERVICE       0x726c       // "rl"
+#define RLOG_MAGIC         0x676f6c72   // "rlog"
+#define RLOG_SLOTS         8
+#define RLOG_SLOT_PAGES    RDISK_BATCH  // a bounce page each
+#define RLOG_PAGES         (1 + RLOG_SLOTS * RLOG_SLOT_PAGES)
+#define RLOG_HEAD_BLOCK    (RLOG_SLOT_PAGES * 4 - 1)
+
+#define LOGMIRROR_BOTH     1            // commit to the standby and this disk
+#define LOGMIRROR_REMOTE   2            // to the standby instead
+
+struct rlog_ctl {
+    uint32 magic;                // RLOG_MAGIC
+    uint32 applied;              // last transaction the standby applied
+};
+
+struct rlog_head {
+    uint32 magic;                // RLOG_MAGIC, written with seq after the rest
+    uint32 seq;                  // 1, 2, ...
+    uint32 n;                    // blocks in the slot, at most LOGBLOCKS
+    uint32 block[RLOG_HEAD_BLOCK];   // where each one goes
+};
 
 /* ============================================
  * HELPER FUNCTIONS
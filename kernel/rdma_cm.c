@@ -0,0 +1,801 @@
+// kernel/rdma_cm.c - RDMA connection manager
+
+/* Connection setup on ETHTYPE_RDMA, a three-way handshake modelled
+ * on the InfiniBand CM:
+ *
+ *   active side                          passive side
+ *   rdma_cm_connect(service, QPs, MRs)   rdma_cm_listen(service, QPs, MRs)
+ *       REQ(service, tid, QPs, MRs)  -->
+ *                                        claim as many free listener
+ *                                        QPs, connect them (RTR)
+ *                                    <-- REP(tid, paired QPs, MRs)
+ *   connect our QPs (RTS)
+ *       RTU(tid)                     -->
+ *                                        QPs to RTS, rdma_cm_accept()
+ *                                        returns
+ *
+ * A single REQ pairs up to RDMA_CM_MAX_QPS QPs and carries MR
+ * descriptors (id, rkey, address, length) both ways, so neither side
+ * needs QP numbers or rkeys out of band.  The REQ may be broadcast,
+ * which turns the service ID into a lookup: whoever listens on it
+ * answers, and the REP's source MAC is the peer.
+ *
+ * Frames may be lost: rdma_cm_tick() retransmits REQs and REPs until
+ * they are answered, a duplicate REQ is answered with the same REP
+ * and a duplicate REP with another RTU.  A REP that is never
+ * confirmed gives its QPs back to the listener's pool.
+ *
+ * Everything here is under cm_lock.  Lock order: cm_lock, then
+ * qp_lock; mr_lock is only taken with neither held.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "rdma.h"
+#include "rdma_net.h"
+
+#define RDMA_CM_MAX_LISTEN   8      // services listened on system-wide
+#define RDMA_CM_BACKLOG      4      // handshakes per listener not yet accepted
+#define RDMA_CM_MAX_CONNECT  8      // active connects in flight
+#define RDMA_CM_RTO_TICKS    2      // retransmit interval
+#define RDMA_CM_RETRIES      10     // retransmits before giving up (~2 s)
+
+#define RDMA_CM_MSG_MAX (sizeof(struct rdma_cm_msg) +                    \
+                         RDMA_CM_MAX_QPS * sizeof(uint16) +              \
+                         RDMA_CM_MAX_MRS * sizeof(struct rdma_cm_mr_wire))
+
+static uint8 broadcast_mac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+enum cm_state {
+    CM_FREE = 0,
+    CM_REQ_SENT,                 // active: waiting for REP
+    CM_REP_SENT,                 // passive: waiting for RTU
+    CM_ESTABLISHED,              // passive: RTU seen, waiting for accept
+    CM_DONE,                     // active: REP seen, RTU sent
+    CM_FAILED                    // active: REJ or timeout
+};
+
+/* Passive side: one handshake on a listener */
+struct cm_conn {
+    enum cm_state state;
+    uint8 mac[6];                // requester
+    uint32 tid;
+    int timer;                   // ticks until retransmit
+    int retries;                 // retransmits left
+    int slot[RDMA_CM_MAX_QPS];   // listener pool entries claimed
+    struct rdma_cm_info info;    // what accept returns
+    uint8 rep[RDMA_CM_MSG_MAX];  // REP, kept for retransmission
+    uint32 rep_len;
+};
+
+struct cm_listener {
+    int valid;
+    uint32 service_id;
+    struct proc *owner;
+    int owner_pid;
+    int nqp;
+    int qp[RDMA_CM_MAX_QPS];     // pool of QPs to hand out; -1 once accepted
+    int claimed[RDMA_CM_MAX_QPS];// 1 while part of a handshake
+    int nmr;
+    struct rdma_cm_mr mr[RDMA_CM_MAX_MRS];
+    struct cm_conn conn[RDMA_CM_BACKLOG];
+};
+
+/* Active side: one rdma_cm_connect() */
+struct cm_connect {
+    enum cm_state state;
+    struct proc *owner;
+    uint8 mac[6];                // where the REQ goes (may be broadcast)
+    uint32 tid;
+    int timer;
+    int retries;
+    uint8 reason;                // RDMA_CM_REJ_* when FAILED, 0 on timeout
+    struct rdma_cm_info info;    // request in, result out
+    uint8 req[RDMA_CM_MSG_MAX];  // REQ, kept for retransmission
+    uint32 req_len;
+};
+
+static struct spinlock cm_lock;
+static struct cm_listener cm_listeners[RDMA_CM_MAX_LISTEN];
+static struct cm_connect cm_connects[RDMA_CM_MAX_CONNECT];
+static uint32 cm_next_tid;
+
+void
+rdma_cm_init(void)
+{
+    initlock(&cm_lock, "rdma_cm");
+    memset(cm_listeners, 0, sizeof(cm_listeners));
+    memset(cm_connects, 0, sizeof(cm_connects));
+    cm_next_tid = 1;
+}
+
+/* ============================================
+ * MESSAGES
+ * ============================================ */
+
+/* Build a CM message in network byte order; returns its length */
+static uint32
+cm_build(uint8 *buf, uint32 service_id, uint32 tid, uint8 flags, uint8 reason,
+         int nqp, uint32 *qps, int nmr, struct rdma_cm_mr *mrs)
+{
+    struct rdma_cm_msg *msg = (struct rdma_cm_msg *)buf;
+    msg->service_id = htonl(service_id);
+    msg->tid = htonl(tid);
+    msg->nqp = nqp;
+    msg->nmr = nmr;
+    msg->flags = flags;
+    msg->reason = reason;
+
+    uint8 *p = buf + sizeof(*msg);
+    for (int i = 0; i < nqp; i++) {
+        uint16 qpn = htons(qps[i]);
+        memmove(p, &qpn, sizeof(qpn));
+        p += sizeof(qpn);
+    }
+    for (int i = 0; i < nmr; i++) {
+        struct rdma_cm_mr_wire w;
+        w.mr_id = htonl(mrs[i].mr_id);
+        w.rkey = htonl(mrs[i].rkey);
+        w.addr = htonll(mrs[i].addr);
+        w.length = htonll(mrs[i].length);
+        memmove(p, &w, sizeof(w));
+        p += sizeof(w);
+    }
+    return p - buf;
+}
+
+/* Parse a received CM message into host byte order
+ *
+ * Returns: 0 on success, -1 if the message is malformed
+ */
+static int
+cm_parse(struct mbuf *m, uint32 len, struct rdma_cm_msg *msg,
+         uint32 *qps, struct rdma_cm_mr *mrs)
+{
+    struct rdma_cm_msg *hdr = mbufpullhdr(m, *hdr);
+    if (!hdr || len < sizeof(*hdr)) {
+        return -1;
+    }
+    msg->service_id = ntohl(hdr->service_id);
+    msg->tid = ntohl(hdr->tid);
+    msg->nqp = hdr->nqp;
+    msg->nmr = hdr->nmr;
+    msg->flags = hdr->flags;
+    msg->reason = hdr->reason;
+
+    if (msg->nqp > RDMA_CM_MAX_QPS || msg->nmr > RDMA_CM_MAX_MRS) {
+        return -1;
+    }
+    if (len != sizeof(*hdr) + msg->nqp * sizeof(uint16) +
+               msg->nmr * sizeof(struct rdma_cm_mr_wire)) {
+        return -1;
+    }
+
+    for (int i = 0; i < msg->nqp; i++) {
+        uint16 qpn;
+        char *p = mbufpull(m, sizeof(qpn));
+        if (!p) return -1;
+        memmove(&qpn, p, sizeof(qpn));
+        qps[i] = ntohs(qpn);
+    }
+    for (int i = 0; i < msg->nmr; i++) {
+        struct rdma_cm_mr_wire w;
+        char *p = mbufpull(m, sizeof(w));
+        if (!p) return -1;
+        memmove(&w, p, sizeof(w));
+        mrs[i].mr_id = ntohl(w.mr_id);
+        mrs[i].rkey = ntohl(w.rkey);
+        mrs[i].addr = ntohll(w.addr);
+        mrs[i].length = ntohll(w.length);
+    }
+    return 0;
+}
+
+static void
+cm_send_simple(uint8 *mac, uint8 opcode, uint32 service_id, uint32 tid, uint8 reason)
+{
+    uint8 buf[sizeof(struct rdma_cm_msg)];
+    uint32 len = cm_build(buf, service_id, tid, 0, reason, 0, 0, 0, 0);
+    rdma_net_tx_cm(mac, opcode, buf, len);
+}
+
+/* ============================================
+ * HELPERS
+ * ============================================ */
+
+/* Describe the caller's MRs for a peer
+ *
+ * Returns: 0 on success, -1 if an MR is not ours
+ */
+static int
+cm_describe_mrs(int *mrs, int nmr, struct rdma_cm_mr *out)
+{
+    acquire(&mr_lock);
+    for (int i = 0; i < nmr; i++) {
+        struct rdma_mr *mr = rdma_mr_get(mrs[i]);
+        if (!mr) {
+            release(&mr_lock);
+            return -1;
+        }
+        out[i].mr_id = mr->hw.id;
+        out[i].rkey = mr->hw.rkey;
+        out[i].addr = mr->hw.vaddr;
+        out[i].length = mr->hw.length;
+    }
+    release(&mr_lock);
+    return 0;
+}
+
+/* Check that QPs are the caller's and still unconnected
+ *
+ * Caller holds qp_lock.
+ */
+static int
+cm_qps_usable(uint32 *qps, int nqp, struct proc *owner)
+{
+    for (int i = 0; i < nqp; i++) {
+        if (qps[i] >= MAX_QPS) {
+            return 0;
+        }
+        struct rdma_qp *qp = &qp_table[qps[i]];
+        if (!qp->valid || qp->owner != owner || qp->state != QP_STATE_INIT) {
+            return 0;
+        }
+        for (int j = 0; j < i; j++) {
+            if (qps[j] == qps[i]) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* A listener whose process has exited no longer owns anything */
+static int
+cm_listener_stale(struct cm_listener *l)
+{
+    return l->owner->pid != l->owner_pid ||
+           l->owner->state == UNUSED || l->owner->state == ZOMBIE;
+}
+
+static struct cm_listener *
+cm_find_listener(uint32 service_id)
+{
+    for (int i = 0; i < RDMA_CM_MAX_LISTEN; i++) {
+        struct cm_listener *l = &cm_listeners[i];
+        if (l->valid && l->service_id == service_id) {
+            return l;
+        }
+    }
+    return 0;
+}
+
+static struct cm_conn *
+cm_find_conn(struct cm_listener *l, uint8 *mac, uint32 tid)
+{
+    for (int i = 0; i < RDMA_CM_BACKLOG; i++) {
+        struct cm_conn *c = &l->conn[i];
+        if (c->state != CM_FREE && c->tid == tid && memcmp(c->mac, mac, 6) == 0) {
+            return c;
+        }
+    }
+    return 0;
+}
+
+/* Give an unconfirmed handshake's QPs back to the listener's pool */
+static void
+cm_release_conn(struct cm_listener *l, struct cm_conn *c)
+{
+    acquire(&qp_lock);
+    for (int i = 0; i < c->info.nqp; i++) {
+        struct rdma_qp *qp = &qp_table[c->info.qp[i]];
+        if (qp->valid && qp->owner == l->owner && qp->state == QP_STATE_RTR) {
+            qp->state = QP_STATE_INIT;
+            qp->connected = 0;
+            qp->network_mode = 0;
+        }
+        l->claimed[c->slot[i]] = 0;
+    }
+    release(&qp_lock);
+    c->state = CM_FREE;
+}
+
+/* ============================================
+ * PASSIVE SIDE
+ * ============================================ */
+
+/* Offer QPs and MRs under a service ID
+ *
+ * Each REQ for service_id is paired with as many of the given QPs,
+ * which must be ours and in INIT, as it brings; the MRs are
+ * advertised in every REP. Returns immediately; rdma_cm_accept()
+ * collects the connections.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_cm_listen(uint32 service_id, int *qps, int nqp, int *mrs, int nmr)
+{
+    struct proc *p = myproc();
+    struct rdma_cm_mr desc[RDMA_CM_MAX_MRS];
+    uint32 qpn[RDMA_CM_MAX_QPS];
+
+    if (nqp < 1 || nqp > RDMA_CM_MAX_QPS || nmr < 0 || nmr > RDMA_CM_MAX_MRS) {
+        return -1;
+    }
+    if (cm_describe_mrs(mrs, nmr, desc) < 0) {
+        printf("rdma_cm_listen: MR not owned by PID %d\n", p->pid);
+        return -1;
+    }
+    for (int i = 0; i < nqp; i++) {
+        qpn[i] = qps[i];
+    }
+
+    acquire(&cm_lock);
+
+    struct cm_listener *l = cm_find_listener(service_id);
+    if (l && !cm_listener_stale(l)) {
+        release(&cm_lock);
+        printf("rdma_cm_listen: service %d already in use\n", service_id);
+        return -1;
+    }
+    if (l) {
+        l->valid = 0;
+    }
+    for (l = cm_listeners; l < &cm_listeners[RDMA_CM_MAX_LISTEN]; l++) {
+        if (!l->valid) break;
+    }
+    if (l == &cm_listeners[RDMA_CM_MAX_LISTEN]) {
+        release(&cm_lock);
+        printf("rdma_cm_listen: no free listener slots\n");
+        return -1;
+    }
+
+    acquire(&qp_lock);
+    int ok = cm_qps_usable(qpn, nqp, p);
+    release(&qp_lock);
+    if (!ok) {
+        release(&cm_lock);
+        printf("rdma_cm_listen: QPs must be owned and in INIT state\n");
+        return -1;
+    }
+
+    memset(l, 0, sizeof(*l));
+    l->service_id = service_id;
+    l->owner = p;
+    l->owner_pid = p->pid;
+    l->nqp = nqp;
+    for (int i = 0; i < nqp; i++) {
+        l->qp[i] = qpn[i];
+    }
+    l->nmr = nmr;
+    memmove(l->mr, desc, nmr * sizeof(desc[0]));
+    l->valid = 1;
+
+    release(&cm_lock);
+    return 0;
+}
+
+/* Wait for a connection on a service we listen on
+ *
+ * Sleeps until a handshake completes (RTU received) and fills info
+ * with the paired QPs and the requester's MRs. The QPs are then
+ * the caller's, connected and in RTS.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_cm_accept(uint32 service_id, struct rdma_cm_info *info)
+{
+    struct proc *p = myproc();
+
+    acquire(&cm_lock);
+
+    for (;;) {
+        struct cm_listener *l = cm_find_listener(service_id);
+        if (!l || l->owner != p || l->owner_pid != p->pid) {
+            release(&cm_lock);
+            return -1;
+        }
+
+        for (int i = 0; i < RDMA_CM_BACKLOG; i++) {
+            struct cm_conn *c = &l->conn[i];
+            if (c->state != CM_ESTABLISHED) continue;
+
+            *info = c->info;
+            for (int j = 0; j < c->info.nqp; j++) {
+                l->qp[c->slot[j]] = -1;
+                l->claimed[c->slot[j]] = 0;
+            }
+            c->state = CM_FREE;
+            release(&cm_lock);
+            return 0;
+        }
+
+        if (killed(p)) {
+            release(&cm_lock);
+            return -1;
+        }
+        sleep(l, &cm_lock);
+    }
+}
+
+/* Stop listening; handshakes in progress are abandoned */
+int
+rdma_cm_close(uint32 service_id)
+{
+    struct proc *p = myproc();
+
+    acquire(&cm_lock);
+
+    struct cm_listener *l = cm_find_listener(service_id);
+    if (!l || l->owner != p || l->owner_pid != p->pid) {
+        release(&cm_lock);
+        return -1;
+    }
+    for (int i = 0; i < RDMA_CM_BACKLOG; i++) {
+        if (l->conn[i].state == CM_REP_SENT) {
+            cm_release_conn(l, &l->conn[i]);
+        }
+    }
+    l->valid = 0;
+    wakeup(l);
+
+    release(&cm_lock);
+    return 0;
+}
+
+/* REQ: pair the requester's QPs with free ones from the pool */
+static void
+cm_rx_req(uint8 *src_mac, struct rdma_cm_msg *msg, uint32 *qps, struct rdma_cm_mr *mrs)
+{
+    struct cm_listener *l = cm_find_listener(msg->service_id);
+    if (!l || cm_listener_stale(l)) {
+        // A broadcast REQ is only answered by whoever listens
+        if (!(msg->flags & RDMA_CM_F_BROADCAST)) {
+            cm_send_simple(src_mac, RDMA_NET_OP_CM_REJ, msg->service_id,
+                           msg->tid, RDMA_CM_REJ_NO_SERVICE);
+        }
+        return;
+    }
+
+    // Retransmitted REQ: our REP (or the requester's RTU) was lost
+    struct cm_conn *c = cm_find_conn(l, src_mac, msg->tid);
+    if (c) {
+        if (c->state == CM_REP_SENT) {
+            rdma_net_tx_cm(c->mac, RDMA_NET_OP_CM_REP, c->rep, c->rep_len);
+        }
+        return;
+    }
+
+    for (c = l->conn; c < &l->conn[RDMA_CM_BACKLOG]; c++) {
+        if (c->state == CM_FREE) break;
+    }
+    if (msg->nqp == 0 || c == &l->conn[RDMA_CM_BACKLOG]) {
+        cm_send_simple(src_mac, RDMA_NET_OP_CM_REJ, msg->service_id,
+                       msg->tid, msg->nqp ? RDMA_CM_REJ_NO_QPS : RDMA_CM_REJ_INVALID);
+        return;
+    }
+
+    // Claim nqp free, still-unconnected QPs from the pool
+    acquire(&qp_lock);
+    int n = 0;
+    for (int i = 0; i < l->nqp && n < msg->nqp; i++) {
+        if (l->qp[i] < 0 || l->claimed[i]) continue;
+        struct rdma_qp *qp = &qp_table[l->qp[i]];
+        if (!qp->valid || qp->owner != l->owner || qp->state != QP_STATE_INIT) continue;
+        c->slot[n] = i;
+        c->info.qp[n] = l->qp[i];
+        n++;
+    }
+    if (n < msg->nqp) {
+        release(&qp_lock);
+        cm_send_simple(src_mac, RDMA_NET_OP_CM_REJ, msg->service_id,
+                       msg->tid, RDMA_CM_REJ_NO_QPS);
+        return;
+    }
+
+    // Ready to receive until the RTU arrives
+    for (int i = 0; i < n; i++) {
+        l->claimed[c->slot[i]] = 1;
+        c->info.remote_qp[i] = qps[i];
+        rdma_qp_connect_locked(&qp_table[c->info.qp[i]], src_mac, qps[i], QP_STATE_RTR);
+    }
+    release(&qp_lock);
+
+    memmove(c->mac, src_mac, 6);
+    c->tid = msg->tid;
+    memmove(c->info.mac, src_mac, 6);
+    c->info.nqp = n;
+    c->info.service_id = msg->service_id;
+    c->info.nmr = msg->nmr;
+    memmove(c->info.mr, mrs, msg->nmr * sizeof(mrs[0]));
+    c->rep_len = cm_build(c->rep, msg->service_id, msg->tid, 0, 0,
+                          n, c->info.qp, l->nmr, l->mr);
+    c->timer = RDMA_CM_RTO_TICKS;
+    c->retries = RDMA_CM_RETRIES;
+    c->state = CM_REP_SENT;
+
+    rdma_net_tx_cm(c->mac, RDMA_NET_OP_CM_REP, c->rep, c->rep_len);
+}
+
+/* RTU: the requester has connected its side */
+static void
+cm_rx_rtu(uint8 *src_mac, struct rdma_cm_msg *msg)
+{
+    struct cm_listener *l = cm_find_listener(msg->service_id);
+    if (!l) return;
+
+    struct cm_conn *c = cm_find_conn(l, src_mac, msg->tid);
+    if (!c || c->state != CM_REP_SENT) return;
+
+    acquire(&qp_lock);
+    for (int i = 0; i < c->info.nqp; i++) {
+        struct rdma_qp *qp = &qp_table[c->info.qp[i]];
+        if (qp->valid && qp->state == QP_STATE_RTR) {
+            qp->state = QP_STATE_RTS;
+        }
+    }
+    release(&qp_lock);
+
+    c->state = CM_ESTABLISHED;
+    wakeup(l);
+}
+
+/* ============================================
+ * ACTIVE SIDE
+ * ============================================ */
+
+/* Connect QPs to a service
+ *
+ * info->mac (or broadcast), info->service_id, info->nqp and info->qp[]
+ * say what to connect; the QPs must be ours and in INIT. mrs are
+ * advertised to the peer. Sleeps until the peer replies; on success
+ * info->mac, info->remote_qp[] and info->mr[] describe the peer and
+ * the QPs are connected and in RTS.
+ *
+ * Returns: 0 on success, -1 on error, rejection or timeout
+ */
+int
+rdma_cm_connect(struct rdma_cm_info *info, int *mrs, int nmr)
+{
+    struct proc *p = myproc();
+    struct rdma_cm_mr desc[RDMA_CM_MAX_MRS];
+
+    if (info->nqp < 1 || info->nqp > RDMA_CM_MAX_QPS || nmr < 0 || nmr > RDMA_CM_MAX_MRS) {
+        return -1;
+    }
+    if (cm_describe_mrs(mrs, nmr, desc) < 0) {
+        printf("rdma_cm_connect: MR not owned by PID %d\n", p->pid);
+        return -1;
+    }
+
+    acquire(&cm_lock);
+
+    acquire(&qp_lock);
+    int ok = cm_qps_usable(info->qp, info->nqp, p);
+    release(&qp_lock);
+    if (!ok) {
+        release(&cm_lock);
+        printf("rdma_cm_connect: QPs must be owned and in INIT state\n");
+        return -1;
+    }
+
+    // Prefer a free slot; finished ones are only kept to re-send RTUs
+    struct cm_connect *a = 0;
+    for (int i = 0; i < RDMA_CM_MAX_CONNECT; i++) {
+        struct cm_connect *s = &cm_connects[i];
+        if (s->state == CM_FREE) {
+            a = s;
+            break;
+        }
+        if (s->state == CM_DONE && !a) {
+            a = s;
+        }
+    }
+    if (!a) {
+        release(&cm_lock);
+        printf("rdma_cm_connect: too many connects in progress\n");
+        return -1;
+    }
+
+    int bcast = memcmp(info->mac, broadcast_mac, 6) == 0;
+    a->owner = p;
+    memmove(a->mac, info->mac, 6);
+    a->tid = cm_next_tid++;
+    a->info = *info;
+    a->reason = 0;
+    a->req_len = cm_build(a->req, info->service_id, a->tid,
+                          bcast ? RDMA_CM_F_BROADCAST : 0, 0,
+                          info->nqp, info->qp, nmr, desc);
+    a->timer = RDMA_CM_RTO_TICKS;
+    a->retries = RDMA_CM_RETRIES;
+    a->state = CM_REQ_SENT;
+
+    rdma_net_tx_cm(a->mac, RDMA_NET_OP_CM_REQ, a->req, a->req_len);
+
+    while (a->state == CM_REQ_SENT) {
+        if (killed(p)) {
+            a->state = CM_FREE;
+            release(&cm_lock);
+            return -1;
+        }
+        sleep(a, &cm_lock);
+    }
+
+    if (a->state == CM_FAILED) {
+        printf("rdma_cm_connect: service %d: %s\n", info->service_id,
+               a->reason == RDMA_CM_REJ_NO_SERVICE ? "no listener" :
+               a->reason == RDMA_CM_REJ_NO_QPS ? "not enough QPs" :
+               a->reason ? "rejected" : "timed out");
+        a->state = CM_FREE;
+        release(&cm_lock);
+        return -1;
+    }
+
+    *info = a->info;
+    a->owner = 0;
+    release(&cm_lock);
+    return 0;
+}
+
+static struct cm_connect *
+cm_find_connect(uint8 *src_mac, uint32 tid)
+{
+    for (int i = 0; i < RDMA_CM_MAX_CONNECT; i++) {
+        struct cm_connect *a = &cm_connects[i];
+        if (a->state == CM_FREE || a->tid != tid) continue;
+        // a broadcast REQ is answered from the listener's own MAC
+        if (a->state == CM_REQ_SENT && memcmp(a->mac, broadcast_mac, 6) == 0) {
+            return a;
+        }
+        if (memcmp(a->mac, src_mac, 6) == 0) {
+            return a;
+        }
+    }
+    return 0;
+}
+
+/* REP: connect our QPs to the ones the listener picked */
+static void
+cm_rx_rep(uint8 *src_mac, struct rdma_cm_msg *msg, uint32 *qps, struct rdma_cm_mr *mrs)
+{
+    struct cm_connect *a = cm_find_connect(src_mac, msg->tid);
+
+    if (a && a->state == CM_DONE) {
+        // our RTU was lost
+        cm_send_simple(src_mac, RDMA_NET_OP_CM_RTU, msg->service_id, msg->tid, 0);
+        return;
+    }
+    if (!a || a->state != CM_REQ_SENT) {
+        // e.g. a second listener answering a broadcast REQ
+        cm_send_simple(src_mac, RDMA_NET_OP_CM_REJ, msg->service_id,
+                       msg->tid, RDMA_CM_REJ_INVALID);
+        return;
+    }
+
+    acquire(&qp_lock);
+    if (msg->nqp != a->info.nqp || !cm_qps_usable(a->info.qp, a->info.nqp, a->owner)) {
+        release(&qp_lock);
+        a->state = CM_FAILED;
+        a->reason = RDMA_CM_REJ_INVALID;
+        cm_send_simple(src_mac, RDMA_NET_OP_CM_REJ, msg->service_id,
+                       msg->tid, RDMA_CM_REJ_INVALID);
+        wakeup(a);
+        return;
+    }
+    for (int i = 0; i < msg->nqp; i++) {
+        rdma_qp_connect_locked(&qp_table[a->info.qp[i]], src_mac, qps[i], QP_STATE_RTS);
+        a->info.remote_qp[i] = qps[i];
+    }
+    release(&qp_lock);
+
+    memmove(a->mac, src_mac, 6);
+    memmove(a->info.mac, src_mac, 6);
+    a->info.nmr = msg->nmr;
+    memmove(a->info.mr, mrs, msg->nmr * sizeof(mrs[0]));
+    a->state = CM_DONE;
+
+    cm_send_simple(src_mac, RDMA_NET_OP_CM_RTU, msg->service_id, msg->tid, 0);
+    wakeup(a);
+}
+
+/* REJ: either our REQ was refused or the requester dropped our REP */
+static void
+cm_rx_rej(uint8 *src_mac, struct rdma_cm_msg *msg)
+{
+    struct cm_listener *l = cm_find_listener(msg->service_id);
+    struct cm_conn *c = l ? cm_find_conn(l, src_mac, msg->tid) : 0;
+    if (c) {
+        if (c->state == CM_REP_SENT) {
+            cm_release_conn(l, c);
+        }
+        return;
+    }
+
+    struct cm_connect *a = cm_find_connect(src_mac, msg->tid);
+    if (a && a->state == CM_REQ_SENT) {
+        a->state = CM_FAILED;
+        a->reason = msg->reason;
+        wakeup(a);
+    }
+}
+
+/* ============================================
+ * RECEIVE AND TIMERS
+ * ============================================ */
+
+/* Handle a CM packet; called from rdma_net_rx() with the RDMA header
+ * already pulled. Consumes m.
+ */
+void
+rdma_cm_rx(struct mbuf *m, uint8 *src_mac, uint8 opcode, uint32 len)
+{
+    struct rdma_cm_msg msg;
+    uint32 qps[RDMA_CM_MAX_QPS];
+    struct rdma_cm_mr mrs[RDMA_CM_MAX_MRS];
+
+    if (cm_parse(m, len, &msg, qps, mrs) < 0) {
+        mbuffree(m);
+        return;
+    }
+    mbuffree(m);
+
+    acquire(&cm_lock);
+    switch (opcode) {
+    case RDMA_NET_OP_CM_REQ:
+        cm_rx_req(src_mac, &msg, qps, mrs);
+        break;
+    case RDMA_NET_OP_CM_REP:
+        cm_rx_rep(src_mac, &msg, qps, mrs);
+        break;
+    case RDMA_NET_OP_CM_RTU:
+        cm_rx_rtu(src_mac, &msg);
+        break;
+    case RDMA_NET_OP_CM_REJ:
+        cm_rx_rej(src_mac, &msg);
+        break;
+    }
+    release(&cm_lock);
+}
+
+/* Retransmit unanswered REQs and REPs; called from clockintr() */
+void
+rdma_cm_tick(void)
+{
+    acquire(&cm_lock);
+
+    for (int i = 0; i < RDMA_CM_MAX_CONNECT; i++) {
+        struct cm_connect *a = &cm_connects[i];
+        if (a->state != CM_REQ_SENT || --a->timer > 0) continue;
+        if (a->retries-- == 0) {
+            a->state = CM_FAILED;
+            wakeup(a);
+            continue;
+        }
+        a->timer = RDMA_CM_RTO_TICKS;
+        rdma_net_tx_cm(a->mac, RDMA_NET_OP_CM_REQ, a->req, a->req_len);
+    }
+
+    for (int i = 0; i < RDMA_CM_MAX_LISTEN; i++) {
+        struct cm_listener *l = &cm_listeners[i];
+        if (!l->valid) continue;
+        for (int j = 0; j < RDMA_CM_BACKLOG; j++) {
+            struct cm_conn *c = &l->conn[j];
+            if (c->state != CM_REP_SENT || --c->timer > 0) continue;
+            if (c->retries-- == 0) {
+                cm_release_conn(l, c);
+                continue;
+            }
+            c->timer = RDMA_CM_RTO_TICKS;
+            rdma_net_tx_cm(c->mac, RDMA_NET_OP_CM_REP, c->rep, c->rep_len);
+        }
+    }
+
+    release(&cm_lock);
+}
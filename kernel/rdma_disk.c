@@ -0,0 +1,519 @@
+// kernel/rdma_disk.c - a block device in another node's memory
+
+/* The disk is memory that a server on another node ("rdisk server",
+ * user/rdisk.c) has registered: one MR per page, RDISK_PAGE_BLOCKS
+ * blocks to a page, listed in a directory page of its own (struct
+ * rdisk_dir) that the server offers through the CM. A process
+ * connects a QP to the server and hands it over, with the directory's
+ * MR descriptor, to rdma_disk_attach(); from then on the QP is the
+ * kernel's, and bread() and bwrite() of device RDISKDEV come here
+ * rather than to virtio_disk_rw().
+ *
+ * A block is read with an RDMA READ and written with an RDMA WRITE,
+ * one at a time, through a bounce page registered as a kernel MR; the
+ * server's CPU takes no part. The caller waits by polling the CQ,
+ * which also polls the ports that don't interrupt: a round trip takes
+ * microseconds, less than a trip through the scheduler. bread() has
+ * no way to report an error, so a server that stops answering is a
+ * panic, as a dead local disk would be. The pager can do better: a
+ * page that didn't go out can stay, and a process whose page didn't
+ * come back can be killed, so swap requests are tried RDISK_TRIES
+ * times before they fail.
+ *
+ * xv6 has one file system, on ROOTDEV, and no mount; the device is
+ * reached through the buffer cache by the blkrw() system call, or
+ * claimed by swap.c (swapon()) or log.c (logmirror()). As swap space
+ * each server page is a slot for one of ours: rdma_disk_swapout()
+ * WRITEs up to RDISK_BATCH pages from bounce pages of their own,
+ * posted back to back before it waits for any, and rdma_disk_swapin()
+ * READs one back a block at a time, again all posted before the first
+ * completes. A log standby's disk holds transaction slots (see
+ * rdma.h): rdma_disk_logpost() posts a transaction's WRITEs from the
+ * bounce pages log.c filled, and rdma_disk_logwait() waits for them,
+ * so the local disk can be written meanwhile.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "defs.h"
+#include "rdma.h"
+
+#define RDISK_PAGE_BLOCKS   (PGSIZE / BSIZE)
+#define RDISK_TIMEOUT       (2 * 10000000)  // time CSR units: 2s at 10 MHz
+#define RDISK_TRIES         3               // posts of a swap request before it fails
+
+static struct {
+    struct sleeplock lock;       // one request at a time
+    int attached;
+    int user;                    // RDISK_BLK, or claimed by swap.c or log.c
+    int posted;                  // log WRITEs not yet waited for
+    uint32 applied;              // the standby's last transaction, when last READ
+    int qp;                      // the kernel's QP to the server
+    int mr[RDISK_BATCH];         // kernel MR over each bounce page
+    char *bounce[RDISK_BATCH];   // the pages data passes through; blocks use [0]
+    struct rdisk_dir *dir;       // the server's directory
+    uint64 wr_id;
+} rdisk;
+
+void
+rdma_disk_init(void)
+{
+    initsleeplock(&rdisk.lock, "rdisk");
+}
+
+/* Post a READ or WRITE of len bytes between byte off of bounce page
+ * buf and the server's MR
+ *
+ * Caller holds rdisk.lock.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int
+rdisk_post(int opcode, int buf, uint32 off, uint32 mr_id, uint32 rkey, uint64 addr, uint32 len)
+{
+    struct rdma_work_request wr;
+
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = rdisk.wr_id + 1;
+    wr.opcode = opcode;
+    wr.flags = RDMA_WR_SIGNALED;
+    wr.local_mr_id = rdisk.mr[buf];
+    wr.local_offset = off;
+    wr.remote_mr_id = mr_id;
+    wr.remote_addr = addr;
+    wr.remote_key = rkey;
+    wr.length = len;
+    if (rdma_qp_post_send_kernel(rdisk.qp, &wr) < 0) {
+        return -1;
+    }
+    rdisk.wr_id++;
+    return 0;
+}
+
+/* Wait for the n requests posted last to complete
+ *
+ * The QP is reliable: they complete in the order they were posted.
+ * Completions of requests posted before them, which an earlier wait
+ * gave up on, are passed over. Caller holds rdisk.lock.
+ *
+ * Returns: 0 if all of them succeeded, -1 on error or timeout
+ */
+static int
+rdisk_wait(int n)
+{
+    struct rdma_completion c;
+    uint64 wr_id = rdisk.wr_id - n;
+    uint64 last = wr_id;         // the last request not ours
+    int got;
+
+    uint64 t0 = readtime();
+    while (n > 0) {
+        if ((got = rdma_qp_poll_cq_kernel(rdisk.qp, &c, 1)) < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            if (readtime() - t0 > RDISK_TIMEOUT) {
+                return -1;
+            }
+            continue;
+        }
+        if (c.wr_id <= last) {
+            continue;            // too late: it has been posted again
+        }
+        if (c.wr_id != ++wr_id || c.status != RDMA_WC_SUCCESS) {
+            return -1;
+        }
+        n--;
+        t0 = readtime();
+    }
+    return 0;
+}
+
+/* Post one request and wait for it: rdisk_post()'s arguments and
+ * rdisk_wait()'s result
+ */
+static int
+rdisk_op(int opcode, uint32 mr_id, uint32 rkey, uint64 addr, uint32 len)
+{
+    if (rdisk_post(opcode, 0, 0, mr_id, rkey, addr, len) < 0) {
+        return -1;
+    }
+    return rdisk_wait(1);
+}
+
+/* Allocate bounce page i and register it as a kernel MR
+ *
+ * Kept for good once registered: a kernel MR is never deregistered.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int
+rdisk_bounce(int i)
+{
+    if (rdisk.bounce[i]) {
+        return 0;
+    }
+    if ((rdisk.bounce[i] = kalloc()) == 0) {
+        return -1;
+    }
+    if ((rdisk.mr[i] = rdma_mr_register_kernel(rdisk.bounce[i], PGSIZE,
+                           RDMA_ACCESS_LOCAL_READ | RDMA_ACCESS_LOCAL_WRITE)) < 0) {
+        kfree(rdisk.bounce[i]);
+        rdisk.bounce[i] = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Take over connected RC QP qp_id, whose peer is a disk server, and
+ * read the server's directory through it, from the directory MR
+ * dir_mr (a page) with rkey dir_rkey
+ *
+ * On failure the QP stays the caller's. There is one remote disk,
+ * attached once.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_disk_attach(int qp_id, uint32 dir_mr, uint32 dir_rkey)
+{
+    struct proc *p = myproc();
+    int r = -1;
+
+    acquiresleep(&rdisk.lock);
+    if (rdisk.attached) {
+        goto out;
+    }
+
+    // Kept across failed attempts
+    if (rdisk.dir == 0 && (rdisk.dir = (struct rdisk_dir*)kalloc()) == 0) {
+        goto out;
+    }
+    if (rdisk_bounce(0) < 0) {
+        goto out;
+    }
+
+    if (rdma_qp_set_owner(qp_id, p, 0) < 0) {
+        goto out;
+    }
+    rdisk.qp = qp_id;
+
+    // A block's worth at a time: a READ comes back in one frame
+    for (uint32 off = 0; off < PGSIZE; off += BSIZE) {
+        if (rdisk_op(RDMA_OP_READ, dir_mr, dir_rkey, off, BSIZE) < 0) {
+            goto giveback;
+        }
+        memmove((char*)rdisk.dir + off, rdisk.bounce[0], BSIZE);
+    }
+    if (rdisk.dir->magic != RDISK_MAGIC || rdisk.dir->npages == 0 ||
+        rdisk.dir->npages > RDISK_MAX_PAGES ||
+        rdisk.dir->nblocks > rdisk.dir->npages * RDISK_PAGE_BLOCKS) {
+        printf("rdisk: bad directory\n");
+        goto giveback;
+    }
+
+    rdisk.attached = 1;
+    printf("rdisk: attached %d blocks on QP %d\n", rdisk.dir->nblocks, qp_id);
+    r = 0;
+    goto out;
+
+giveback:
+    rdma_qp_set_owner(qp_id, 0, p);
+out:
+    releasesleep(&rdisk.lock);
+    return r;
+}
+
+/* The remote disk's size in blocks, 0 if none is attached or it is
+ * swap space
+ */
+int
+rdma_disk_nblocks(void)
+{
+    return rdisk.attached && rdisk.user == RDISK_BLK ? rdisk.dir->nblocks : 0;
+}
+
+/* Read or write b, a block of RDISKDEV: bio.c's virtio_disk_rw() */
+void
+rdma_disk_rw(struct buf *b, int write)
+{
+    acquiresleep(&rdisk.lock);
+    if (!rdisk.attached || rdisk.user != RDISK_BLK || b->blockno >= rdisk.dir->nblocks) {
+        panic("rdma_disk_rw: no such block");
+    }
+
+    uint32 page = b->blockno / RDISK_PAGE_BLOCKS;
+    uint64 addr = (b->blockno % RDISK_PAGE_BLOCKS) * BSIZE;
+    if (write) {
+        memmove(rdisk.bounce[0], b->data, BSIZE);
+    }
+    if (rdisk_op(write ? RDMA_OP_WRITE : RDMA_OP_READ, rdisk.dir->page[page].mr_id,
+                 rdisk.dir->page[page].rkey, addr, BSIZE) < 0) {
+        panic("rdma_disk_rw: no answer from the server");
+    }
+    if (!write) {
+        memmove(b->data, rdisk.bounce[0], BSIZE);
+    }
+
+    releasesleep(&rdisk.lock);
+}
+
+/* Give the remote disk to user: RDISK_SWAP or RDISK_LOG, or back to
+ * blkrw() with RDISK_BLK
+ *
+ * swap.c and log.c never give it back, since what they put there
+ * exists nowhere else; the host harness does.
+ *
+ * Returns: the number of pages, or -1 if there is no disk, someone
+ * else has it, or the bounce pages can't be had
+ */
+int
+rdma_disk_claim(int user)
+{
+    int r = -1;
+
+    acquiresleep(&rdisk.lock);
+    if (rdisk.attached && (rdisk.user == RDISK_BLK || rdisk.user == user || user == RDISK_BLK)) {
+        int i;
+        for (i = 1; i < RDISK_BATCH && rdisk_bounce(i) == 0; i++)
+            ;
+        if (i == RDISK_BATCH) {
+            rdisk.user = user;
+            r = rdisk.dir->npages;
+        }
+    }
+    releasesleep(&rdisk.lock);
+    return r;
+}
+
+/* Bounce page i, which swap.c and log.c fill before they send it */
+char*
+rdma_disk_buf(int i)
+{
+    return rdisk.bounce[i];
+}
+
+/* WRITE bounce page i to server page slot[i], for each i < n, n at
+ * most RDISK_BATCH
+ *
+ * The batch is posted again, whole, if any of it fails.
+ *
+ * Returns: 0 once all of them are written, -1 on error
+ */
+int
+rdma_disk_swapout(uint *slot, int n)
+{
+    struct rdisk_dir *d;
+    int r = -1;
+
+    acquiresleep(&rdisk.lock);
+    d = rdisk.dir;
+    if (rdisk.user != RDISK_SWAP || n > RDISK_BATCH) {
+        goto out;
+    }
+    for (int i = 0; i < n; i++) {
+        if (slot[i] >= d->npages) {
+            goto out;
+        }
+    }
+    for (int try = 0; try < RDISK_TRIES && r < 0; try++) {
+        int posted = 0;
+        for (; posted < n; posted++) {
+            if (rdisk_post(RDMA_OP_WRITE, posted, 0, d->page[slot[posted]].mr_id,
+                           d->page[slot[posted]].rkey, 0, PGSIZE) < 0) {
+                break;
+            }
+        }
+        // Whatever was posted has to finish before the bounce pages
+        // can be used again
+        if (rdisk_wait(posted) == 0 && posted == n) {
+            r = 0;
+        }
+    }
+out:
+    releasesleep(&rdisk.lock);
+    return r;
+}
+
+/* READ server page slot into pa, a block at a time: a READ comes
+ * back in one frame
+ *
+ * The page is READ again, whole, if any of it fails.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_disk_swapin(uint slot, char *pa)
+{
+    int r = -1;
+
+    acquiresleep(&rdisk.lock);
+    if (rdisk.user != RDISK_SWAP || slot >= rdisk.dir->npages) {
+        goto out;
+    }
+    for (int try = 0; try < RDISK_TRIES && r < 0; try++) {
+        int posted = 0;
+        for (; posted < RDISK_PAGE_BLOCKS; posted++) {
+            if (rdisk_post(RDMA_OP_READ, 0, posted * BSIZE, rdisk.dir->page[slot].mr_id,
+                           rdisk.dir->page[slot].rkey, posted * BSIZE, BSIZE) < 0) {
+                break;
+            }
+        }
+        if (rdisk_wait(posted) == 0 && posted == RDISK_PAGE_BLOCKS) {
+            memmove(pa, rdisk.bounce[0], PGSIZE);
+            r = 0;
+        }
+    }
+out:
+    releasesleep(&rdisk.lock);
+    return r;
+}
+
+/* READ the standby's control block, and note the last transaction it
+ * has applied
+ *
+ * It goes to the block before the header, which no transaction uses
+ * (LOGBLOCKS < RLOG_HEAD_BLOCK), so a READ doesn't disturb the one
+ * log.c is filling in. Caller holds rdisk.lock.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int
+rlog_applied(void)
+{
+    int spare = RLOG_HEAD_BLOCK - 1;
+    uint32 buf = spare / RDISK_PAGE_BLOCKS;
+    uint32 off = (spare % RDISK_PAGE_BLOCKS) * BSIZE;
+    struct rlog_ctl *ctl = (struct rlog_ctl*)(rdisk.bounce[buf] + off);
+
+    if (rdisk_post(RDMA_OP_READ, buf, off, rdisk.dir->page[0].mr_id, rdisk.dir->page[0].rkey,
+                   0, sizeof(*ctl)) < 0 || rdisk_wait(1) < 0 || ctl->magic != RLOG_MAGIC) {
+        return -1;
+    }
+    rdisk.applied = ctl->applied;
+    return 0;
+}
+
+/* Check that the disk log.c claimed is a log standby's
+ *
+ * Returns: the last transaction the standby applied, or -1 if it
+ * isn't one
+ */
+int
+rdma_disk_logstart(void)
+{
+    int r = -1;
+
+    acquiresleep(&rdisk.lock);
+    if (rdisk.user == RDISK_LOG && rdisk.dir->npages >= RLOG_PAGES && rlog_applied() == 0) {
+        r = rdisk.applied;
+    }
+    releasesleep(&rdisk.lock);
+    return r;
+}
+
+/* Wait until the standby has applied the transaction that had seq's
+ * slot before it
+ *
+ * Returns: 0 on success, -1 if it hasn't within RDISK_TIMEOUT
+ */
+int
+rdma_disk_logroom(uint seq)
+{
+    int r = 0;
+
+    acquiresleep(&rdisk.lock);
+    uint64 t0 = readtime();
+    while (seq - rdisk.applied > RLOG_SLOTS) {
+        if (rlog_applied() < 0 || readtime() - t0 > RDISK_TIMEOUT) {
+            r = -1;
+            break;
+        }
+    }
+    releasesleep(&rdisk.lock);
+    return r;
+}
+
+/* Post transaction seq: n blocks, in bounce pages 0, 1, ... four to a
+ * page, going to block[] on the standby's disk
+ *
+ * The blocks go first, a page at a time, then the header but for its
+ * first two words, then those: when the standby sees seq, the rest is
+ * there. rdma_disk_logwait() waits for them.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_disk_logpost(uint seq, int n, int *block)
+{
+    uint32 head_page = RLOG_HEAD_BLOCK / RDISK_PAGE_BLOCKS;
+    uint32 head_off = (RLOG_HEAD_BLOCK % RDISK_PAGE_BLOCKS) * BSIZE;
+    struct rlog_head *h = (struct rlog_head*)(rdisk.bounce[head_page] + head_off);
+    int r = -1;
+
+    acquiresleep(&rdisk.lock);
+    if (rdisk.user != RDISK_LOG || n < 0 || n > LOGBLOCKS) {
+        goto out;
+    }
+    h->magic = RLOG_MAGIC;
+    h->seq = seq;
+    h->n = n;
+    for (int i = 0; i < n; i++) {
+        h->block[i] = block[i];
+    }
+
+    struct rdisk_dir *d = rdisk.dir;
+    uint32 page = 1 + (seq % RLOG_SLOTS) * RLOG_SLOT_PAGES;
+    int posted = 0;
+    for (int i = 0; i * RDISK_PAGE_BLOCKS < n; i++) {
+        int blocks = n - i * RDISK_PAGE_BLOCKS;
+        if (blocks > RDISK_PAGE_BLOCKS) {
+            blocks = RDISK_PAGE_BLOCKS;
+        }
+        if (rdisk_post(RDMA_OP_WRITE, i, 0, d->page[page + i].mr_id, d->page[page + i].rkey,
+                       0, blocks * BSIZE) < 0) {
+            goto unwind;
+        }
+        posted++;
+    }
+    page += head_page;
+    if (rdisk_post(RDMA_OP_WRITE, head_page, head_off + 8, d->page[page].mr_id,
+                   d->page[page].rkey, head_off + 8, sizeof(*h) - 8) < 0) {
+        goto unwind;
+    }
+    posted++;
+    if (rdisk_post(RDMA_OP_WRITE, head_page, head_off, d->page[page].mr_id,
+                   d->page[page].rkey, head_off, 8) < 0) {
+        goto unwind;
+    }
+    rdisk.posted = posted + 1;
+    r = 0;
+    goto out;
+
+unwind:
+    rdisk_wait(posted);
+out:
+    releasesleep(&rdisk.lock);
+    return r;
+}
+
+/* Wait for the transaction rdma_disk_logpost() posted
+ *
+ * Returns: 0 once the standby has all of it, -1 on error or timeout
+ */
+int
+rdma_disk_logwait(void)
+{
+    acquiresleep(&rdisk.lock);
+    int r = rdisk_wait(rdisk.posted);
+    rdisk.posted = 0;
+    releasesleep(&rdisk.lock);
+    return r;
+}
@@ -10,45 +10,1009 @@
 #include "rdma.h"
 #include "rdma_net.h"
 
-// Local MAC address (should match QEMU configuration)
-static uint8 local_mac[6];
+// Local MAC address of each network port (should match QEMU
+// configuration); port 0's is the one CM and UD traffic uses
+static uint8 local_macs[NNETDEV][6];
+static int nports;
 
 void
 rdma_net_init(void)
 {
-    // Get local MAC address from E1000
-    e1000_get_mac(local_mac);
+    // Get local MAC addresses from the NICs
+    nports = netdev_nports();
+    for (int i = 0; i < nports; i++) {
+        netdev_mac(i, local_macs[i]);
+    }
+    
+    printf("rdma_net: initialized (MAC: %x:%x:%x:%x:%x:%x, %d port(s))\n",
+           local_macs[0][0], local_macs[0][1], local_macs[0][2], 
+           local_macs[0][3], local_macs[0][4], local_macs[0][5], nports);
+}
+
+/* Start a frame to dst_mac that will leave by port: the Ethernet
+ * header, with that port's address as the source
+ */
+static void
+rdma_net_eth(struct mbuf *m, uint8 *dst_mac, int port)
+{
+    struct eth *ethhdr = mbufputhdr(m, *ethhdr);
+    memmove(ethhdr->dhost, dst_mac, 6);
+    memmove(ethhdr->shost, local_macs[port], 6);
+    ethhdr->type = htons(ETHTYPE_RDMA);
+    m->dev = port;
+}
+
+/* UDP source port of qp's frames: the same for all of a QP pair's
+ * traffic, so it stays in order, but spread over 0xC000..0xFFFF
+ * across pairs for ECMP
+ */
+static uint16
+rdma_net_sport(struct rdma_qp *qp)
+{
+    uint32 h = (qp->id * 0x9E3779B1) ^ (qp->remote_qp_num * 0x85EBCA6B);
+    return 0xC000 | ((h >> 16) & 0x3FFF);
+}
+
+/* Start a frame of qp's along path: the Ethernet header, then the
+ * IP and UDP headers if the path is encapsulated
+ */
+static void
+rdma_net_start(struct mbuf *m, struct rdma_qp *qp, struct rdma_path *path)
+{
+    rdma_net_eth(m, path->mac, path->port);
+    if (path->ip) {
+        struct eth *ethhdr = (struct eth*)m->head;
+        ethhdr->type = htons(ETHTYPE_IP);
+        net_udp_put(m, path->ip, rdma_net_sport(qp), path->udp_port);
+    }
+}
+
+/* The RDMA header of a frame built by rdma_net_start() */
+static struct rdma_pkt_hdr *
+rdma_net_pkt(struct mbuf *m)
+{
+    struct eth *ethhdr = (struct eth*)m->head;
+    uint32 off = sizeof(struct eth);
+    if (ethhdr->type == htons(ETHTYPE_IP)) {
+        off += RDMA_UDP_HDRLEN;
+    }
+    return (struct rdma_pkt_hdr*)(m->head + off);
+}
+
+/* Queue a finished frame: an encapsulated one gets its IP and UDP
+ * lengths now that they are known
+ */
+static int
+rdma_net_xmit(struct rdma_qp *qp, struct mbuf *m)
+{
+    if (((struct eth*)m->head)->type == htons(ETHTYPE_IP)) {
+        net_udp_fill(m, sizeof(struct eth));
+    }
+    return rdma_sched_xmit(qp, m);
+}
+
+/* Ethernet payload a frame of qp's may carry after any encapsulation
+ * and CRC trailer
+ */
+static uint32
+rdma_net_mtu(struct rdma_qp *qp)
+{
+    uint32 mtu = qp->crc ? RDMA_NET_MTU - RDMA_CRC_LEN : RDMA_NET_MTU;
+    for (int i = 0; i < qp->npaths; i++) {
+        if (qp->paths[i].ip) {
+            return mtu - RDMA_UDP_HDRLEN;
+        }
+    }
+    return mtu;
+}
+
+/* Append the CRC trailer for a body whose CRC32C is crc */
+static void
+rdma_net_put_crc(struct mbuf *m, uint32 crc)
+{
+    uint32 be = htonl(crc);
+    memmove(mbufput(m, RDMA_CRC_LEN), &be, RDMA_CRC_LEN);
+}
+
+/* The next len bytes of a received frame's body: from the mbuf, or
+ * from the driver's buffer once the headers run out (m->ext)
+ * 
+ * Returns: a pointer to them, or 0 if the frame is too short
+ */
+static char *
+rdma_net_body(struct mbuf *m, uint32 len)
+{
+    if (m->ext && m->len == 0) {
+        if (len > m->extlen) {
+            return 0;
+        }
+        char *p = m->ext;
+        m->ext += len;
+        m->extlen -= len;
+        return p;
+    }
+    return mbufpull(m, len);
+}
+
+/* How much of a received frame a driver should copy into an mbuf
+ * 
+ * For a WRITE, a segment of one, a READ response or a UD datagram
+ * with a long enough payload, that is just the headers: the driver
+ * points m->ext at the payload in its own buffer, and rdma_net_rx()
+ * reads it from there into the MR.  The driver must not reuse the
+ * buffer until rdma_net_rx() returns.  Frames with a CRC are checked
+ * as a whole, so they are copied as a whole.
+ * 
+ * Returns: the length of the headers, or 0 to copy the whole frame
+ */
+uint32
+rdma_net_split(char *frame, uint32 len)
+{
+    struct eth *eth = (struct eth *)frame;
+    struct rdma_pkt_hdr *hdr = (struct rdma_pkt_hdr *)(eth + 1);
+    uint32 hlen = sizeof(*eth) + sizeof(*hdr);
+    
+    if (len < hlen || ntohs(eth->type) != ETHTYPE_RDMA ||
+        (hdr->flags & RDMA_PKT_FLAG_CRC)) {
+        return 0;
+    }
+    switch (hdr->opcode) {
+    case RDMA_NET_OP_WRITE:
+    case RDMA_NET_OP_READ_RESP:
+    case RDMA_NET_OP_UD_SEND:
+        break;
+    case RDMA_NET_OP_WRITE_SEG:
+        hlen += sizeof(struct rdma_seg_hdr);
+        break;
+    default:
+        return 0;
+    }
+    if (len < hlen + RDMA_SPLIT_MIN) {
+        return 0;
+    }
+    return hlen;
+}
+
+/* Check the CRC trailer of a frame whose body (m's first covered
+ * bytes) it covers
+ * 
+ * Returns: 0 if it matches, -1 if not or if there is none
+ */
+static int
+rdma_net_check_crc(struct mbuf *m, uint32 covered)
+{
+    uint32 be;
+    
+    if (covered > m->len || m->len - covered < RDMA_CRC_LEN) {
+        return -1;
+    }
+    memmove(&be, m->head + covered, RDMA_CRC_LEN);
+    return crc32c(0, m->head, covered) == ntohl(be) ? 0 : -1;
+}
+
+/* Where replies to a frame go: back the way it came, by UDP if it
+ * came by UDP, to the port qp's own path to that address names
+ */
+static void
+rdma_net_reply_path(struct rdma_qp *qp, struct mbuf *m, uint8 *src_mac, uint32 src_ip,
+                    struct rdma_path *to)
+{
+    to->port = m->dev;
+    memmove(to->mac, src_mac, 6);
+    to->ip = src_ip;
+    to->udp_port = src_ip ? RDMA_UDP_PORT : 0;
+    for (int i = 0; src_ip && i < qp->npaths; i++) {
+        if (qp->paths[i].ip == src_ip) {
+            to->udp_port = qp->paths[i].udp_port;
+            break;
+        }
+    }
+}
+
+/* ============================================
+ * DELIVERY (shared by receive and the same-host fast path)
+ * ============================================ */
+
+/* Find the bytes a peer's WRITE or READ names in one of our MRs
+ * 
+ * The MR is validated by rkey: we are not in the owner's context.
+ * access is the RDMA_ACCESS_REMOTE_* bit the operation needs. On
+ * success *offset is where in the MR they start.
+ * 
+ * Returns: the MR, or 0 if the access is not allowed
+ */
+static struct rdma_mr *
+rdma_net_remote_mr(uint32 remote_mr_id, uint32 remote_key, uint64 remote_addr,
+                   uint32 length, int access, uint64 *offset)
+{
+    struct rdma_mr *mr = rdma_mr_get_remote(remote_mr_id, remote_key);
+    if (!mr || !(mr->hw.access_flags & access)) {
+        return 0;
+    }
+    
+    // remote_addr is an address within the MR, or an offset into it
+    if (remote_addr >= mr->hw.vaddr && 
+        remote_addr < mr->hw.vaddr + mr->hw.length) {
+        *offset = remote_addr - mr->hw.vaddr;
+    } else if (remote_addr < mr->hw.length) {
+        *offset = remote_addr;
+    } else {
+        return 0;
+    }
+    
+    // Check bounds
+    if (*offset + length > mr->hw.length) {
+        return 0;
+    }
+    return mr;
+}
+
+/* Copy incoming WRITE data into the destination MR
+ * 
+ * Caller holds qp_lock.
+ * 
+ * Returns: 0 on success, -1 if the WRITE is not allowed
+ */
+static int
+rdma_net_place(uint32 remote_mr_id, uint32 remote_key, uint64 remote_addr,
+               char *payload, uint32 length)
+{
+    uint64 offset;
+    struct rdma_mr *dst_mr = rdma_net_remote_mr(remote_mr_id, remote_key, remote_addr,
+                                                length, RDMA_ACCESS_REMOTE_WRITE, &offset);
+    if (!dst_mr) {
+        return -1;
+    }
+    
+    // Write data to destination memory
+    memmove((void*)(dst_mr->hw.paddr + offset), payload, length);
+    rdma_mr_dirty(dst_mr, offset, length);
+    
+    return 0;
+}
+
+/* Where the data a READ asks for is, in one of our MRs
+ * 
+ * Caller holds qp_lock.
+ * 
+ * Returns: a pointer to it, or 0 if the READ is not allowed
+ */
+static char *
+rdma_net_fetch(uint32 remote_mr_id, uint32 remote_key, uint64 remote_addr, uint32 length)
+{
+    uint64 offset;
+    struct rdma_mr *src_mr = rdma_net_remote_mr(remote_mr_id, remote_key, remote_addr,
+                                                length, RDMA_ACCESS_REMOTE_READ, &offset);
+    return src_mr ? (char*)(src_mr->hw.paddr + offset) : 0;
+}
+
+/* Post the receiver's completion for a WRITE of length bytes */
+static void
+rdma_net_complete_write(struct rdma_qp *qp, uint32 length)
+{
+    // Post completion to CQ (receiver side)
+    struct rdma_completion comp = {
+        .wr_id = 0,  // Receiver doesn't know sender's wr_id
+        .byte_len = length,
+        .status = RDMA_WC_SUCCESS,
+        .opcode = RDMA_OP_WRITE,
+    };
+    qp->cq[qp->cq_tail] = comp;
+    qp->cq_tail = (qp->cq_tail + 1) % qp->cq_size;
+    qp->stats_completions++;
+}
+
+/* Apply an incoming WRITE to the destination MR and post the
+ * receiver's completion on qp
+ * 
+ * Caller holds qp_lock.
+ * 
+ * Returns: 0 on success, -1 if the WRITE is not allowed
+ */
+static int
+rdma_net_deliver_write(struct rdma_qp *qp, uint32 remote_mr_id, uint32 remote_key,
+                       uint64 remote_addr, char *payload, uint32 length)
+{
+    if (rdma_net_place(remote_mr_id, remote_key, remote_addr, payload, length) < 0) {
+        return -1;
+    }
+    rdma_net_complete_write(qp, length);
+    return 0;
+}
+
+/* Deliver a datagram into a UD QP's oldest posted receive
+ * 
+ * Caller holds qp_lock. Drops (and counts) datagrams for the wrong
+ * Q_Key or with no receive posted.
+ */
+static void
+rdma_net_deliver_ud(struct rdma_qp *qp, uint8 *src_mac, uint16 src_qp,
+                    uint32 qkey, char *payload, uint32 length)
+{
+    if (qp->type != RDMA_QPT_UD || qkey != qp->qkey ||
+        qp->rq_head == qp->rq_tail) {
+        qp->stats_rx_drops++;
+        return;
+    }
+    
+    // Take the oldest posted receive, whatever happens to the datagram
+    uint64 wr_id = qp->rq[qp->rq_head].wr_id;
+    uint32 mr_id = qp->rq[qp->rq_head].mr_id;
+    uint64 offset = qp->rq[qp->rq_head].offset;
+    uint32 buflen = qp->rq[qp->rq_head].length;
+    qp->rq_head = (qp->rq_head + 1) % RDMA_RQ_SIZE;
+    
+    // The MR must still be there and still the QP owner's
+    struct rdma_mr *mr = (mr_id >= 1 && mr_id <= MAX_MRS) ? &mr_table[mr_id - 1] : 0;
+    uint8 status = RDMA_WC_SUCCESS;
+    if (!mr || !mr->hw.valid || mr->owner != qp->owner ||
+        offset + buflen > mr->hw.length) {
+        status = RDMA_WC_LOC_PROT_ERR;
+    } else if (sizeof(struct rdma_ud_grh) + length > buflen) {
+        status = RDMA_WC_LOC_LEN_ERR;
+    }
+    
+    if (status == RDMA_WC_SUCCESS) {
+        struct rdma_ud_grh grh;
+        memmove(grh.smac, src_mac, 6);
+        grh.src_qp = src_qp;
+        char *buf = (char*)(mr->hw.paddr + offset);
+        memmove(buf, &grh, sizeof(grh));
+        memmove(buf + sizeof(grh), payload, length);
+    } else {
+        qp->stats_rx_drops++;
+    }
+    
+    struct rdma_completion comp = {
+        .wr_id = wr_id,
+        .byte_len = status == RDMA_WC_SUCCESS ? sizeof(struct rdma_ud_grh) + length : 0,
+        .status = status,
+        .opcode = RDMA_OP_RECV,
+    };
+    qp->cq[qp->cq_tail] = comp;
+    qp->cq_tail = (qp->cq_tail + 1) % qp->cq_size;
+    qp->stats_completions++;
+}
+
+/* Is the peer on this node?
+ * 
+ * Frames to our own MAC would leave through the NIC and never come
+ * back, so a QP whose peer is local is served by direct delivery,
+ * the way loopback mode serves unconnected QPs.
+ */
+static int
+rdma_net_is_local(uint8 *mac)
+{
+    for (int i = 0; i < nports; i++) {
+        if (memcmp(mac, local_macs[i], 6) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Same-host WRITE: apply it to the peer QP's MR and complete both
+ * sides at once, as if the frame had gone out and been ACKed.
+ * 
+ * Caller holds qp_lock.
+ */
+static int
+rdma_net_local_write(struct rdma_qp *qp, struct rdma_work_request *wr)
+{
+    uint32 dst = qp->remote_qp_num;
+    int ok = dst < MAX_QPS && qp_table[dst].valid && qp_table[dst].type == RDMA_QPT_RC;
+    
+    qp->tx_seq_num++;
+    if (qp->state == QP_STATE_RTR) {
+        qp->state = QP_STATE_RTS;
+    }
+    if (ok) {
+        struct rdma_qp *peer = &qp_table[dst];
+        if (peer->state == QP_STATE_RTR) {
+            peer->state = QP_STATE_RTS;
+        }
+        ok = rdma_net_deliver_write(peer, wr->remote_mr_id, wr->remote_key,
+                                    wr->remote_addr, (char*)wr->local_offset,
+                                    wr->length) == 0;
+    }
+    
+    // On the wire a refused WRITE is dropped and never ACKed; here
+    // the sender can at least be told.
+    if ((wr->flags & RDMA_WR_SIGNALED) || !ok) {
+        struct rdma_completion comp = {
+            .wr_id = wr->wr_id,
+            .byte_len = 0,       // as for an ACK
+            .status = ok ? RDMA_WC_SUCCESS : RDMA_WC_REM_ACCESS_ERR,
+            .opcode = RDMA_OP_WRITE,
+        };
+        qp->cq[qp->cq_tail] = comp;
+        qp->cq_tail = (qp->cq_tail + 1) % qp->cq_size;
+        if (ok) {
+            qp->stats_completions++;
+        } else {
+            qp->stats_errors++;
+        }
+    }
+    return 0;
+}
+
+/* Put a READ's data where the requester asked for it, and complete
+ * the READ
+ * 
+ * The MR must still be there and still the QP owner's. data is 0 if
+ * the response was refused or too short.
+ * 
+ * Caller holds qp_lock.
+ */
+static void
+rdma_net_read_done(struct rdma_qp *qp, uint64 wr_id, int signaled, uint32 mr_id,
+                   uint64 offset, uint32 length, char *data)
+{
+    struct rdma_mr *mr = (mr_id >= 1 && mr_id <= MAX_MRS) ? &mr_table[mr_id - 1] : 0;
+    uint8 status = RDMA_WC_SUCCESS;
+    
+    if (!data) {
+        status = RDMA_WC_REM_ACCESS_ERR;
+    } else if (!mr || !mr->hw.valid || mr->owner != qp->owner ||
+               offset + length > mr->hw.length) {
+        status = RDMA_WC_LOC_PROT_ERR;
+    } else {
+        memmove((void*)(mr->hw.paddr + offset), data, length);
+        rdma_mr_dirty(mr, offset, length);
+    }
+    
+    if (signaled || status != RDMA_WC_SUCCESS) {
+        struct rdma_completion comp = {
+            .wr_id = wr_id,
+            .byte_len = status == RDMA_WC_SUCCESS ? length : 0,
+            .status = status,
+            .opcode = RDMA_OP_READ,
+        };
+        qp->cq[qp->cq_tail] = comp;
+        qp->cq_tail = (qp->cq_tail + 1) % qp->cq_size;
+        if (status == RDMA_WC_SUCCESS) {
+            qp->stats_completions++;
+        } else {
+            qp->stats_errors++;
+        }
+    }
+}
+
+/* Same-host READ: copy from the peer QP's MR and complete at once
+ * 
+ * Returns -1, as rdma_net_tx_read() does, if the local MR may not be
+ * written. Caller holds qp_lock.
+ */
+static int
+rdma_net_local_read(struct rdma_qp *qp, struct rdma_work_request *wr)
+{
+    uint32 dst = qp->remote_qp_num;
+    struct rdma_mr *mr = rdma_mr_get_owner(wr->local_mr_id, qp->owner);
+    char *data = 0;
+    
+    if (!mr || !(mr->hw.access_flags & RDMA_ACCESS_LOCAL_WRITE)) {
+        return -1;
+    }
+    qp->tx_seq_num++;
+    if (qp->state == QP_STATE_RTR) {
+        qp->state = QP_STATE_RTS;
+    }
+    if (dst < MAX_QPS && qp_table[dst].valid && qp_table[dst].type == RDMA_QPT_RC) {
+        if (qp_table[dst].state == QP_STATE_RTR) {
+            qp_table[dst].state = QP_STATE_RTS;
+        }
+        data = rdma_net_fetch(wr->remote_mr_id, wr->remote_key, wr->remote_addr, wr->length);
+    }
+    
+    // local_offset is the local MR's address
+    rdma_net_read_done(qp, wr->wr_id, wr->flags & RDMA_WR_SIGNALED, wr->local_mr_id,
+                       wr->local_offset - mr->hw.paddr, wr->length, data);
+    return 0;
+}
+
+/* ============================================
+ * WRITE COMBINING
+ * ============================================ */
+
+/* Remember a signaled WR until the ACK for seq_num arrives */
+static void
+rdma_net_track_ack(struct rdma_qp *qp, struct rdma_work_request *wr, uint32 seq_num)
+{
+    if (!(wr->flags & RDMA_WR_SIGNALED)) {
+        return;
+    }
+    for (int i = 0; i < 64; i++) {
+        if (!qp->pending_acks[i].valid) {
+            qp->pending_acks[i].seq_num = seq_num;
+            qp->pending_acks[i].wr_id = wr->wr_id;
+            qp->pending_acks[i].opcode = RDMA_OP_WRITE;
+            qp->pending_acks[i].valid = 1;
+            break;
+        }
+    }
+}
+
+/* Send the QP's combined frame, if it has one
+ * 
+ * A frame holding a single WRITE goes out as a plain WRITE, so a
+ * lone small WRITE looks on the wire exactly as it did before
+ * combining. Called when a WR can't join the frame, when the frame
+ * is full, when the owner polls an empty CQ, on destroy, and from
+ * the clock tick so a quiet QP never sits on its WRITEs.
+ * 
+ * Caller holds qp_lock.
+ */
+void
+rdma_net_flush(struct rdma_qp *qp)
+{
+    struct mbuf *m = qp->wc_m;
+    if (!m) {
+        return;
+    }
+    qp->wc_m = 0;
+    
+    struct rdma_pkt_hdr *rdmahdr = rdma_net_pkt(m);
+    uint32 body = m->head + m->len - (char*)(rdmahdr + 1);
+    
+    if (qp->wc_count == 1) {
+        // Fold the sub-header into the packet header
+        struct rdma_write_sub *sub = (struct rdma_write_sub*)(rdmahdr + 1);
+        rdmahdr->opcode = RDMA_NET_OP_WRITE;
+        rdmahdr->local_mr_id = sub->local_mr_id;
+        rdmahdr->remote_mr_id = sub->remote_mr_id;
+        rdmahdr->remote_addr = sub->remote_addr;
+        rdmahdr->length = sub->length;
+        rdmahdr->remote_key = sub->remote_key;
+        memmove(sub, sub + 1, body - sizeof(*sub));
+        mbuftrim(m, sizeof(*sub));
+    } else {
+        rdmahdr->length = htonl(body);
+    }
+    if (qp->crc) {
+        // Folding moved the data, so it is summed here, not as added
+        rdmahdr->flags |= RDMA_PKT_FLAG_CRC;
+        rdma_net_put_crc(m, crc32c(0, rdmahdr + 1, m->head + m->len - (char*)(rdmahdr + 1)));
+    }
+    
+    qp->stats_wc_frames++;
+    if (rdma_net_xmit(qp, m) < 0) {
+        mbuffree(m);
+    }
+}
+
+/* Append a small WRITE to the QP's combined frame, starting a new
+ * frame if there is none or this one would not fit
+ * 
+ * Caller holds qp_lock.
+ */
+static int
+rdma_net_wc_add(struct rdma_qp *qp, struct rdma_work_request *wr)
+{
+    uint32 need = sizeof(struct rdma_write_sub) + wr->length;
+    
+    if (qp->wc_m &&
+        qp->wc_m->len - sizeof(struct eth) + need +
+        (qp->crc ? RDMA_CRC_LEN : 0) > RDMA_NET_MTU) {
+        rdma_net_flush(qp);
+    }
+    
+    if (!qp->wc_m) {
+        struct mbuf *m = mbufalloc(0);
+        if (!m) {
+            return -1;
+        }
+        
+        rdma_net_start(m, qp, &qp->paths[0]);
+        
+        // The per-WRITE fields live in the sub-headers; flush fills in length
+        struct rdma_pkt_hdr *rdmahdr = mbufputhdr(m, *rdmahdr);
+        memset(rdmahdr, 0, sizeof(*rdmahdr));
+        rdmahdr->opcode = RDMA_NET_OP_WRITE_MULTI;
+        rdmahdr->src_qp = htons(qp->id);
+        rdmahdr->dst_qp = htons(qp->remote_qp_num);
+        rdmahdr->seq_num = htonl(qp->tx_seq_num);
+        
+        qp->wc_m = m;
+        qp->wc_count = 0;
+    }
+    
+    struct rdma_pkt_hdr *rdmahdr = rdma_net_pkt(qp->wc_m);
+    if (wr->flags & RDMA_WR_SIGNALED) {
+        rdmahdr->flags |= RDMA_PKT_FLAG_SIGNALED;
+    }
+    
+    struct rdma_write_sub *sub = mbufputhdr(qp->wc_m, *sub);
+    sub->local_mr_id = htonl(wr->local_mr_id);
+    sub->remote_mr_id = htonl(wr->remote_mr_id);
+    sub->remote_addr = htonll(wr->remote_addr);
+    sub->length = htonl(wr->length);
+    sub->remote_key = htonl(wr->remote_key);
+    memmove(mbufput(qp->wc_m, wr->length), (void*)(wr->local_offset), wr->length);
+    
+    rdma_net_track_ack(qp, wr, qp->tx_seq_num);
+    qp->tx_seq_num++;
+    qp->wc_count++;
+    qp->stats_wc_writes++;
+    
+    if (qp->state == QP_STATE_RTR) {
+        qp->state = QP_STATE_RTS;
+    }
+    
+    if (qp->wc_count >= RDMA_WC_MAX_WRS) {
+        rdma_net_flush(qp);
+    }
+    return 0;
+}
+
+static void rdma_net_seg_complete(struct rdma_qp *qp);
+
+/* Clock tick: push out every combined frame that is still waiting,
+ * and anything the scheduler could not fit in the TX ring, and give
+ * up on segmented WRITEs that have waited too long for the rest
+ */
+void
+rdma_net_tick(void)
+{
+    acquire(&qp_lock);
+    for (int i = 0; i < MAX_QPS; i++) {
+        if (qp_table[i].valid && qp_table[i].wc_m) {
+            rdma_net_flush(&qp_table[i]);
+        }
+        if (qp_table[i].valid && qp_table[i].network_mode) {
+            rdma_net_seg_complete(&qp_table[i]);
+        }
+    }
+    release(&qp_lock);
+    rdma_sched_run();
+}
+
+/* ============================================
+ * SEGMENTATION AND MULTIPATH
+ * ============================================ */
+
+/* Segments of a WRITE, as a got bitmap with all of them present */
+static inline uint64
+rdma_net_seg_mask(uint32 count)
+{
+    return count >= 64 ? ~0ULL : (1ULL << count) - 1;
+}
+
+/* Payload bytes in each of qp's WRITE_SEG frames */
+uint32
+rdma_net_seg_len(struct rdma_qp *qp)
+{
+    return rdma_net_mtu(qp) - sizeof(struct rdma_pkt_hdr) - sizeof(struct rdma_seg_hdr);
+}
+
+/* Start segment i of count of wr, the len bytes at off, on the
+ * next of the QP's paths: every header up to the payload
+ * 
+ * Returns: the segment header, which a CRC covers
+ */
+static struct rdma_seg_hdr *
+rdma_net_seg_start(struct rdma_qp *qp, struct mbuf *m, struct rdma_work_request *wr,
+                   uint32 i, uint32 count, uint32 off, uint32 len)
+{
+    struct rdma_path *path = &qp->paths[qp->next_path];
+    qp->next_path = (qp->next_path + 1) % qp->npaths;
+    
+    rdma_net_start(m, qp, path);
+    
+    struct rdma_pkt_hdr *rdmahdr = mbufputhdr(m, *rdmahdr);
+    rdmahdr->opcode = RDMA_NET_OP_WRITE_SEG;
+    rdmahdr->flags = wr->flags & RDMA_WR_SIGNALED ? RDMA_PKT_FLAG_SIGNALED : 0;
+    if (qp->crc) {
+        rdmahdr->flags |= RDMA_PKT_FLAG_CRC;
+    }
+    rdmahdr->src_qp = htons(qp->id);
+    rdmahdr->dst_qp = htons(qp->remote_qp_num);
+    rdmahdr->reserved1 = 0;
+    rdmahdr->seq_num = htonl(qp->tx_seq_num);
+    rdmahdr->local_mr_id = htonl(wr->local_mr_id);
+    rdmahdr->remote_mr_id = htonl(wr->remote_mr_id);
+    rdmahdr->remote_addr = htonll(wr->remote_addr + off);
+    rdmahdr->length = htonl(len);
+    rdmahdr->remote_key = htonl(wr->remote_key);
+    
+    struct rdma_seg_hdr *seg = mbufputhdr(m, *seg);
+    seg->msg = htonl(qp->tx_msg);
+    seg->index = htons(i);
+    seg->count = htons(count);
+    seg->total_len = htonl(wr->length);
+    return seg;
+}
+
+/* Queue a WRITE's finished segments, all or none, and track its ACK
+ * 
+ * Returns: 0, or -1 if the scheduler has no room for them
+ */
+static int
+rdma_net_seg_queue(struct rdma_qp *qp, struct rdma_work_request *wr,
+                   struct mbuf **segs, uint32 count)
+{
+    if (rdma_sched_xmitv(qp, segs, count) < 0) {
+        return -1;
+    }
+    
+    rdma_net_track_ack(qp, wr, qp->tx_seq_num);
+    qp->tx_seq_num++;
+    qp->tx_msg++;
+    qp->stats_seg_frames += count;
+    
+    if (qp->state == QP_STATE_RTR) {
+        qp->state = QP_STATE_RTS;
+    }
+    return 0;
+}
+
+/* Send a WRITE as WRITE_SEG frames, dealt round robin across the
+ * QP's paths
+ * 
+ * Every segment is built before any is queued, and they are queued
+ * together, all or none: a WRITE that went out in part would never
+ * complete, and would hold up every later one at the receiver.
+ * 
+ * Caller holds qp_lock.
+ */
+static int
+rdma_net_tx_seg(struct rdma_qp *qp, struct rdma_work_request *wr)
+{
+    struct mbuf *segs[RDMA_SEG_MAX];
+    uint32 seg_len = rdma_net_seg_len(qp);
+    uint32 count = (wr->length + seg_len - 1) / seg_len;
+    
+    if (count == 0) {
+        count = 1;
+    }
+    if (count > RDMA_SEG_MAX || rdma_sched_room(qp) < count) {
+        return -1;
+    }
+    
+    for (uint32 i = 0; i < count; i++) {
+        segs[i] = mbufalloc(0);
+        if (!segs[i]) {
+            while (i > 0) {
+                mbuffree(segs[--i]);
+            }
+            return -1;
+        }
+    }
+    
+    for (uint32 i = 0; i < count; i++) {
+        struct mbuf *m = segs[i];
+        uint32 off = i * seg_len;
+        uint32 len = wr->length - off < seg_len ? wr->length - off : seg_len;
+        struct rdma_seg_hdr *seg = rdma_net_seg_start(qp, m, wr, i, count, off, len);
+        
+        if (qp->crc) {
+            // The CRC covers the segment header too
+            uint32 crc = crc32c(0, seg, sizeof(*seg));
+            crc = crc32c_copy(crc, mbufput(m, len), (void*)(wr->local_offset + off), len);
+            rdma_net_put_crc(m, crc);
+        } else {
+            memmove(mbufput(m, len), (void*)(wr->local_offset + off), len);
+        }
+        if (((struct eth*)m->head)->type == htons(ETHTYPE_IP)) {
+            net_udp_fill(m, sizeof(struct eth));
+        }
+    }
+    
+    // Room was checked above, under qp_lock: this can't fail
+    if (rdma_net_seg_queue(qp, wr, segs, count) < 0) {
+        for (uint32 i = 0; i < count; i++) {
+            mbuffree(segs[i]);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* Send a WRITE whose payload is already in segs, seg_len bytes to a
+ * segment (the last may be shorter), as rdma_net_tx_seg() would send
+ * it from an MR
+ * 
+ * rdma_qp_sendfile() fills the segments from the buffer cache with
+ * room left in front for the headers, which go in here. The mbufs
+ * are the caller's again if this fails.
+ * 
+ * Caller holds qp_lock.
+ * 
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_net_tx_prefilled(struct rdma_qp *qp, struct rdma_work_request *wr,
+                      struct mbuf **segs, uint32 count)
+{
+    uint32 seg_len = rdma_net_seg_len(qp);
+    uint32 hlen = sizeof(struct eth) + sizeof(struct rdma_pkt_hdr) + sizeof(struct rdma_seg_hdr);
+    
+    // A peer on this node is served by copying from the source MR,
+    // and there is none
+    if (rdma_net_is_local(qp->remote_mac)) {
+        return -1;
+    }
     
-    printf("rdma_net: initialized (MAC: %x:%x:%x:%x:%x:%x)\n",
-           local_mac[0], local_mac[1], local_mac[2], 
-           local_mac[3], local_mac[4], local_mac[5]);
+    // The segments were cut to the QP's path MTU before qp_lock was
+    // taken; a path change since then leaves them the wrong size
+    if (count == 0 || count > RDMA_SEG_MAX || rdma_sched_room(qp) < count ||
+        (count - 1) * seg_len >= wr->length || count * seg_len < wr->length) {
+        return -1;
+    }
+    for (uint32 i = 0; i < count; i++) {
+        uint32 left = wr->length - i * seg_len;
+        if (segs[i]->len != (left < seg_len ? left : seg_len) ||
+            segs[i]->head - segs[i]->buf < hlen + RDMA_UDP_HDRLEN) {
+            return -1;
+        }
+    }
+    rdma_net_flush(qp);
+    
+    for (uint32 i = 0; i < count; i++) {
+        struct mbuf *m = segs[i];
+        char *payload = m->head;
+        uint32 len = m->len;
+        
+        // Back up over the headroom and build the headers there; they
+        // end where the payload starts
+        struct rdma_path *path = &qp->paths[qp->next_path];
+        m->head = payload - hlen - (path->ip ? RDMA_UDP_HDRLEN : 0);
+        m->len = 0;
+        struct rdma_seg_hdr *seg = rdma_net_seg_start(qp, m, wr, i, count, i * seg_len, len);
+        mbufput(m, len);
+        if (qp->crc) {
+            rdma_net_put_crc(m, crc32c(crc32c(0, seg, sizeof(*seg)), payload, len));
+        }
+        if (path->ip) {
+            net_udp_fill(m, sizeof(struct eth));
+        }
+    }
+    
+    return rdma_net_seg_queue(qp, wr, segs, count);
+}
+
+/* Has any segmented WRITE waited RDMA_SEG_TIMEOUT for the rest? */
+static int
+rdma_net_seg_stale(struct rdma_qp *qp, uint64 now)
+{
+    for (int i = 0; i < RDMA_SEG_SLOTS; i++) {
+        if (qp->rx_seg[i].valid && now - qp->rx_seg[i].start > RDMA_SEG_TIMEOUT) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Complete, in order, every finished segmented WRITE from the oldest
+ * on
+ * 
+ * Nothing resends a lost segment, so once a WRITE has waited
+ * RDMA_SEG_TIMEOUT the oldest one, whole or missing, is given up on,
+ * unACKed: its sender's WR never completes, as for a lost plain
+ * WRITE, and those behind it aren't held up for good. A refused one
+ * completes nothing and is never ACKed either.
+ * 
+ * Caller holds qp_lock.
+ */
+static void
+rdma_net_seg_complete(struct rdma_qp *qp)
+{
+    struct rdma_seg_rx *r;
+    uint64 now = readtime();
+    
+    for (;;) {
+        r = &qp->rx_seg[qp->rx_msg % RDMA_SEG_SLOTS];
+        if (r->valid && r->got == rdma_net_seg_mask(r->count)) {
+            if (!r->failed) {
+                rdma_net_complete_write(qp, r->length);
+                rdma_net_tx_ack(qp, r->src_qp, r->seq, 1, &r->from);
+            }
+        } else if (rdma_net_seg_stale(qp, now)) {
+            if (r->valid) {
+                qp->stats_rx_drops++;
+            }
+        } else {
+            break;
+        }
+        r->valid = 0;
+        qp->rx_msg++;
+    }
+}
+
+/* Receive one WRITE_SEG frame
+ * 
+ * Each segment is placed as it arrives. Once all of a WRITE's are
+ * in, it completes, with a single ACK, unless an earlier segmented
+ * WRITE is still incomplete; then it waits, and completes right after
+ * that one, or once that one is given up on (rdma_net_seg_complete).
+ * Only the next RDMA_SEG_SLOTS WRITEs can be in progress; segments of
+ * later ones, and duplicates, are dropped.
+ * 
+ * Caller holds qp_lock.
+ */
+static void
+rdma_net_rx_seg(struct rdma_qp *qp, struct mbuf *m, struct rdma_path *from, uint16 src_qp,
+                uint32 seq_num, uint32 remote_mr_id, uint32 remote_key,
+                uint64 remote_addr, uint32 length)
+{
+    struct rdma_seg_hdr *seg = mbufpullhdr(m, *seg);
+    char *payload = seg ? rdma_net_body(m, length) : 0;
+    if (!payload) {
+        return;
+    }
+    
+    uint32 msg = ntohl(seg->msg);
+    uint32 index = ntohs(seg->index);
+    uint32 count = ntohs(seg->count);
+    if (msg - qp->rx_msg >= RDMA_SEG_SLOTS ||
+        count == 0 || count > RDMA_SEG_MAX || index >= count) {
+        qp->stats_rx_drops++;
+        return;
+    }
+    
+    struct rdma_seg_rx *r = &qp->rx_seg[msg % RDMA_SEG_SLOTS];
+    if (!r->valid) {
+        r->valid = 1;
+        r->msg = msg;
+        r->seq = seq_num;
+        r->count = count;
+        r->got = 0;
+        r->start = readtime();
+        r->length = ntohl(seg->total_len);
+        r->failed = 0;
+    }
+    if (r->count != count || (r->got & (1ULL << index))) {
+        return;
+    }
+    r->got |= 1ULL << index;
+    if (rdma_net_place(remote_mr_id, remote_key, remote_addr, payload, length) < 0) {
+        r->failed = 1;
+    }
+    r->src_qp = src_qp;
+    r->from = *from;
+    rdma_net_seg_complete(qp);
 }
 
 /* Transmit RDMA_WRITE packet
  * 
  * Builds and sends an RDMA packet over the network.
  * Called from rdma_process_work_requests() in network mode.
+ * WRITEs of up to RDMA_WC_MAX_LEN bytes are combined into shared
+ * frames (see rdma_net_wc_add); anything larger first flushes what is
+ * queued, so WRITEs still leave the QP in posting order. WRITEs that
+ * don't fit one frame, and all WRITEs on a multipath QP, are
+ * segmented (see rdma_net_tx_seg).
  */
 int
 rdma_net_tx_write(struct rdma_qp *qp, struct rdma_work_request *wr)
 {
+    // Peer on this node: skip the frame and the NIC
+    if (rdma_net_is_local(qp->remote_mac)) {
+        return rdma_net_local_write(qp, wr);
+    }
+    
     // Get source MR
-    struct rdma_mr *src_mr = rdma_mr_get(wr->local_mr_id);
+    struct rdma_mr *src_mr = rdma_mr_get_owner(wr->local_mr_id, qp->owner);
     if (!src_mr) {
         return -1;
     }
     
+    if (qp->npaths == 1 && wr->length <= RDMA_WC_MAX_LEN) {
+        return rdma_net_wc_add(qp, wr);
+    }
+    rdma_net_flush(qp);
+    
+    if (qp->npaths > 1 || wr->length > rdma_net_mtu(qp) - sizeof(struct rdma_pkt_hdr)) {
+        return rdma_net_tx_seg(qp, wr);
+    }
+    
     // Allocate mbuf for packet
     struct mbuf *m = mbufalloc(0);
     if (!m) {
         return -1;
     }
     
-    // Build Ethernet header
-    struct eth *ethhdr = mbufputhdr(m, *ethhdr);
-    memmove(ethhdr->dhost, qp->remote_mac, 6);
-    memmove(ethhdr->shost, local_mac, 6);
-    ethhdr->type = htons(ETHTYPE_RDMA);
+    // Build Ethernet (and maybe IP and UDP) headers
+    rdma_net_start(m, qp, &qp->paths[0]);
     
     // Build RDMA header
     struct rdma_pkt_hdr *rdmahdr = mbufputhdr(m, *rdmahdr);
@@ -69,20 +1033,24 @@ rdma_net_tx_write(struct rdma_qp *qp, struct rdma_work_request *wr)
         mbuffree(m);
         return -1;
     }
-    memmove(payload, (void*)(wr->local_offset), wr->length);
+    if (qp->crc) {
+        // Summed as it is copied: one pass over the data
+        rdmahdr->flags |= RDMA_PKT_FLAG_CRC;
+        rdma_net_put_crc(m, crc32c_copy(0, payload, (void*)(wr->local_offset), wr->length));
+    } else {
+        memmove(payload, (void*)(wr->local_offset), wr->length);
+    }
     
-    // Track this WR for ACK matching (if signaled)
-    if (wr->flags & RDMA_WR_SIGNALED) {
-        for (int i = 0; i < 64; i++) {
-            if (!qp->pending_acks[i].valid) {
-                qp->pending_acks[i].seq_num = qp->tx_seq_num;
-                qp->pending_acks[i].wr_id = wr->wr_id;
-                qp->pending_acks[i].valid = 1;
-                break;
-            }
-        }
+    // Queue packet for transmission; we hold qp_lock, so the ACK
+    // can't be processed before the WR is tracked below
+    if (rdma_net_xmit(qp, m) < 0) {
+        mbuffree(m);
+        return -1;
     }
     
+    // Track this WR for ACK matching (if signaled)
+    rdma_net_track_ack(qp, wr, qp->tx_seq_num);
+    
     // Increment sequence number
     qp->tx_seq_num++;
     
@@ -91,26 +1059,157 @@ rdma_net_tx_write(struct rdma_qp *qp, struct rdma_work_request *wr)
         qp->state = QP_STATE_RTS;
     }
     
-    // Transmit packet
-    printf("rdma_net_tx: sending WRITE packet (seq=%d, len=%d)\n", qp->tx_seq_num - 1, wr->length);
-    e1000_transmit(m);
+    return 0;
+}
+
+/* Transmit a READ request
+ * 
+ * The request is a header alone; the peer answers with one READ_RESP
+ * frame holding the data, so a READ may be at most a frame's payload.
+ * The request names the local MR, but the response is placed by the
+ * pending entry the READ leaves, matched by sequence number, and
+ * completes the READ. Unlike a WRITE, every READ leaves one, signaled
+ * or not.
+ * 
+ * Caller holds qp_lock.
+ */
+int
+rdma_net_tx_read(struct rdma_qp *qp, struct rdma_work_request *wr)
+{
+    // Peer on this node: copy straight out of its MR
+    if (rdma_net_is_local(qp->remote_mac)) {
+        return rdma_net_local_read(qp, wr);
+    }
+    
+    struct rdma_mr *dst_mr = rdma_mr_get_owner(wr->local_mr_id, qp->owner);
+    if (!dst_mr || !(dst_mr->hw.access_flags & RDMA_ACCESS_LOCAL_WRITE) ||
+        wr->length > rdma_net_mtu(qp) - sizeof(struct rdma_pkt_hdr)) {
+        return -1;
+    }
+    
+    int slot = -1;
+    for (int i = 0; i < 64; i++) {
+        if (!qp->pending_acks[i].valid) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        return -1;
+    }
+    
+    // The READ goes behind any WRITEs posted before it
+    rdma_net_flush(qp);
+    
+    struct mbuf *m = mbufalloc(0);
+    if (!m) {
+        return -1;
+    }
+    rdma_net_start(m, qp, &qp->paths[0]);
+    
+    struct rdma_pkt_hdr *rdmahdr = mbufputhdr(m, *rdmahdr);
+    memset(rdmahdr, 0, sizeof(*rdmahdr));
+    rdmahdr->opcode = RDMA_NET_OP_READ;
+    rdmahdr->flags = wr->flags & RDMA_WR_SIGNALED ? RDMA_PKT_FLAG_SIGNALED : 0;
+    rdmahdr->src_qp = htons(qp->id);
+    rdmahdr->dst_qp = htons(qp->remote_qp_num);
+    rdmahdr->seq_num = htonl(qp->tx_seq_num);
+    rdmahdr->local_mr_id = htonl(wr->local_mr_id);
+    rdmahdr->remote_mr_id = htonl(wr->remote_mr_id);
+    rdmahdr->remote_addr = htonll(wr->remote_addr);
+    rdmahdr->length = htonl(wr->length);
+    rdmahdr->remote_key = htonl(wr->remote_key);
+    
+    if (rdma_net_xmit(qp, m) < 0) {
+        mbuffree(m);
+        return -1;
+    }
+    
+    // We hold qp_lock, so the response can't arrive before this
+    qp->pending_acks[slot].seq_num = qp->tx_seq_num;
+    qp->pending_acks[slot].wr_id = wr->wr_id;
+    qp->pending_acks[slot].opcode = RDMA_OP_READ;
+    qp->pending_acks[slot].signaled = (wr->flags & RDMA_WR_SIGNALED) != 0;
+    qp->pending_acks[slot].mr_id = wr->local_mr_id;
+    qp->pending_acks[slot].offset = wr->local_offset - dst_mr->hw.paddr;
+    qp->pending_acks[slot].length = wr->length;
+    qp->pending_acks[slot].valid = 1;
+    
+    qp->tx_seq_num++;
+    if (qp->state == QP_STATE_RTR) {
+        qp->state = QP_STATE_RTS;
+    }
+    return 0;
+}
+
+/* Transmit a UD SEND
+ * 
+ * The destination MAC, QP and Q_Key come from the WR (see rdma.h).
+ * Nothing is tracked: there is no ACK, and the WR is done once the
+ * frame is queued.
+ */
+int
+rdma_net_tx_ud(struct rdma_qp *qp, struct rdma_work_request *wr)
+{
+    if (wr->length > RDMA_UD_MTU) {
+        return -1;
+    }
+    
+    // Peer on this node: deliver straight into its receive queue
+    uint8 dst_mac[6];
+    rdma_ud_mac(wr->remote_addr, dst_mac);
+    if (rdma_net_is_local(dst_mac)) {
+        qp->tx_seq_num++;
+        if (wr->remote_mr_id < MAX_QPS && qp_table[wr->remote_mr_id].valid) {
+            rdma_net_deliver_ud(&qp_table[wr->remote_mr_id], local_macs[0], qp->id,
+                                wr->remote_key, (char*)wr->local_offset, wr->length);
+        }
+        return 0;
+    }
+    
+    struct mbuf *m = mbufalloc(0);
+    if (!m) {
+        return -1;
+    }
+    
+    // Build Ethernet header
+    rdma_net_eth(m, dst_mac, 0);
+    
+    // Build RDMA header; remote_key carries the Q_Key
+    struct rdma_pkt_hdr *rdmahdr = mbufputhdr(m, *rdmahdr);
+    memset(rdmahdr, 0, sizeof(*rdmahdr));
+    rdmahdr->opcode = RDMA_NET_OP_UD_SEND;
+    rdmahdr->src_qp = htons(qp->id);
+    rdmahdr->dst_qp = htons(wr->remote_mr_id);
+    rdmahdr->seq_num = htonl(qp->tx_seq_num++);
+    rdmahdr->length = htonl(wr->length);
+    rdmahdr->remote_key = htonl(wr->remote_key);
+    
+    memmove(mbufput(m, wr->length), (void*)(wr->local_offset), wr->length);
     
+    if (rdma_sched_xmit(qp, m) < 0) {
+        mbuffree(m);
+        return -1;
+    }
     return 0;
 }
 
-/* Send ACK packet to remote peer */
+/* Send ACK packet to remote peer
+ * 
+ * Acknowledges count WRITEs starting at seq_num. A count above one
+ * (for a WRITE_MULTI) travels in local_mr_id; plain ACKs leave it 0.
+ * The ACK goes back the way the WRITE came (rdma_net_reply_path).
+ */
 void
-rdma_net_tx_ack(struct rdma_qp *qp, uint16 remote_qp, uint32 seq_num, uint8 *dst_mac)
+rdma_net_tx_ack(struct rdma_qp *qp, uint16 remote_qp, uint32 seq_num, uint32 count,
+                struct rdma_path *to)
 {
     // Allocate mbuf
     struct mbuf *m = mbufalloc(0);
     if (!m) return;
     
-    // Build Ethernet header
-    struct eth *ethhdr = mbufputhdr(m, *ethhdr);
-    memmove(ethhdr->dhost, dst_mac, 6);
-    memmove(ethhdr->shost, local_mac, 6);
-    ethhdr->type = htons(ETHTYPE_RDMA);
+    // Build Ethernet (and maybe IP and UDP) headers
+    rdma_net_start(m, qp, to);
     
     // Build RDMA ACK header (no payload)
     struct rdma_pkt_hdr *rdmahdr = mbufputhdr(m, *rdmahdr);
@@ -119,25 +1218,92 @@ rdma_net_tx_ack(struct rdma_qp *qp, uint16 remote_qp, uint32 seq_num, uint8 *dst
     rdmahdr->src_qp = htons(qp->id);
     rdmahdr->dst_qp = htons(remote_qp);
     rdmahdr->seq_num = htonl(seq_num);
-    rdmahdr->local_mr_id = 0;
+    rdmahdr->local_mr_id = count > 1 ? htonl(count) : 0;
     rdmahdr->remote_mr_id = 0;
     rdmahdr->remote_addr = 0;
     rdmahdr->length = 0;
     rdmahdr->remote_key = 0;
     
-    // Transmit ACK
-    e1000_transmit(m);
+    // Transmit ACK, ahead of any QP's data
+    if (rdma_net_xmit(0, m) < 0) {
+        mbuffree(m);
+    }
+}
+
+/* Answer a READ with the data it asked for, back the way it came
+ * 
+ * The response echoes the request's sequence number and, in
+ * remote_mr_id, the MR it named.
+ */
+static void
+rdma_net_tx_read_resp(struct rdma_qp *qp, uint16 remote_qp, uint32 seq_num, uint32 mr_id,
+                      char *data, uint32 length, struct rdma_path *to)
+{
+    struct mbuf *m = mbufalloc(0);
+    if (!m) return;
+    
+    rdma_net_start(m, qp, to);
+    
+    struct rdma_pkt_hdr *rdmahdr = mbufputhdr(m, *rdmahdr);
+    memset(rdmahdr, 0, sizeof(*rdmahdr));
+    rdmahdr->opcode = RDMA_NET_OP_READ_RESP;
+    rdmahdr->src_qp = htons(qp->id);
+    rdmahdr->dst_qp = htons(remote_qp);
+    rdmahdr->seq_num = htonl(seq_num);
+    rdmahdr->remote_mr_id = htonl(mr_id);
+    rdmahdr->length = htonl(length);
+    
+    char *payload = mbufput(m, length);
+    if (qp->crc) {
+        rdmahdr->flags |= RDMA_PKT_FLAG_CRC;
+        rdma_net_put_crc(m, crc32c_copy(0, payload, data, length));
+    } else {
+        memmove(payload, data, length);
+    }
+    
+    if (rdma_net_xmit(qp, m) < 0) {
+        mbuffree(m);
+    }
+}
+
+/* Send a connection manager message
+ * 
+ * msg is the rdma_cm_msg plus its QP and MR arrays, len bytes in
+ * all; it goes out as the payload of an otherwise empty RDMA header.
+ */
+int
+rdma_net_tx_cm(uint8 *dst_mac, uint8 opcode, void *msg, uint32 len)
+{
+    struct mbuf *m = mbufalloc(0);
+    if (!m) return -1;
+    
+    // Build Ethernet header
+    rdma_net_eth(m, dst_mac, 0);
+    
+    // CM messages are not addressed to a QP
+    struct rdma_pkt_hdr *rdmahdr = mbufputhdr(m, *rdmahdr);
+    memset(rdmahdr, 0, sizeof(*rdmahdr));
+    rdmahdr->opcode = opcode;
+    rdmahdr->length = htonl(len);
+    
+    memmove(mbufput(m, len), msg, len);
+    
+    if (rdma_sched_xmit(0, m) < 0) {
+        mbuffree(m);
+        return -1;
+    }
+    return 0;
 }
 
 /* Receive and process RDMA packet
  * 
- * Called from net_rx() when ETHTYPE_RDMA packet arrives.
+ * Called from net_rx() when an ETHTYPE_RDMA packet arrives (src_ip
+ * 0), and from net_rx_udp() for one that came by UDP from src_ip;
+ * m starts at the RDMA header either way.
  */
 void
-rdma_net_rx(struct mbuf *m, uint8 *src_mac)
+rdma_net_rx(struct mbuf *m, uint8 *src_mac, uint32 src_ip)
 {
-    printf("rdma_net_rx: received packet\n");
-    
     // Parse RDMA header
     struct rdma_pkt_hdr *hdr = mbufpullhdr(m, *hdr);
     if (!hdr) {
@@ -151,11 +1317,17 @@ rdma_net_rx(struct mbuf *m, uint8 *src_mac)
     uint16 dst_qp_num = ntohs(hdr->dst_qp);
     uint16 src_qp_num = ntohs(hdr->src_qp);
     uint32 seq_num = ntohl(hdr->seq_num);
+    uint32 local_mr_id = ntohl(hdr->local_mr_id);
     uint32 remote_mr_id = ntohl(hdr->remote_mr_id);
     uint64 remote_addr = ntohll(hdr->remote_addr);
     uint32 length = ntohl(hdr->length);
+    uint32 remote_key = ntohl(hdr->remote_key);
     
-    printf("rdma_net_rx: opcode=%d dst_qp=%d seq=%d len=%d\n", opcode, dst_qp_num, seq_num, length);
+    // Connection manager traffic is not addressed to a QP
+    if (opcode >= RDMA_NET_OP_CM_REQ && opcode <= RDMA_NET_OP_CM_REJ) {
+        rdma_cm_rx(m, src_mac, opcode, length);
+        return;
+    }
     
     // Get destination QP
     acquire(&qp_lock);
@@ -167,6 +1339,33 @@ rdma_net_rx(struct mbuf *m, uint8 *src_mac)
     }
     
     struct rdma_qp *qp = &qp_table[dst_qp_num];
+    struct rdma_path from;
+    rdma_net_reply_path(qp, m, src_mac, src_ip, &from);
+    
+    // Datagram QPs take nothing but datagrams
+    if (qp->type == RDMA_QPT_UD && opcode != RDMA_NET_OP_UD_SEND) {
+        release(&qp_lock);
+        mbuffree(m);
+        return;
+    }
+    
+    // A frame with a CRC is checked before anything in it is used;
+    // a bad one is dropped unACKed, as a refused WRITE is
+    if (hdr->flags & RDMA_PKT_FLAG_CRC) {
+        uint32 covered = length;
+        if (opcode == RDMA_NET_OP_WRITE_SEG) {
+            covered += sizeof(struct rdma_seg_hdr);
+        } else if (opcode == RDMA_NET_OP_READ) {
+            covered = 0;     // length is what it asks for, not what it carries
+        }
+        if (rdma_net_check_crc(m, covered) < 0) {
+            printf("rdma_net_rx: bad CRC (QP %d seq %d)\n", dst_qp_num, seq_num);
+            qp->stats_crc_errors++;
+            release(&qp_lock);
+            mbuffree(m);
+            return;
+        }
+    }
     
     // Process based on opcode
     switch (opcode) {
@@ -176,94 +1375,146 @@ rdma_net_rx(struct mbuf *m, uint8 *src_mac)
             qp->state = QP_STATE_RTS;
         }
         
-        // Validate destination MR
-        struct rdma_mr *dst_mr = rdma_mr_get(remote_mr_id);
-        if (!dst_mr) {
-            release(&qp_lock);
-            mbuffree(m);
-            return;
+        // Pull payload from mbuf, or where the driver left it
+        char *payload = rdma_net_body(m, length);
+        if (!payload) {
+            break;
         }
         
-        // Check permissions
-        if (!(dst_mr->hw.access_flags & RDMA_ACCESS_REMOTE_WRITE)) {
-            release(&qp_lock);
-            mbuffree(m);
-            return;
+        // Apply it, then ACK back to sender; bad WRITEs are dropped
+        if (rdma_net_deliver_write(qp, remote_mr_id, remote_key, remote_addr,
+                                   payload, length) == 0) {
+            rdma_net_tx_ack(qp, src_qp_num, seq_num, 1, &from);
         }
         
-        // Calculate destination offset
-        uint64 offset;
-        if (remote_addr >= dst_mr->hw.vaddr && 
-            remote_addr < dst_mr->hw.vaddr + dst_mr->hw.length) {
-            offset = remote_addr - dst_mr->hw.vaddr;
-        } else if (remote_addr < dst_mr->hw.length) {
-            offset = remote_addr;
-        } else {
-            release(&qp_lock);
-            mbuffree(m);
-            return;
+        break;
+    }
+    
+    case RDMA_NET_OP_WRITE_MULTI: {
+        if (qp->state == QP_STATE_RTR) {
+            qp->state = QP_STATE_RTS;
         }
         
-        // Check bounds
-        if (offset + length > dst_mr->hw.length) {
-            release(&qp_lock);
-            mbuffree(m);
-            return;
+        // Apply each sub-WRITE. The leading run that succeeds gets a
+        // single ACK; after a refusal, later ones are ACKed one by
+        // one, as if they had come in separate frames.
+        uint32 first = seq_num, run = 0, i = 0;
+        int broken = 0;
+        while (length >= sizeof(struct rdma_write_sub)) {
+            struct rdma_write_sub *sub = mbufpullhdr(m, *sub);
+            if (!sub) {
+                break;
+            }
+            uint32 sublen = ntohl(sub->length);
+            char *payload;
+            if (sublen > length - sizeof(*sub) || !(payload = mbufpull(m, sublen))) {
+                break;
+            }
+            length -= sizeof(*sub) + sublen;
+            
+            int ok = rdma_net_deliver_write(qp, ntohl(sub->remote_mr_id),
+                                            ntohl(sub->remote_key),
+                                            ntohll(sub->remote_addr),
+                                            payload, sublen) == 0;
+            if (ok && !broken) {
+                run++;
+            } else if (ok) {
+                rdma_net_tx_ack(qp, src_qp_num, first + i, 1, &from);
+            } else {
+                broken = 1;
+            }
+            i++;
         }
-        
-        // Pull payload from mbuf
-        char *payload = mbufpull(m, length);
-        if (!payload) {
-            release(&qp_lock);
-            mbuffree(m);
-            return;
+        if (run > 0) {
+            rdma_net_tx_ack(qp, src_qp_num, first, run, &from);
         }
+        break;
+    }
+    
+    case RDMA_NET_OP_WRITE_SEG: {
+        if (qp->state == QP_STATE_RTR) {
+            qp->state = QP_STATE_RTS;
+        }
+        rdma_net_rx_seg(qp, m, &from, src_qp_num, seq_num, remote_mr_id,
+                        remote_key, remote_addr, length);
+        break;
+    }
+    
+    case RDMA_NET_OP_ACK: {
+        // One ACK may cover several WRITEs of a combined frame
+        uint32 count = local_mr_id > 1 ? local_mr_id : 1;
         
-        // Write data to destination memory
-        memmove((void*)(dst_mr->hw.paddr + offset), payload, length);
-        
-        // Post completion to CQ (receiver side)
-        struct rdma_completion comp = {
-            .wr_id = 0,  // Receiver doesn't know sender's wr_id
-            .byte_len = length,
-            .status = RDMA_WC_SUCCESS,
-            .opcode = RDMA_OP_WRITE,
-        };
-        qp->cq[qp->cq_tail] = comp;
-        qp->cq_tail = (qp->cq_tail + 1) % qp->cq_size;
-        qp->stats_completions++;
-        
-        // Send ACK back to sender
-        rdma_net_tx_ack(qp, src_qp_num, seq_num, src_mac);
+        // Find matching pending WRs, in sequence order
+        for (uint32 s = seq_num; s != seq_num + count; s++) {
+            for (int i = 0; i < 64; i++) {
+                if (qp->pending_acks[i].valid && 
+                    qp->pending_acks[i].opcode == RDMA_OP_WRITE &&
+                    qp->pending_acks[i].seq_num == s) {
+                    
+                    // Post completion for sender
+                    struct rdma_completion comp = {
+                        .wr_id = qp->pending_acks[i].wr_id,
+                        .byte_len = length,  // Will be 0 for ACK
+                        .status = RDMA_WC_SUCCESS,
+                        .opcode = RDMA_OP_WRITE,
+                    };
+                    qp->cq[qp->cq_tail] = comp;
+                    qp->cq_tail = (qp->cq_tail + 1) % qp->cq_size;
+                    qp->stats_completions++;
+                    
+                    // Mark this ACK as processed
+                    qp->pending_acks[i].valid = 0;
+                    break;
+                }
+            }
+        }
+        break;
+    }
+    
+    case RDMA_NET_OP_READ: {
+        if (qp->state == QP_STATE_RTR) {
+            qp->state = QP_STATE_RTS;
+        }
         
+        // The data goes back in one frame; a READ that is refused or
+        // would not fit is dropped, as a refused WRITE is
+        uint32 room = RDMA_NET_MTU - sizeof(struct rdma_pkt_hdr) -
+                      (qp->crc ? RDMA_CRC_LEN : 0) - (from.ip ? RDMA_UDP_HDRLEN : 0);
+        char *data = length <= room ?
+                     rdma_net_fetch(remote_mr_id, remote_key, remote_addr, length) : 0;
+        if (data) {
+            rdma_net_tx_read_resp(qp, src_qp_num, seq_num, local_mr_id, data, length, &from);
+        }
         break;
     }
     
-    case RDMA_NET_OP_ACK: {
-        // Find matching pending WR
+    case RDMA_NET_OP_READ_RESP: {
+        // Answers the READ with this sequence number, if one is waiting
         for (int i = 0; i < 64; i++) {
-            if (qp->pending_acks[i].valid && 
+            if (qp->pending_acks[i].valid &&
+                qp->pending_acks[i].opcode == RDMA_OP_READ &&
                 qp->pending_acks[i].seq_num == seq_num) {
-                
-                // Post completion for sender
-                struct rdma_completion comp = {
-                    .wr_id = qp->pending_acks[i].wr_id,
-                    .byte_len = length,  // Will be 0 for ACK
-                    .status = RDMA_WC_SUCCESS,
-                    .opcode = RDMA_OP_WRITE,
-                };
-                qp->cq[qp->cq_tail] = comp;
-                qp->cq_tail = (qp->cq_tail + 1) % qp->cq_size;
-                qp->stats_completions++;
-                
-                // Mark this ACK as processed
                 qp->pending_acks[i].valid = 0;
+                char *data = length == qp->pending_acks[i].length ? rdma_net_body(m, length) : 0;
+                rdma_net_read_done(qp, qp->pending_acks[i].wr_id, qp->pending_acks[i].signaled,
+                                   qp->pending_acks[i].mr_id, qp->pending_acks[i].offset,
+                                   qp->pending_acks[i].length, data);
                 break;
             }
         }
         break;
     }
     
+    case RDMA_NET_OP_UD_SEND: {
+        char *payload = rdma_net_body(m, length);
+        if (!payload) {
+            qp->stats_rx_drops++;
+            break;
+        }
+        rdma_net_deliver_ud(qp, src_mac, src_qp_num, remote_key, payload, length);
+        break;
+    }
+    
     default:
         // Unknown opcode
         break;
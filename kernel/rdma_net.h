@@ -14,11 +14,28 @@
 #define RDMA_NET_OP_READ        0x02
 #define RDMA_NET_OP_READ_RESP   0x03
 #define RDMA_NET_OP_ACK         0x04
+#define RDMA_NET_OP_SEND        0x05    // reserved: not handled by rdma_net_rx() yet
+#define RDMA_NET_OP_UD_SEND     0x06    // datagram to a UD QP; never ACKed
+#define RDMA_NET_OP_WRITE_MULTI 0x07    // several small WRITEs (rdma_write_sub each)
+#define RDMA_NET_OP_WRITE_SEG   0x08    // one piece of a large or striped WRITE
+
+// Connection manager opcodes (handled by rdma_cm_rx(), see rdma_cm.c)
+#define RDMA_NET_OP_CM_REQ      0x10    // connect request: service, QPs, MRs
+#define RDMA_NET_OP_CM_REP      0x11    // reply: paired QPs and MRs
+#define RDMA_NET_OP_CM_RTU      0x12    // ready to use: confirms the REP
+#define RDMA_NET_OP_CM_REJ      0x13    // reject, with a reason
 
 // RDMA packet flags
 #define RDMA_PKT_FLAG_SIGNALED  0x01
+#define RDMA_PKT_FLAG_CRC       0x02    // a CRC32C trailer follows the body
+
+// CRC trailer: with RDMA_PKT_FLAG_CRC, the 4 bytes after the body
+// (length bytes, plus the rdma_seg_hdr of a WRITE_SEG) hold its
+// CRC32C in network byte order.  They are not counted in length,
+// and come out of the MTU like any other header.
+#define RDMA_CRC_LEN            4
 
-// RDMA packet header (40 bytes)
+// RDMA packet header (36 bytes on the wire)
 struct rdma_pkt_hdr {
     uint8  opcode;           // RDMA_NET_OP_*
     uint8  flags;            // Packet flags
@@ -33,6 +50,77 @@ struct rdma_pkt_hdr {
     uint32 remote_key;       // Remote key for validation
 } __attribute__((packed));
 
+// WRITE_MULTI: the header's length field is the size of everything
+// after it, a run of sub-headers each followed by its data.  Sub-WRITE
+// i has sequence number seq_num + i; one ACK, whose local_mr_id field
+// holds the count, acknowledges them all.
+struct rdma_write_sub {
+    uint32 local_mr_id;
+    uint32 remote_mr_id;
+    uint64 remote_addr;
+    uint32 length;
+    uint32 remote_key;
+} __attribute__((packed));
+
+// Write combining limits
+#define RDMA_NET_MTU            1500    // Ethernet payload per frame
+#define RDMA_WC_MAX_LEN         256     // larger WRITEs get a frame of their own
+#define RDMA_WC_MAX_WRS         32      // WRITEs per combined frame
+
+// WRITE_SEG: follows the RDMA header, whose remote_addr and length
+// describe this segment alone; all segments of a WRITE carry its
+// seq_num.  msg numbers a QP's segmented WRITEs 0, 1, 2, ...; the
+// receiver completes and ACKs each (one plain ACK) when all count
+// segments are in and every earlier msg has completed.
+struct rdma_seg_hdr {
+    uint32 msg;
+    uint16 index;            // 0 .. count-1
+    uint16 count;
+    uint32 total_len;        // length of the whole WRITE
+} __attribute__((packed));
+
+// A driver that can leave a received frame's payload where it lies
+// copies only the headers into an mbuf and points m->ext at the rest
+// (see rdma_net_split()); the payload then moves once, straight into
+// the MR.  Payloads shorter than this are copied with the headers.
+#define RDMA_SPLIT_MIN          512
+
+#define RDMA_SEG_LEN            (RDMA_NET_MTU - sizeof(struct rdma_pkt_hdr) - sizeof(struct rdma_seg_hdr))
+
+// UDP encapsulation (RoCEv2 style): on a path with an IP address the
+// RDMA header follows IP and UDP headers instead of the Ethernet
+// header, to RDMA_UDP_PORT (net.h) unless the path names another.
+// The source port is a hash of the QP pair, for ECMP.  These headers
+// come out of the 1500-byte MTU.
+#define RDMA_UDP_HDRLEN         (sizeof(struct ip) + sizeof(struct udp))
+
+// CM message: follows the RDMA header of a CM_* packet, whose
+// length field is the size of everything after the header.  nqp
+// 16-bit QP numbers and nmr MR descriptors follow it, in that order.
+struct rdma_cm_msg {
+    uint32 service_id;       // service the requester is connecting to
+    uint32 tid;              // transaction ID, chosen by the requester
+    uint8  nqp;              // QP numbers that follow
+    uint8  nmr;              // MR descriptors that follow
+    uint8  flags;            // RDMA_CM_F_*
+    uint8  reason;           // CM_REJ: RDMA_CM_REJ_*
+} __attribute__((packed));
+
+struct rdma_cm_mr_wire {
+    uint32 mr_id;
+    uint32 rkey;
+    uint64 addr;
+    uint64 length;
+} __attribute__((packed));
+
+// CM message flags
+#define RDMA_CM_F_BROADCAST     0x01    // CM_REQ sent to ff:ff:ff:ff:ff:ff
+
+// CM_REJ reasons
+#define RDMA_CM_REJ_NO_SERVICE  1   // nobody is listening on the service ID
+#define RDMA_CM_REJ_NO_QPS      2   // listener has too few free QPs
+#define RDMA_CM_REJ_INVALID     3   // malformed message or stale QPs
+
 // Endianness helpers for 64-bit values
 static inline uint64 htonll(uint64 val)
 {
@@ -46,8 +134,18 @@ static inline uint64 ntohll(uint64 val)
 
 // Function declarations
 void rdma_net_init(void);
-void rdma_net_rx(struct mbuf *m, uint8 *src_mac);
+void rdma_net_rx(struct mbuf *m, uint8 *src_mac, uint32 src_ip);
+uint32 rdma_net_split(char *frame, uint32 len);
+uint32 rdma_net_seg_len(struct rdma_qp *qp);
+int  rdma_net_tx_prefilled(struct rdma_qp *qp, struct rdma_work_request *wr,
+                           struct mbuf **segs, uint32 count);
 int  rdma_net_tx_write(struct rdma_qp *qp, struct rdma_work_request *wr);
-void rdma_net_tx_ack(struct rdma_qp *qp, uint16 remote_qp, uint32 seq_num, uint8 *dst_mac);
+int  rdma_net_tx_read(struct rdma_qp *qp, struct rdma_work_request *wr);
+int  rdma_net_tx_ud(struct rdma_qp *qp, struct rdma_work_request *wr);
+void rdma_net_tx_ack(struct rdma_qp *qp, uint16 remote_qp, uint32 seq_num, uint32 count,
+                     struct rdma_path *to);
+void rdma_net_flush(struct rdma_qp *qp);
+void rdma_net_tick(void);
+int  rdma_net_tx_cm(uint8 *dst_mac, uint8 opcode, void *msg, uint32 len);
 
 #endif // _RDMA_NET_H_
@@ -0,0 +1,318 @@
+// kernel/rdma_sched.c - transmit scheduling across QPs
+
+/* Every RDMA frame reaches the NIC through here. An e1000 TX ring
+ * has only 16 slots; rather than letting whichever QP posts first
+ * fill it, frames wait on per-QP queues and rdma_sched_run() feeds the
+ * ring from them, in this order:
+ *
+ *   1. control frames (ACKs and CM messages), which are small and
+ *      which a peer is always waiting for;
+ *   2. QPs in the strict-priority class, round robin, a frame each;
+ *   3. every other QP by deficit round robin: per round a QP may send
+ *      tx_weight * RDMA_SCHED_QUANTUM bytes, and unused credit carries
+ *      over while it stays backlogged.
+ *
+ * The ring is refilled whenever a frame is queued, when the NIC
+ * reports its transmit queue drained, when a QP's owner polls an empty
+ * CQ, and on the clock tick.
+ *
+ * With several ports (netdev.c) each has its own ring. A pass remembers
+ * which rings it found full and skips any QP whose next frame is for
+ * one of them (a QP's frames still leave in order), so a busy port
+ * doesn't starve traffic for the others. Frames are only placed in
+ * the rings during a pass; the NICs are told about them once, at the
+ * end, so a burst costs one doorbell per port rather than one per
+ * frame.
+ *
+ * The queue fields of struct rdma_qp belong to sched_lock, not
+ * qp_lock, so the refill from the interrupt handler needs no QP
+ * locking. Lock order: qp_lock, then sched_lock, then the NIC port
+ * locks.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "rdma.h"
+#include "net.h"
+
+#define RDMA_SCHED_QUANTUM   1514   // bytes per round at weight 1: one full frame
+#define RDMA_CTLQ_MAX        256    // control frames waiting
+#define TIME_NS              100    // ns per time CSR unit (10 MHz under qemu)
+
+static struct spinlock sched_lock;
+
+static struct mbuf *ctlq_head, *ctlq_tail;
+static uint32 ctlq_len;
+
+static int prio_cur;                // next strict-priority QP to look at
+static int drr_cur;                 // QP the DRR round is on
+static int drr_credited;            // drr_cur has had this round's quantum
+
+void
+rdma_sched_init(void)
+{
+    initlock(&sched_lock, "rdma_sched");
+}
+
+/* Reset a new QP's queue and scheduling parameters */
+void
+rdma_sched_qp_init(struct rdma_qp *qp)
+{
+    acquire(&sched_lock);
+    qp->txq_head = qp->txq_tail = 0;
+    qp->txq_len = 0;
+    qp->tx_weight = 1;
+    qp->tx_prio = 0;
+    qp->tx_deficit = 0;
+    qp->stats_txq_frames = 0;
+    qp->stats_txq_drops = 0;
+    qp->stats_txq_delay = 0;
+    qp->stats_txq_delay_max = 0;
+    release(&sched_lock);
+}
+
+/* Drop whatever a destroyed QP still has queued, as a NIC drops a
+ * destroyed QP's send queue
+ */
+void
+rdma_sched_qp_purge(struct rdma_qp *qp)
+{
+    acquire(&sched_lock);
+    while (qp->txq_head) {
+        struct mbuf *m = qp->txq_head;
+        qp->txq_head = m->next;
+        mbuffree(m);
+    }
+    qp->txq_tail = 0;
+    qp->txq_len = 0;
+    qp->tx_deficit = 0;
+    release(&sched_lock);
+}
+
+void
+rdma_sched_set(struct rdma_qp *qp, uint32 weight, uint32 prio)
+{
+    acquire(&sched_lock);
+    qp->tx_weight = weight;
+    qp->tx_prio = prio;
+    release(&sched_lock);
+}
+
+/* Copy the scheduler's statistics for qp into st */
+void
+rdma_sched_stats(struct rdma_qp *qp, struct rdma_qp_stats *st)
+{
+    acquire(&sched_lock);
+    st->txq_len = qp->txq_len;
+    st->txq_frames = qp->stats_txq_frames;
+    st->txq_drops = qp->stats_txq_drops;
+    st->txq_delay_ns = qp->stats_txq_delay * TIME_NS;
+    st->txq_delay_max_ns = qp->stats_txq_delay_max * TIME_NS;
+    release(&sched_lock);
+}
+
+/* How many more frames qp may queue */
+uint32
+rdma_sched_room(struct rdma_qp *qp)
+{
+    acquire(&sched_lock);
+    uint32 room = RDMA_TXQ_MAX - qp->txq_len;
+    release(&sched_lock);
+    return room;
+}
+
+/* Hand m to the NIC unless its port's ring is already known full;
+ * *full collects the ports found full
+ *
+ * Returns: 0 on success, -1 if the TX ring is full
+ */
+static int
+rdma_sched_transmit(struct mbuf *m, uint32 *full)
+{
+    if (*full & (1 << m->dev)) {
+        return -1;
+    }
+    if (netdev_transmit(m) < 0) {
+        *full |= 1 << m->dev;
+        return -1;
+    }
+    return 0;
+}
+
+/* Hand qp's oldest frame to the NIC
+ *
+ * Returns: 0 on success, -1 if the TX ring is full
+ */
+static int
+rdma_sched_send(struct rdma_qp *qp, uint32 *full)
+{
+    struct mbuf *m = qp->txq_head;
+    struct mbuf *next = m->next;        // the frame is the NIC's once sent
+    uint64 delay = readtime() - m->tstamp;
+
+    if (rdma_sched_transmit(m, full) < 0) {
+        return -1;
+    }
+    qp->txq_head = next;
+    if (!qp->txq_head) {
+        qp->txq_tail = 0;
+    }
+    qp->txq_len--;
+
+    qp->stats_txq_frames++;
+    qp->stats_txq_delay += delay;
+    if (delay > qp->stats_txq_delay_max) {
+        qp->stats_txq_delay_max = delay;
+    }
+    return 0;
+}
+
+/* Fill the TX ring; see the top of the file for the order */
+static void
+rdma_sched_run_locked(void)
+{
+    uint32 full = 0;                    // ports whose ring is full
+    uint32 all = (1 << netdev_nports()) - 1;
+
+    // 1. control frames, in order
+    while (ctlq_head) {
+        struct mbuf *next = ctlq_head->next;
+        if (rdma_sched_transmit(ctlq_head, &full) < 0) {
+            break;
+        }
+        ctlq_head = next;
+        ctlq_len--;
+    }
+    if (!ctlq_head) {
+        ctlq_tail = 0;
+    }
+
+    // 2. strict priority, one frame per QP per pass
+    int sent;
+    do {
+        sent = 0;
+        for (int n = 0; n < MAX_QPS; n++) {
+            struct rdma_qp *qp = &qp_table[prio_cur];
+            prio_cur = (prio_cur + 1) % MAX_QPS;
+            if (!qp->tx_prio || !qp->txq_head) {
+                continue;
+            }
+            if (rdma_sched_send(qp, &full) < 0) {
+                if (full == all) {
+                    return;
+                }
+                continue;
+            }
+            sent = 1;
+        }
+    } while (sent);
+
+    // 3. deficit round robin over the rest, until a whole round finds
+    // nothing to send. A quantum is at least a full frame, so every
+    // backlogged QP with a free ring sends at least one frame per round.
+    for (int idle = 0; idle < MAX_QPS; ) {
+        struct rdma_qp *qp = &qp_table[drr_cur];
+        int progress = 0;
+
+        if (!qp->tx_prio && qp->txq_head) {
+            if (!drr_credited) {
+                qp->tx_deficit += qp->tx_weight * RDMA_SCHED_QUANTUM;
+                drr_credited = 1;
+            }
+            while (qp->txq_head && qp->txq_head->len <= qp->tx_deficit) {
+                uint32 len = qp->txq_head->len;
+                if (rdma_sched_send(qp, &full) < 0) {
+                    if (full == all) {
+                        return;         // resume here, credit intact
+                    }
+                    // its port is full: pass it over, without banking
+                    // more than a round's credit
+                    if (qp->tx_deficit > qp->tx_weight * RDMA_SCHED_QUANTUM) {
+                        qp->tx_deficit = qp->tx_weight * RDMA_SCHED_QUANTUM;
+                    }
+                    break;
+                }
+                qp->tx_deficit -= len;
+                progress = 1;
+            }
+            if (!qp->txq_head) {
+                qp->tx_deficit = 0;     // idle QPs bank no credit
+            }
+        }
+        idle = progress ? 0 : idle + 1;
+
+        drr_cur = (drr_cur + 1) % MAX_QPS;
+        drr_credited = 0;
+    }
+}
+
+void
+rdma_sched_run(void)
+{
+    acquire(&sched_lock);
+    rdma_sched_run_locked();
+    netdev_kick();
+    release(&sched_lock);
+}
+
+/* Queue n frames for transmission, all or none, and refill the ring
+ *
+ * qp is the sending QP, or 0 for control frames. On success the
+ * frames belong to the scheduler; on failure (queue full) the caller
+ * still owns them. Frames queued together are handed to the NIC in
+ * one pass, and so cost one doorbell.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+rdma_sched_xmitv(struct rdma_qp *qp, struct mbuf **ms, int n)
+{
+    uint64 now = readtime();
+
+    acquire(&sched_lock);
+    if (qp ? qp->txq_len + n > RDMA_TXQ_MAX : ctlq_len + n > RDMA_CTLQ_MAX) {
+        if (qp) {
+            qp->stats_txq_drops += n;
+        }
+        release(&sched_lock);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        struct mbuf *m = ms[i];
+        m->next = 0;
+        if (qp) {
+            m->tstamp = now;
+            if (qp->txq_tail) {
+                qp->txq_tail->next = m;
+            } else {
+                qp->txq_head = m;
+            }
+            qp->txq_tail = m;
+            qp->txq_len++;
+        } else {
+            if (ctlq_tail) {
+                ctlq_tail->next = m;
+            } else {
+                ctlq_head = m;
+            }
+            ctlq_tail = m;
+            ctlq_len++;
+        }
+    }
+    rdma_sched_run_locked();
+    netdev_kick();
+    release(&sched_lock);
+    return 0;
+}
+
+/* Queue one frame; see rdma_sched_xmitv */
+int
+rdma_sched_xmit(struct rdma_qp *qp, struct mbuf *m)
+{
+    return rdma_sched_xmitv(qp, &m, 1);
+}
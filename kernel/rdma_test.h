@@ -378,6 +378,45 @@ static int rdma_test_power_of_2(void)
     RDMA_TEST_PASS("Power-of-2 Validation");
 }
 
+/* ============================================
+ * TEST 11: CRC32C (payload check)
+ * ============================================ */
+static int rdma_test_crc32c(void)
+{
+    printf("TEST 11: CRC32C\n");
+    
+    // Check values from RFC 3720, B.4
+    uint8 v[32];
+    memset(v, 0, sizeof(v));
+    RDMA_TEST_ASSERT(crc32c(0, v, 32) == 0x8A9136AA, "CRC32C of 32 zeros");
+    memset(v, 0xFF, sizeof(v));
+    RDMA_TEST_ASSERT(crc32c(0, v, 32) == 0x62A8AB43, "CRC32C of 32 ones");
+    RDMA_TEST_ASSERT(crc32c(0, "123456789", 9) == 0xE3069283, "CRC32C of 123456789");
+    
+    // Copying and summing at once agrees with summing, at every
+    // alignment of source and destination, and a CRC continues
+    char *src = kalloc();
+    char *dst = kalloc();
+    RDMA_TEST_ASSERT(src && dst, "kalloc failed");
+    for (int i = 0; i < 256; i++) {
+        src[i] = i * 13 + 1;
+    }
+    uint32 want = crc32c(0, src + 3, 200);
+    for (int s = 0; s < 8; s++) {
+        for (int d = 0; d < 8; d++) {
+            memset(dst, 0, 256);
+            uint32 got = crc32c_copy(0, dst + d, src + s, 200);
+            RDMA_TEST_ASSERT(got == crc32c(0, src + s, 200), "crc32c_copy sum");
+            RDMA_TEST_ASSERT(memcmp(dst + d, src + s, 200) == 0, "crc32c_copy data");
+        }
+    }
+    RDMA_TEST_ASSERT(crc32c(crc32c(0, src + 3, 77), src + 80, 123) == want, "CRC32C continued");
+    kfree(src);
+    kfree(dst);
+    
+    RDMA_TEST_PASS("CRC32C");
+}
+
 /* ============================================
  * MAIN TEST RUNNER
  * ============================================ */
@@ -399,6 +438,7 @@ static void rdma_run_kernel_tests(void)
     rdma_test_mr_table();
     rdma_test_qp_alloc();
     rdma_test_power_of_2();
+    rdma_test_crc32c();
     
     // Print summary
     printf("========================================\n");
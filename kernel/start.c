@@ -6,10 +6,18 @@
 
 void main();
 void timerinit();
+void ipiinit();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// ipivec's scratch area for each CPU: a save slot, then the
+// address of the CPU's CLINT MSIP word.
+uint64 ipi_scratch[NCPU][2];
+
+// in kernelvec.S, runs in machine mode.
+extern void ipivec();
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -30,7 +38,7 @@ start()
   // delegate all interrupts and exceptions to supervisor mode.
   w_medeleg(0xffff);
   w_mideleg(0xffff);
-  w_sie(r_sie() | SIE_SEIE | SIE_STIE);
+  w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
   // configure Physical Memory Protection to give supervisor mode
   // access to all of physical memory.
@@ -40,6 +48,9 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // take inter-processor interrupts.
+  ipiinit();
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -60,7 +71,25 @@ timerinit()
   
   // allow supervisor to use stimecmp and time.
   w_mcounteren(r_mcounteren() | 2);
+
+  // allow user code to read time as well, so that
+  // benchmarks (user/kbench.c) can use rdtime.
+  w_scounteren(r_scounteren() | 2);
   
   // ask for the very first timer interrupt.
   w_stimecmp(r_time() + 1000000);
 }
+
+// let other harts interrupt this one through the CLINT (see
+// netdev_rx()); ipivec turns each into a supervisor software
+// interrupt.
+void
+ipiinit()
+{
+  int id = r_mhartid();
+
+  ipi_scratch[id][1] = CLINT_MSIP(id);
+  w_mscratch((uint64)ipi_scratch[id]);
+  w_mtvec((uint64)ipivec);
+  w_mie(r_mie() | MIE_MSIE);
+}
@@ -0,0 +1,343 @@
+//
+// paging to another node's memory.
+//
+// swapon(RDISKDEV) makes the RDMA remote disk (rdma_disk.c) swap
+// space: each of the server's pages is a slot for one of ours.
+// user memory comes from swapalloc(), which, once free memory drops
+// below SWAP_LOW pages, first pages out up to SWAP_BATCH cold user
+// pages.  a clock hand sweeps the processes' pages, clearing the
+// PTE_A the MMU set on those used since it last came by and taking
+// those it didn't.  a victim is copied into one of the disk's bounce
+// pages, and its PTE keeps its permissions and gets PTE_S and the
+// slot number in place of PTE_V and the physical page; the batch
+// goes out as RDMA WRITEs posted back to back, and the pager waits
+// for the last before it frees the pages.  if the swap server
+// doesn't answer, the pages are put back.
+//
+// touching a paged-out page faults into vmfault(), as touching a
+// lazily allocated one does, and swapin() READs it back into a new
+// page: a few network round trips, not a disk seek.  a process whose
+// page can't be read back is killed.
+//
+// only pages nothing is using are taken: those of processes that
+// aren't running, which can't look at their page tables until they
+// run and flush the TLB on the way back to user space, and those of
+// the process that is paging, which is in the kernel.  pages under
+// an MR stay put, since peers reach them by physical address.  the
+// last SWAP_RESERVE free pages are left to the kernel, for page
+// tables and for the mbufs the pager needs to send pages out.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "rdma.h"
+#include "swap.h"
+
+#define SWAP_BATCH   RDISK_BATCH  // pages paged out at once
+#define SWAP_LOW     64   // free pages below which swapalloc() pages out
+#define SWAP_RESERVE 32   // free pages swapalloc() leaves to the kernel
+
+// what's in a slot.
+#define SLOT_FREE 0
+#define SLOT_USED 1   // a page
+#define SLOT_OUT  2   // a page swapout() is writing
+#define SLOT_GONE 3   // one it is writing whose PTE has been unmapped
+
+// a paged-out PTE's slot sits where a valid one's PPN would.
+#define SLOT2PTE(s)   (((uint64)(s)) << 10)
+#define PTE2SLOT(pte) ((uint)((pte) >> 10))
+
+extern struct proc proc[NPROC];
+
+static struct {
+  struct sleeplock lock;  // one pager at a time
+  struct spinlock slock;  // protects used[] and st.used
+  int nslots;             // 0 until swapon()
+  int next;               // where slotalloc() looks first
+  uchar used[RDISK_MAX_PAGES];  // SLOT_FREE, ...
+  int hand;               // the clock hand: a slot in proc[]
+  uint64 handva;          // and an address in that process
+  struct swapstat st;
+} swap;
+
+void
+swapinit(void)
+{
+  initsleeplock(&swap.lock, "swap");
+  initlock(&swap.slock, "swapslot");
+}
+
+// give device dev to the pager.  only the RDMA remote disk can be
+// swap space.  returns the number of slots, or -1.
+int
+swapon(int dev)
+{
+  int n = -1;
+
+  if(dev != RDISKDEV)
+    return -1;
+  acquiresleep(&swap.lock);
+  if(swap.nslots == 0 && (n = rdma_disk_claim(RDISK_SWAP)) > 0){
+    if(n > RDISK_MAX_PAGES)
+      n = RDISK_MAX_PAGES;
+    swap.nslots = n;
+    swap.st.nslots = n;
+    printf("swap: %d pages on the remote disk\n", n);
+  }
+  releasesleep(&swap.lock);
+  return n;
+}
+
+// a free slot, marked SLOT_OUT, or -1.
+static int
+slotalloc(void)
+{
+  int s = -1;
+
+  acquire(&swap.slock);
+  for(int i = 0; i < swap.nslots; i++){
+    int j = (swap.next + i) % swap.nslots;
+    if(swap.used[j] == SLOT_FREE){
+      swap.used[j] = SLOT_OUT;
+      swap.st.used++;
+      swap.next = j + 1;
+      s = j;
+      break;
+    }
+  }
+  release(&swap.slock);
+  return s;
+}
+
+// caller holds swap.slock.
+static void
+slotfree(uint s)
+{
+  swap.used[s] = SLOT_FREE;
+  swap.st.used--;
+}
+
+// PTE pte is being unmapped: free its slot if it is still paged out.
+// returns 0 if swapout() has put its page back meanwhile, for the
+// caller to free.  doesn't sleep: uvmunmap() calls it from
+// freeproc(), with a process lock held.
+int
+swapfree(pte_t *pte)
+{
+  int r = 0;
+
+  acquire(&swap.slock);
+  if(*pte & PTE_S){
+    uint s = PTE2SLOT(*pte);
+    if(swap.used[s] == SLOT_OUT)
+      swap.used[s] = SLOT_GONE;   // swapout() frees it and its page
+    else
+      slotfree(s);
+    r = 1;
+  }
+  release(&swap.slock);
+  return r;
+}
+
+// move the clock hand through p's pages, from swap.handva on,
+// taking cold ones into bounce pages n, n+1, ..., their slots into
+// slot[] and their PTEs and pages into vpte[] and vpa[].  sets *full if
+// the slots run out.  returns the new n.
+// caller holds swap.lock and p->lock.
+static int
+sweep(struct proc *p, uint *slot, pte_t **vpte, uint64 *vpa, int n, int *full)
+{
+  pte_t *pte;
+  uint64 pa;
+  int s;
+
+  for(; swap.handva < p->sz && n < SWAP_BATCH; swap.handva += PGSIZE){
+    if((pte = walk(p->pagetable, swap.handva, 0)) == 0)
+      continue;
+    swap.st.scans++;
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;   // not there, or the stack guard page
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;   // used lately: a second chance
+      continue;
+    }
+    pa = PTE2PA(*pte);
+    if(rdma_mr_pinned(pa))
+      continue;
+    if((s = slotalloc()) < 0){
+      *full = 1;
+      break;
+    }
+    memmove(rdma_disk_buf(n), (char*)pa, PGSIZE);
+    *pte = SLOT2PTE(s) | (PTE_FLAGS(*pte) & (PTE_R|PTE_W|PTE_X|PTE_U)) | PTE_S;
+    vpte[n] = pte;
+    vpa[n] = pa;
+    slot[n++] = s;
+  }
+  return n;
+}
+
+// page out up to SWAP_BATCH cold pages.  returns how many pages
+// it freed.  caller holds swap.lock.
+static int
+swapout(void)
+{
+  uint slot[SWAP_BATCH];
+  pte_t *vpte[SWAP_BATCH];
+  uint64 vpa[SWAP_BATCH];
+  int n = 0, full = 0, freed = 0;
+  uint64 t0 = readtime();
+
+  // twice round at most: a page used since the hand last passed
+  // goes the second time, unless it has been used again.
+  for(int i = 0; i <= 2*NPROC && n < SWAP_BATCH && !full; i++){
+    struct proc *p = &proc[swap.hand];
+    int done = 1;
+
+    acquire(&p->lock);
+    if(p->pagetable &&
+       (p == myproc() || p->state == SLEEPING || p->state == RUNNABLE)){
+      n = sweep(p, slot, vpte, vpa, n, &full);
+      done = swap.handva >= p->sz;
+    }
+    release(&p->lock);
+    if(done){
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.handva = 0;
+    }
+  }
+
+  if(n == 0)
+    return 0;
+  // the pages' owners fault on them now, and wait for swap.lock
+  int ok = rdma_disk_swapout(slot, n) == 0;
+  if(!ok)
+    printf("swapout: no answer from the swap server, keeping %d pages\n", n);
+  acquire(&swap.slock);
+  for(int i = 0; i < n; i++){
+    if(swap.used[slot[i]] == SLOT_GONE){
+      slotfree(slot[i]);   // unmapped meanwhile
+    } else if(ok){
+      swap.used[slot[i]] = SLOT_USED;
+    } else {
+      // back where it was, and not to be taken again next time round
+      *vpte[i] = PA2PTE(vpa[i]) | (PTE_FLAGS(*vpte[i]) & ~PTE_S) | PTE_V | PTE_A;
+      slotfree(slot[i]);
+      vpa[i] = 0;
+    }
+  }
+  release(&swap.slock);
+  for(int i = 0; i < n; i++){
+    if(vpa[i]){
+      kfree((void*)vpa[i]);
+      freed++;
+    }
+  }
+  if(ok){
+    swap.st.pageouts += n;
+    swap.st.batches++;
+    swap.st.outtime += readtime() - t0;
+  }
+  return freed;
+}
+
+// allocate a page of user memory, paging others out first if free
+// memory is low.  returns 0 if there is none to be had.  may sleep.
+void *
+swapalloc(void)
+{
+  if(swap.nslots > 0 && kfreepages() < SWAP_LOW){
+    acquiresleep(&swap.lock);
+    // another pager may have made room while we waited
+    int room = kfreepages() >= SWAP_LOW || swapout() > 0;
+    releasesleep(&swap.lock);
+    if(!room && kfreepages() < SWAP_RESERVE)
+      return 0;
+  }
+  return kalloc();
+}
+
+// the swap server has lost the current process's page.
+static void
+swaplost(void)
+{
+  struct proc *p = myproc();
+
+  printf("swap: no answer from the swap server, killing pid %d\n", p->pid);
+  setkilled(p);
+}
+
+// bring va's paged-out page back, for vmfault().  returns its
+// physical address, or 0 if there is no memory for it or the page
+// can't be read, which kills the process.
+uint64
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+
+  if((mem = swapalloc()) == 0)
+    return 0;
+  acquiresleep(&swap.lock);
+  uint64 t0 = readtime();
+  // only its own process brings a page in, but swapout() may have
+  // put it back
+  pte = walk(pagetable, va, 0);
+  if((*pte & PTE_S) == 0){
+    releasesleep(&swap.lock);
+    kfree(mem);
+    return PTE2PA(*pte);
+  }
+  if(rdma_disk_swapin(PTE2SLOT(*pte), mem) < 0){
+    releasesleep(&swap.lock);
+    kfree(mem);
+    swaplost();
+    return 0;
+  }
+  acquire(&swap.slock);
+  slotfree(PTE2SLOT(*pte));
+  release(&swap.slock);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_S) | PTE_V | PTE_A;
+  swap.st.pageins++;
+  swap.st.intime += readtime() - t0;
+  releasesleep(&swap.lock);
+  return (uint64)mem;
+}
+
+// copy paged-out page *pte into mem and leave it in swap: fork's
+// copy of a page the parent has paged out.  returns 0, or -1 if the
+// page can't be read, which kills the process.
+int
+swapread(pte_t *pte, char *mem)
+{
+  int r = 0;
+
+  acquiresleep(&swap.lock);
+  uint64 t0 = readtime();
+  if((*pte & PTE_S) == 0){
+    memmove(mem, (char*)PTE2PA(*pte), PGSIZE);   // swapout() put it back
+  } else if(rdma_disk_swapin(PTE2SLOT(*pte), mem) < 0){
+    swaplost();
+    r = -1;
+  } else {
+    swap.st.pageins++;
+    swap.st.intime += readtime() - t0;
+  }
+  releasesleep(&swap.lock);
+  return r;
+}
+
+void
+swapstat(struct swapstat *st)
+{
+  acquire(&swap.slock);
+  *st = swap.st;
+  release(&swap.slock);
+  st->freepages = kfreepages();
+}
@@ -0,0 +1,13 @@
+// what swapstat() reports; see swap.c.
+struct swapstat {
+  uint64 pageouts;   // pages written to swap
+  uint64 pageins;    // pages read back
+  uint64 batches;    // page-out batches they went in
+  uint64 scans;      // PTEs the clock hand has passed
+  uint64 outtime;    // time CSR units spent paging out
+  uint64 intime;     // and paging in
+  int nslots;        // swap slots, 0 if swap is off
+  int used;          // slots holding a page
+  int freepages;     // free pages of local memory
+  int pad;
+};
@@ -110,6 +110,29 @@ extern uint64 sys_rdma_destroy_qp(void);
 extern uint64 sys_rdma_post_send(void);
 extern uint64 sys_rdma_poll_cq(void);
 extern uint64 sys_rdma_connect(void);
+extern uint64 sys_rdma_cm_listen(void);
+extern uint64 sys_rdma_cm_accept(void);
+extern uint64 sys_rdma_cm_connect(void);
+extern uint64 sys_rdma_cm_close(void);
+extern uint64 sys_rdma_create_ud_qp(void);
+extern uint64 sys_rdma_post_recv(void);
+extern uint64 sys_rdma_set_qp_sched(void);
+extern uint64 sys_rdma_query_qp(void);
+extern uint64 sys_rdma_set_qp_path(void);
+extern uint64 sys_rdma_set_qp_udp(void);
+extern uint64 sys_udp_bind(void);
+extern uint64 sys_udp_recvmmsg(void);
+extern uint64 sys_udp_sendmmsg(void);
+extern uint64 sys_rdma_set_qp_crc(void);
+extern uint64 sys_rdma_sendfile(void);
+extern uint64 sys_rdma_reg_file_mr(void);
+extern uint64 sys_rdma_sync_mr(void);
+extern uint64 sys_rdisk_attach(void);
+extern uint64 sys_blkrw(void);
+extern uint64 sys_swapon(void);
+extern uint64 sys_swapstat(void);
+extern uint64 sys_logmirror(void);
+extern uint64 sys_logreplay(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -142,6 +165,29 @@ static uint64 (*syscalls[])(void) = {
 [SYS_rdma_post_send]  sys_rdma_post_send,
 [SYS_rdma_poll_cq]    sys_rdma_poll_cq,
 [SYS_rdma_connect]    sys_rdma_connect,
+[SYS_rdma_cm_listen]  sys_rdma_cm_listen,
+[SYS_rdma_cm_accept]  sys_rdma_cm_accept,
+[SYS_rdma_cm_connect] sys_rdma_cm_connect,
+[SYS_rdma_cm_close]   sys_rdma_cm_close,
+[SYS_rdma_create_ud_qp] sys_rdma_create_ud_qp,
+[SYS_rdma_post_recv]  sys_rdma_post_recv,
+[SYS_rdma_set_qp_sched] sys_rdma_set_qp_sched,
+[SYS_rdma_query_qp]   sys_rdma_query_qp,
+[SYS_rdma_set_qp_path] sys_rdma_set_qp_path,
+[SYS_rdma_set_qp_udp] sys_rdma_set_qp_udp,
+[SYS_udp_bind]     sys_udp_bind,
+[SYS_udp_recvmmsg] sys_udp_recvmmsg,
+[SYS_udp_sendmmsg] sys_udp_sendmmsg,
+[SYS_rdma_set_qp_crc] sys_rdma_set_qp_crc,
+[SYS_rdma_sendfile]   sys_rdma_sendfile,
+[SYS_rdma_reg_file_mr] sys_rdma_reg_file_mr,
+[SYS_rdma_sync_mr]    sys_rdma_sync_mr,
+[SYS_rdisk_attach]    sys_rdisk_attach,
+[SYS_blkrw]           sys_blkrw,
+[SYS_swapon]          sys_swapon,
+[SYS_swapstat]        sys_swapstat,
+[SYS_logmirror]       sys_logmirror,
+[SYS_logreplay]       sys_logreplay,
 };
 
 void
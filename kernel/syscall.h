@@ -29,3 +29,29 @@
 #define SYS_rdma_post_send  26
 #define SYS_rdma_poll_cq    27
 #define SYS_rdma_connect    28
+#define SYS_rdma_cm_listen  29
+#define SYS_rdma_cm_accept  30
+#define SYS_rdma_cm_connect 31
+#define SYS_rdma_cm_close   32
+#define SYS_rdma_create_ud_qp 33
+#define SYS_rdma_post_recv  34
+#define SYS_rdma_set_qp_sched 35
+#define SYS_rdma_query_qp   36
+#define SYS_rdma_set_qp_path 37
+#define SYS_rdma_set_qp_udp 38
+
+// UDP sockets
+#define SYS_udp_bind     39
+#define SYS_udp_recvmmsg 40
+#define SYS_udp_sendmmsg 41
+
+#define SYS_rdma_set_qp_crc 42
+#define SYS_rdma_sendfile   43
+#define SYS_rdma_reg_file_mr 44
+#define SYS_rdma_sync_mr    45
+#define SYS_rdisk_attach    46
+#define SYS_blkrw           47
+#define SYS_swapon          48
+#define SYS_swapstat        49
+#define SYS_logmirror       50
+#define SYS_logreplay       51
@@ -14,7 +14,10 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "buf.h"
 #include "fcntl.h"
+#include "net.h"
+#include "rdma.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -503,3 +506,125 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// a UDP socket bound to port lport (0 for any free one).
+// returns the fd; the port is the socket's to keep until close.
+uint64
+sys_udp_bind(void)
+{
+  struct file *f;
+  int lport, flags, fd;
+
+  argint(0, &lport);
+  argint(1, &flags);
+  if(lport < 0 || lport > 0xffff)
+    return -1;
+  if(sockalloc(&f, lport, flags) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+uint64
+sys_udp_recvmmsg(void)
+{
+  struct file *f;
+  uint64 msgs;
+  int n, flags;
+
+  argaddr(1, &msgs);
+  argint(2, &n);
+  argint(3, &flags);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_SOCK)
+    return -1;
+  return sockrecvmmsg(f->sock, msgs, n, flags & UDP_DONTWAIT);
+}
+
+uint64
+sys_udp_sendmmsg(void)
+{
+  struct file *f;
+  uint64 msgs;
+  int n;
+
+  argaddr(1, &msgs);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_SOCK)
+    return -1;
+  return socksendmmsg(f->sock, msgs, n);
+}
+
+// WRITE part of a file to a connected RDMA QP's peer, straight from
+// the buffer cache; see rdma_qp_sendfile().
+uint64
+sys_rdma_sendfile(void)
+{
+  struct file *f;
+  struct rdma_work_request wr;
+  uint64 uwr;
+  int qp;
+
+  argint(0, &qp);
+  argaddr(2, &uwr);
+  if(argfd(1, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)&wr, uwr, sizeof(wr)) < 0)
+    return -1;
+  return rdma_qp_sendfile(qp, f->ip, &wr);
+}
+
+// register part of a file as an RDMA MR; see rdma_mr_register_file().
+uint64
+sys_rdma_reg_file_mr(void)
+{
+  struct file *f;
+  int off, len, flags;
+
+  argint(1, &off);
+  argint(2, &len);
+  argint(3, &flags);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+    return -1;
+  if((flags & (RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE)) && !f->writable)
+    return -1;
+  return rdma_mr_register_file(f->ip, off, len, flags);
+}
+
+// read or write one block of a disk, through the buffer cache: the
+// RDMA remote disk, or, read-only since the file system is on it,
+// the root disk.
+uint64
+sys_blkrw(void)
+{
+  struct buf *b;
+  uint64 addr;
+  int dev, blockno, write, r;
+
+  argint(0, &dev);
+  argint(1, &blockno);
+  argaddr(2, &addr);
+  argint(3, &write);
+  if(dev == RDISKDEV){
+    if(blockno < 0 || blockno >= rdma_disk_nblocks())
+      return -1;
+  } else if(dev == ROOTDEV){
+    if(write || blockno < 0 || blockno >= FSSIZE)
+      return -1;
+  } else {
+    return -1;
+  }
+
+  b = bread(dev, blockno);
+  if(write){
+    r = copyin(myproc()->pagetable, (char*)b->data, addr, BSIZE);
+    if(r == 0)
+      bwrite(b);
+  } else {
+    r = copyout(myproc()->pagetable, addr, (char*)b->data, BSIZE);
+  }
+  brelse(b);
+  return r;
+}
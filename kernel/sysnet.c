@@ -0,0 +1,339 @@
+//
+// UDP sockets.
+//
+// udp_bind() makes a socket for a local port.  net.c hands each
+// datagram for the port to sockrecvudp(), which queues its mbuf on
+// the socket (at most SOCK_RXQ of them; more are dropped) with the
+// sender's address in the headroom the headers left.
+// udp_recvmmsg() and udp_sendmmsg() move up to UDP_MMSG_MAX
+// datagrams per system call, and a batch of sends shares one NIC
+// doorbell.  read() returns one datagram's payload; sockets have no
+// peer, so write() fails.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "net.h"
+#include "defs.h"
+
+#define SOCK_EPHEMERAL 49152   // first port udp_bind(0) hands out
+
+struct sock {
+  struct sock *next;  // the next socket in the list
+  uint16 lport;       // the local UDP port number
+  int nonblock;       // udp_recvmmsg() never waits
+  struct spinlock lock; // protects the rx queue
+  struct mbufq rxq;   // datagrams waiting to be received
+  int qlen;
+  uint64 drops;       // datagrams that found rxq full
+  int cpu;            // where the last receiver ran, or -1
+};
+
+// where a queued datagram came from; it sits just before the payload.
+struct sockfrom {
+  uint32 sip;
+  uint16 sport;
+  uint16 pad;
+};
+
+static struct spinlock lock;
+static struct sock *sockets;
+static uint16 next_ephemeral = SOCK_EPHEMERAL;
+
+void
+sockinit(void)
+{
+  initlock(&lock, "socktbl");
+}
+
+// the socket bound to lport, or 0.  caller holds lock.
+static struct sock *
+socklookup(uint16 lport)
+{
+  struct sock *s;
+
+  for(s = sockets; s; s = s->next)
+    if(s->lport == lport)
+      return s;
+  return 0;
+}
+
+// makes *f a socket bound to lport, or to a free ephemeral port if
+// lport is 0.  returns the port, or -1 if it is taken.
+int
+sockalloc(struct file **f, uint16 lport, int flags)
+{
+  struct sock *si;
+
+  si = 0;
+  *f = 0;
+  if(lport == RDMA_UDP_PORT)  // net.c gives that port to RDMA
+    return -1;
+  if((*f = filealloc()) == 0)
+    goto bad;
+  if((si = (struct sock*)kalloc()) == 0)
+    goto bad;
+
+  // initialize objects
+  memset(si, 0, sizeof(*si));
+  si->nonblock = (flags & UDP_NONBLOCK) != 0;
+  si->cpu = -1;
+  initlock(&si->lock, "sock");
+  mbufq_init(&si->rxq);
+  (*f)->type = FD_SOCK;
+  (*f)->readable = 1;
+  (*f)->writable = 0;
+  (*f)->sock = si;
+
+  // add to list of sockets
+  acquire(&lock);
+  if(lport == 0){
+    for(int i = 0; i < 65536 - SOCK_EPHEMERAL; i++){
+      uint16 p = next_ephemeral;
+      next_ephemeral = p == 65535 ? SOCK_EPHEMERAL : p + 1;
+      if(!socklookup(p)){
+        lport = p;
+        break;
+      }
+    }
+  }
+  if(lport == 0 || socklookup(lport)){
+    release(&lock);
+    goto bad;
+  }
+  si->lport = lport;
+  si->next = sockets;
+  sockets = si;
+  release(&lock);
+  return lport;
+
+bad:
+  if(si)
+    kfree((char*)si);
+  if(*f){
+    (*f)->type = FD_NONE;
+    fileclose(*f);
+  }
+  return -1;
+}
+
+void
+sockclose(struct sock *si)
+{
+  struct sock **pos;
+
+  // remove from list of sockets; once off it, sockrecvudp()
+  // can't find it.
+  acquire(&lock);
+  for(pos = &sockets; *pos; pos = &(*pos)->next){
+    if(*pos == si){
+      *pos = si->next;
+      break;
+    }
+  }
+  release(&lock);
+
+  // free any pending mbufs
+  acquire(&si->lock);
+  while(!mbufq_empty(&si->rxq))
+    mbuffree(mbufq_pophead(&si->rxq));
+  release(&si->lock);
+
+  kfree((char*)si);
+}
+
+// waits, unless the socket or dontwait says not to, until si has
+// a datagram.  returns with si->lock held and 0 if one is queued,
+// else without it and -1.
+static int
+sockwait(struct sock *si, int dontwait)
+{
+  struct proc *pr = myproc();
+
+  acquire(&si->lock);
+  si->cpu = cpuid();
+  while(mbufq_empty(&si->rxq)){
+    if(dontwait || si->nonblock || killed(pr)){
+      release(&si->lock);
+      return -1;
+    }
+    sleep(&si->rxq, &si->lock);
+  }
+  return 0;
+}
+
+// takes up to n datagrams off si's queue; caller holds si->lock.
+static int
+sockdequeue(struct sock *si, struct mbuf **ms, int n)
+{
+  int i;
+
+  for(i = 0; i < n && !mbufq_empty(&si->rxq); i++){
+    ms[i] = mbufq_pophead(&si->rxq);
+    si->qlen--;
+  }
+  return i;
+}
+
+// reads the payload of one datagram, truncated to n bytes.
+int
+sockread(struct sock *si, uint64 addr, int n)
+{
+  struct proc *pr = myproc();
+  struct mbuf *m;
+  int len;
+
+  if(sockwait(si, 0) < 0)
+    return si->nonblock ? 0 : -1;
+  sockdequeue(si, &m, 1);
+  release(&si->lock);
+
+  mbufpullhdr(m, struct sockfrom);
+  len = m->len < n ? m->len : n;
+  if(copyout(pr->pagetable, addr, m->head, len) < 0)
+    len = -1;
+  mbuffree(m);
+  return len;
+}
+
+// fills in the udp_msg at user address ma from datagram m.
+static int
+sockmsgout(struct proc *pr, uint64 ma, struct mbuf *m)
+{
+  struct sockfrom *from = mbufpullhdr(m, *from);
+  struct udp_msg msg;
+
+  if(copyin(pr->pagetable, (char*)&msg, ma, sizeof(msg)) < 0)
+    return -1;
+  msg.addr = from->sip;
+  msg.port = from->sport;
+  msg.flags = m->len > msg.len ? UDP_MSG_TRUNC : 0;
+  if(m->len < msg.len)
+    msg.len = m->len;
+  if(copyout(pr->pagetable, msg.buf, m->head, msg.len) < 0 ||
+     copyout(pr->pagetable, ma, (char*)&msg, sizeof(msg)) < 0)
+    return -1;
+  return 0;
+}
+
+// receives up to n datagrams into the udp_msgs at addr, waiting for
+// the first unless the socket is non-blocking or dontwait is set.
+// returns how many were received: 0 if none were waiting and we
+// mustn't wait, -1 on error.
+int
+sockrecvmmsg(struct sock *si, uint64 addr, int n, int dontwait)
+{
+  struct proc *pr = myproc();
+  struct mbuf *ms[UDP_MMSG_MAX];
+  int got, i, r;
+
+  if(n <= 0)
+    return -1;
+  if(n > UDP_MMSG_MAX)
+    n = UDP_MMSG_MAX;
+
+  if(sockwait(si, dontwait) < 0)
+    return killed(pr) ? -1 : 0;
+  got = sockdequeue(si, ms, n);
+  release(&si->lock);
+
+  // copy out with no lock held; a fault loses the rest
+  r = got;
+  for(i = 0; i < got; i++){
+    if(r == got && sockmsgout(pr, addr + i * sizeof(struct udp_msg), ms[i]) < 0)
+      r = i > 0 ? i : -1;
+    mbuffree(ms[i]);
+  }
+  return r;
+}
+
+// sends the n datagrams described by the udp_msgs at addr from si's
+// port, then rings the NIC once for all of them.  returns how many
+// were sent, or -1 if the first couldn't be.
+int
+socksendmmsg(struct sock *si, uint64 addr, int n)
+{
+  struct proc *pr = myproc();
+  struct udp_msg msg;
+  int i;
+
+  if(n <= 0)
+    return -1;
+  if(n > UDP_MMSG_MAX)
+    n = UDP_MMSG_MAX;
+
+  for(i = 0; i < n; i++){
+    struct mbuf *m;
+
+    if(copyin(pr->pagetable, (char*)&msg, addr + i * sizeof(msg), sizeof(msg)) < 0 ||
+       msg.len > UDP_MAX_DATA)
+      break;
+    if((m = mbufalloc(MBUF_DEFAULT_HEADROOM)) == 0)
+      break;
+    if(copyin(pr->pagetable, mbufput(m, msg.len), msg.buf, msg.len) < 0){
+      mbuffree(m);
+      break;
+    }
+    if(net_tx_udp(m, msg.addr, si->lport, msg.port) < 0)
+      break;
+  }
+  netdev_kick();
+  return i > 0 ? i : -1;
+}
+
+// called by net.c for each incoming UDP datagram; m starts at the
+// payload.
+void
+sockrecvudp(struct mbuf *m, uint32 sip, uint16 dport, uint16 sport)
+{
+  struct sock *si;
+  struct sockfrom *from;
+
+  acquire(&lock);
+  si = socklookup(dport);
+  if(si == 0){
+    release(&lock);
+    mbuffree(m);
+    return;
+  }
+  acquire(&si->lock);
+  release(&lock);
+
+  if(si->qlen >= SOCK_RXQ){
+    si->drops++;
+    release(&si->lock);
+    mbuffree(m);
+    return;
+  }
+  // the UDP header we were handed m past has room for this
+  from = mbufpushhdr(m, *from);
+  from->sip = sip;
+  from->sport = sport;
+  from->pad = 0;
+  mbufq_pushtail(&si->rxq, m);
+  si->qlen++;
+  wakeup(&si->rxq);
+  release(&si->lock);
+}
+
+// the CPU the process receiving on lport last asked from, or -1;
+// receive steering sends lport's datagrams there.
+int
+sockcpu(uint16 lport)
+{
+  struct sock *si;
+  int cpu = -1;
+
+  acquire(&lock);
+  if((si = socklookup(lport)) != 0)
+    cpu = si->cpu;
+  release(&lock);
+  return cpu;
+}
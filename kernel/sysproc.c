@@ -6,6 +6,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "vm.h"
+#include "swap.h"
 
 uint64
 sys_exit(void)
@@ -107,3 +108,27 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// make device dev swap space.  returns the number of page slots.
+uint64
+sys_swapon(void)
+{
+  int dev;
+
+  argint(0, &dev);
+  return swapon(dev);
+}
+
+// copy the pager's counters to the struct swapstat at addr.
+uint64
+sys_swapstat(void)
+{
+  uint64 addr;
+  struct swapstat st;
+
+  argaddr(0, &addr);
+  swapstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
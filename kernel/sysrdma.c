@@ -6,6 +6,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "fs.h"
 #include "rdma.h"
 
 // Register memory region
@@ -193,3 +194,341 @@ sys_rdma_connect(void)
     
     return rdma_qp_connect(qp_id, mac, (uint32)remote_qp);
 }
+
+// Offer QPs and MRs under a service ID (connection manager)
+// args: service_id (uint32), qps (int *), nqp (int), mrs (int *), nmr (int)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_cm_listen(void)
+{
+    int service_id;
+    uint64 qps_ptr, mrs_ptr;
+    int nqp, nmr;
+    int qps[RDMA_CM_MAX_QPS];
+    int mrs[RDMA_CM_MAX_MRS];
+    struct proc *p = myproc();
+    
+    argint(0, &service_id);
+    argaddr(1, &qps_ptr);
+    argint(2, &nqp);
+    argaddr(3, &mrs_ptr);
+    argint(4, &nmr);
+    
+    // Validate counts
+    if (nqp < 1 || nqp > RDMA_CM_MAX_QPS || nmr < 0 || nmr > RDMA_CM_MAX_MRS) {
+        return -1;
+    }
+    
+    // Copy QP and MR IDs from user space
+    if (copyin(p->pagetable, (char*)qps, qps_ptr, nqp * sizeof(int)) < 0) {
+        return -1;
+    }
+    if (nmr > 0 && copyin(p->pagetable, (char*)mrs, mrs_ptr, nmr * sizeof(int)) < 0) {
+        return -1;
+    }
+    
+    return rdma_cm_listen((uint32)service_id, qps, nqp, mrs, nmr);
+}
+
+// Wait for a connection on a listened-on service
+// args: service_id (uint32), info (struct rdma_cm_info *)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_cm_accept(void)
+{
+    int service_id;
+    uint64 info_ptr;
+    struct rdma_cm_info info;
+    struct proc *p = myproc();
+    
+    argint(0, &service_id);
+    argaddr(1, &info_ptr);
+    
+    if (rdma_cm_accept((uint32)service_id, &info) < 0) {
+        return -1;
+    }
+    
+    // Copy connection info to user space
+    if (copyout(p->pagetable, info_ptr, (char*)&info, sizeof(info)) < 0) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Connect QPs to a service, resolving remote QPs and MRs
+// args: info (struct rdma_cm_info *, in/out), mrs (int *), nmr (int)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_cm_connect(void)
+{
+    uint64 info_ptr, mrs_ptr;
+    int nmr;
+    struct rdma_cm_info info;
+    int mrs[RDMA_CM_MAX_MRS];
+    struct proc *p = myproc();
+    
+    argaddr(0, &info_ptr);
+    argaddr(1, &mrs_ptr);
+    argint(2, &nmr);
+    
+    if (nmr < 0 || nmr > RDMA_CM_MAX_MRS) {
+        return -1;
+    }
+    
+    // Copy request and MR IDs from user space
+    if (copyin(p->pagetable, (char*)&info, info_ptr, sizeof(info)) < 0) {
+        return -1;
+    }
+    if (nmr > 0 && copyin(p->pagetable, (char*)mrs, mrs_ptr, nmr * sizeof(int)) < 0) {
+        return -1;
+    }
+    
+    if (rdma_cm_connect(&info, mrs, nmr) < 0) {
+        return -1;
+    }
+    
+    // Copy result back to user space
+    if (copyout(p->pagetable, info_ptr, (char*)&info, sizeof(info)) < 0) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Stop listening on a service
+// args: service_id (uint32)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_cm_close(void)
+{
+    int service_id;
+    
+    argint(0, &service_id);
+    
+    return rdma_cm_close((uint32)service_id);
+}
+
+// Create unreliable datagram queue pair
+// args: sq_size (uint32), cq_size (uint32), qkey (uint32)
+// returns: qp_id on success, -1 on failure
+uint64
+sys_rdma_create_ud_qp(void)
+{
+    int sq_size;
+    int cq_size;
+    int qkey;
+    
+    argint(0, &sq_size);
+    argint(1, &cq_size);
+    argint(2, &qkey);
+    
+    // Validate queue sizes (must be positive and reasonable)
+    if (sq_size <= 0 || sq_size > 1024 || cq_size <= 0 || cq_size > 1024) {
+        return -1;
+    }
+    
+    return rdma_qp_create_type((uint32)sq_size, (uint32)cq_size, RDMA_QPT_UD, (uint32)qkey);
+}
+
+// Post receive buffer to a UD queue pair
+// args: qp_id (int), rr (struct rdma_recv_request *)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_post_recv(void)
+{
+    int qp_id;
+    uint64 rr_ptr;
+    struct rdma_recv_request rr;
+    struct proc *p = myproc();
+    
+    argint(0, &qp_id);
+    argaddr(1, &rr_ptr);
+    
+    // Validate qp_id
+    if (qp_id < 0 || qp_id >= MAX_QPS) {
+        return -1;
+    }
+    
+    // Copy receive request from user space
+    if (copyin(p->pagetable, (char*)&rr, rr_ptr, sizeof(rr)) < 0) {
+        return -1;
+    }
+    
+    return rdma_qp_post_recv(qp_id, &rr);
+}
+
+// Set a QP's transmit scheduling weight and class
+// args: qp_id (int), weight (int), prio (int)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_set_qp_sched(void)
+{
+    int qp_id;
+    int weight;
+    int prio;
+    
+    argint(0, &qp_id);
+    argint(1, &weight);
+    argint(2, &prio);
+    
+    if (weight <= 0) {
+        return -1;
+    }
+    
+    return rdma_qp_set_sched(qp_id, (uint32)weight, (uint32)prio);
+}
+
+// Read a QP's statistics
+// args: qp_id (int), st (struct rdma_qp_stats *)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_query_qp(void)
+{
+    int qp_id;
+    uint64 st_ptr;
+    struct rdma_qp_stats st;
+    struct proc *p = myproc();
+    
+    argint(0, &qp_id);
+    argaddr(1, &st_ptr);
+    
+    if (rdma_qp_query(qp_id, &st) < 0) {
+        return -1;
+    }
+    
+    if (copyout(p->pagetable, st_ptr, (char*)&st, sizeof(st)) < 0) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Add or move one of a connected QP's paths
+// args: qp_id (int), path (int), port (int), mac (uint8 *)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_set_qp_path(void)
+{
+    int qp_id, path, port;
+    uint64 mac_ptr;
+    uint8 mac[6];
+    struct proc *p = myproc();
+    
+    argint(0, &qp_id);
+    argint(1, &path);
+    argint(2, &port);
+    argaddr(3, &mac_ptr);
+    
+    if (path < 0 || port < 0) {
+        return -1;
+    }
+    
+    if (copyin(p->pagetable, (char*)mac, mac_ptr, 6) < 0) {
+        return -1;
+    }
+    
+    return rdma_qp_set_path(qp_id, (uint32)path, (uint32)port, mac);
+}
+
+// Carry one of a connected QP's paths in UDP, or stop
+// args: qp_id (int), path (int), ip (uint32), udp_port (int)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_set_qp_udp(void)
+{
+    int qp_id, path, ip, udp_port;
+    
+    argint(0, &qp_id);
+    argint(1, &path);
+    argint(2, &ip);
+    argint(3, &udp_port);
+    
+    if (path < 0 || udp_port < 0) {
+        return -1;
+    }
+    
+    return rdma_qp_set_udp(qp_id, (uint32)path, (uint32)ip, (uint32)udp_port);
+}
+
+// Turn a connected QP's CRC32C payload check on or off
+// args: qp_id (int), on (int)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_set_qp_crc(void)
+{
+    int qp_id, on;
+    
+    argint(0, &qp_id);
+    argint(1, &on);
+    
+    return rdma_qp_set_crc(qp_id, on);
+}
+
+// Write a file-backed MR's changed blocks back to its file
+// args: mr_id (int)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdma_sync_mr(void)
+{
+    int mr_id;
+    
+    argint(0, &mr_id);
+    
+    return rdma_mr_sync(mr_id);
+}
+
+// Hand a QP connected to a disk server over to the kernel, as the
+// remote disk RDISKDEV; see rdma_disk_attach()
+// args: qp_id (int), dir_mr (int), dir_rkey (int)
+// returns: 0 on success, -1 on failure
+uint64
+sys_rdisk_attach(void)
+{
+    int qp_id, dir_mr, dir_rkey;
+    
+    argint(0, &qp_id);
+    argint(1, &dir_mr);
+    argint(2, &dir_rkey);
+    
+    return rdma_disk_attach(qp_id, (uint32)dir_mr, (uint32)dir_rkey);
+}
+
+// Mirror the file system log to the log standby on the remote disk;
+// see log_mirror()
+// args: dev (int), mode (int: LOGMIRROR_BOTH or LOGMIRROR_REMOTE)
+// returns: 0 on success, -1 on failure
+uint64
+sys_logmirror(void)
+{
+    int dev, mode, applied;
+
+    argint(0, &dev);
+    argint(1, &mode);
+
+    if (dev != RDISKDEV || (mode != LOGMIRROR_BOTH && mode != LOGMIRROR_REMOTE))
+        return -1;
+    if (rdma_disk_claim(RDISK_LOG) < 0 || (applied = rdma_disk_logstart()) < 0)
+        return -1;
+    return log_mirror(applied, mode == LOGMIRROR_REMOTE);
+}
+
+// On a log standby: apply the transaction in the slot at addr, its
+// header in the slot's last block; see log_replay()
+// args: addr (void*)
+// returns: 0 on success, -1 on failure
+uint64
+sys_logreplay(void)
+{
+    struct proc *p = myproc();
+    struct rlog_head h;
+    uint64 addr;
+
+    argaddr(0, &addr);
+
+    if (copyin(p->pagetable, (char*)&h, addr + RLOG_HEAD_BLOCK * BSIZE, sizeof(h)) < 0)
+        return -1;
+    if (h.magic != RLOG_MAGIC || h.n > LOGBLOCKS)
+        return -1;
+    return log_replay(h.n, (int*)h.block, addr);
+}
@@ -68,9 +68,9 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
-  } else if((r_scause() == 15 || r_scause() == 13) &&
+  } else if((r_scause() == 15 || r_scause() == 13 || r_scause() == 12) &&
             vmfault(p->pagetable, r_stval(), (r_scause() == 13)? 1 : 0) != 0) {
-    // page fault on lazily-allocated page
+    // page fault on lazily-allocated or paged-out page
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -161,6 +161,14 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// the time CSR, for fine-grained timestamps; it counts at
+// 10 MHz under qemu.
+uint64
+readtime(void)
+{
+  return r_time();
+}
+
 void
 clockintr()
 {
@@ -170,11 +178,18 @@ clockintr()
     wakeup(&ticks);
     release(&tickslock);
     
-    // Poll E1000 RX as fallback in case interrupts don't work
+    // Poll the NICs' RX as fallback in case interrupts don't work
     // This polls every ~0.1 seconds (10 Hz)
     if (ticks % 1 == 0) {
-      e1000_recv();
+      netdev_recv();
     }
+
+    // retransmit RDMA connection manager handshakes and
+    // send any combined RDMA WRITEs still waiting
+    rdma_cm_tick();
+    rdma_net_tick();
+    // repeat unanswered ARP requests
+    net_tick();
   }
 
   // ask for the next timer interrupt. this also clears
@@ -203,8 +218,11 @@ devintr()
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
       virtio_disk_intr();
-    } else if(irq == E1000_IRQ){
+    } else if(irq == VIRTIO1_IRQ){
+      virtio_net_intr();
+    } else if(irq >= PCIE_IRQ && irq < PCIE_IRQ + NPCIE_IRQ){
       e1000_intr();
+      ivshmem_intr();
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -220,6 +238,12 @@ devintr()
     // timer interrupt.
     clockintr();
     return 2;
+  } else if(scause == 0x8000000000000001L){
+    // software interrupt: another hart queued received
+    // frames for this one (see ipivec in kernelvec.S).
+    w_sip(r_sip() & ~2);
+    netdev_rxintr();
+    return 1;
   } else {
     return 0;
   }
@@ -7,14 +7,17 @@
 // https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.pdf
 //
 
-// virtio mmio control registers, mapped starting at 0x10001000.
+// virtio mmio control registers, mapped starting at 0x10001000
+// (the disk) and 0x10002000 (the network card).
 // from qemu virtio_mmio.h
 #define VIRTIO_MMIO_MAGIC_VALUE		0x000 // 0x74726976
 #define VIRTIO_MMIO_VERSION		0x004 // version; should be 2
 #define VIRTIO_MMIO_DEVICE_ID		0x008 // device type; 1 is net, 2 is disk
 #define VIRTIO_MMIO_VENDOR_ID		0x00c // 0x554d4551
 #define VIRTIO_MMIO_DEVICE_FEATURES	0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL	0x014 // which 32 feature bits to read
 #define VIRTIO_MMIO_DRIVER_FEATURES	0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL	0x024 // which 32 feature bits to write
 #define VIRTIO_MMIO_QUEUE_SEL		0x030 // select queue, write-only
 #define VIRTIO_MMIO_QUEUE_NUM_MAX	0x034 // max size of current queue, read-only
 #define VIRTIO_MMIO_QUEUE_NUM		0x038 // size of current queue, write-only
@@ -29,6 +32,7 @@
 #define VIRTIO_MMIO_DRIVER_DESC_HIGH	0x094
 #define VIRTIO_MMIO_DEVICE_DESC_LOW	0x0a0 // physical address for used ring, write-only
 #define VIRTIO_MMIO_DEVICE_DESC_HIGH	0x0a4
+#define VIRTIO_MMIO_CONFIG		0x100 // device-specific configuration
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -44,6 +48,7 @@
 #define VIRTIO_F_ANY_LAYOUT         27
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
+#define VIRTIO_F_VERSION_1          32	/* in the second word of features */
 
 // this many virtio descriptors.
 // must be a power of two.
@@ -94,3 +99,50 @@ struct virtio_blk_req {
   uint32 reserved;
   uint64 sector;
 };
+
+// these are specific to virtio network devices,
+// described in Section 5.1 of the spec.
+
+#define VIRTIO_NET_F_MAC             5	/* config space holds the MAC */
+
+// queue size for the network card's queues, which may be larger
+// than the disk's. must be a power of two.
+#define VNET_NUM 256
+
+// the network card's avail and used rings. with
+// VIRTIO_RING_F_EVENT_IDX, each ends in a word with which its
+// reader tells the writer when next to notify it.
+struct vnet_avail {
+  uint16 flags;
+  uint16 idx;
+  uint16 ring[VNET_NUM];
+  uint16 used_event; // device interrupts when used->idx passes this
+};
+
+struct vnet_used {
+  uint16 flags;
+  uint16 idx;
+  struct virtq_used_elem ring[VNET_NUM];
+  uint16 avail_event; // driver notifies when avail->idx passes this
+};
+
+// the header in front of every frame, in both directions.
+// with VIRTIO_F_VERSION_1 it includes num_buffers.
+struct virtio_net_hdr {
+  uint8 flags;
+  uint8 gso_type;
+  uint16 hdr_len;
+  uint16 gso_size;
+  uint16 csum_start;
+  uint16 csum_offset;
+  uint16 num_buffers;
+};
+
+// with EVENT_IDX: should moving an index from old to new_idx
+// trigger a notification, given the other side asked for one
+// once it passed event? from the spec, Section 2.6.7.
+static inline int
+vring_need_event(uint16 event, uint16 new_idx, uint16 old)
+{
+  return (uint16)(new_idx - event - 1) < (uint16)(new_idx - old);
+}
@@ -0,0 +1,385 @@
+//
+// driver for qemu's virtio network device.
+// uses qemu's mmio interface to virtio, like virtio_disk.c.
+//
+// qemu ... -device virtio-net-device,netdev=n1,bus=virtio-mmio-bus.1
+//
+// queue 0 receives and queue 1 transmits.  unlike the e1000's
+// 16-slot rings these have VNET_NUM entries, a frame takes
+// descriptors from a pool rather than a fixed slot, and both
+// directions keep the device quiet until there is a batch:
+//
+//  - transmit only fills the avail ring; netdev_kick() notifies the
+//    device once for everything queued, and with
+//    VIRTIO_RING_F_EVENT_IDX only if the device asked to be told
+//    (it hasn't if it is still working through the ring).
+//  - transmit completions don't interrupt at all while the ring has
+//    room; they are reclaimed the next time a frame is sent.  when
+//    the ring fills, the device is asked to interrupt once half of
+//    it is done, and the interrupt refills it from the RDMA queues,
+//    as the e1000's TXQE interrupt does.
+//  - receive interrupts once per batch, and every received frame is
+//    handed up in that one interrupt.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "net.h"
+#include "defs.h"
+#include "virtio.h"
+
+// the address of virtio mmio register r.
+#define R(r) ((volatile uint32 *)(VIRTIO1 + (r)))
+
+#define VNET_RXQ 0
+#define VNET_TXQ 1
+#define VNET_RXBUFS 128          // receive buffers posted
+#define VNET_TXPAIRS (VNET_NUM/2) // a frame is a header and a data descriptor
+
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+#define VRING_USED_F_NO_NOTIFY     1
+
+// one virtqueue.
+struct vnet_queue {
+  int qn;                  // queue number, for QUEUE_NOTIFY
+  struct virtq_desc *desc;
+  struct vnet_avail *avail;
+  struct vnet_used *used;
+  uint16 used_idx;         // we've looked this far in used->ring.
+  uint16 kicked_idx;       // avail->idx at the last kick.
+};
+
+static struct vnet {
+  int present;
+  int event_idx;           // negotiated VIRTIO_RING_F_EVENT_IDX
+  int port;                // netdev port number
+  uint8 mac[6];
+
+  struct vnet_queue rx;
+  struct mbuf *rx_mbufs[VNET_RXBUFS]; // by descriptor number
+
+  struct vnet_queue tx;
+  struct mbuf *tx_mbufs[VNET_TXPAIRS]; // by pair number
+  uint16 tx_free[VNET_TXPAIRS];        // stack of free pairs
+  int tx_nfree;
+
+  // every frame sent shares this header: no offloads.
+  struct virtio_net_hdr tx_hdr;
+
+  struct spinlock lock;
+} vnet;
+
+static int virtio_net_transmit(int unit, struct mbuf *m);
+static void virtio_net_kick(int unit);
+static void virtio_net_recv(int unit);
+
+// set up queue qn, as virtio_disk_init() does queue 0.
+static void
+vnet_queue_init(struct vnet_queue *q, int qn)
+{
+  q->qn = qn;
+  *R(VIRTIO_MMIO_QUEUE_SEL) = qn;
+  if(*R(VIRTIO_MMIO_QUEUE_READY))
+    panic("virtio net should not be ready");
+  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if(max < VNET_NUM)
+    panic("virtio net max queue too short");
+
+  q->desc = kalloc();
+  q->avail = kalloc();
+  q->used = kalloc();
+  if(!q->desc || !q->avail || !q->used)
+    panic("virtio net kalloc");
+  memset(q->desc, 0, PGSIZE);
+  memset(q->avail, 0, PGSIZE);
+  memset(q->used, 0, PGSIZE);
+
+  *R(VIRTIO_MMIO_QUEUE_NUM) = VNET_NUM;
+  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)q->desc;
+  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)q->desc >> 32;
+  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)q->avail;
+  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)q->avail >> 32;
+  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)q->used;
+  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)q->used >> 32;
+  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+}
+
+// add descriptor chain head to q's avail ring.  the device may not
+// look until vnet_queue_kick().
+static void
+vnet_queue_add(struct vnet_queue *q, int head)
+{
+  q->avail->ring[q->avail->idx % VNET_NUM] = head;
+  __sync_synchronize();
+  q->avail->idx += 1; // not % VNET_NUM ...
+}
+
+// notify the device of what was added since the last kick, unless
+// it has said it doesn't need to be told.
+static void
+vnet_queue_kick(struct vnet_queue *q)
+{
+  uint16 idx = q->avail->idx;
+  int need;
+
+  if(idx == q->kicked_idx)
+    return;
+  __sync_synchronize(); // avail->idx before reading the device's wishes
+  if(vnet.event_idx)
+    need = vring_need_event(q->used->avail_event, idx, q->kicked_idx);
+  else
+    need = !(q->used->flags & VRING_USED_F_NO_NOTIFY);
+  q->kicked_idx = idx;
+  if(need)
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = q->qn;
+}
+
+// ask for an interrupt once the device has used n more entries of
+// q, or (n == 0) for none.
+static void
+vnet_queue_arm(struct vnet_queue *q, int n)
+{
+  if(vnet.event_idx){
+    // an event VNET_NUM away can't be reached before we re-arm.
+    q->avail->used_event = q->used_idx + (n ? n - 1 : VNET_NUM);
+  } else {
+    q->avail->flags = n ? 0 : VRING_AVAIL_F_NO_INTERRUPT;
+  }
+  __sync_synchronize();
+}
+
+// point rx descriptor i at m's buffer and post it.
+static void
+vnet_rx_post(int i, struct mbuf *m)
+{
+  vnet.rx_mbufs[i] = m;
+  vnet.rx.desc[i].addr = (uint64)m->buf;
+  vnet.rx.desc[i].len = MBUF_SIZE;
+  vnet.rx.desc[i].flags = VRING_DESC_F_WRITE;
+  vnet.rx.desc[i].next = 0;
+  vnet_queue_add(&vnet.rx, i);
+}
+
+void
+virtio_net_init(void)
+{
+  uint32 status = 0;
+
+  initlock(&vnet.lock, "virtio_net");
+
+  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(VIRTIO_MMIO_VERSION) != 2 ||
+     *R(VIRTIO_MMIO_DEVICE_ID) != 1 ||
+     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    printf("virtio_net: no device\n");
+    return;
+  }
+
+  // reset device
+  *R(VIRTIO_MMIO_STATUS) = status;
+  status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
+  *R(VIRTIO_MMIO_STATUS) = status;
+  status |= VIRTIO_CONFIG_S_DRIVER;
+  *R(VIRTIO_MMIO_STATUS) = status;
+
+  // negotiate features: only the MAC, event indices, and the
+  // modern layout; no offloads and no mergeable buffers.
+  *R(VIRTIO_MMIO_DEVICE_FEATURES_SEL) = 0;
+  uint32 lo = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  *R(VIRTIO_MMIO_DEVICE_FEATURES_SEL) = 1;
+  uint32 hi = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  lo &= (1 << VIRTIO_NET_F_MAC) | (1 << VIRTIO_RING_F_EVENT_IDX);
+  hi &= 1 << (VIRTIO_F_VERSION_1 - 32);
+  if(hi == 0){
+    printf("virtio_net: device is legacy-only\n");
+    return;
+  }
+  *R(VIRTIO_MMIO_DRIVER_FEATURES_SEL) = 0;
+  *R(VIRTIO_MMIO_DRIVER_FEATURES) = lo;
+  *R(VIRTIO_MMIO_DRIVER_FEATURES_SEL) = 1;
+  *R(VIRTIO_MMIO_DRIVER_FEATURES) = hi;
+  vnet.event_idx = (lo >> VIRTIO_RING_F_EVENT_IDX) & 1;
+
+  status |= VIRTIO_CONFIG_S_FEATURES_OK;
+  *R(VIRTIO_MMIO_STATUS) = status;
+  status = *R(VIRTIO_MMIO_STATUS);
+  if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
+    panic("virtio net FEATURES_OK unset");
+
+  // the MAC is the first six bytes of config space.
+  volatile uint8 *config = (volatile uint8 *)R(VIRTIO_MMIO_CONFIG);
+  uint8 fallback[6] = { 0x52, 0x54, 0x00, 0x12, 0x35, 0x56 };
+  for(int i = 0; i < 6; i++)
+    vnet.mac[i] = (lo & (1 << VIRTIO_NET_F_MAC)) ? config[i] : fallback[i];
+
+  vnet_queue_init(&vnet.rx, VNET_RXQ);
+  vnet_queue_init(&vnet.tx, VNET_TXQ);
+
+  // post the receive buffers.
+  for(int i = 0; i < VNET_RXBUFS; i++){
+    struct mbuf *m = mbufalloc(0);
+    if(!m)
+      panic("virtio net rx mbuf");
+    vnet_rx_post(i, m);
+  }
+  vnet_queue_arm(&vnet.rx, 1);
+
+  // transmit descriptors go in pairs, 2p and 2p+1: the shared header,
+  // then the frame.  only the second changes per frame.
+  for(int p = 0; p < VNET_TXPAIRS; p++){
+    vnet.tx.desc[2*p].addr = (uint64)&vnet.tx_hdr;
+    vnet.tx.desc[2*p].len = sizeof(vnet.tx_hdr);
+    vnet.tx.desc[2*p].flags = VRING_DESC_F_NEXT;
+    vnet.tx.desc[2*p].next = 2*p + 1;
+    vnet.tx_free[vnet.tx_nfree++] = p;
+  }
+  vnet_queue_arm(&vnet.tx, 0);
+
+  // tell device we're completely ready.
+  status |= VIRTIO_CONFIG_S_DRIVER_OK;
+  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = VNET_RXQ;
+  vnet.rx.kicked_idx = vnet.rx.avail->idx;
+  vnet.present = 1;
+
+  struct netdev nd = {
+    .name = "virtio-net",
+    .unit = 0,
+    .transmit = virtio_net_transmit,
+    .kick = virtio_net_kick,
+    .recv = virtio_net_recv,
+  };
+  memmove(nd.mac, vnet.mac, 6);
+  vnet.port = netdev_register(&nd);
+
+  // plic.c and trap.c arrange for interrupts from VIRTIO1_IRQ.
+}
+
+// free the mbufs of frames the device has finished sending.
+// returns the number reclaimed.
+static int
+vnet_tx_reclaim(void)
+{
+  int n = 0;
+
+  while(vnet.tx.used_idx != vnet.tx.used->idx){
+    __sync_synchronize();
+    int p = vnet.tx.used->ring[vnet.tx.used_idx % VNET_NUM].id / 2;
+    mbuffree(vnet.tx_mbufs[p]);
+    vnet.tx_mbufs[p] = 0;
+    vnet.tx_free[vnet.tx_nfree++] = p;
+    vnet.tx.used_idx += 1;
+    n++;
+  }
+  return n;
+}
+
+// queue m.  the device doesn't see it until virtio_net_kick().
+// returns 0 on success, -1 if the ring is full.
+static int
+virtio_net_transmit(int unit, struct mbuf *m)
+{
+  acquire(&vnet.lock);
+
+  if(vnet.tx_nfree == 0 && vnet_tx_reclaim() == 0){
+    // full: interrupt when half the ring is done, then look once
+    // more in case it finished before it saw the request.
+    vnet_queue_arm(&vnet.tx, VNET_TXPAIRS / 2);
+    if(vnet_tx_reclaim() == 0){
+      release(&vnet.lock);
+      return -1;
+    }
+  }
+  vnet_queue_arm(&vnet.tx, 0);
+
+  int p = vnet.tx_free[--vnet.tx_nfree];
+  vnet.tx_mbufs[p] = m;
+  vnet.tx.desc[2*p + 1].addr = (uint64)m->head;
+  vnet.tx.desc[2*p + 1].len = m->len;
+  vnet.tx.desc[2*p + 1].flags = 0; // device reads the frame
+  vnet.tx.desc[2*p + 1].next = 0;
+  vnet_queue_add(&vnet.tx, 2*p);
+
+  release(&vnet.lock);
+  return 0;
+}
+
+static void
+virtio_net_kick(int unit)
+{
+  acquire(&vnet.lock);
+  vnet_queue_kick(&vnet.tx);
+  release(&vnet.lock);
+}
+
+// hand up every frame received so far.
+static void
+virtio_net_recv(int unit)
+{
+  struct mbuf *head = 0, **tail = &head;
+
+  if(!vnet.present)
+    return;
+
+  acquire(&vnet.lock);
+  do {
+    while(vnet.rx.used_idx != vnet.rx.used->idx){
+      __sync_synchronize();
+      struct virtq_used_elem *e = &vnet.rx.used->ring[vnet.rx.used_idx % VNET_NUM];
+      int i = e->id;
+      uint32 len = e->len;
+      struct mbuf *m = vnet.rx_mbufs[i];
+      struct mbuf *fresh = mbufalloc(0);
+
+      vnet.rx.used_idx += 1;
+      if(fresh == 0 || len < sizeof(struct virtio_net_hdr)){
+        vnet_rx_post(i, m); // drop the frame, keep the buffer
+        if(fresh)
+          mbuffree(fresh);
+        continue;
+      }
+      vnet_rx_post(i, fresh);
+
+      m->head = m->buf + sizeof(struct virtio_net_hdr);
+      m->len = len - sizeof(struct virtio_net_hdr);
+      m->dev = vnet.port;
+      m->next = 0;
+      *tail = m;
+      tail = &m->next;
+    }
+    // interrupt on the next frame, then look once more in case it
+    // arrived before the device saw the request.
+    vnet_queue_arm(&vnet.rx, 1);
+  } while(vnet.rx.used_idx != vnet.rx.used->idx);
+  vnet_queue_kick(&vnet.rx);
+  release(&vnet.lock);
+
+  // netdev_rx() may transmit, so it must not hold vnet.lock.
+  while(head){
+    struct mbuf *m = head;
+    head = m->next;
+    m->next = 0;
+    netdev_rx(m);
+  }
+}
+
+void
+virtio_net_intr(void)
+{
+  // as in virtio_disk_intr(), acknowledge first: anything that
+  // arrives after this raises a new interrupt.
+  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  __sync_synchronize();
+
+  virtio_net_recv(0);
+
+  // the TX ring may have drained: refill it with queued RDMA frames
+  acquire(&vnet.lock);
+  vnet_tx_reclaim();
+  release(&vnet.lock);
+  rdma_sched_run();
+}
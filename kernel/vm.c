@@ -32,11 +32,21 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // virtio mmio network interface
+  kvmmap(kpgtbl, VIRTIO1, VIRTIO1, PGSIZE, PTE_R | PTE_W);
+
   // PCIe ECAM (configuration space) - 256MB for all buses/devices/functions
   kvmmap(kpgtbl, PCIE_ECAM, PCIE_ECAM, 0x10000000, PTE_R | PTE_W);
 
-  // E1000 NIC registers (needs 128KB for register space)
-  kvmmap(kpgtbl, E1000_BASE, E1000_BASE, 0x20000, PTE_R | PTE_W);
+  // E1000 NIC registers (needs 128KB for register space, per NIC)
+  kvmmap(kpgtbl, E1000_BASE, E1000_BASE, NE1000 * E1000_MMIO_SIZE, PTE_R | PTE_W);
+
+  // ivshmem registers and the memory shared with the other VM
+  kvmmap(kpgtbl, IVSHMEM_REGS, IVSHMEM_REGS, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, IVSHMEM_BASE, IVSHMEM_BASE, IVSHMEM_SIZE, PTE_R | PTE_W);
+
+  // CLINT, for sending inter-processor interrupts
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
@@ -207,6 +217,10 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0) // leaf page table entry allocated?
       continue;   
+    if((*pte & PTE_S) && (!do_free || swapfree(pte))){  // paged out?
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)  // has physical page been allocated?
       continue;
     if(do_free){
@@ -230,13 +244,13 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = swapalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
     memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
+    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|PTE_A|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
       return 0;
@@ -310,13 +324,22 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
       continue;   // page table entry hasn't been allocated
-    if((*pte & PTE_V) == 0)
+    if((*pte & (PTE_V|PTE_S)) == 0)
       continue;   // physical page hasn't been allocated
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    // may page out old's pages, this one too
+    if((mem = swapalloc()) == 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
+    if(*pte & PTE_S){
+      if(swapread(pte, mem) < 0){
+        kfree(mem);
+        goto err;
+      }
+      flags = PTE_FLAGS(*pte) & ~PTE_S;
+    } else {
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte);
+      memmove(mem, (char*)pa, PGSIZE);
+    }
     if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
       kfree(mem);
       goto err;
@@ -421,8 +444,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0) {
+      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
+        return -1;
+      }
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -452,13 +478,15 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 }
 
 // allocate and map user memory if process is referencing a page
-// that was lazily allocated in sys_sbrk().
+// that was lazily allocated in sys_sbrk(), or bring it back if
+// swap.c paged it out.
 // returns 0 if va is invalid or already mapped, or if
 // out of physical memory, and physical address if successful.
 uint64
 vmfault(pagetable_t pagetable, uint64 va, int read)
 {
   uint64 mem;
+  pte_t *pte;
   struct proc *p = myproc();
 
   if (va >= p->sz)
@@ -467,11 +495,13 @@ vmfault(pagetable_t pagetable, uint64 va, int read)
   if(ismapped(pagetable, va)) {
     return 0;
   }
-  mem = (uint64) kalloc();
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_S))
+    return swapin(pagetable, va);
+  mem = (uint64) swapalloc();
   if(mem == 0)
     return 0;
   memset((void *) mem, 0, PGSIZE);
-  if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
+  if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R|PTE_A) != 0) {
     kfree((void *)mem);
     return 0;
   }
@@ -0,0 +1,955 @@
+// rdmapeer - a Linux peer that speaks the xv6 RDMA wire protocol.
+//
+// It attaches to the same QEMU netdev a second xv6 VM would use and
+// exchanges raw Ethernet frames (ethertype 0x8915) with the guest:
+//
+//   QEMU -netdev socket,listen=:1234    rdmapeer -c 127.0.0.1:1234 ...
+//   QEMU -netdev socket,connect=:1234   rdmapeer -l 1234 ...
+//   QEMU -netdev socket,udp=:5555,localaddr=:5556
+//                                       rdmapeer -u 5555:127.0.0.1:5556 ...
+//
+// The stream (TCP) transport frames each packet with a 4-byte
+// big-endian length, as QEMU's net/socket.c does; UDP carries one frame
+// per datagram.
+//
+// Modes:
+//   sink    act as an RDMA target: export MRs 1..N (rkey == id, as in
+//           kernel/rdma.c), apply WRITEs and SENDs and ACK them (UD
+//           SENDs are counted but, as datagrams, not ACKed; a combined
+//           WRITE_MULTI frame gets one ACK covering all its WRITEs,
+//           a segmented WRITE one ACK once all its segments are in),
+//           answer READs with READ_RESP, and check every frame for
+//           protocol conformance.  "rdmabench host_a" on a guest started with
+//           scripts/run_host_a.sh runs against it unchanged.  It also
+//           answers connection manager REQs for any service ID,
+//           pairing the requester's QPs with QPs my_qp, my_qp+1, ...
+//           and advertising its MRs (at address 0, i.e. by offset).
+//   source  generate WRITE (or READ or SEND) traffic toward a guest
+//           target as fast as the window and rate allow, and report
+//           rates and round-trip percentiles.
+//
+// The header layout must match struct rdma_pkt_hdr in kernel/rdma_net.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <endian.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define ETHTYPE_RDMA            0x8915
+#define ETH_HLEN                14
+#define MAX_FRAME               2048
+
+// opcodes, from kernel/rdma_net.h
+#define RDMA_NET_OP_WRITE       0x01
+#define RDMA_NET_OP_READ        0x02
+#define RDMA_NET_OP_READ_RESP   0x03
+#define RDMA_NET_OP_ACK         0x04
+#define RDMA_NET_OP_SEND        0x05
+#define RDMA_NET_OP_UD_SEND     0x06
+#define RDMA_NET_OP_WRITE_MULTI 0x07
+#define RDMA_NET_OP_WRITE_SEG   0x08
+#define RDMA_NET_OP_CM_REQ      0x10
+#define RDMA_NET_OP_CM_REP      0x11
+#define RDMA_NET_OP_CM_RTU      0x12
+#define RDMA_NET_OP_CM_REJ      0x13
+
+#define RDMA_PKT_FLAG_SIGNALED  0x01
+#define RDMA_PKT_FLAGS_KNOWN    (RDMA_PKT_FLAG_SIGNALED)
+
+struct rdma_pkt_hdr {
+  uint8_t  opcode;
+  uint8_t  flags;
+  uint16_t src_qp;
+  uint16_t dst_qp;
+  uint16_t reserved1;
+  uint32_t seq_num;
+  uint32_t local_mr_id;
+  uint32_t remote_mr_id;
+  uint64_t remote_addr;
+  uint32_t length;
+  uint32_t remote_key;
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct rdma_pkt_hdr) == 36, "rdma_pkt_hdr must be 36 bytes");
+
+// connection manager payload, from kernel/rdma_net.h; nqp 16-bit QP
+// numbers and nmr rdma_cm_mr_wire descriptors follow.
+struct rdma_cm_msg {
+  uint32_t service_id;
+  uint32_t tid;
+  uint8_t  nqp;
+  uint8_t  nmr;
+  uint8_t  flags;
+  uint8_t  reason;
+} __attribute__((packed));
+
+struct rdma_cm_mr_wire {
+  uint32_t mr_id;
+  uint32_t rkey;
+  uint64_t addr;
+  uint64_t length;
+} __attribute__((packed));
+
+// WRITE_MULTI sub-header, from kernel/rdma_net.h; each is followed
+// by its data, and sub-WRITE i has the frame's seq_num + i.
+struct rdma_write_sub {
+  uint32_t local_mr_id;
+  uint32_t remote_mr_id;
+  uint64_t remote_addr;
+  uint32_t length;
+  uint32_t remote_key;
+} __attribute__((packed));
+
+// WRITE_SEG header, from kernel/rdma_net.h; it follows the RDMA
+// header, which describes the segment.  All segments of a WRITE share
+// its seq_num.
+struct rdma_seg_hdr {
+  uint32_t msg;
+  uint16_t index;
+  uint16_t count;
+  uint32_t total_len;
+} __attribute__((packed));
+
+#define RDMA_CM_MAX_QPS 16
+#define RDMA_CM_MAX_MRS 8
+
+#define HDRS (ETH_HLEN + sizeof(struct rdma_pkt_hdr))
+#define MAX_PAYLOAD (MAX_FRAME - HDRS)
+
+#define NMRS_MAX   64
+#define MR_SIZE    4096
+#define NQPS       65536
+#define MAXSAMPLES 1000000
+
+//
+// configuration
+//
+
+static int verbose;
+static uint8_t my_mac[6]  = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x57 };  // stands in for host B
+static uint8_t dst_mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };  // host A
+static int my_qp = 0, dst_qp = 0;
+static int remote_mr = 1, remote_key = -1;
+static int local_mr = 1;
+static int size = 256;
+static long count = 1000;
+static int window = 16;
+static long rate;          // packets per second, 0 = unlimited
+static int nmrs = 4;
+static int opcode = RDMA_NET_OP_WRITE;
+
+//
+// transport: QEMU socket netdev, stream or datagram
+//
+
+static int link_fd = -1;
+static int link_stream;
+static struct sockaddr_in udp_dst;
+
+static void
+die(const char *s)
+{
+  perror(s);
+  exit(1);
+}
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+parse_hostport(const char *s, struct sockaddr_in *sa)
+{
+  char host[256];
+  const char *colon = strrchr(s, ':');
+  if(colon == 0 || colon - s >= (int)sizeof(host))
+    return -1;
+  memcpy(host, s, colon - s);
+  host[colon - s] = 0;
+  memset(sa, 0, sizeof(*sa));
+  sa->sin_family = AF_INET;
+  sa->sin_port = htons(atoi(colon + 1));
+  if(host[0] == 0)
+    sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  else if(inet_pton(AF_INET, host, &sa->sin_addr) != 1){
+    struct hostent *he = gethostbyname(host);
+    if(he == 0)
+      return -1;
+    memcpy(&sa->sin_addr, he->h_addr_list[0], 4);
+  }
+  return 0;
+}
+
+static void
+link_connect(const char *hostport)
+{
+  struct sockaddr_in sa;
+  if(parse_hostport(hostport, &sa) < 0){
+    fprintf(stderr, "rdmapeer: bad address %s\n", hostport);
+    exit(1);
+  }
+  if((link_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    die("socket");
+  if(connect(link_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    die("connect");
+  link_stream = 1;
+}
+
+static void
+link_listen(int port)
+{
+  struct sockaddr_in sa;
+  int one = 1;
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  if(lfd < 0)
+    die("socket");
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    die("bind");
+  if(listen(lfd, 1) < 0)
+    die("listen");
+  fprintf(stderr, "rdmapeer: waiting for qemu on port %d\n", port);
+  if((link_fd = accept(lfd, 0, 0)) < 0)
+    die("accept");
+  close(lfd);
+  link_stream = 1;
+}
+
+// lport:host:rport
+static void
+link_udp(const char *spec)
+{
+  struct sockaddr_in sa;
+  char *colon;
+  int lport = strtol(spec, &colon, 10);
+  if(*colon != ':' || parse_hostport(colon + 1, &udp_dst) < 0){
+    fprintf(stderr, "rdmapeer: bad udp spec %s\n", spec);
+    exit(1);
+  }
+  if((link_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    die("socket");
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(lport);
+  sa.sin_addr.s_addr = htonl(INADDR_ANY);
+  if(bind(link_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    die("bind");
+  link_stream = 0;
+}
+
+static int
+readn(int fd, void *buf, size_t n)
+{
+  size_t done = 0;
+  while(done < n){
+    ssize_t r = read(fd, (char *)buf + done, n - done);
+    if(r == 0)
+      return -1;
+    if(r < 0){
+      if(errno == EINTR)
+        continue;
+      return -1;
+    }
+    done += r;
+  }
+  return 0;
+}
+
+static void
+link_send(const void *frame, size_t len)
+{
+  if(link_stream){
+    uint8_t buf[4 + MAX_FRAME];
+    uint32_t belen = htonl(len);
+    memcpy(buf, &belen, 4);
+    memcpy(buf + 4, frame, len);
+    size_t done = 0;
+    while(done < len + 4){
+      ssize_t r = write(link_fd, buf + done, len + 4 - done);
+      if(r < 0){
+        if(errno == EINTR)
+          continue;
+        die("write");
+      }
+      done += r;
+    }
+  } else {
+    if(sendto(link_fd, frame, len, 0, (struct sockaddr *)&udp_dst, sizeof(udp_dst)) < 0)
+      die("sendto");
+  }
+}
+
+// returns the frame length, 0 on timeout; exits when qemu goes away.
+static int
+link_recv(void *frame, int timeout_ms)
+{
+  struct pollfd pfd = { link_fd, POLLIN, 0 };
+  int r = poll(&pfd, 1, timeout_ms);
+  if(r < 0 && errno != EINTR)
+    die("poll");
+  if(r <= 0)
+    return 0;
+
+  if(link_stream){
+    uint32_t belen;
+    if(readn(link_fd, &belen, 4) < 0){
+      fprintf(stderr, "rdmapeer: qemu closed the connection\n");
+      exit(0);
+    }
+    uint32_t len = ntohl(belen);
+    if(len > MAX_FRAME){
+      uint8_t junk[4096];
+      while(len > 0){
+        uint32_t n = len > sizeof(junk) ? sizeof(junk) : len;
+        if(readn(link_fd, junk, n) < 0)
+          exit(0);
+        len -= n;
+      }
+      return 0;
+    }
+    if(readn(link_fd, frame, len) < 0)
+      exit(0);
+    return len;
+  }
+  ssize_t n = recv(link_fd, frame, MAX_FRAME, 0);
+  if(n < 0)
+    die("recv");
+  return n;
+}
+
+//
+// packet construction
+//
+
+static uint32_t tx_seq = 1;
+
+static size_t
+build(uint8_t *frame, const uint8_t *dmac, int op, int flags, int src, int dst,
+      uint32_t seq, uint32_t lmr, uint32_t rmr, uint64_t raddr,
+      uint32_t len, uint32_t rkey, const void *payload, uint32_t plen)
+{
+  struct rdma_pkt_hdr *h = (struct rdma_pkt_hdr *)(frame + ETH_HLEN);
+  memcpy(frame, dmac, 6);
+  memcpy(frame + 6, my_mac, 6);
+  frame[12] = ETHTYPE_RDMA >> 8;
+  frame[13] = ETHTYPE_RDMA & 0xff;
+  h->opcode = op;
+  h->flags = flags;
+  h->src_qp = htons(src);
+  h->dst_qp = htons(dst);
+  h->reserved1 = 0;
+  h->seq_num = htonl(seq);
+  h->local_mr_id = htonl(lmr);
+  h->remote_mr_id = htonl(rmr);
+  h->remote_addr = htobe64(raddr);
+  h->length = htonl(len);
+  h->remote_key = htonl(rkey);
+  if(plen)
+    memcpy(frame + HDRS, payload, plen);
+  return HDRS + plen;
+}
+
+//
+// sink
+//
+
+struct mr {
+  uint32_t id;
+  uint32_t rkey;
+  uint8_t mem[MR_SIZE];
+};
+
+static struct mr mrs[NMRS_MAX];
+static uint8_t recvbuf[MAX_PAYLOAD];   // target of SENDs (one posted receive)
+
+static struct {
+  uint64_t frames, other, writes, reads, sends, acks, bytes, cm;
+  uint64_t violations, seq_gaps, seq_dups;
+} st;
+
+static uint32_t last_seq[NQPS];  // last seq seen per source QP, 0 = none
+static uint32_t seg_msg[NQPS];   // segmented WRITE being received per source QP
+static uint32_t seg_got[NQPS];   // and how many of its segments are in
+
+static struct mr *
+mr_lookup(uint32_t id, uint32_t rkey)
+{
+  if(id < 1 || id > (uint32_t)nmrs || mrs[id-1].rkey != rkey)
+    return 0;
+  return &mrs[id-1];
+}
+
+// xv6 accepts either an offset into the MR or an address inside it;
+// a peer MR has no virtual address, so only offsets apply here.
+static int
+mr_range(uint64_t addr, uint32_t len)
+{
+  return addr < MR_SIZE && addr + len <= MR_SIZE;
+}
+
+// conformance checks that apply to every frame; returns a reason or 0.
+static const char *
+check(struct rdma_pkt_hdr *h, int plen)
+{
+  uint32_t len = ntohl(h->length);
+
+  if(h->flags & ~RDMA_PKT_FLAGS_KNOWN)
+    return "unknown flag bits";
+  if(h->reserved1 != 0)
+    return "reserved1 not zero";
+  switch(h->opcode){
+  case RDMA_NET_OP_WRITE:
+  case RDMA_NET_OP_SEND:
+  case RDMA_NET_OP_UD_SEND:
+  case RDMA_NET_OP_READ_RESP:
+    if(len > (uint32_t)plen)
+      return "length exceeds payload";
+    if(h->opcode == RDMA_NET_OP_WRITE && ntohl(h->remote_mr_id) == 0)
+      return "WRITE to MR 0";
+    break;
+  case RDMA_NET_OP_WRITE_MULTI: {
+    uint8_t *p = (uint8_t *)(h + 1), *end = p + len;
+    int count = 0;
+    if(len > (uint32_t)plen)
+      return "length exceeds payload";
+    while(p < end){
+      struct rdma_write_sub *s = (struct rdma_write_sub *)p;
+      if(end - p < (long)sizeof(*s) || ntohl(s->length) > end - p - sizeof(*s))
+        return "WRITE_MULTI sub-WRITE truncated";
+      if(ntohl(s->remote_mr_id) == 0)
+        return "WRITE to MR 0";
+      p += sizeof(*s) + ntohl(s->length);
+      count++;
+    }
+    if(count < 2)
+      return "WRITE_MULTI with fewer than two WRITEs";
+    break;
+  }
+  case RDMA_NET_OP_WRITE_SEG: {
+    struct rdma_seg_hdr *g = (struct rdma_seg_hdr *)(h + 1);
+    if(plen < (int)sizeof(*g) || len > plen - sizeof(*g))
+      return "length exceeds payload";
+    if(ntohs(g->count) == 0 || ntohs(g->index) >= ntohs(g->count))
+      return "WRITE_SEG index out of range";
+    if(len > ntohl(g->total_len))
+      return "WRITE_SEG longer than its WRITE";
+    if(ntohl(h->remote_mr_id) == 0)
+      return "WRITE to MR 0";
+    break;
+  }
+  case RDMA_NET_OP_READ:
+    if(ntohl(h->remote_mr_id) == 0)
+      return "READ from MR 0";
+    if(len > MAX_PAYLOAD)
+      return "READ longer than one frame";
+    break;
+  case RDMA_NET_OP_ACK:
+    if(len != 0)
+      return "ACK with nonzero length";
+    break;
+  case RDMA_NET_OP_CM_REQ:
+  case RDMA_NET_OP_CM_REP:
+  case RDMA_NET_OP_CM_RTU:
+  case RDMA_NET_OP_CM_REJ: {
+    struct rdma_cm_msg *m = (struct rdma_cm_msg *)(h + 1);
+    if(len > (uint32_t)plen || len < sizeof(*m))
+      return "CM message truncated";
+    if(m->nqp > RDMA_CM_MAX_QPS || m->nmr > RDMA_CM_MAX_MRS)
+      return "CM message with too many QPs or MRs";
+    if(len != sizeof(*m) + m->nqp * 2 + m->nmr * sizeof(struct rdma_cm_mr_wire))
+      return "CM length does not match its QP and MR counts";
+    if(h->dst_qp != 0 || h->src_qp != 0)
+      return "CM message addressed to a QP";
+    break;
+  }
+  default:
+    return "unknown opcode";
+  }
+  return 0;
+}
+
+static void
+violation(const uint8_t *frame, struct rdma_pkt_hdr *h, const char *why)
+{
+  st.violations++;
+  printf("rdmapeer: violation from %02x:%02x:%02x:%02x:%02x:%02x qp %d seq %u op %d: %s\n",
+         frame[6], frame[7], frame[8], frame[9], frame[10], frame[11],
+         ntohs(h->src_qp), ntohl(h->seq_num), h->opcode, why);
+}
+
+// a frame carrying n operations uses sequence numbers seq .. seq+n-1.
+static void
+track_seq(struct rdma_pkt_hdr *h, uint32_t n)
+{
+  uint16_t src = ntohs(h->src_qp);
+  uint32_t seq = ntohl(h->seq_num);
+  uint32_t last = last_seq[src];
+
+  if(last != 0){
+    if(seq == last)
+      st.seq_dups++;
+    else if(seq != last + 1)
+      st.seq_gaps++;
+  }
+  last_seq[src] = seq + n - 1;
+}
+
+static void
+sink_frame(uint8_t *frame, int n)
+{
+  uint8_t reply[MAX_FRAME];
+  struct rdma_pkt_hdr *h = (struct rdma_pkt_hdr *)(frame + ETH_HLEN);
+  int plen = n - HDRS;
+  const char *why;
+
+  if(n < (int)HDRS){
+    st.other++;
+    return;
+  }
+  if(((frame[12] << 8) | frame[13]) != ETHTYPE_RDMA){
+    st.other++;
+    return;
+  }
+  st.frames++;
+  if((why = check(h, plen)) != 0){
+    violation(frame, h, why);
+    return;
+  }
+
+  int src = ntohs(h->src_qp);
+  uint32_t seq = ntohl(h->seq_num);
+  uint32_t len = ntohl(h->length);
+  uint64_t addr = be64toh(h->remote_addr);
+  uint32_t rkey = ntohl(h->remote_key);
+  struct mr *mr;
+
+  if(verbose)
+    printf("rx op %d src_qp %d dst_qp %d seq %u mr %u addr %lu len %u rkey %u\n",
+           h->opcode, src, ntohs(h->dst_qp), seq, ntohl(h->remote_mr_id),
+           (unsigned long)addr, len, rkey);
+
+  switch(h->opcode){
+  case RDMA_NET_OP_WRITE:
+    track_seq(h, 1);
+    mr = mr_lookup(ntohl(h->remote_mr_id), rkey);
+    if(mr == 0){
+      violation(frame, h, "WRITE with bad MR or rkey");
+      return;
+    }
+    if(!mr_range(addr, len)){
+      violation(frame, h, "WRITE out of MR bounds");
+      return;
+    }
+    memcpy(mr->mem + addr, frame + HDRS, len);
+    st.writes++;
+    st.bytes += len;
+    link_send(reply, build(reply, frame + 6, RDMA_NET_OP_ACK, 0, my_qp, src,
+                           seq, 0, 0, 0, 0, 0, 0, 0));
+    st.acks++;
+    break;
+
+  case RDMA_NET_OP_WRITE_MULTI: {
+    // check() has walked the sub-WRITEs already.  Apply them in
+    // order and ACK the run that succeeded, count in local_mr_id.
+    uint8_t *p = frame + HDRS, *end = p + len;
+    uint32_t count = 0;
+    while(p < end){
+      struct rdma_write_sub *s = (struct rdma_write_sub *)p;
+      uint32_t slen = ntohl(s->length);
+      uint64_t saddr = be64toh(s->remote_addr);
+      mr = mr_lookup(ntohl(s->remote_mr_id), ntohl(s->remote_key));
+      if(mr == 0 || !mr_range(saddr, slen)){
+        violation(frame, h, mr == 0 ? "WRITE with bad MR or rkey" : "WRITE out of MR bounds");
+        break;
+      }
+      memcpy(mr->mem + saddr, s + 1, slen);
+      st.writes++;
+      st.bytes += slen;
+      p += sizeof(*s) + slen;
+      count++;
+    }
+    track_seq(h, count > 0 ? count : 1);
+    if(count == 0)
+      return;
+    link_send(reply, build(reply, frame + 6, RDMA_NET_OP_ACK, 0, my_qp, src,
+                           seq, count > 1 ? count : 0, 0, 0, 0, 0, 0, 0));
+    st.acks++;
+    break;
+  }
+
+  case RDMA_NET_OP_WRITE_SEG: {
+    // one link delivers in order, so counting segments is enough
+    struct rdma_seg_hdr *g = (struct rdma_seg_hdr *)(frame + HDRS);
+    uint32_t msg = ntohl(g->msg);
+    mr = mr_lookup(ntohl(h->remote_mr_id), rkey);
+    if(mr == 0 || !mr_range(addr, len)){
+      violation(frame, h, mr == 0 ? "WRITE with bad MR or rkey" : "WRITE out of MR bounds");
+      return;
+    }
+    memcpy(mr->mem + addr, g + 1, len);
+    st.bytes += len;
+    if(seg_got[src] == 0 || seg_msg[src] != msg){
+      seg_msg[src] = msg;
+      seg_got[src] = 0;
+      track_seq(h, 1);
+    }
+    if(++seg_got[src] < ntohs(g->count))
+      break;
+    seg_got[src] = 0;
+    st.writes++;
+    link_send(reply, build(reply, frame + 6, RDMA_NET_OP_ACK, 0, my_qp, src,
+                           seq, 0, 0, 0, 0, 0, 0, 0));
+    st.acks++;
+    break;
+  }
+
+  case RDMA_NET_OP_SEND:
+    track_seq(h, 1);
+    memcpy(recvbuf, frame + HDRS, len);
+    st.sends++;
+    st.bytes += len;
+    link_send(reply, build(reply, frame + 6, RDMA_NET_OP_ACK, 0, my_qp, src,
+                           seq, 0, 0, 0, 0, 0, 0, 0));
+    st.acks++;
+    break;
+
+  case RDMA_NET_OP_UD_SEND:
+    // datagrams are never ACKed, and may come from any QP in any order.
+    memcpy(recvbuf, frame + HDRS, len);
+    st.sends++;
+    st.bytes += len;
+    break;
+
+  case RDMA_NET_OP_READ:
+    track_seq(h, 1);
+    mr = mr_lookup(ntohl(h->remote_mr_id), rkey);
+    if(mr == 0){
+      violation(frame, h, "READ with bad MR or rkey");
+      return;
+    }
+    if(!mr_range(addr, len)){
+      violation(frame, h, "READ out of MR bounds");
+      return;
+    }
+    // the response lands in the requester's local MR, named in the request.
+    link_send(reply, build(reply, frame + 6, RDMA_NET_OP_READ_RESP, 0, my_qp, src,
+                           seq, 0, ntohl(h->local_mr_id), 0, len, 0,
+                           mr->mem + addr, len));
+    st.reads++;
+    st.bytes += len;
+    break;
+
+  case RDMA_NET_OP_CM_REQ: {
+    // accept every REQ: a retransmitted REQ just gets the same REP.
+    struct rdma_cm_msg *req = (struct rdma_cm_msg *)(frame + HDRS);
+    uint8_t msg[sizeof(struct rdma_cm_msg) + RDMA_CM_MAX_QPS * 2 +
+                RDMA_CM_MAX_MRS * sizeof(struct rdma_cm_mr_wire)];
+    struct rdma_cm_msg *rep = (struct rdma_cm_msg *)msg;
+    uint8_t *p = msg + sizeof(*rep);
+    int nmr = nmrs < RDMA_CM_MAX_MRS ? nmrs : RDMA_CM_MAX_MRS;
+
+    *rep = *req;
+    rep->nmr = nmr;
+    rep->flags = 0;
+    for(int i = 0; i < req->nqp; i++){
+      uint16_t qpn = htons(my_qp + i);
+      memcpy(p, &qpn, 2);
+      p += 2;
+    }
+    for(int i = 0; i < nmr; i++){
+      struct rdma_cm_mr_wire w = {
+        htonl(mrs[i].id), htonl(mrs[i].rkey), 0, htobe64(MR_SIZE)
+      };
+      memcpy(p, &w, sizeof(w));
+      p += sizeof(w);
+    }
+    if(verbose)
+      printf("cm: REQ service %u tid %u nqp %d -> REP\n",
+             ntohl(req->service_id), ntohl(req->tid), req->nqp);
+    link_send(reply, build(reply, frame + 6, RDMA_NET_OP_CM_REP, 0, 0, 0,
+                           0, 0, 0, 0, p - msg, 0, msg, p - msg));
+    st.cm++;
+    break;
+  }
+
+  case RDMA_NET_OP_CM_RTU:
+  case RDMA_NET_OP_CM_REJ:
+    st.cm++;
+    break;
+
+  default:
+    // ACK and READ_RESP are answers to traffic a sink does not originate.
+    break;
+  }
+}
+
+static void
+print_sink_stats(double secs)
+{
+  printf("rdmapeer: %.1fs frames=%lu writes=%lu reads=%lu sends=%lu acks=%lu "
+         "bytes=%lu violations=%lu seq_gaps=%lu seq_dups=%lu other=%lu cm=%lu\n",
+         secs, st.frames, st.writes, st.reads, st.sends, st.acks, st.bytes,
+         st.violations, st.seq_gaps, st.seq_dups, st.other, st.cm);
+  fflush(stdout);
+}
+
+static void
+sink(void)
+{
+  uint8_t frame[MAX_FRAME];
+  uint64_t start = now_ns(), last_print = start, last_frames = 0;
+
+  for(int i = 0; i < nmrs; i++){
+    mrs[i].id = i + 1;
+    mrs[i].rkey = i + 1;
+  }
+  printf("rdmapeer: sink qp %d, MRs 1..%d of %d bytes\n", my_qp, nmrs, MR_SIZE);
+  for(;;){
+    int n = link_recv(frame, 1000);
+    if(n > 0)
+      sink_frame(frame, n);
+    uint64_t t = now_ns();
+    if(t - last_print >= 1000000000ull && st.frames != last_frames){
+      print_sink_stats((t - start) / 1e9);
+      last_print = t;
+      last_frames = st.frames;
+    }
+  }
+}
+
+//
+// source
+//
+
+struct inflight {
+  uint32_t seq;
+  uint64_t sent;
+  int valid;
+};
+
+static struct inflight *inflight;
+static uint64_t *rtts;
+static long nrtts;
+
+static int
+cmp64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+source(void)
+{
+  uint8_t frame[MAX_FRAME], payload[MAX_PAYLOAD];
+  int slots = window > 0 ? window : 1;
+  long sent = 0, done = 0, lost = 0, bad = 0;
+  int outstanding = 0;
+  uint64_t timeout = 2000000000ull;
+  uint64_t start, interval = rate > 0 ? 1000000000ull / rate : 0, next;
+
+  inflight = calloc(slots, sizeof(*inflight));
+  rtts = malloc(sizeof(uint64_t) * MAXSAMPLES);
+  if(!inflight || !rtts)
+    die("malloc");
+  for(int i = 0; i < size; i++)
+    payload[i] = i;
+  if(remote_key < 0)
+    remote_key = remote_mr;
+
+  printf("rdmapeer: source op %d size %d count %ld window %d -> qp %d mr %d rkey %d\n",
+         opcode, size, count, window, dst_qp, remote_mr, remote_key);
+  start = next = now_ns();
+  while(count == 0 || done < count){
+    uint64_t t = now_ns();
+
+    // send while the window and rate allow.
+    while((count == 0 || sent < count) && (window == 0 || outstanding < window) &&
+          (interval == 0 || t >= next)){
+      int plen = (opcode == RDMA_NET_OP_READ) ? 0 : size;
+      size_t len = build(frame, dst_mac, opcode, RDMA_PKT_FLAG_SIGNALED, my_qp, dst_qp,
+                         tx_seq, local_mr, remote_mr, 0, size, remote_key,
+                         payload, plen);
+      link_send(frame, len);
+      if(window > 0){
+        for(int i = 0; i < slots; i++){
+          if(!inflight[i].valid){
+            inflight[i].seq = tx_seq;
+            inflight[i].sent = t;
+            inflight[i].valid = 1;
+            break;
+          }
+        }
+        outstanding++;
+      } else {
+        done++;
+      }
+      tx_seq++;
+      sent++;
+      next += interval;
+      t = now_ns();
+    }
+
+    // collect ACKs / READ responses.
+    int n = link_recv(frame, window > 0 ? 1 : 0);
+    if(n >= (int)HDRS && ((frame[12] << 8) | frame[13]) == ETHTYPE_RDMA){
+      struct rdma_pkt_hdr *h = (struct rdma_pkt_hdr *)(frame + ETH_HLEN);
+      const char *why = check(h, n - HDRS);
+      int want = (opcode == RDMA_NET_OP_READ) ? RDMA_NET_OP_READ_RESP : RDMA_NET_OP_ACK;
+      if(why){
+        violation(frame, h, why);
+        bad++;
+      } else if(h->opcode == want && window > 0){
+        uint32_t seq = ntohl(h->seq_num);
+        for(int i = 0; i < slots; i++){
+          if(inflight[i].valid && inflight[i].seq == seq){
+            if(nrtts < MAXSAMPLES)
+              rtts[nrtts++] = now_ns() - inflight[i].sent;
+            inflight[i].valid = 0;
+            outstanding--;
+            done++;
+            break;
+          }
+        }
+      }
+    }
+
+    // give up on requests that were never answered.
+    if(window > 0){
+      t = now_ns();
+      for(int i = 0; i < slots; i++){
+        if(inflight[i].valid && t - inflight[i].sent > timeout){
+          inflight[i].valid = 0;
+          outstanding--;
+          lost++;
+          done++;
+        }
+      }
+    }
+  }
+
+  double secs = (now_ns() - start) / 1e9;
+  printf("rdmapeer: sent=%ld acked=%ld lost=%ld bad=%ld in %.3fs: %.0f pps %.2f Mbit/s\n",
+         sent, nrtts, lost, bad, secs, sent / secs, sent * (double)size * 8 / secs / 1e6);
+  if(nrtts > 0){
+    qsort(rtts, nrtts, sizeof(uint64_t), cmp64);
+    printf("rdmapeer: rtt n=%ld min=%lu p50=%lu p90=%lu p99=%lu max=%lu\n", nrtts,
+           rtts[0], rtts[(nrtts-1)*50/100], rtts[(nrtts-1)*90/100],
+           rtts[(nrtts-1)*99/100], rtts[nrtts-1]);
+  }
+}
+
+//
+// command line
+//
+
+static int
+parse_mac(const char *s, uint8_t *mac)
+{
+  unsigned int b[6];
+  if(sscanf(s, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+    return -1;
+  for(int i = 0; i < 6; i++)
+    mac[i] = b[i];
+  return 0;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+    "Usage: rdmapeer (-c host:port | -l port | -u lport:host:rport) [options] sink|source\n"
+    "  -m mac     our MAC (default 52:54:00:12:34:57)\n"
+    "  -d mac     destination MAC for source mode (default 52:54:00:12:34:56)\n"
+    "  -q qp      our QP number (default 0)\n"
+    "  -Q qp      destination QP number (default 0)\n"
+    "  -M n       sink: number of exported 4096-byte MRs (default 4)\n"
+    "  -o op      source: write, read or send (default write)\n"
+    "  -r mr      source: remote MR id (default 1)\n"
+    "  -k rkey    source: remote key (default: the MR id)\n"
+    "  -L mr      source: local MR id named in requests (default 1)\n"
+    "  -s bytes   source: payload size (default 256)\n"
+    "  -n count   source: number of requests, 0 = forever (default 1000)\n"
+    "  -w window  source: requests in flight, 0 = don't wait for replies (default 16)\n"
+    "  -R pps     source: rate limit in packets/s (default unlimited)\n"
+    "  -v         print every received frame\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *connect_to = 0, *udp = 0;
+  int listen_port = 0;
+  int c;
+
+  setvbuf(stdout, 0, _IOLBF, 0);
+  while((c = getopt(argc, argv, "c:l:u:m:d:q:Q:M:o:r:k:L:s:n:w:R:v")) != -1){
+    switch(c){
+    case 'c': connect_to = optarg; break;
+    case 'l': listen_port = atoi(optarg); break;
+    case 'u': udp = optarg; break;
+    case 'm': if(parse_mac(optarg, my_mac) < 0) usage(); break;
+    case 'd': if(parse_mac(optarg, dst_mac) < 0) usage(); break;
+    case 'q': my_qp = atoi(optarg); break;
+    case 'Q': dst_qp = atoi(optarg); break;
+    case 'M': nmrs = atoi(optarg); break;
+    case 'o':
+      if(strcmp(optarg, "write") == 0) opcode = RDMA_NET_OP_WRITE;
+      else if(strcmp(optarg, "read") == 0) opcode = RDMA_NET_OP_READ;
+      else if(strcmp(optarg, "send") == 0) opcode = RDMA_NET_OP_SEND;
+      else usage();
+      break;
+    case 'r': remote_mr = atoi(optarg); break;
+    case 'k': remote_key = atoi(optarg); break;
+    case 'L': local_mr = atoi(optarg); break;
+    case 's': size = atoi(optarg); break;
+    case 'n': count = atol(optarg); break;
+    case 'w': window = atoi(optarg); break;
+    case 'R': rate = atol(optarg); break;
+    case 'v': verbose = 1; break;
+    default: usage();
+    }
+  }
+  if(optind != argc - 1 || (!!connect_to + !!listen_port + !!udp) != 1)
+    usage();
+  if(size < 0 || size > (int)MAX_PAYLOAD || nmrs < 1 || nmrs > NMRS_MAX || window < 0)
+    usage();
+
+  if(connect_to)
+    link_connect(connect_to);
+  else if(listen_port)
+    link_listen(listen_port);
+  else
+    link_udp(udp);
+  if(link_stream){
+    int one = 1;
+    setsockopt(link_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  if(strcmp(argv[optind], "sink") == 0)
+    sink();
+  else if(strcmp(argv[optind], "source") == 0)
+    source();
+  else
+    usage();
+  return 0;
+}
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+
+#
+# compare two captured runs of user/kbench (or user/rdmabench, or
+# host/rdmahost).
+#
+# ./scripts/kbench_compare.py base.out new.out
+#
+# Each input is console output containing lines such as
+#   kbench: null n=2000 min=1200 p50=1400 p90=1600 p99=2300 max=9100 mean=1480
+# Other lines (kernel chatter, the shell prompt) are ignored.  For every
+# operation present in both runs the script prints the chosen statistic
+# side by side with the relative change; with -t it exits non-zero if any
+# operation got worse by more than the threshold.  Latencies are in ns;
+# kbps (rdmabench and rdmahost throughput) is the one statistic where
+# higher is better.
+#
+
+import argparse, re, sys
+
+LINE = re.compile(r'(?:kbench|rdmabench|rdmahost): (\S+) n=(\d+)((?: \w+=\d+)*)')
+STATS = ["min", "p50", "p90", "p99", "max", "mean", "kbps"]
+HIGHER_IS_BETTER = {"kbps"}
+
+def parse(path):
+    results = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            m = LINE.search(line)
+            if not m:
+                continue
+            fields = dict(kv.split("=") for kv in m.group(3).split())
+            fields = {k: int(v) for k, v in fields.items()}
+            fields["n"] = int(m.group(2))
+            results[m.group(1)] = fields
+    return results
+
+def compare(base, new, stat, threshold=None):
+    """Print a table of stat for base vs new; return the regressed ops."""
+    unit = "" if stat in HIGHER_IS_BETTER else " ns"
+    print(f"{'op':<12} {'base ' + stat + unit:>16} {'new ' + stat + unit:>16} {'change':>9}")
+    regressions = []
+    for op in base:
+        if op not in new or stat not in base[op] or stat not in new[op]:
+            continue
+        b = base[op][stat]
+        n = new[op][stat]
+        change = (n - b) * 100.0 / b if b else 0.0
+        print(f"{op:<12} {b:>16} {n:>16} {change:>+8.1f}%")
+        worse = -change if stat in HIGHER_IS_BETTER else change
+        if threshold is not None and worse > threshold:
+            regressions.append(op)
+    for op in new:
+        if op not in base and stat in new[op]:
+            print(f"{op:<12} {'-':>16} {new[op][stat]:>16} {'new':>9}")
+    return regressions
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("base", help="output of the baseline kernel")
+    parser.add_argument("new", help="output of the kernel under test")
+    parser.add_argument("-s", "--stat", default="p50", choices=STATS,
+                        help="statistic to compare (default p50)")
+    parser.add_argument("-t", "--threshold", type=float, default=None,
+                        help="fail if any op is this many percent worse")
+    args = parser.parse_args()
+
+    base = parse(args.base)
+    new = parse(args.new)
+    if not base or not new:
+        print("no benchmark results found", file=sys.stderr)
+        sys.exit(2)
+
+    regressions = compare(base, new, args.stat, args.threshold)
+    if regressions:
+        print("regressed: " + " ".join(regressions))
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+
+#
+# boot two xv6 VMs on a local socket netdev and run user/rdmabench
+# between them, without typing into either console.
+#
+# ./scripts/rdma_bench.py                      (build, run, print results)
+# ./scripts/rdma_bench.py -o base.out          (also save the raw results)
+# ./scripts/rdma_bench.py -b base.out -t 10    (compare against a saved run;
+#                                               exit 1 on a >10% regression)
+#
+# Host A (initiator) listens on 127.0.0.1:PORT with MAC 52:54:00:12:34:56,
+# host B (target) connects with MAC 52:54:00:12:34:57, as in
+# scripts/run_host_{a,b}.sh.  Each VM gets its own copy of fs.img.
+# Set QEMU to pick a particular qemu-system-riscv64 binary.
+#
+# ./scripts/rdma_bench.py --fabric "-l 1 -d 2"  (run over an impaired link)
+#
+# With --fabric, B connects to fabric/fabric on PORT+1 instead, which
+# forwards to A with the given loss/delay/... options.
+#
+# ./scripts/rdma_bench.py --nic virtio          (virtio-net instead of e1000)
+# ./scripts/rdma_bench.py --ivshmem              (through shared memory)
+#
+# With --ivshmem both VMs also get an ivshmem-plain port (port 1) on
+# /dev/shm/xv6-rdma-bench, and the WRITEs go through it.
+#
+
+import argparse, os, re, shlex, shutil, subprocess, sys, time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from kbench_compare import parse, compare, STATS
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+parser = argparse.ArgumentParser()
+parser.add_argument("-n", "--iters", type=int, default=200,
+                    help="WRITEs per message size (default 200)")
+parser.add_argument("-p", "--port", type=int, default=1234,
+                    help="TCP port for the socket netdev (default 1234)")
+parser.add_argument("-o", "--output", help="save rdmabench result lines here")
+parser.add_argument("-b", "--baseline", help="results of an earlier run to compare with")
+parser.add_argument("-s", "--stat", default="p50", choices=STATS,
+                    help="latency statistic to compare (default p50)")
+parser.add_argument("-t", "--threshold", type=float, default=None,
+                    help="with -b, fail if any result is this many percent worse")
+parser.add_argument("--fabric", metavar="OPTS",
+                    help="impair the link with fabric/fabric OPTS, e.g. \"-l 1 -d 2\"")
+parser.add_argument("--nic", default="e1000", choices=["e1000", "virtio"],
+                    help="network card model (default e1000)")
+parser.add_argument("--ivshmem", action="store_true",
+                    help="send through an ivshmem port instead of the NIC")
+parser.add_argument("--no-build", action="store_true",
+                    help="use the existing kernel/kernel and fs.img")
+parser.add_argument("--timeout", type=int, default=600,
+                    help="seconds to wait for the benchmark (default 600)")
+args = parser.parse_args()
+
+QEMU_BIN = os.environ.get("QEMU", "qemu-system-riscv64")
+SHM = "/dev/shm/xv6-rdma-bench"
+NIC = {"e1000": "e1000,netdev=net0,mac=%s",
+       "virtio": "virtio-net-device,netdev=net0,mac=%s,bus=virtio-mmio-bus.1"}[args.nic]
+
+class VM(object):
+
+    def __init__(self, name, mac, netdev, fsimg):
+        self.name = name
+        q = [QEMU_BIN,
+             "-machine", "virt", "-bios", "none", "-kernel", "kernel/kernel",
+             "-m", "128M", "-smp", "3", "-nographic",
+             "-global", "virtio-mmio.force-legacy=false",
+             "-drive", "file=%s,if=none,format=raw,id=x0" % fsimg,
+             "-device", "virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0",
+             "-device", NIC % mac,
+             "-netdev", "socket,id=net0,%s" % netdev]
+        if args.ivshmem:
+            q += ["-object", "memory-backend-file,id=ivs,share=on,mem-path=%s,size=2M" % SHM,
+                  "-device", "ivshmem-plain,memdev=ivs"]
+        self.proc = subprocess.Popen(q, cwd=ROOT, stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE,
+                                     stderr=subprocess.STDOUT)
+        os.set_blocking(self.proc.stdout.fileno(), False)
+        self.outbytes = bytearray()
+        self.seen = 0
+
+    def cmd(self, c):
+        self.proc.stdin.write(c.encode("utf-8"))
+        self.proc.stdin.flush()
+
+    def read(self):
+        try:
+            buf = os.read(self.proc.stdout.fileno(), 65536)
+        except BlockingIOError:
+            return
+        if not buf and self.proc.poll() is not None:
+            raise RuntimeError("%s: qemu exited (status %d)" % (self.name, self.proc.returncode))
+        self.outbytes.extend(buf)
+
+    def output(self):
+        return self.outbytes.decode("utf-8", "replace")
+
+    def expect(self, regexp, timeout):
+        # wait for regexp to show up in output produced after the last match.
+        deadline = time.time() + timeout
+        r = re.compile(regexp, re.M)
+        while True:
+            self.read()
+            m = r.search(self.output(), self.seen)
+            if m:
+                self.seen = m.end()
+                return m
+            if time.time() > deadline:
+                raise RuntimeError("%s: timed out waiting for %r" % (self.name, regexp))
+            time.sleep(0.1)
+
+    def stop(self):
+        if self.proc.poll() is None:
+            self.proc.terminate()
+            try:
+                self.proc.wait(5)
+            except subprocess.TimeoutExpired:
+                self.proc.kill()
+
+    def save(self, path):
+        with open(path, "w") as f:
+            f.write(self.output())
+
+def build():
+    targets = ["kernel/kernel", "fs.img"]
+    if args.fabric is not None:
+        targets.append("fabric/fabric")
+    subprocess.run(["make"] + targets, cwd=ROOT, check=True)
+    for img in ("fs_host_a.img", "fs_host_b.img"):
+        shutil.copyfile(os.path.join(ROOT, "fs.img"), os.path.join(ROOT, img))
+
+def results(text):
+    return [l.strip() for l in text.splitlines()
+            if re.match(r"\s*rdmabench: \S+ n=", l)]
+
+def main():
+    if shutil.which(QEMU_BIN) is None:
+        print("cannot find %s; set QEMU" % QEMU_BIN, file=sys.stderr)
+        sys.exit(2)
+    if args.no_build:
+        for img in ("fs_host_a.img", "fs_host_b.img"):
+            if not os.path.exists(os.path.join(ROOT, img)):
+                shutil.copyfile(os.path.join(ROOT, "fs.img"), os.path.join(ROOT, img))
+    else:
+        build()
+
+    a = b = fabric = None
+    bport = args.port
+    nicport = ""
+    if args.ivshmem:
+        nicport = " 1"
+        if os.path.exists(SHM):
+            os.unlink(SHM)      # each VM claims a side of a fresh file
+    try:
+        a = VM("host_a", "52:54:00:12:34:56",
+               "listen=127.0.0.1:%d" % args.port, "fs_host_a.img")
+        time.sleep(1)
+        if args.fabric is not None:
+            bport = args.port + 1
+            fabric = subprocess.Popen([os.path.join(ROOT, "fabric", "fabric")] +
+                                      shlex.split(args.fabric) +
+                                      ["c:127.0.0.1:%d" % args.port, "l:%d" % bport],
+                                      cwd=ROOT, stdout=subprocess.PIPE,
+                                      stderr=subprocess.STDOUT, text=True)
+            time.sleep(1)
+        b = VM("host_b", "52:54:00:12:34:57",
+               "connect=127.0.0.1:%d" % bport, "fs_host_b.img")
+        a.expect(r"^\$ ", 60)
+        b.expect(r"^\$ ", 60)
+
+        b.cmd("rdmabench host_b %d%s\n" % (args.iters, nicport))
+        b.expect(r"rdmabench: ready", 30)
+        a.cmd("rdmabench host_a %d%s\n" % (args.iters, nicport))
+        a.expect(r"rdmabench: done", args.timeout)
+        b.expect(r"rdmabench: done", 60)
+    except RuntimeError as e:
+        print("FAIL:", e, file=sys.stderr)
+        for vm in (a, b):
+            if vm:
+                vm.save("rdma_bench_%s.log" % vm.name)
+                print("console output saved in rdma_bench_%s.log" % vm.name, file=sys.stderr)
+        sys.exit(1)
+    finally:
+        for vm in (a, b):
+            if vm:
+                vm.stop()
+        if fabric:
+            fabric.terminate()
+            fabric_out = fabric.communicate(timeout=5)[0]
+
+    lines = results(a.output()) + results(b.output())
+    print("\n".join(lines))
+    if fabric:
+        print("".join(l for l in fabric_out.splitlines(True) if l.startswith("fabric: ") and " rx=" in l))
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write("\n".join(lines) + "\n")
+
+    if args.baseline:
+        tmp = args.output or "rdma_bench.out"
+        if not args.output:
+            with open(tmp, "w") as f:
+                f.write("\n".join(lines) + "\n")
+        print()
+        regressions = compare(parse(args.baseline), parse(tmp), args.stat, args.threshold)
+        print()
+        regressions += compare(parse(args.baseline), parse(tmp), "kbps", args.threshold)
+        if regressions:
+            print("regressed: " + " ".join(regressions))
+            sys.exit(1)
+
+if __name__ == "__main__":
+    main()
@@ -13,11 +13,40 @@ echo ""
 echo "After connecting, run: rdmanet_test host_b"
 echo ""
 
-/opt/homebrew/bin/qemu-system-riscv64 \
+# NETDEV=virtio makes port 0 a virtio-net card instead of an e1000.
+NIC0=(-device e1000,netdev=net0,mac=52:54:00:12:34:57)
+if [ "${NETDEV:-e1000}" = virtio ]; then
+    NIC0=(-device virtio-net-device,netdev=net0,mac=52:54:00:12:34:57,bus=virtio-mmio-bus.1)
+fi
+# NICS=n adds e1000 ports 1..n-1, port i on 127.0.0.1:(1234+i) with
+# the fifth MAC byte raised by i, for RDMA multipath (rdma_set_qp_path)
+EXTRA_NICS=()
+for ((i = 1; i < ${NICS:-1}; i++)); do
+    EXTRA_NICS+=(-device e1000,netdev=net$i,mac=52:54:00:12:$(printf %02x $((0x34 + i))):57
+                 -netdev socket,id=net$i,connect=127.0.0.1:$((1234 + i)))
+done
+# IVSHMEM=plain adds a port in memory shared with the other host
+# (polled); IVSHMEM=doorbell one with interrupts, which needs
+#   ivshmem-server -S /tmp/xv6-ivshmem -l 2M -n 1
+# running first.  Start host A first.
+SHM=()
+case "${IVSHMEM:-}" in
+plain)
+    SHM=(-object memory-backend-file,id=ivs,share=on,mem-path=/dev/shm/xv6-rdma,size=2M
+         -device ivshmem-plain,memdev=ivs)
+    ;;
+doorbell)
+    SHM=(-chardev socket,path=/tmp/xv6-ivshmem,id=ivs
+         -device ivshmem-doorbell,chardev=ivs,vectors=1)
+    ;;
+esac
+${QEMU:-qemu-system-riscv64} \
     -machine virt -bios none -kernel kernel/kernel \
     -m 128M -smp 3 -nographic \
     -global virtio-mmio.force-legacy=false \
     -drive file=fs_host_b.img,if=none,format=raw,id=x0 \
     -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0 \
-    -device e1000,netdev=net0,mac=52:54:00:12:34:57 \
-    -netdev socket,id=net0,connect=127.0.0.1:1234
+    "${NIC0[@]}" \
+    -netdev socket,id=net0,connect=127.0.0.1:1234 \
+    "${EXTRA_NICS[@]}" \
+    "${SHM[@]}"
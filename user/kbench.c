@@ -0,0 +1,440 @@
+//
+// kernel microbenchmarks.
+//
+// kbench without arguments runs every benchmark; kbench <name> ...
+// runs only the named ones.  Each benchmark times individual
+// operations with the time CSR (start.c lets user mode read it)
+// and reports one line per measured operation:
+//
+//   kbench: <op> n=<samples> min=<ns> p50=<ns> p90=<ns> p99=<ns> max=<ns> mean=<ns>
+//
+// The format is meant to stay stable so that captured console output
+// from two kernel builds can be diffed by scripts/kbench_compare.py.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/timebase.h"
+
+#define MAXSAMPLES 2000
+#define CHUNK      4096        // bytes per read()/write() in the big-file tests
+#define BIGBLOCKS  128         // size of the sequential-I/O file, in blocks
+#define NRANDFILES 64          // files touched by the random-I/O tests
+
+struct series {
+  char *name;
+  int n;
+  uint64 t[MAXSAMPLES];
+};
+
+static struct series s0, s1, s2, s3;
+static char buf[CHUNK];
+
+static inline uint64
+now(void)
+{
+  return r_time();
+}
+
+static void
+begin(struct series *s, char *name)
+{
+  s->name = name;
+  s->n = 0;
+}
+
+static inline void
+record(struct series *s, uint64 t0, uint64 t1)
+{
+  if(s->n < MAXSAMPLES)
+    s->t[s->n++] = t1 - t0;
+}
+
+// shell sort; the sample counts are small.
+static void
+sort(uint64 *a, int n)
+{
+  for(int gap = n/2; gap > 0; gap /= 2){
+    for(int i = gap; i < n; i++){
+      uint64 v = a[i];
+      int j;
+      for(j = i; j >= gap && a[j-gap] > v; j -= gap)
+        a[j] = a[j-gap];
+      a[j] = v;
+    }
+  }
+}
+
+static uint64
+pct(uint64 *a, int n, int p)
+{
+  return a[(uint64)(n - 1) * p / 100] * NS_PER_TICK;
+}
+
+static void
+report(struct series *s)
+{
+  uint64 sum = 0;
+
+  if(s->n == 0){
+    printf("kbench: %s n=0\n", s->name);
+    return;
+  }
+  sort(s->t, s->n);
+  for(int i = 0; i < s->n; i++)
+    sum += s->t[i];
+  printf("kbench: %s n=%d min=%lu p50=%lu p90=%lu p99=%lu max=%lu mean=%lu\n",
+         s->name, s->n,
+         s->t[0] * NS_PER_TICK,
+         pct(s->t, s->n, 50), pct(s->t, s->n, 90), pct(s->t, s->n, 99),
+         s->t[s->n - 1] * NS_PER_TICK,
+         sum * NS_PER_TICK / s->n);
+}
+
+static void
+fail(char *what)
+{
+  printf("kbench: %s failed\n", what);
+  exit(1);
+}
+
+// from FreeBSD, as in grind.c.
+static int
+do_rand(unsigned long *ctx)
+{
+  long hi, lo, x;
+
+  x = (*ctx % 0x7ffffffe) + 1;
+  hi = x / 127773;
+  lo = x % 127773;
+  x = 16807 * lo - 2836 * hi;
+  if (x < 0)
+    x += 0x7fffffff;
+  x--;
+  *ctx = x;
+  return x;
+}
+
+static void
+fname(char *name, char *prefix, int i)
+{
+  int n = strlen(prefix);
+  memmove(name, prefix, n);
+  name[n] = '0' + (i / 10) % 10;
+  name[n+1] = '0' + i % 10;
+  name[n+2] = '\0';
+}
+
+//
+// process and memory benchmarks
+//
+
+void
+b_null(void)
+{
+  begin(&s0, "null");
+  for(int i = 0; i < MAXSAMPLES; i++){
+    uint64 t0 = now();
+    getpid();
+    record(&s0, t0, now());
+  }
+  report(&s0);
+}
+
+// one byte there and back again over a pair of pipes.
+void
+b_pipe(void)
+{
+  int ab[2], ba[2];
+  char c = 0;
+  int pid;
+
+  if(pipe(ab) < 0 || pipe(ba) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(ab[1]);
+    close(ba[0]);
+    while(read(ab[0], &c, 1) == 1)
+      write(ba[1], &c, 1);
+    exit(0);
+  }
+  close(ab[0]);
+  close(ba[1]);
+
+  begin(&s0, "pipe");
+  for(int i = 0; i < 1000; i++){
+    uint64 t0 = now();
+    if(write(ab[1], &c, 1) != 1 || read(ba[0], &c, 1) != 1)
+      fail("pipe ping-pong");
+    record(&s0, t0, now());
+  }
+  close(ab[1]);
+  close(ba[0]);
+  wait(0);
+  report(&s0);
+}
+
+void
+b_fork(void)
+{
+  begin(&s0, "fork");
+  for(int i = 0; i < 200; i++){
+    uint64 t0 = now();
+    int pid = fork();
+    if(pid < 0)
+      fail("fork");
+    if(pid == 0)
+      exit(0);
+    wait(0);
+    record(&s0, t0, now());
+  }
+  report(&s0);
+}
+
+void
+b_exec(void)
+{
+  char *argv[] = { "kbench", "-exit", 0 };
+
+  begin(&s0, "exec");
+  for(int i = 0; i < 50; i++){
+    uint64 t0 = now();
+    int pid = fork();
+    if(pid < 0)
+      fail("fork");
+    if(pid == 0){
+      exec("kbench", argv);
+      exit(1);
+    }
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      fail("exec");
+    record(&s0, t0, now());
+  }
+  report(&s0);
+}
+
+// grow by one page (eagerly allocated and zeroed), then give it back.
+void
+b_sbrk(void)
+{
+  begin(&s0, "sbrk");
+  for(int i = 0; i < 500; i++){
+    uint64 t0 = now();
+    if(sbrk(PGSIZE) == SBRK_ERROR)
+      fail("sbrk");
+    if(sbrk(-PGSIZE) == SBRK_ERROR)
+      fail("sbrk shrink");
+    record(&s0, t0, now());
+  }
+  report(&s0);
+}
+
+// first touch of lazily allocated pages; each sample is one vmfault().
+void
+b_pgfault(void)
+{
+  int npages = 100;
+
+  begin(&s0, "pgfault");
+  for(int round = 0; round < 5; round++){
+    char *a = sbrklazy(npages * PGSIZE);
+    if(a == SBRK_ERROR)
+      fail("sbrklazy");
+    for(int i = 0; i < npages; i++){
+      uint64 t0 = now();
+      a[i * PGSIZE] = 1;
+      record(&s0, t0, now());
+    }
+    if(sbrk(-(npages * PGSIZE)) == SBRK_ERROR)
+      fail("sbrk shrink");
+  }
+  report(&s0);
+}
+
+//
+// file system benchmarks
+//
+
+// small-file life cycle: create, write one block, read it back, unlink.
+void
+b_file(void)
+{
+  char name[16];
+  int fd;
+
+  begin(&s0, "create");
+  begin(&s1, "write");
+  begin(&s2, "read");
+  begin(&s3, "unlink");
+  for(int i = 0; i < 100; i++){
+    fname(name, "kb", i);
+    uint64 t0 = now();
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+      fail("create");
+    uint64 t1 = now();
+    if(write(fd, buf, BSIZE) != BSIZE)
+      fail("write");
+    uint64 t2 = now();
+    close(fd);
+    record(&s0, t0, t1);
+    record(&s1, t1, t2);
+
+    if((fd = open(name, O_RDONLY)) < 0)
+      fail("open");
+    t0 = now();
+    if(read(fd, buf, BSIZE) != BSIZE)
+      fail("read");
+    record(&s2, t0, now());
+    close(fd);
+
+    t0 = now();
+    if(unlink(name) < 0)
+      fail("unlink");
+    record(&s3, t0, now());
+  }
+  report(&s0);
+  report(&s1);
+  report(&s2);
+  report(&s3);
+}
+
+// sequential CHUNK-sized writes and reads of a BIGBLOCKS-block file.
+void
+b_seq(void)
+{
+  int nchunks = BIGBLOCKS * BSIZE / CHUNK;
+  int fd;
+
+  begin(&s0, "seqwrite");
+  begin(&s1, "seqread");
+  for(int round = 0; round < 4; round++){
+    unlink("kbbig");
+    if((fd = open("kbbig", O_CREATE|O_WRONLY)) < 0)
+      fail("create kbbig");
+    for(int i = 0; i < nchunks; i++){
+      uint64 t0 = now();
+      if(write(fd, buf, CHUNK) != CHUNK)
+        fail("seqwrite");
+      record(&s0, t0, now());
+    }
+    close(fd);
+
+    if((fd = open("kbbig", O_RDONLY)) < 0)
+      fail("open kbbig");
+    for(int i = 0; i < nchunks; i++){
+      uint64 t0 = now();
+      if(read(fd, buf, CHUNK) != CHUNK)
+        fail("seqread");
+      record(&s1, t0, now());
+    }
+    close(fd);
+  }
+  unlink("kbbig");
+  report(&s0);
+  report(&s1);
+}
+
+// xv6 has no lseek(), so random I/O is spread across NRANDFILES
+// one-block files (more than NBUF, so the buffer cache is defeated):
+// each sample opens a random file, transfers one block, and closes it.
+void
+b_rand(void)
+{
+  unsigned long seed = 1;
+  char name[16];
+  int fd;
+
+  for(int i = 0; i < NRANDFILES; i++){
+    fname(name, "kr", i);
+    if((fd = open(name, O_CREATE|O_WRONLY)) < 0)
+      fail("create");
+    if(write(fd, buf, BSIZE) != BSIZE)
+      fail("write");
+    close(fd);
+  }
+
+  begin(&s0, "randread");
+  begin(&s1, "randwrite");
+  for(int i = 0; i < 500; i++){
+    fname(name, "kr", do_rand(&seed) % NRANDFILES);
+    uint64 t0 = now();
+    if((fd = open(name, O_RDONLY)) < 0 || read(fd, buf, BSIZE) != BSIZE)
+      fail("randread");
+    close(fd);
+    record(&s0, t0, now());
+
+    fname(name, "kr", do_rand(&seed) % NRANDFILES);
+    t0 = now();
+    if((fd = open(name, O_WRONLY)) < 0 || write(fd, buf, BSIZE) != BSIZE)
+      fail("randwrite");
+    close(fd);
+    record(&s1, t0, now());
+  }
+
+  for(int i = 0; i < NRANDFILES; i++){
+    fname(name, "kr", i);
+    unlink(name);
+  }
+  report(&s0);
+  report(&s1);
+}
+
+struct bench {
+  void (*f)(void);
+  char *s;
+} benches[] = {
+  {b_null, "null"},
+  {b_pipe, "pipe"},
+  {b_fork, "fork"},
+  {b_exec, "exec"},
+  {b_sbrk, "sbrk"},
+  {b_pgfault, "pgfault"},
+  {b_file, "file"},
+  {b_seq, "seq"},
+  {b_rand, "rand"},
+  {0, 0},
+};
+
+int
+main(int argc, char *argv[])
+{
+  // target of the exec benchmark.
+  if(argc == 2 && strcmp(argv[1], "-exit") == 0)
+    exit(0);
+
+  for(int i = 1; i < argc; i++){
+    struct bench *b;
+    for(b = benches; b->s != 0; b++)
+      if(strcmp(b->s, argv[i]) == 0)
+        break;
+    if(b->s == 0){
+      printf("Usage: kbench [");
+      for(b = benches; b->s != 0; b++)
+        printf(b == benches ? "%s" : "|%s", b->s);
+      printf("] ...\n");
+      exit(1);
+    }
+  }
+
+  memset(buf, 'k', sizeof(buf));
+  printf("kbench: start timebase=%d\n", TIMEBASE_HZ);
+  for(struct bench *b = benches; b->s != 0; b++){
+    int run = (argc == 1);
+    for(int i = 1; i < argc; i++)
+      if(strcmp(b->s, argv[i]) == 0)
+        run = 1;
+    if(run)
+      b->f();
+  }
+  printf("kbench: done\n");
+  exit(0);
+}
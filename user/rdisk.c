@@ -0,0 +1,181 @@
+// user/rdisk.c - RDMA remote disk: server, tests and benchmark
+//
+// "rdisk server [pages]" on one host exports pages * 4 blocks of its
+// memory as a disk: an MR per page and a directory MR listing them,
+// offered through the CM.  "rdisk client [iterations]" on the other
+// finds it by broadcast, hands the connected QP to the kernel as
+// device RDISKDEV, checks that blocks written there read back, and
+// compares block reads from the remote disk with reads from the
+// local virtio disk, all through the buffer cache (blkrw()).  Results
+// use kbench's one-line format:
+//
+//   rdisk: <op> n=<blocks> ns=<elapsed> mean=<ns per block> kbps=<kbit/s>
+//
+// Reads cycle through more blocks than the buffer cache holds, so
+// every one goes to the disk.  Writes cycle through fewer, so each
+// is one write to the disk and no read.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "kernel/param.h"
+#include "user/user.h"
+#include "user/rdma.h"
+#include "user/timebase.h"
+
+#define DEFAULT_PAGES 128
+#define DEFAULT_ITERS 1000
+#define CONNECT_TRIES 5
+#define READ_SPAN     (4 * NBUF)    // blocks a read pass cycles through
+#define WRITE_SPAN    (NBUF / 2)    // and a write pass
+
+static char buf[BSIZE];
+
+static void fail(char *what)
+{
+    printf("rdisk: %s FAILED\n", what);
+    exit(1);
+}
+
+static void server(int npages)
+{
+    struct rdma_cm_info info;
+    struct rdma_completion c;
+    int flags = RDMA_ACCESS_LOCAL_READ | RDMA_ACCESS_LOCAL_WRITE |
+                RDMA_ACCESS_REMOTE_READ | RDMA_ACCESS_REMOTE_WRITE;
+
+    char *mem = alloc_page_aligned((npages + 1) * PGSIZE);
+    if (!mem)
+        fail("sbrk");
+    struct rdisk_dir *dir = (struct rdisk_dir*)(mem + npages * PGSIZE);
+    memset(mem, 0, (npages + 1) * PGSIZE);
+
+    dir->magic = RDISK_MAGIC;
+    dir->nblocks = npages * RDISK_PAGE_BLOCKS;
+    dir->npages = npages;
+    for (int i = 0; i < npages; i++) {
+        int mr = rdma_reg_mr(mem + i * PGSIZE, PGSIZE, flags);
+        if (mr < 0)
+            fail("register disk page");
+        dir->page[i].mr_id = mr;
+        dir->page[i].rkey = mr;     // the kernel's rkey is the MR's id
+    }
+    int dir_mr = rdma_reg_mr(dir, PGSIZE, RDMA_ACCESS_LOCAL_READ | RDMA_ACCESS_REMOTE_READ);
+    int qp = rdma_create_qp(64, 64);
+    if (dir_mr < 0 || qp < 0)
+        fail("setup");
+
+    if (rdma_cm_listen(RDISK_SERVICE, &qp, 1, &dir_mr, 1) < 0)
+        fail("listen");
+    printf("rdisk: ready, %d blocks\n", dir->nblocks);
+    if (rdma_cm_accept(RDISK_SERVICE, &info) < 0)
+        fail("accept");
+    rdma_cm_close(RDISK_SERVICE);
+    printf("rdisk: serving %02x:%02x:%02x:%02x:%02x:%02x\n",
+           info.mac[0], info.mac[1], info.mac[2], info.mac[3], info.mac[4], info.mac[5]);
+
+    // The client's READs and WRITEs need nothing from us, but a port
+    // without interrupts is only looked at when someone polls
+    for (;;)
+        rdma_poll_cq(qp, &c, 1);
+}
+
+static void attach(void)
+{
+    struct rdma_cm_info info;
+    int connected = 0;
+
+    int qp = rdma_create_qp(64, 64);
+    if (qp < 0)
+        fail("create QP");
+    memset(&info, 0, sizeof(info));
+    memset(info.mac, 0xff, 6);
+    info.service_id = RDISK_SERVICE;
+    info.nqp = 1;
+    info.qp[0] = qp;
+    for (int try = 0; try < CONNECT_TRIES && !connected; try++) {
+        if (rdma_cm_connect(&info, 0, 0) == 0)
+            connected = 1;
+        else
+            pause(10);
+    }
+    if (!connected || info.nmr < 1)
+        fail("connect to a server");
+    if (rdisk_attach(qp, info.mr[0].mr_id, info.mr[0].rkey) < 0)
+        fail("attach");
+}
+
+static void fill(int blockno)
+{
+    for (int i = 0; i < BSIZE; i++)
+        buf[i] = blockno * 7 + i + (i >> 8);
+}
+
+static void tests(void)
+{
+    // Written, pushed out of the buffer cache, and read back from
+    // the server
+    for (int b = 0; b < READ_SPAN; b++) {
+        fill(b);
+        if (blkrw(RDISKDEV, b, buf, 1) < 0)
+            fail("write");
+    }
+    for (int b = READ_SPAN; b < 2 * READ_SPAN; b++)
+        if (blkrw(RDISKDEV, b, buf, 0) < 0)
+            fail("read");
+    for (int b = 0; b < READ_SPAN; b++) {
+        char want[BSIZE];
+        fill(b);
+        memmove(want, buf, BSIZE);
+        if (blkrw(RDISKDEV, b, buf, 0) < 0 || memcmp(buf, want, BSIZE) != 0)
+            fail("data read back");
+    }
+
+    if (blkrw(RDISKDEV, -1, buf, 0) >= 0 || blkrw(RDISKDEV, 1 << 20, buf, 0) >= 0)
+        fail("block out of range");
+    if (blkrw(ROOTDEV, 0, buf, 1) >= 0)
+        fail("write to the root disk");
+    printf("rdisk: tests OK\n");
+}
+
+static void bench(char *op, int dev, int base, int span, int write, int iters)
+{
+    uint64 t0 = r_time();
+    for (int i = 0; i < iters; i++)
+        if (blkrw(dev, base + i % span, buf, write) < 0)
+            fail(op);
+    uint64 ns = (r_time() - t0) * NS_PER_TICK;
+    if (ns == 0)
+        ns = 1;
+    printf("rdisk: %s n=%d ns=%lu mean=%lu kbps=%lu\n", op, iters, ns, ns / iters,
+           (uint64)iters * BSIZE * 8 * 1000000 / ns);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 2 && strcmp(argv[1], "server") == 0) {
+        int npages = argc > 2 ? atoi(argv[2]) : DEFAULT_PAGES;
+        if (npages < 1 || npages > RDISK_MAX_PAGES) {
+            printf("rdisk: 1 to %d pages\n", RDISK_MAX_PAGES);
+            exit(1);
+        }
+        server(npages);
+    }
+    if (argc < 2 || argc > 3 || strcmp(argv[1], "client") != 0) {
+        printf("Usage: rdisk server [pages] | rdisk client [iterations]\n");
+        exit(1);
+    }
+    int iters = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERS;
+    if (iters < 1)
+        iters = DEFAULT_ITERS;
+
+    attach();
+    tests();
+
+    // The root disk's last blocks, which nothing else is reading
+    bench("virtio_read", ROOTDEV, FSSIZE - READ_SPAN, READ_SPAN, 0, iters);
+    bench("rdisk_read", RDISKDEV, 0, READ_SPAN, 0, iters);
+    bench("rdisk_write", RDISKDEV, 0, WRITE_SPAN, 1, iters);
+    exit(0);
+}
@@ -12,6 +12,11 @@
 #define RDMA_OP_READ       0x02
 #define RDMA_OP_SEND       0x03
 #define RDMA_OP_READ_RESP  0x04
+#define RDMA_OP_RECV       0x05    // Completion of a posted receive (UD)
+
+// Unreliable datagram QPs (see kernel/rdma.h)
+#define RDMA_RQ_SIZE       64      // Posted receives per UD QP
+#define RDMA_UD_MTU        1464    // Largest UD SEND
 
 // Access flags for memory regions
 #define RDMA_ACCESS_LOCAL_READ    0x01
@@ -21,6 +26,7 @@
 
 // Work request flags
 #define RDMA_WR_SIGNALED   (1 << 0)
+#define RDMA_WR_MORE       (1 << 1)    // More WRs follow (see rdma_post_send)
 
 // Completion status codes
 #define RDMA_WC_SUCCESS        0x00
@@ -29,6 +35,26 @@
 #define RDMA_WC_LOC_LEN_ERR    0x03
 #define RDMA_WC_REM_INV_REQ    0x04
 
+// Connection manager limits (see kernel/rdma.h)
+#define RDMA_CM_MAX_QPS   16
+#define RDMA_CM_MAX_MRS   8
+
+// Remote block device (see kernel/rdma.h and kernel/rdma_disk.c)
+#define RDISK_SERVICE      0x7264
+#define RDISK_MAGIC        0x6b736964
+#define RDISK_MAX_PAGES    510
+#define RDISKDEV           2       // blkrw() device number
+
+// File system log standby (see kernel/rdma.h and kernel/log.c)
+#define RLOG_SERVICE       0x726c
+#define RLOG_MAGIC         0x676f6c72
+#define RLOG_SLOTS         8
+#define RLOG_SLOT_PAGES    8
+#define RLOG_PAGES         (1 + RLOG_SLOTS * RLOG_SLOT_PAGES)
+#define RLOG_HEAD_BLOCK    (RLOG_SLOT_PAGES * 4 - 1)
+#define LOGMIRROR_BOTH     1       // commit to the standby and this disk
+#define LOGMIRROR_REMOTE   2       // to the standby instead
+
 /* ============================================
  * DATA STRUCTURES
  * ============================================ */
@@ -56,6 +82,86 @@ struct rdma_completion {
     unsigned short reserved;
 } __attribute__((packed));
 
+// Sender address at the start of every UD receive buffer
+struct rdma_ud_grh {
+    unsigned char smac[6];       // Sender's MAC
+    unsigned short src_qp;       // Sender's QP
+} __attribute__((packed));
+
+// Receive request - one buffer for an incoming UD datagram
+struct rdma_recv_request {
+    unsigned long wr_id;         // Returned in the RDMA_OP_RECV completion
+    unsigned int mr_id;          // MR holding the buffer (LOCAL_WRITE)
+    unsigned int length;         // Buffer size, including the GRH
+    unsigned long offset;        // Offset of the buffer within the MR
+} __attribute__((packed));
+
+// MR descriptor received from a peer through the connection manager
+struct rdma_cm_mr {
+    unsigned int mr_id;          // Use as remote_mr_id
+    unsigned int rkey;           // Use as remote_key
+    unsigned long addr;          // MR start in the peer's address space
+    unsigned long length;        // MR size in bytes
+} __attribute__((packed));
+
+// Connection manager request/result
+struct rdma_cm_info {
+    unsigned char mac[6];        // Peer MAC (connect: all 0xff = broadcast)
+    unsigned short nqp;          // Number of QP pairs
+    unsigned int service_id;     // Service connected to
+    unsigned int nmr;            // Number of peer MR descriptors
+    unsigned int qp[RDMA_CM_MAX_QPS];        // Local QPs
+    unsigned int remote_qp[RDMA_CM_MAX_QPS]; // Peer QP paired with qp[i]
+    struct rdma_cm_mr mr[RDMA_CM_MAX_MRS];   // Peer's MRs
+};
+
+// A disk server's directory: one page-long MR per RDISK_PAGE_BLOCKS
+// blocks of the disk
+#define RDISK_PAGE_BLOCKS  4
+struct rdisk_dir {
+    unsigned int magic;          // RDISK_MAGIC
+    unsigned int nblocks;        // Disk size in 1024-byte blocks
+    unsigned int npages;
+    struct {
+        unsigned int mr_id;
+        unsigned int rkey;
+    } page[RDISK_MAX_PAGES];
+} __attribute__((packed));
+
+// A log standby's control page, and the header in each slot's last
+// block
+struct rlog_ctl {
+    unsigned int magic;          // RLOG_MAGIC
+    unsigned int applied;        // Last transaction applied here
+};
+
+struct rlog_head {
+    unsigned int magic;          // RLOG_MAGIC, written after the rest
+    unsigned int seq;            // 1, 2, ...
+    unsigned int n;              // Blocks in the slot
+    unsigned int block[RLOG_HEAD_BLOCK];
+};
+
+// Per-QP statistics (rdma_query_qp)
+struct rdma_qp_stats {
+    unsigned int sends;          // WRs posted
+    unsigned int completions;
+    unsigned int errors;
+    unsigned int rx_drops;       // UD datagrams dropped
+    unsigned int wc_writes;      // WRITEs sent combined
+    unsigned int wc_frames;      // Combined frames sent
+    unsigned int txq_len;        // Frames waiting to transmit now
+    unsigned int txq_frames;     // Frames transmitted
+    unsigned int txq_drops;      // Frames refused, transmit queue full
+    unsigned int seg_frames;     // WRITE segments sent (large or striped WRITEs)
+    unsigned long txq_delay_ns;     // Total time frames spent queued
+    unsigned long txq_delay_max_ns; // Longest time one spent queued
+    unsigned int crc_errors;     // Frames received with a bad CRC32C
+};
+
+#define RDMA_SCHED_MAX_WEIGHT 64
+#define RDMA_MAX_PATHS        4
+
 /* ============================================
  * SYSTEM CALL WRAPPERS
  * ============================================ */
@@ -76,7 +182,9 @@ int rdma_create_qp(int sq_size, int cq_size);
 // Returns: 0 on success, -1 on failure
 int rdma_destroy_qp(int qp_id);
 
-// Post send work request
+// Post send work request. A small WRITE goes out at once, unless
+// RDMA_WR_MORE says more are coming: then it waits, for the next
+// post without that flag or an empty poll, to share their frame
 // Returns: 0 on success, -1 on failure
 int rdma_post_send(int qp_id, struct rdma_work_request *wr);
 
@@ -88,6 +196,100 @@ int rdma_poll_cq(int qp_id, struct rdma_completion *comps, int max_comps);
 // Returns: 0 on success, -1 on failure
 int rdma_connect(int qp_id, unsigned char mac[6], unsigned int remote_qp);
 
+// Create unreliable datagram QP; it accepts datagrams carrying qkey
+// Returns: qp_id >= 0 on success, -1 on failure
+int rdma_create_ud_qp(int sq_size, int cq_size, unsigned int qkey);
+
+// Post a receive buffer to a UD QP
+// Returns: 0 on success, -1 on failure
+int rdma_post_recv(int qp_id, struct rdma_recv_request *rr);
+
+// Set a QP's share of the link: weight 1..RDMA_SCHED_MAX_WEIGHT among
+// ordinary QPs, or prio != 0 for the strict-priority class
+// Returns: 0 on success, -1 on failure
+int rdma_set_qp_sched(int qp_id, int weight, int prio);
+
+// Read a QP's statistics, including its transmit queueing delay
+// Returns: 0 on success, -1 on failure
+int rdma_query_qp(int qp_id, struct rdma_qp_stats *st);
+
+// Set path 'path' of a connected QP: out of network port 'port' to the
+// peer's MAC on that link. Path 0 is the one rdma_connect() made; with
+// more, WRITEs are striped across them all
+// Returns: 0 on success, -1 on failure
+int rdma_set_qp_path(int qp_id, int path, int port, unsigned char mac[6]);
+
+// Carry path 'path' of a connected QP in UDP to ip:udp_port (ip in
+// host byte order, e.g. MAKE_IP_ADDR(10,0,2,2); udp_port 0 means
+// RDMA_UDP_PORT, 4791), or with ip 0 go back to raw Ethernet. The
+// path's MAC becomes the next hop's. The peer QP should do the same,
+// so that its ACKs come back by UDP to the right port
+// Returns: 0 on success, -1 on failure
+int rdma_set_qp_udp(int qp_id, int path, unsigned int ip, int udp_port);
+
+// With on set, a connected QP's WRITE frames carry a CRC32C of their
+// payload, which the receiver checks; a frame that fails is dropped
+// and counted in the receiving QP's crc_errors
+// Returns: 0 on success, -1 on failure
+int rdma_set_qp_crc(int qp_id, int on);
+
+// WRITE wr->length bytes of open file fd, from file offset
+// wr->local_offset on, to the peer, straight from the kernel's
+// buffer cache: no read() into a buffer and no MR (local_mr_id is
+// unused). The rest of the WR is as for rdma_post_send(); fd's own
+// offset doesn't move. The WRITE may take at most 64 frames
+// Returns: 0 on success, -1 on failure
+int rdma_sendfile(int qp_id, int fd, struct rdma_work_request *wr);
+
+// Register bytes [off, off + len) of open file fd, at most 4096 of
+// them, as an MR that peers READ and WRITE by offset. The kernel
+// keeps its own copy of the range, read from the file now; WRITEs to
+// the MR reach the file on rdma_sync_mr() or rdma_dereg_mr(). Remote
+// or local write access needs fd open for writing
+// Returns: mr_id >= 0 on success, -1 on failure
+int rdma_reg_file_mr(int fd, unsigned int off, unsigned int len, int flags);
+
+// Write the file blocks WRITEs have changed in a file-backed MR back
+// to the file, in one log transaction
+// Returns: 0 on success, -1 on failure
+int rdma_sync_mr(int mr_id);
+
+// Hand connected QP qp_id, whose peer is a disk server, to the kernel
+// as the remote disk: blkrw(RDISKDEV, ...) then READs and WRITEs the
+// server's memory. dir_mr and dir_rkey name the server's directory,
+// the MR the CM advertised. On failure the QP is still ours
+// Returns: 0 on success, -1 on failure
+int rdisk_attach(int qp_id, int dir_mr, int dir_rkey);
+
+// Send every file system log transaction to the remote disk, which
+// must be a log standby (rlog standby), as well as (LOGMIRROR_BOTH) or
+// instead of (LOGMIRROR_REMOTE) writing it to the local log. Once on,
+// mirroring stays on until the standby stops answering
+// Returns: 0 on success, -1 on failure
+int logmirror(int dev, int mode);
+
+// On a standby: apply the transaction in the slot at addr (RLOG_SLOT_PAGES
+// pages, header in the last block) to this node's disk
+// Returns: 0 on success, -1 on failure
+int logreplay(void *slot);
+
+// Offer QPs (in INIT state) and MRs under a service ID; returns at once
+// Returns: 0 on success, -1 on failure
+int rdma_cm_listen(unsigned int service_id, int *qps, int nqp, int *mrs, int nmr);
+
+// Wait for a peer to connect to a service we listen on
+// Returns: 0 on success (info filled in), -1 on failure
+int rdma_cm_accept(unsigned int service_id, struct rdma_cm_info *info);
+
+// Connect info->qp[0..nqp-1] to info->service_id at info->mac,
+// advertising our MRs; fills in the peer's QPs and MRs
+// Returns: 0 on success, -1 on failure, rejection or timeout
+int rdma_cm_connect(struct rdma_cm_info *info, int *mrs, int nmr);
+
+// Stop listening on a service
+// Returns: 0 on success, -1 on failure
+int rdma_cm_close(unsigned int service_id);
+
 /* ============================================
  * HELPER FUNCTIONS
  * ============================================ */
@@ -115,7 +317,10 @@ rdma_build_write_wr(struct rdma_work_request *wr,
     wr->length = length;
 }
 
-// Build an RDMA_READ work request
+// Build an RDMA_READ work request. The local MR needs
+// RDMA_ACCESS_LOCAL_WRITE and the remote one RDMA_ACCESS_REMOTE_READ;
+// over the network a READ comes back in one frame, so length is at
+// most 1464 bytes (less with CRC32C or UDP paths)
 static inline void
 rdma_build_read_wr(struct rdma_work_request *wr,
                   unsigned long wr_id,
@@ -138,6 +343,31 @@ rdma_build_read_wr(struct rdma_work_request *wr,
     wr->length = length;
 }
 
+// Build a UD SEND to QP qpn at MAC mac, carrying Q_Key qkey
+static inline void
+rdma_build_ud_send_wr(struct rdma_work_request *wr,
+                      unsigned long wr_id,
+                      int local_mr_id,
+                      unsigned long local_offset,
+                      unsigned int length,
+                      unsigned char mac[6],
+                      unsigned int qpn,
+                      unsigned int qkey)
+{
+    wr->wr_id = wr_id;
+    wr->opcode = RDMA_OP_SEND;
+    wr->flags = RDMA_WR_SIGNALED;
+    wr->reserved = 0;
+    wr->local_mr_id = local_mr_id;
+    wr->local_offset = local_offset;
+    wr->remote_mr_id = qpn;
+    wr->remote_addr = 0;
+    for (int i = 0; i < 6; i++)
+        wr->remote_addr = (wr->remote_addr << 8) | mac[i];
+    wr->remote_key = qkey;
+    wr->length = length;
+}
+
 // Check if completion indicates success
 static inline int
 rdma_comp_is_success(struct rdma_completion *comp)
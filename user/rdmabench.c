@@ -0,0 +1,256 @@
+// user/rdmabench.c - Two-host RDMA_WRITE benchmark
+//
+// Run "rdmabench host_b" on the target first, wait for it to print
+// "rdmabench: ready", then run "rdmabench host_a" on the initiator.
+// "rdmabench host_a 200 1" sends by port 1 instead of port 0, to the
+// peer MAC the run_host scripts give that port (fifth byte + 1).
+// scripts/rdma_bench.py does this automatically through both serial
+// consoles.  Results use the same one-line format as kbench:
+//
+//   rdmabench: lat<size> n=<samples> min=<ns> p50=<ns> ... mean=<ns>
+//   rdmabench: tput<size> n=<writes> ns=<elapsed> kbps=<kbit/s>
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+#include "user/rdma.h"
+#include "user/timebase.h"
+
+#define TIMEOUT     (2 * TIMEBASE_HZ) // give up on a completion after 2s
+#define IDLE        (5 * TIMEBASE_HZ) // target stops after 5s without data
+
+#define DEFAULT_ITERS 200
+#define MAXSAMPLES    1000
+#define WINDOW        8             // outstanding WRITEs in the throughput phase
+
+static int sizes[] = { 64, 256, 1024, 1400 };
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+// Same MACs as rdmanet_test and scripts/run_host_{a,b}.sh
+static unsigned char host_a_mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+static unsigned char host_b_mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x57 };
+
+static uint64 samples[MAXSAMPLES];
+
+static void sort(uint64 *a, int n)
+{
+    for (int gap = n / 2; gap > 0; gap /= 2) {
+        for (int i = gap; i < n; i++) {
+            uint64 v = a[i];
+            int j;
+            for (j = i; j >= gap && a[j - gap] > v; j -= gap)
+                a[j] = a[j - gap];
+            a[j] = v;
+        }
+    }
+}
+
+static void report_latency(int size, uint64 *t, int n)
+{
+    uint64 sum = 0;
+
+    if (n == 0) {
+        printf("rdmabench: lat%d n=0\n", size);
+        return;
+    }
+    sort(t, n);
+    for (int i = 0; i < n; i++)
+        sum += t[i];
+    printf("rdmabench: lat%d n=%d min=%lu p50=%lu p90=%lu p99=%lu max=%lu mean=%lu\n",
+           size, n,
+           t[0] * NS_PER_TICK,
+           t[(n - 1) * 50 / 100] * NS_PER_TICK,
+           t[(n - 1) * 90 / 100] * NS_PER_TICK,
+           t[(n - 1) * 99 / 100] * NS_PER_TICK,
+           t[n - 1] * NS_PER_TICK,
+           sum * NS_PER_TICK / n);
+}
+
+// Busy-poll for up to max completions of WRs lo .. hi-1; returns
+// how many arrived before the deadline, or -1 if a completion
+// reported an error.  Late completions of WRs before lo, already
+// counted as lost, are passed over.
+static int wait_comps(int qp_id, uint64 lo, uint64 hi, int max, uint64 deadline)
+{
+    struct rdma_completion comps[16];
+    int got = 0;
+
+    while (got < max && r_time() < deadline) {
+        int want = max - got > 16 ? 16 : max - got;
+        int n = rdma_poll_cq(qp_id, comps, want);
+        if (n < 0)
+            return -1;
+        for (int i = 0; i < n; i++) {
+            if (comps[i].wr_id < lo || comps[i].wr_id >= hi)
+                continue;
+            if (comps[i].status != RDMA_WC_SUCCESS) {
+                printf("rdmabench: completion error %s\n",
+                       rdma_comp_status_str(comps[i].status));
+                return -1;
+            }
+            got++;
+        }
+    }
+    return got;
+}
+
+static int initiator(int qp_id, int mr_id, int iters)
+{
+    struct rdma_work_request wr;
+    uint64 id = 0;              // wr_id of the next WRITE, over the whole run
+    int lost = 0;
+
+    for (int s = 0; s < NSIZES; s++) {
+        int size = sizes[s];
+        int n = 0;
+
+        // Latency: one signaled WRITE at a time, timed until its ACK.
+        for (int i = 0; i < iters; i++) {
+            rdma_build_write_wr(&wr, id, mr_id, 0, 1, 0, 1, size);
+            uint64 t0 = r_time();
+            if (rdma_post_send(qp_id, &wr) < 0) {
+                printf("rdmabench: post_send failed\n");
+                return -1;
+            }
+            int got = wait_comps(qp_id, id, id + 1, 1, t0 + TIMEOUT);
+            id++;
+            if (got < 0)
+                return -1;
+            if (got == 0) {
+                lost++;
+                continue;
+            }
+            if (n < MAXSAMPLES)
+                samples[n++] = r_time() - t0;
+        }
+        report_latency(size, samples, n);
+
+        // Throughput: keep WINDOW WRITEs in flight.
+        int posted = 0, done = 0;
+        uint64 lo = id;         // WRs before it have completed or been lost
+        uint64 t0 = r_time();
+        while (done < iters) {
+            while (posted < iters && posted - done < WINDOW) {
+                rdma_build_write_wr(&wr, id, mr_id, 0, 1, 0, 1, size);
+                if (rdma_post_send(qp_id, &wr) < 0) {
+                    printf("rdmabench: post_send failed\n");
+                    return -1;
+                }
+                posted++;
+                id++;
+            }
+            int got = wait_comps(qp_id, lo, id, posted - done, r_time() + TIMEOUT);
+            if (got < 0)
+                return -1;
+            if (got == 0) {
+                // Whatever is still outstanding was lost on the wire.
+                lost += posted - done;
+                done = posted;
+                lo = id;
+            }
+            done += got;
+        }
+        uint64 ns = (r_time() - t0) * NS_PER_TICK;
+        if (ns == 0)
+            ns = 1;
+        printf("rdmabench: tput%d n=%d ns=%lu kbps=%lu\n",
+               size, iters, ns, (uint64)iters * size * 8 * 1000000 / ns);
+    }
+    printf("rdmabench: lost n=%d\n", lost);
+    return 0;
+}
+
+static int target(int qp_id, int expected)
+{
+    struct rdma_completion comps[16];
+    uint64 bytes = 0;
+    int received = 0;
+    uint64 first = 0, last = r_time();
+
+    printf("rdmabench: ready\n");
+    while (received < expected && r_time() - last < (received ? IDLE : 30 * IDLE)) {
+        int n = rdma_poll_cq(qp_id, comps, 16);
+        if (n < 0)
+            return -1;
+        if (n > 0) {
+            last = r_time();
+            if (received == 0)
+                first = last;
+        }
+        for (int i = 0; i < n; i++)
+            bytes += comps[i].byte_len;
+        received += n;
+    }
+    uint64 ns = (last - first) * NS_PER_TICK;
+    printf("rdmabench: target n=%d bytes=%lu ns=%lu\n", received, bytes, ns);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int iters = DEFAULT_ITERS;
+    int port = 0;
+
+    if (argc < 2 || argc > 4 ||
+        (strcmp(argv[1], "host_a") != 0 && strcmp(argv[1], "host_b") != 0)) {
+        printf("Usage: rdmabench <host_a|host_b> [iterations [port]]\n");
+        exit(1);
+    }
+    if (argc >= 3)
+        iters = atoi(argv[2]);
+    if (argc == 4)
+        port = atoi(argv[3]);
+    if (iters <= 0 || iters > MAXSAMPLES) {
+        printf("rdmabench: iterations must be 1..%d\n", MAXSAMPLES);
+        exit(1);
+    }
+
+    int is_host_a = (strcmp(argv[1], "host_a") == 0);
+
+    char *buf = alloc_page_aligned(PGSIZE);
+    if (!buf) {
+        printf("rdmabench: failed to allocate buffer\n");
+        exit(1);
+    }
+    memset(buf, is_host_a ? 'a' : 0, PGSIZE);
+
+    // The target's buffer must be MR 1: that is what the initiator writes to.
+    int mr_id = rdma_reg_mr(buf, PGSIZE,
+                            is_host_a ? RDMA_ACCESS_LOCAL_READ
+                                      : RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
+    if (mr_id < 0) {
+        printf("rdmabench: failed to register MR\n");
+        exit(1);
+    }
+
+    int qp_id = rdma_create_qp(64, 64);
+    if (qp_id < 0) {
+        printf("rdmabench: failed to create QP\n");
+        exit(1);
+    }
+    if (rdma_connect(qp_id, is_host_a ? host_b_mac : host_a_mac, 0) < 0) {
+        printf("rdmabench: failed to connect QP\n");
+        exit(1);
+    }
+    if (port > 0) {
+        unsigned char mac[6];
+        memcpy(mac, is_host_a ? host_b_mac : host_a_mac, 6);
+        mac[4] += port;
+        if (rdma_set_qp_path(qp_id, 0, port, mac) < 0) {
+            printf("rdmabench: no port %d\n", port);
+            exit(1);
+        }
+    }
+
+    int r;
+    if (is_host_a)
+        r = initiator(qp_id, mr_id, iters);
+    else
+        r = target(qp_id, iters * NSIZES * 2);
+
+    rdma_destroy_qp(qp_id);
+    rdma_dereg_mr(mr_id);
+    printf("rdmabench: done\n");
+    exit(r < 0 ? 1 : 0);
+}
@@ -8,30 +8,10 @@
 #define TEST_SIZE 256
 #define PGSIZE 4096
 
-// Host A MAC: 52:54:00:12:34:56 (QEMU default)
-#define HOST_A_MAC_0 0x52
-#define HOST_A_MAC_1 0x54
-#define HOST_A_MAC_2 0x00
-#define HOST_A_MAC_3 0x12
-#define HOST_A_MAC_4 0x34
-#define HOST_A_MAC_5 0x56
-
-// Host B MAC: 52:54:00:12:34:57 (configured in QEMU)
-#define HOST_B_MAC_0 0x52
-#define HOST_B_MAC_1 0x54
-#define HOST_B_MAC_2 0x00
-#define HOST_B_MAC_3 0x12
-#define HOST_B_MAC_4 0x34
-#define HOST_B_MAC_5 0x57
-
-void* alloc_page_aligned(int size)
-{
-    char *p = sbrk(size + PGSIZE);
-    if (p == (char*)-1) return 0;
-    uint64 addr = (uint64)p;
-    uint64 aligned = (addr + PGSIZE - 1) & ~(PGSIZE - 1);
-    return (void*)aligned;
-}
+// Host B listens on this service ID; Host A finds it by broadcast,
+// so neither side needs the other's MAC, QP number or rkey.
+#define TEST_SERVICE 4791
+#define CONNECT_TRIES 5
 
 int main(int argc, char *argv[])
 {
@@ -84,22 +64,31 @@ int main(int argc, char *argv[])
         }
         printf("Host A: Created QP %d\n", qp_id);
         
-        // Connect to Host B
-        unsigned char host_b_mac[6] = {
-            HOST_B_MAC_0, HOST_B_MAC_1, HOST_B_MAC_2,
-            HOST_B_MAC_3, HOST_B_MAC_4, HOST_B_MAC_5
-        };
-        if (rdma_connect(qp_id, host_b_mac, 0) < 0) {
+        // Connect to whoever listens on TEST_SERVICE (Host B)
+        struct rdma_cm_info info;
+        memset(&info, 0, sizeof(info));
+        memset(info.mac, 0xff, 6);
+        info.service_id = TEST_SERVICE;
+        info.nqp = 1;
+        info.qp[0] = qp_id;
+        int connected = 0;
+        for (int try = 0; try < CONNECT_TRIES && !connected; try++) {
+            if (rdma_cm_connect(&info, &mr_id, 1) == 0) {
+                connected = 1;
+            } else {
+                printf("Host A:   no answer yet, retrying...\n");
+                pause(10);
+            }
+        }
+        if (!connected || info.nmr < 1) {
             printf("ERROR: Failed to connect QP\n");
             exit(1);
         }
-        printf("Host A: Connected to Host B (QP 0, MAC: %02x:%02x:%02x:%02x:%02x:%02x)\n",
-               host_b_mac[0], host_b_mac[1], host_b_mac[2],
-               host_b_mac[3], host_b_mac[4], host_b_mac[5]);
-        
-        // Sleep to let Host B set up
-        printf("Host A: Waiting for Host B to be ready...\n");
-        pause(3);
+        printf("Host A: Connected to Host B (QP %d, MAC: %02x:%02x:%02x:%02x:%02x:%02x)\n",
+               info.remote_qp[0], info.mac[0], info.mac[1], info.mac[2],
+               info.mac[3], info.mac[4], info.mac[5]);
+        printf("Host A: Host B's MR %d (rkey=%d, len=%d)\n",
+               info.mr[0].mr_id, info.mr[0].rkey, (int)info.mr[0].length);
         
         // Build and post RDMA_WRITE
         struct rdma_work_request wr;
@@ -107,9 +96,9 @@ int main(int argc, char *argv[])
                            1,              // wr_id
                            mr_id,          // local MR
                            0,              // local offset
-                           1,              // remote MR (Host B's MR ID)
+                           info.mr[0].mr_id, // remote MR (from the CM)
                            0,              // remote offset
-                           1,              // remote key
+                           info.mr[0].rkey,  // remote key (from the CM)
                            TEST_SIZE);     // length
         
         printf("Host A: Posting RDMA_WRITE (%d bytes)...\n", TEST_SIZE);
@@ -164,7 +153,7 @@ int main(int argc, char *argv[])
         }
         printf("Host B: Cleared buffer (all zeros)\n");
         
-        // Register memory region (must be MR ID 1 to match sender)
+        // Register memory region
         int mr_id = rdma_reg_mr(buf, TEST_SIZE,
                                RDMA_ACCESS_LOCAL_WRITE | RDMA_ACCESS_REMOTE_WRITE);
         if (mr_id < 0) {
@@ -173,7 +162,7 @@ int main(int argc, char *argv[])
         }
         printf("Host B: Registered MR %d (addr=%p, size=%d)\n", mr_id, buf, TEST_SIZE);
         
-        // Create queue pair (must be QP ID 0 to match sender)
+        // Create queue pair
         int qp_id = rdma_create_qp(64, 64);
         if (qp_id < 0) {
             printf("ERROR: Failed to create QP\n");
@@ -181,18 +170,21 @@ int main(int argc, char *argv[])
         }
         printf("Host B: Created QP %d\n", qp_id);
         
-        // Connect to Host A
-        unsigned char host_a_mac[6] = {
-            HOST_A_MAC_0, HOST_A_MAC_1, HOST_A_MAC_2,
-            HOST_A_MAC_3, HOST_A_MAC_4, HOST_A_MAC_5
-        };
-        if (rdma_connect(qp_id, host_a_mac, 0) < 0) {
-            printf("ERROR: Failed to connect QP\n");
+        // Offer the QP and MR to Host A and wait for it to connect
+        if (rdma_cm_listen(TEST_SERVICE, &qp_id, 1, &mr_id, 1) < 0) {
+            printf("ERROR: Failed to listen\n");
+            exit(1);
+        }
+        printf("Host B: Listening on service %d...\n", TEST_SERVICE);
+        struct rdma_cm_info info;
+        if (rdma_cm_accept(TEST_SERVICE, &info) < 0) {
+            printf("ERROR: Failed to accept\n");
             exit(1);
         }
-        printf("Host B: Connected to Host A (QP 0, MAC: %02x:%02x:%02x:%02x:%02x:%02x)\n",
-               host_a_mac[0], host_a_mac[1], host_a_mac[2],
-               host_a_mac[3], host_a_mac[4], host_a_mac[5]);
+        rdma_cm_close(TEST_SERVICE);
+        printf("Host B: Connected to Host A (QP %d, MAC: %02x:%02x:%02x:%02x:%02x:%02x)\n",
+               info.remote_qp[0], info.mac[0], info.mac[1], info.mac[2],
+               info.mac[3], info.mac[4], info.mac[5]);
         
         printf("Host B: Ready! Waiting for RDMA_WRITE from Host A...\n");
         
@@ -18,19 +18,6 @@ void print_result(char *test_name, int passed)
     }
 }
 
-// Allocate a page-aligned buffer using sbrk
-void* alloc_page_aligned(int size)
-{
-    char *p = sbrk(size + PGSIZE);
-    if (p == (char*)-1) {
-        return 0;
-    }
-    // Align to page boundary
-    uint64 addr = (uint64)p;
-    uint64 aligned = (addr + PGSIZE - 1) & ~(PGSIZE - 1);
-    return (void*)aligned;
-}
-
 // Test 1: Memory region registration and deregistration
 int test_mr_registration(void)
 {
@@ -0,0 +1,197 @@
+// user/rlog.c - file system log replicated over RDMA: standby, tests
+// and benchmark
+//
+// "rlog standby" on one host exports RLOG_PAGES pages of its memory
+// as a remote disk laid out as a log standby's (see rdma.h): a
+// control page, then RLOG_SLOTS transaction slots.  It applies each
+// transaction the primary WRITEs into a slot to its own disk, in
+// order, with logreplay(), and tells the primary how far it has got
+// in the control page.  "rlog primary [iterations]" on the other host
+// attaches it as the remote disk and mirrors its log there, first as
+// well as (logmirror(LOGMIRROR_BOTH)), then instead of
+// (LOGMIRROR_REMOTE) its local log, timing one-block file writes,
+// each a transaction of its own, both ways.  Both hosts must boot
+// the same fs.img, and the primary must write nothing before it
+// mirrors, so "rlog local [iterations]", the same writes with the
+// local log alone, is a run of its own.  Results use kbench's
+// one-line format:
+//
+//   rlog: <op> n=<transactions> ns=<elapsed> mean=<ns per one> kbps=<kbit/s>
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "user/user.h"
+#include "user/rdma.h"
+#include "user/timebase.h"
+
+#define DEFAULT_ITERS 200
+#define CONNECT_TRIES 5
+#define FILE_BLOCKS   16            // blocks the writes cycle through
+#define REPORT_EVERY  100           // transactions between standby reports
+
+static char *file = "rlog.data";
+static char buf[BSIZE];
+
+static void fail(char *what)
+{
+    printf("rlog: %s FAILED\n", what);
+    exit(1);
+}
+
+static void standby(void)
+{
+    struct rdma_cm_info info;
+    struct rdma_completion c;
+    int flags = RDMA_ACCESS_LOCAL_READ | RDMA_ACCESS_LOCAL_WRITE |
+                RDMA_ACCESS_REMOTE_READ | RDMA_ACCESS_REMOTE_WRITE;
+
+    char *mem = alloc_page_aligned((RLOG_PAGES + 1) * PGSIZE);
+    if (!mem)
+        fail("sbrk");
+    struct rdisk_dir *dir = (struct rdisk_dir*)(mem + RLOG_PAGES * PGSIZE);
+    struct rlog_ctl *ctl = (struct rlog_ctl*)mem;
+    memset(mem, 0, (RLOG_PAGES + 1) * PGSIZE);
+
+    dir->magic = RDISK_MAGIC;
+    dir->nblocks = RLOG_PAGES * RDISK_PAGE_BLOCKS;
+    dir->npages = RLOG_PAGES;
+    for (int i = 0; i < RLOG_PAGES; i++) {
+        int mr = rdma_reg_mr(mem + i * PGSIZE, PGSIZE, flags);
+        if (mr < 0)
+            fail("register standby page");
+        dir->page[i].mr_id = mr;
+        dir->page[i].rkey = mr;     // the kernel's rkey is the MR's id
+    }
+    ctl->magic = RLOG_MAGIC;
+    ctl->applied = 0;
+    int dir_mr = rdma_reg_mr(dir, PGSIZE, RDMA_ACCESS_LOCAL_READ | RDMA_ACCESS_REMOTE_READ);
+    int qp = rdma_create_qp(64, 64);
+    if (dir_mr < 0 || qp < 0)
+        fail("setup");
+
+    if (rdma_cm_listen(RLOG_SERVICE, &qp, 1, &dir_mr, 1) < 0)
+        fail("listen");
+    printf("rlog: standby ready, %d slots\n", RLOG_SLOTS);
+    if (rdma_cm_accept(RLOG_SERVICE, &info) < 0)
+        fail("accept");
+    rdma_cm_close(RLOG_SERVICE);
+    printf("rlog: standing by for %02x:%02x:%02x:%02x:%02x:%02x\n",
+           info.mac[0], info.mac[1], info.mac[2], info.mac[3], info.mac[4], info.mac[5]);
+
+    // The primary's WRITEs land without us, but a port without
+    // interrupts is only looked at when someone polls
+    unsigned int applied = 0;
+    for (;;) {
+        rdma_poll_cq(qp, &c, 1);
+        char *slot = mem + (1 + ((applied + 1) % RLOG_SLOTS) * RLOG_SLOT_PAGES) * PGSIZE;
+        volatile struct rlog_head *h = (struct rlog_head*)(slot + RLOG_HEAD_BLOCK * BSIZE);
+        if (h->magic != RLOG_MAGIC || h->seq != applied + 1)
+            continue;
+        // Its seq is written last: the rest of the slot is there
+        __sync_synchronize();
+        if (logreplay(slot) < 0)
+            fail("replay");
+        applied++;
+        ctl->applied = applied;
+        if (applied % REPORT_EVERY == 0)
+            printf("rlog: applied %d transactions\n", applied);
+    }
+}
+
+static void attach(void)
+{
+    struct rdma_cm_info info;
+    int connected = 0;
+
+    int qp = rdma_create_qp(64, 64);
+    if (qp < 0)
+        fail("create QP");
+    memset(&info, 0, sizeof(info));
+    memset(info.mac, 0xff, 6);
+    info.service_id = RLOG_SERVICE;
+    info.nqp = 1;
+    info.qp[0] = qp;
+    for (int try = 0; try < CONNECT_TRIES && !connected; try++) {
+        if (rdma_cm_connect(&info, 0, 0) == 0)
+            connected = 1;
+        else
+            pause(10);
+    }
+    if (!connected || info.nmr < 1)
+        fail("connect to a standby");
+    if (rdisk_attach(qp, info.mr[0].mr_id, info.mr[0].rkey) < 0)
+        fail("attach");
+}
+
+static void tests(void)
+{
+    if (logmirror(RDISKDEV, LOGMIRROR_BOTH) >= 0)
+        fail("mirror with no remote disk");
+    attach();
+    if (logmirror(ROOTDEV, LOGMIRROR_BOTH) >= 0 || logmirror(RDISKDEV, 0) >= 0)
+        fail("bad device or mode");
+    if (logmirror(RDISKDEV, LOGMIRROR_BOTH) < 0)
+        fail("mirror");
+    if (blkrw(RDISKDEV, 0, buf, 0) >= 0 || swapon(RDISKDEV) >= 0)
+        fail("remote disk kept for the log");
+    if (logreplay(alloc_page_aligned(RLOG_SLOT_PAGES * PGSIZE)) >= 0)
+        fail("replay an empty slot");
+    printf("rlog: tests OK\n");
+}
+
+// One-block writes to file, each its own transaction, cycling
+// through its first FILE_BLOCKS blocks
+static void bench(char *op, int iters)
+{
+    int fd = -1;
+
+    uint64 t0 = r_time();
+    for (int i = 0; i < iters; i++) {
+        if (i % FILE_BLOCKS == 0) {
+            if (fd >= 0)
+                close(fd);
+            if ((fd = open(file, O_CREATE | O_RDWR)) < 0)
+                fail("open");
+        }
+        buf[0] = i;
+        if (write(fd, buf, BSIZE) != BSIZE)
+            fail(op);
+    }
+    uint64 ns = (r_time() - t0) * NS_PER_TICK;
+    close(fd);
+    if (ns == 0)
+        ns = 1;
+    printf("rlog: %s n=%d ns=%lu mean=%lu kbps=%lu\n", op, iters, ns, ns / iters,
+           (uint64)iters * BSIZE * 8 * 1000000 / ns);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 2 && strcmp(argv[1], "standby") == 0)
+        standby();
+    if (argc < 2 || argc > 3 ||
+        (strcmp(argv[1], "primary") != 0 && strcmp(argv[1], "local") != 0)) {
+        printf("Usage: rlog standby | rlog primary [iterations] | rlog local [iterations]\n");
+        exit(1);
+    }
+    int iters = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERS;
+    if (iters < 1)
+        iters = DEFAULT_ITERS;
+
+    if (strcmp(argv[1], "local") == 0) {
+        bench("local_commit", iters);
+    } else {
+        tests();
+        bench("both_commit", iters);
+        if (logmirror(RDISKDEV, LOGMIRROR_REMOTE) < 0)
+            fail("mirror instead");
+        bench("remote_commit", iters);
+    }
+    if (unlink(file) < 0)
+        fail("unlink");
+    exit(0);
+}
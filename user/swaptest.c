@@ -0,0 +1,186 @@
+// user/swaptest.c - paging to a remote node's memory: tests and benchmark
+//
+// Run "rdisk server 255" on the other host, then "swaptest" here.  It
+// finds the server by broadcast, attaches it as the remote disk and
+// makes that swap space (swapon()), then grows itself by more pages
+// than this host has free, until memory and swap are both full, so
+// the kernel has to page out, and checks
+// that every page reads back as written.  A forked child checks the
+// copies it got of pages its parent had paged out.  Results use
+// kbench's one-line format:
+//
+//   swap: <op> n=<pages> ns=<elapsed> mean=<ns per page> kbps=<kbit/s>
+//
+// "touch" is a pass over all the pages as the program sees it, faults
+// included; "pagein" and "pageout" are the kernel's time inside the
+// pager, from swapstat().
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/swap.h"
+#include "kernel/param.h"
+#include "user/user.h"
+#include "user/rdma.h"
+#include "user/timebase.h"
+
+#define CONNECT_TRIES 5
+#define CHUNK         16            // pages per sbrk()
+#define GIVEBACK      64            // pages returned before the checks
+
+static char *base;
+static int npages;
+
+static void fail(char *what)
+{
+    printf("swap: %s FAILED\n", what);
+    exit(1);
+}
+
+static void attach(void)
+{
+    struct rdma_cm_info info;
+    int connected = 0;
+
+    int qp = rdma_create_qp(64, 64);
+    if (qp < 0)
+        fail("create QP");
+    memset(&info, 0, sizeof(info));
+    memset(info.mac, 0xff, 6);
+    info.service_id = RDISK_SERVICE;
+    info.nqp = 1;
+    info.qp[0] = qp;
+    for (int try = 0; try < CONNECT_TRIES && !connected; try++) {
+        if (rdma_cm_connect(&info, 0, 0) == 0)
+            connected = 1;
+        else
+            pause(10);
+    }
+    if (!connected || info.nmr < 1)
+        fail("connect to a server");
+    if (rdisk_attach(qp, info.mr[0].mr_id, info.mr[0].rkey) < 0)
+        fail("attach");
+}
+
+static uint64 tag(int i)
+{
+    return 0x5377617000000000ULL | i;   // "Swap"
+}
+
+// Grows by up to want pages, tagging each one's first and last words.
+// If the kernel ran out of memory and slots first, gives some back:
+// a page can't come in until another can go out
+static void grow(int want)
+{
+    char *p;
+
+    while (npages < want && (p = sbrk(CHUNK * PGSIZE)) != SBRK_ERROR) {
+        for (int i = npages; i < npages + CHUNK; i++) {
+            uint64 *w = (uint64*)(p + (uint64)(i - npages) * PGSIZE);
+            w[0] = tag(i);
+            w[PGSIZE / 8 - 1] = ~tag(i);
+        }
+        npages += CHUNK;
+    }
+    if (npages < want) {
+        if (sbrk(-GIVEBACK * PGSIZE) == SBRK_ERROR)
+            fail("shrink");
+        npages -= GIVEBACK;
+    }
+}
+
+// Checks the tags of pages [from, to), returns how many are wrong
+static int check(int from, int to)
+{
+    int bad = 0;
+    for (int i = from; i < to; i++) {
+        uint64 *w = (uint64*)(base + (uint64)i * PGSIZE);
+        if (w[0] != tag(i) || w[PGSIZE / 8 - 1] != ~tag(i))
+            bad++;
+    }
+    return bad;
+}
+
+static void report(char *op, uint64 n, uint64 ticks)
+{
+    uint64 ns = ticks * NS_PER_TICK;
+    if (n == 0)
+        n = 1;
+    if (ns == 0)
+        ns = 1;
+    printf("swap: %s n=%lu ns=%lu mean=%lu kbps=%lu\n", op, n, ns, ns / n,
+           n * PGSIZE * 8 * 1000000 / ns);
+}
+
+static void tests(struct swapstat *st0)
+{
+    struct swapstat st;
+
+    // More pages than were free
+    base = sbrk(0);
+    grow(st0->freepages + st0->nslots);
+    if (npages <= st0->freepages)
+        fail("grow past local memory");
+    if (swapstat(&st) < 0 || st.pageouts == st0->pageouts)
+        fail("page out");
+    if (check(0, npages) != 0)
+        fail("data read back");
+    if (swapstat(&st) < 0 || st.pageins == st0->pageins)
+        fail("page in");
+    printf("swap: %d pages, %d free before, %lu out, %lu in\n", npages,
+           st0->freepages, st.pageouts - st0->pageouts, st.pageins - st0->pageins);
+
+    // A child's copy of a paged-out page comes from swap; give it
+    // room first
+    int keep = st0->nslots / 2;
+    if (keep < npages) {
+        sbrk(-(npages - keep) * PGSIZE);
+        npages = keep;
+    }
+    int pid = fork();
+    if (pid < 0)
+        fail("fork");
+    if (pid == 0)
+        exit(check(0, npages) != 0);
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != 0)
+        fail("child's copy");
+    printf("swap: tests OK\n");
+}
+
+static void bench(struct swapstat *st0)
+{
+    struct swapstat st1, st2;
+
+    // Grow again, then pass over it all twice: more than fits
+    grow(st0->freepages + st0->nslots);
+
+    swapstat(&st1);
+    uint64 t0 = r_time();
+    if (check(0, npages) + check(0, npages) != 0)
+        fail("data read back");
+    uint64 t1 = r_time();
+    swapstat(&st2);
+    report("touch", 2 * npages, t1 - t0);
+    report("pagein", st2.pageins - st1.pageins, st2.intime - st1.intime);
+    report("pageout", st2.pageouts - st1.pageouts, st2.outtime - st1.outtime);
+    printf("swap: %lu pages in %lu batches\n", st2.pageouts - st1.pageouts,
+           st2.batches - st1.batches);
+}
+
+int main(int argc, char *argv[])
+{
+    struct swapstat st0;
+
+    if (argc != 1) {
+        printf("Usage: swaptest, with rdisk server running on the other host\n");
+        exit(1);
+    }
+    attach();
+    if (swapon(RDISKDEV) < 0 || swapstat(&st0) < 0 || st0.nslots == 0)
+        fail("swapon");
+    tests(&st0);
+    bench(&st0);
+    exit(0);
+}
@@ -0,0 +1,5 @@
+// user/timebase.h - the time CSR's rate, for programs that time
+// themselves with r_time()
+
+#define TIMEBASE_HZ 10000000        // qemu virt's time CSR frequency
+#define NS_PER_TICK (1000000000 / TIMEBASE_HZ)
@@ -0,0 +1,167 @@
+//
+// UDP socket tests and a packet-rate benchmark.
+//
+// udptest checks udp_bind(), udp_sendmmsg() and udp_recvmmsg()
+// through the kernel's loopback to its own IP, then reports how many
+// datagrams per second batches of BATCH go through, in kbench's
+// one-line format:
+//
+//   udptest: <op> n=<datagrams> ns=<elapsed> pps=<datagrams/s>
+//
+// "udptest -b" runs only the benchmark.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+#include "user/timebase.h"
+
+#define LOCAL_IP  ((10 << 24) | (0 << 16) | (2 << 8) | 15)  // net.c's local_ip
+#define PORT_A    2000
+#define PORT_B    2001
+#define BATCH     32
+#define ITERS     500          // batches per benchmark size
+
+static char sbuf[BATCH][UDP_MAX_DATA];
+static char rbuf[BATCH][UDP_MAX_DATA];
+static struct udp_msg smsg[BATCH], rmsg[BATCH];
+
+static void
+fail(char *what)
+{
+  printf("udptest: %s FAILED\n", what);
+  exit(1);
+}
+
+// describe n datagrams of len bytes to port on our own IP, and n
+// receive buffers.
+static void
+setup(int n, int len, int port)
+{
+  for(int i = 0; i < n; i++){
+    smsg[i].addr = LOCAL_IP;
+    smsg[i].port = port;
+    smsg[i].len = len;
+    smsg[i].buf = sbuf[i];
+    rmsg[i].len = sizeof(rbuf[i]);
+    rmsg[i].buf = rbuf[i];
+  }
+}
+
+// receive exactly n datagrams from fd.
+static void
+recvall(int fd, int n)
+{
+  int got = 0;
+
+  while(got < n){
+    for(int i = got; i < n; i++)
+      rmsg[i].len = sizeof(rbuf[i]);
+    int r = udp_recvmmsg(fd, rmsg + got, n - got, 0);
+    if(r <= 0)
+      fail("recvmmsg");
+    got += r;
+  }
+}
+
+static void
+tests(void)
+{
+  int a, b, c;
+  char one[8];
+
+  printf("udptest: tests\n");
+  if((a = udp_bind(PORT_A, UDP_NONBLOCK)) < 0 || (b = udp_bind(PORT_B, 0)) < 0)
+    fail("bind");
+  if(udp_bind(PORT_A, 0) >= 0 || udp_bind(4791, 0) >= 0)
+    fail("bind taken port");
+  if((c = udp_bind(0, 0)) < 0)
+    fail("bind any port");
+  close(c);
+
+  // nothing there: don't wait
+  setup(BATCH, 0, PORT_B);
+  if(udp_recvmmsg(a, rmsg, BATCH, 0) != 0 || udp_recvmmsg(b, rmsg, BATCH, UDP_DONTWAIT) != 0)
+    fail("empty recvmmsg");
+
+  // a batch from a to b, one size each
+  for(int i = 0; i < BATCH; i++){
+    smsg[i].len = 1 + i * (UDP_MAX_DATA - 1) / (BATCH - 1);
+    for(int j = 0; j < smsg[i].len; j++)
+      sbuf[i][j] = i + j;
+  }
+  if(udp_sendmmsg(a, smsg, BATCH) != BATCH)
+    fail("sendmmsg");
+  recvall(b, BATCH);
+  for(int i = 0; i < BATCH; i++){
+    if(rmsg[i].addr != LOCAL_IP || rmsg[i].port != PORT_A || rmsg[i].flags != 0)
+      fail("source address");
+    if(rmsg[i].len != smsg[i].len || memcmp(rbuf[i], sbuf[i], smsg[i].len) != 0)
+      fail("datagram contents");
+  }
+
+  // too long for the buffer
+  smsg[0].len = 100;
+  if(udp_sendmmsg(a, smsg, 1) != 1)
+    fail("sendmmsg");
+  rmsg[0].len = 10;
+  if(udp_recvmmsg(b, rmsg, 1, 0) != 1 || rmsg[0].len != 10 || !(rmsg[0].flags & UDP_MSG_TRUNC))
+    fail("truncation");
+
+  // read() takes one datagram; write() has nowhere to go
+  if(udp_sendmmsg(a, smsg, 2) != 2)
+    fail("sendmmsg");
+  if(read(b, one, sizeof(one)) != sizeof(one) || memcmp(one, sbuf[0], sizeof(one)) != 0)
+    fail("read");
+  if(udp_recvmmsg(b, rmsg, BATCH, UDP_DONTWAIT) != 1)
+    fail("read took one");
+  if(write(b, one, sizeof(one)) >= 0)
+    fail("write");
+
+  // too big to send
+  smsg[0].len = UDP_MAX_DATA + 1;
+  if(udp_sendmmsg(a, smsg, 1) >= 0)
+    fail("oversized send");
+
+  close(a);
+  close(b);
+  printf("udptest: tests OK\n");
+}
+
+static void
+bench(char *name, int len, int batch)
+{
+  int a, b;
+
+  if((a = udp_bind(PORT_A, 0)) < 0 || (b = udp_bind(PORT_B, 0)) < 0)
+    fail("bind");
+  setup(batch, len, PORT_B);
+
+  uint64 t0 = r_time();
+  for(int i = 0; i < ITERS; i++){
+    if(udp_sendmmsg(a, smsg, batch) != batch)
+      fail("sendmmsg");
+    recvall(b, batch);
+  }
+  uint64 ns = (r_time() - t0) * NS_PER_TICK;
+  uint64 n = (uint64)ITERS * batch;
+  printf("udptest: %s%d n=%ld ns=%ld pps=%ld\n", name, len, n, ns,
+         ns ? n * 1000000000 / ns : 0);
+
+  close(a);
+  close(b);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 2 || strcmp(argv[1], "-b") != 0)
+    tests();
+
+  // one datagram per call against BATCH per call
+  bench("udp1_", 64, 1);
+  bench("udpmmsg_", 64, BATCH);
+  bench("udpmmsg_", 1024, BATCH);
+  exit(0);
+}
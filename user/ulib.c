@@ -159,3 +159,13 @@ sbrklazy(int n) {
   return sys_sbrk(n, SBRK_LAZY);
 }
 
+// size bytes of fresh memory starting on a page boundary,
+// as RDMA memory regions must; 0 if sbrk fails.
+void*
+alloc_page_aligned(int size)
+{
+  char *p = sbrk(size + PGSIZE);
+  if(p == (char*)-1)
+    return 0;
+  return (void*)PGROUNDUP((uint64)p);
+}
@@ -1,6 +1,27 @@
 #define SBRK_ERROR ((char *)-1)
 
 struct stat;
+struct swapstat;
+
+// UDP sockets (kernel/sysnet.c; the kernel's copy is in net.h).
+// udp_bind() returns an fd for local port lport, 0 meaning any.
+// udp_recvmmsg() waits for at least one datagram, unless the socket
+// is UDP_NONBLOCK or flags has UDP_DONTWAIT, and returns how many it
+// got, 0 if it mustn't wait; udp_sendmmsg() returns how many it sent.
+// both move at most UDP_MMSG_MAX per call.
+struct udp_msg {
+  uint addr;      // peer IP, host byte order
+  ushort port;    // peer port
+  ushort flags;   // UDP_MSG_TRUNC: datagram was longer than buf
+  uint len;       // send: bytes in buf; receive: room in buf, then bytes
+  uint pad;
+  void *buf;
+};
+#define UDP_MSG_TRUNC 0x1
+#define UDP_NONBLOCK  0x1
+#define UDP_DONTWAIT  0x1
+#define UDP_MAX_DATA  1472
+#define UDP_MMSG_MAX  64
 
 // system calls
 int fork(void);
@@ -24,6 +45,12 @@ int getpid(void);
 char* sys_sbrk(int,int);
 int pause(int);
 int uptime(void);
+int udp_bind(int lport, int flags);
+int udp_recvmmsg(int fd, struct udp_msg *msgs, int n, int flags);
+int udp_sendmmsg(int fd, struct udp_msg *msgs, int n);
+int blkrw(int dev, int blockno, void *buf, int write);
+int swapon(int dev);
+int swapstat(struct swapstat *st);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,6 +66,7 @@ int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
 char* sbrk(int);
 char* sbrklazy(int);
+void* alloc_page_aligned(int);
 
 // printf.c
 void fprintf(int, const char*, ...) __attribute__ ((format (printf, 2, 3)));
@@ -51,3 +51,26 @@ entry("rdma_destroy_qp");
 entry("rdma_post_send");
 entry("rdma_poll_cq");
 entry("rdma_connect");
+entry("rdma_cm_listen");
+entry("rdma_cm_accept");
+entry("rdma_cm_connect");
+entry("rdma_cm_close");
+entry("rdma_create_ud_qp");
+entry("rdma_post_recv");
+entry("rdma_set_qp_sched");
+entry("rdma_query_qp");
+entry("rdma_set_qp_path");
+entry("rdma_set_qp_udp");
+entry("udp_bind");
+entry("udp_recvmmsg");
+entry("udp_sendmmsg");
+entry("rdma_set_qp_crc");
+entry("rdma_sendfile");
+entry("rdma_reg_file_mr");
+entry("rdma_sync_mr");
+entry("rdisk_attach");
+entry("blkrw");
+entry("swapon");
+entry("swapstat");
+entry("logmirror");
+entry("logreplay");